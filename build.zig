@@ -166,8 +166,10 @@ fn bundleExe(b: *std.Build, exe: *std.Build.Step.Compile, target: std.Target.Os.
         const install_exe = b.addInstallArtifact(exe, .{});
         install_exe.step.dependOn(embedVkShader(b, "runtime/shader/text.vert"));
         install_exe.step.dependOn(embedVkShader(b, "runtime/shader/text.frag"));
+        install_exe.step.dependOn(embedVkShader(b, "runtime/shader/text_slot.frag"));
         install_exe.step.dependOn(embedVkShader(b, "runtime/shader/model.vert"));
         install_exe.step.dependOn(embedVkShader(b, "runtime/shader/model.frag"));
+        install_exe.step.dependOn(embedVkShader(b, "runtime/shader/cull.comp"));
         break :cond &install_exe.step;
     };
 
@@ -288,15 +290,24 @@ fn createRuntime(b: *std.Build, optimize: std.builtin.OptimizeMode, target: std.
     if (usesVulkan(os)) {
         cpp_sources.appendSlice(b.allocator, &[_][]const u8{
             "runtime/render/vk_renderer.cc",
+            "runtime/render/vk_render_context.cc",
             "runtime/gpu/vulkan/command_pool.cc",
+            "runtime/gpu/vulkan/compute_pipeline.cc",
             "runtime/gpu/vulkan/descriptor_pool.cc",
             "runtime/gpu/vulkan/device.cc",
             "runtime/gpu/vulkan/gpu.cc",
             "runtime/gpu/vulkan/image.cc",
+            "runtime/gpu/vulkan/offscreen_target.cc",
             "runtime/gpu/vulkan/pipeline.cc",
+            "runtime/gpu/vulkan/pipeline_cache.cc",
+            "runtime/gpu/vulkan/present_timer.cc",
             "runtime/gpu/vulkan/shader.cc",
             "runtime/gpu/vulkan/swapchain.cc",
+            "runtime/gpu/vulkan/texture_table.cc",
             "runtime/gpu/vulkan/buffer.cc",
+            "runtime/gpu/vulkan/upload_queue.cc",
+            "runtime/gpu/vulkan/memory_allocator.cc",
+            "runtime/gpu/vulkan/mesh_buffer.cc",
         }) catch unreachable;
 
         if (optimize == .Debug) {
@@ -26,6 +26,12 @@ pub fn Profiler(comptime name: []const u8, comptime Enum: type) type {
             }
         }
 
+        // adds a duration measured elsewhere, such as on the GPU, without touching the timer
+        pub fn record(self: *Self, comptime label: Enum, duration_ns: u64) void {
+            const enum_index = @intFromEnum(label);
+            self.durations[enum_index] +|= duration_ns;
+        }
+
         pub fn format(self: *Self, writer: anytype) !void {
             try writer.print("Profiler " ++ name, .{});
             const fields = @typeInfo(Enum).@"enum".fields;
@@ -1,5 +1,6 @@
 #include <memory>
 #include <span>
+#include <stdexcept>
 
 #include "ffi.h"
 #include "gpu/gpu.h"
@@ -85,8 +86,23 @@ int get_typed_chars_length(const Window *window) {
 
 #ifdef VKAD_APPLE
 
-Renderer *create_renderer(Gpu *gpu, const Window *window) {
-   return new Renderer(*gpu, window->layer_pixel_format(), window->metal_layer());
+RenderContext *create_render_context(
+    Gpu *gpu, const Window *window, const RenderContextOptions *options
+) {
+   return new RenderContext(*gpu);
+}
+
+void submit_frames(RenderContext *context) {}
+
+Renderer *
+create_renderer(RenderContext *context, const Window *window, const RendererOptions *options) {
+   return new Renderer(context->gpu(), window->layer_pixel_format(), window->metal_layer());
+}
+
+Renderer *create_headless_renderer(
+    RenderContext *context, uint32_t width, uint32_t height, const RendererOptions *options
+) {
+   return nullptr;
 }
 
 #else
@@ -95,13 +111,40 @@ void *get_window_surface(const Window *window) {
    return reinterpret_cast<void *>(window->surface());
 }
 
-Renderer *create_renderer(Gpu *gpu, const Window *window) {
-   gpu->initialize_surface(window->surface());
-   return new Renderer(*gpu, window->surface(), window->width(), window->height());
+RenderContext *create_render_context(
+    Gpu *gpu, const Window *window, const RenderContextOptions *options
+) {
+   // Queue families of a windowed Gpu are only known once a surface has been seen
+   if (window != nullptr && !gpu->initialize_surface(window->surface())) {
+      return nullptr;
+   }
+   return new RenderContext(*gpu, *options);
+}
+
+void submit_frames(RenderContext *context) {
+   context->submit_frames();
+}
+
+Renderer *
+create_renderer(RenderContext *context, const Window *window, const RendererOptions *options) {
+   if (!context->supports_surface(window->surface())) {
+      return nullptr;
+   }
+   return new Renderer(*context, window->surface(), window->width(), window->height(), *options);
+}
+
+Renderer *create_headless_renderer(
+    RenderContext *context, uint32_t width, uint32_t height, const RendererOptions *options
+) {
+   return new Renderer(*context, VK_NULL_HANDLE, width, height, *options);
 }
 
 #endif
 
+void destroy_render_context(RenderContext *context) {
+   delete context;
+}
+
 void destroy_renderer(Renderer *renderer) {
    delete renderer;
 }
@@ -110,13 +153,42 @@ Gpu *create_gpu(void) {
    return new Gpu();
 }
 
+Gpu *create_headless_gpu(void) {
+#ifdef VKAD_APPLE
+   return new Gpu();
+#else
+   // Machines without a usable Vulkan device are expected here, unlike for a windowed Gpu
+   try {
+      return new Gpu(true);
+   } catch (const std::runtime_error &e) {
+      return nullptr;
+   }
+#endif
+}
+
 void destroy_gpu(Gpu *gpu) {
    delete gpu;
 }
 
-uint32_t create_image(Renderer *renderer, uint8_t *img_data, int width, int height) {
+uint32_t create_image(
+    Renderer *renderer, uint8_t *img_data, int width, int height, uint32_t max_mip_levels
+) {
    std::span<uint8_t> data_span(img_data, width * height * 4);
-   return static_cast<uint32_t>(renderer->create_image(data_span, width, height));
+   return static_cast<uint32_t>(renderer->create_image(data_span, width, height, max_mip_levels));
+}
+
+bool supports_compressed_format(Renderer *renderer, CompressedFormat format) {
+   return renderer->supports_compressed_format(format);
+}
+
+uint32_t create_compressed_image(
+    Renderer *renderer, CompressedFormat format, const uint8_t *data, size_t size, int width,
+    int height, uint32_t mip_levels
+) {
+   std::span<const uint8_t> data_span(data, size);
+   return static_cast<uint32_t>(
+       renderer->create_compressed_image(data_span, format, width, height, mip_levels)
+   );
 }
 
 void wait_idle(Renderer *renderer) {
@@ -2,6 +2,7 @@ const std = @import("std");
 
 pub const CameraDevice = @import("camera.zig").CameraDevice;
 pub const DisplayDevice = @import("display.zig").DisplayDevice;
+pub const DisplayGpu = @import("display.zig").DisplayGpu;
 const Runtime = @import("../runtime.zig").Runtime;
 
 pub const DeviceType = {};
@@ -7,6 +7,8 @@ const DMat3 = math.DMat3;
 const Mat4 = math.Mat4;
 
 const Renderer = @import("../render/renderer.zig").Renderer;
+const RenderContext = @import("../render/renderer.zig").RenderContext;
+const RenderTarget = @import("../render/renderer.zig").RenderTarget;
 const Runtime = @import("../runtime.zig").Runtime;
 const Window = @import("../window/window.zig").Window;
 const Gpu = @import("../gpu/gpu.zig").Gpu;
@@ -16,6 +18,7 @@ const EyeGuard = @import("../eyeguard.zig").EyeGuard;
 const Logger = @import("../log.zig").Logger;
 const IniIterator = @import("../ini.zig").Iterator;
 
+const fs_storage = @import("../fs_storage.zig");
 const wasm_message = @import("../wasm_message.zig");
 
 const Profiler = engine.profiler.Profiler;
@@ -26,10 +29,19 @@ const DisplayProfiler = Profiler("display", enum {
     resize,
     process_pose,
     update,
-    render,
+    publish,
+    // GPU time of the latest frame with resolved timestamps, a frame or two behind `publish`
+    gpu_render,
 });
 
 const FIRST_PROGRAM_VISIBLE_RENDER_LAYER = 8;
+const MAX_DISPLAYS = 8;
+// displays are polled at most this often with a render thread, which draws the latest snapshots
+// on its own time, about one refresh at 60hz
+const POLL_INTERVAL_NS = std.time.ns_per_s / 60;
+// how long a frame with nothing new to draw idles for in place of waiting on the display, about
+// one refresh at 60hz
+const IDLE_FRAME_NS = std.time.ns_per_s / 60;
 const MAX_PROGRAM_VISIBLE_RENDER_LAYERS = 16;
 
 const poses = @import("../inference/pose.zig");
@@ -49,13 +61,160 @@ const vertices = [_]Vertex{
 const power_on = [_]u8{ 0x06, 0x14, 0x00, 0x04, 0x00, 0x34, 0x11, 0x00, 0x00, 0x5D };
 const power_off = [_]u8{ 0x06, 0x14, 0x00, 0x04, 0x00, 0x34, 0x11, 0x01, 0x00, 0x5E };
 
+// the gpu and render context every display draws with, so displays share device memory, uploads
+// and the pipeline cache, and their frames are submitted together. the context is made along with
+// the first display's window, since a windowed gpu only picks the queue it presents from once it has
+// seen a surface.
+//
+// with vulkan, displays are drawn on a render thread, from the snapshots their renderers publish
+// each poll, so a slow poll doesn't hold back presenting and a blocked present doesn't hold back
+// the poll. metal draws them during present instead.
+pub const DisplayGpu = struct {
+    gpu: Gpu,
+    context: ?RenderContext = null,
+    // renderers that are drawn, guarded by frame_lock, and the context's lock too for writes
+    targets: util.FixedArrayList(*RenderTarget, MAX_DISPLAYS) = .{},
+    // held for all of drawFrame, which leaves the context's lock while it waits on the gpu and the
+    // display, so targets aren't removed, and their renderers destroyed, in the meantime. always
+    // taken before the context's lock.
+    frame_lock: std.Thread.Mutex = .{},
+    render_thread: ?std.Thread = null,
+    running: bool = false,
+    // set once snapshots are published
+    published: std.Thread.ResetEvent = .{},
+    // when present lets the next poll start, see POLL_INTERVAL_NS
+    next_poll_ns: i128 = 0,
+    logger: Logger("render", 1024),
+
+    pub fn init() DisplayGpu {
+        return .{ .gpu = Gpu.init(), .logger = Logger("render", 1024).init() };
+    }
+
+    // every display must be deinitialized first
+    pub fn deinit(self: *DisplayGpu) void {
+        @atomicStore(bool, &self.running, false, .seq_cst);
+        if (self.render_thread) |*thread| {
+            self.published.set();
+            thread.join();
+        }
+
+        if (self.context) |*context| context.deinit();
+        self.gpu.deinit();
+    }
+
+    // frames_in_flight only applies when the context doesn't exist yet
+    fn contextFor(self: *DisplayGpu, window: *const Window, frames_in_flight: ?u32) !*RenderContext {
+        if (self.context) |*context| return context;
+
+        var options = RenderContext.Options{};
+        if (frames_in_flight) |count| options.frames_in_flight = count;
+        var cache_path_buf: [std.fs.max_path_bytes]u8 = undefined;
+        options.pipeline_cache_path = fs_storage.getFilePath(&cache_path_buf, "pipeline_cache") catch null;
+
+        self.context = try RenderContext.init(&self.gpu, window, options);
+        return &self.context.?;
+    }
+
+    // the renderer's snapshots are drawn from then on, until removeTarget
+    fn addTarget(self: *DisplayGpu, target: *RenderTarget) !void {
+        if (comptime util.vulkan) {
+            if (self.render_thread == null) {
+                @atomicStore(bool, &self.running, true, .seq_cst);
+                self.render_thread = try std.Thread.spawn(.{}, renderLoop, .{self});
+            }
+        }
+
+        self.frame_lock.lock();
+        defer self.frame_lock.unlock();
+        const context = &self.context.?;
+        context.lock.lock();
+        defer context.lock.unlock();
+        try self.targets.append(target);
+    }
+
+    fn removeTarget(self: *DisplayGpu, target: *RenderTarget) void {
+        self.frame_lock.lock();
+        defer self.frame_lock.unlock();
+        const context = &self.context.?;
+        context.lock.lock();
+        defer context.lock.unlock();
+        for (self.targets.items(), 0..) |item, i| {
+            if (item == target) {
+                self.targets.swapDelete(@intCast(i)) catch unreachable;
+                return;
+            }
+        }
+    }
+
+    // called once every display has published its snapshot. the render thread draws whichever
+    // snapshots are newest when it's next free, so nothing here waits on it or on the display.
+    // polls are instead paced by POLL_INTERVAL_NS.
+    pub fn present(self: *DisplayGpu) void {
+        if (self.context == null) return;
+        if (self.render_thread == null) {
+            if (!self.drawFrame()) std.Thread.sleep(IDLE_FRAME_NS);
+            return;
+        }
+
+        self.published.set();
+
+        const now = std.time.nanoTimestamp();
+        if (self.next_poll_ns > now) std.Thread.sleep(@intCast(self.next_poll_ns - now));
+        // a poll that ran long starts a fresh interval instead of the next ones catching up
+        self.next_poll_ns = @max(self.next_poll_ns, now) + POLL_INTERVAL_NS;
+    }
+
+    fn renderLoop(self: *DisplayGpu) void {
+        while (@atomicLoad(bool, &self.running, .seq_cst)) {
+            // drawing a snapshot again would show nothing new, so the thread sleeps until the next
+            self.published.wait();
+            self.published.reset();
+            // nothing drawn means nothing waited on the display either, so the thread idles in
+            // its place rather than spinning on polls that publish nothing new
+            if (!self.drawFrame()) std.Thread.sleep(IDLE_FRAME_NS);
+        }
+    }
+
+    // draws the latest snapshot of every display that published one since it was last drawn, and
+    // submits them together. false if no display had anything new to draw, such as while every
+    // scene is static, in which case the gpu isn't used at all.
+    fn drawFrame(self: *DisplayGpu) bool {
+        self.frame_lock.lock();
+        defer self.frame_lock.unlock();
+
+        const targets = self.targets.items();
+        var fresh: [MAX_DISPLAYS]bool = undefined;
+        for (targets, fresh[0..targets.len]) |target, *is_fresh| {
+            is_fresh.* = target.takeSnapshot();
+            // the wait for a free frame slot and swapchain image leaves the context to the poll
+            if (is_fresh.*) target.acquire();
+        }
+
+        const context = &self.context.?;
+        context.lock.lock();
+        defer context.lock.unlock();
+
+        var drawn = false;
+        for (targets, fresh[0..targets.len]) |target, is_fresh| {
+            if (!is_fresh) continue;
+            target.draw() catch |err| {
+                self.logger.err("render failed: {any}", .{err});
+                continue;
+            };
+            drawn = true;
+        }
+        if (drawn) context.submitFrames();
+        return drawn;
+    }
+};
+
 pub const DisplayDevice = struct {
     id: util.FixedArrayList(u8, 16),
     allocator: std.mem.Allocator,
+    display_gpu: *DisplayGpu,
 
     last_width: i32,
     last_height: i32,
-    gpu: *Gpu,
     window: Window,
     renderer: Renderer,
     serial: ?Serial,
@@ -81,10 +240,12 @@ pub const DisplayDevice = struct {
 
     camera_chan: poses.DetectionSpsc,
 
-    pub fn createFromIni(allocator: std.mem.Allocator, ini: *IniIterator) !DisplayDevice {
+    pub fn createFromIni(allocator: std.mem.Allocator, display_gpu: *DisplayGpu, ini: *IniIterator) !DisplayDevice {
         var name: ?[]const u8 = null;
         var port_path: ?[]const u8 = null;
         var skip_calibration = false;
+        var frames_in_flight: ?u32 = null;
+        var renderer_options = Renderer.Options{};
 
         while (try ini.nextProperty()) |event| {
             switch (event) {
@@ -95,6 +256,34 @@ pub const DisplayDevice = struct {
                         port_path = pair.value;
                     } else if (std.mem.eql(u8, pair.key, "skip_calibration")) {
                         skip_calibration = try pair.valueAsBool();
+                    } else if (std.mem.eql(u8, pair.key, "frames_in_flight")) {
+                        frames_in_flight = try std.fmt.parseInt(u32, pair.value, 10);
+                    } else if (std.mem.eql(u8, pair.key, "present_mode")) {
+                        renderer_options.present_mode = std.meta.stringToEnum(Renderer.PresentMode, pair.value) orelse
+                            return error.InvalidPresentMode;
+                    } else if (std.mem.eql(u8, pair.key, "swapchain_images")) {
+                        renderer_options.swapchain_images = try std.fmt.parseInt(u32, pair.value, 10);
+                    } else if (std.mem.eql(u8, pair.key, "gpu_culling")) {
+                        renderer_options.gpu_culling = try pair.valueAsBool();
+                    } else if (std.mem.eql(u8, pair.key, "depth_buffer")) {
+                        renderer_options.depth_buffer = try pair.valueAsBool();
+                    } else if (std.mem.eql(u8, pair.key, "render_scale")) {
+                        renderer_options.render_scale = try parseRenderScale(pair.value);
+                    } else if (std.mem.eql(u8, pair.key, "min_render_scale")) {
+                        renderer_options.min_render_scale = try parseRenderScale(pair.value);
+                    } else if (std.mem.eql(u8, pair.key, "gpu_budget_ms")) {
+                        const budget_ms = try std.fmt.parseFloat(f64, pair.value);
+                        if (!(budget_ms >= 0 and budget_ms <= std.time.ms_per_s)) return error.InvalidGpuBudget;
+                        renderer_options.gpu_budget_ns = @intFromFloat(budget_ms * std.time.ns_per_ms);
+                    } else if (std.mem.eql(u8, pair.key, "capture_interval")) {
+                        renderer_options.capture_interval = try std.fmt.parseInt(u32, pair.value, 10);
+                    } else if (std.mem.eql(u8, pair.key, "capture_width")) {
+                        renderer_options.capture_width = try parseCaptureSize(pair.value);
+                    } else if (std.mem.eql(u8, pair.key, "capture_height")) {
+                        renderer_options.capture_height = try parseCaptureSize(pair.value);
+                    } else if (std.mem.eql(u8, pair.key, "capture_quality")) {
+                        renderer_options.capture_quality = try std.fmt.parseInt(u8, pair.value, 10);
+                        if (renderer_options.capture_quality > 100) return error.InvalidCaptureQuality;
                     }
                 },
                 .err => return error.ConfigParseError,
@@ -103,28 +292,28 @@ pub const DisplayDevice = struct {
 
         return DisplayDevice.init(
             allocator,
+            display_gpu,
             name orelse return error.MissingDeviceName,
             if (skip_calibration) DMat3.scale(.{ 1.0 / 640.0, 1.0 / 640.0 }) else null,
             if (port_path) |p| @ptrCast(p) else null,
+            frames_in_flight,
+            renderer_options,
         );
     }
 
-    pub fn init(allocator: std.mem.Allocator, id: []const u8, transform_override: ?DMat3, serial_port: ?[:0]const u8) !DisplayDevice {
-        const gpu = try allocator.create(Gpu);
-        gpu.* = Gpu.init();
-        errdefer gpu.deinit(); // TODO: this causes a segfault
-        errdefer allocator.destroy(gpu);
-
-        var window = Window.init(gpu, "simulo runtime");
+    // frames_in_flight is shared by every display and only taken from the first one created
+    pub fn init(allocator: std.mem.Allocator, display_gpu: *DisplayGpu, id: []const u8, transform_override: ?DMat3, serial_port: ?[:0]const u8, frames_in_flight: ?u32, renderer_options: Renderer.Options) !DisplayDevice {
+        var window = Window.init(&display_gpu.gpu, "simulo runtime");
         errdefer window.deinit();
 
-        var renderer = try Renderer.init(gpu, &window, allocator);
+        const context = try display_gpu.contextFor(&window, frames_in_flight);
+        var renderer = try Renderer.init(context, &window, allocator, renderer_options);
         errdefer renderer.deinit();
 
         const image = createChessboard(&renderer);
-        const white_pixel_texture = renderer.createImage(&[_]u8{ 0xFF, 0xFF, 0xFF, 0xFF }, 1, 1);
-        const chessboard_material = try renderer.createUiMaterial(image, 1.0, 1.0, 1.0, 1.0);
-        const mesh = try renderer.createMesh(std.mem.asBytes(&vertices), &[_]u16{ 0, 1, 2, 2, 3, 0 });
+        const white_pixel_texture = renderer.createImage(&[_]u8{ 0xFF, 0xFF, 0xFF, 0xFF }, 1, 1, 0);
+        const chessboard_material = try renderer.createUiMaterial(.{ .image = image, .fully_opaque = true }, 1.0, 1.0, 1.0, 1.0);
+        const mesh = try renderer.createMesh(Vertex, &vertices, u16, &[_]u16{ 0, 1, 2, 2, 3, 0 });
 
         const chessboard = try renderer.addObject(mesh, Mat4.identity(), chessboard_material, 31);
         errdefer renderer.deleteObject(chessboard);
@@ -135,13 +324,16 @@ pub const DisplayDevice = struct {
         var serial = if (serial_port) |ser_port| Serial.open(ser_port, 1000) catch return error.OpenDisplaySerialFailed else null;
         errdefer if (serial) |*ser| ser.close();
 
+        const display_id = util.FixedArrayList(u8, 16).initFrom(id) catch return error.DisplayIdTooLong;
+        try display_gpu.addTarget(renderer.target);
+
         return DisplayDevice{
-            .id = util.FixedArrayList(u8, 16).initFrom(id) catch return error.DisplayIdTooLong,
+            .id = display_id,
             .allocator = allocator,
+            .display_gpu = display_gpu,
 
             .last_width = 0,
             .last_height = 0,
-            .gpu = gpu,
             .window = window,
             .renderer = renderer,
             .serial = serial,
@@ -182,7 +374,6 @@ pub const DisplayDevice = struct {
         for (FIRST_PROGRAM_VISIBLE_RENDER_LAYER..FIRST_PROGRAM_VISIBLE_RENDER_LAYER + MAX_PROGRAM_VISIBLE_RENDER_LAYERS) |layer| {
             self.renderer.clearLayer(@intCast(layer));
         }
-        self.renderer.clearUiMaterials();
     }
 
     pub fn poll(self: *DisplayDevice, events: ?*std.io.Writer, runtime: *Runtime) !void {
@@ -203,7 +394,6 @@ pub const DisplayDevice = struct {
             for (FIRST_PROGRAM_VISIBLE_RENDER_LAYER..FIRST_PROGRAM_VISIBLE_RENDER_LAYER + MAX_PROGRAM_VISIBLE_RENDER_LAYERS) |layer| {
                 self.renderer.clearLayer(@intCast(layer));
             }
-            self.renderer.clearUiMaterials();
         }
         self.was_running = running;
 
@@ -225,10 +415,6 @@ pub const DisplayDevice = struct {
                 };
             }
 
-            if (comptime util.vulkan) {
-                self.renderer.handleResize(width, height, self.window.surface());
-            }
-
             self.renderer.setObjectTransform(
                 self.chessboard,
                 if (runtime.calibrations_remaining > 0)
@@ -254,18 +440,20 @@ pub const DisplayDevice = struct {
 
         const view_projection = projection.matmul(&self.view);
 
-        self.renderer.render(&self.window, &view_projection, &view_projection) catch |err| {
-            self.logger.err("render failed: {any}", .{err});
+        // drawn once the runtime presents, after every display has published
+        self.renderer.publish(&view_projection, width, height) catch |err| {
+            self.logger.err("failed to publish frame: {any}", .{err});
         };
+        self.poll_profiler.log(.publish);
+        self.poll_profiler.record(.gpu_render, self.renderer.gpuFrameNs());
     }
 
     pub fn deinit(self: *DisplayDevice, runtime: *Runtime) void {
         _ = runtime;
+        self.display_gpu.removeTarget(self.renderer.target);
         self.eyeguard.deinit();
         self.window.deinit();
         self.renderer.deinit();
-        self.gpu.deinit();
-        self.allocator.destroy(self.gpu);
     }
 
     pub fn addObject(self: *DisplayDevice, material_id: Renderer.MaterialHandle, render_order: u8) !Renderer.ObjectHandle {
@@ -282,6 +470,11 @@ pub const DisplayDevice = struct {
         );
     }
 
+    // the latest frame captured from the display as a jpeg, see Renderer.latestCapture
+    pub fn latestCapture(self: *DisplayDevice, out: *std.ArrayList(u8)) !?u64 {
+        return self.renderer.latestCapture(out);
+    }
+
     pub fn dropMaterial(self: *DisplayDevice, material_id: Renderer.MaterialHandle) void {
         self.renderer.unrefMaterial(material_id.id);
     }
@@ -318,8 +511,8 @@ pub const DisplayDevice = struct {
         self.view = view;
     }
 
-    pub fn createUiMaterial(self: *DisplayDevice, image: ?Renderer.ImageHandle, r: f32, g: f32, b: f32, a: f32) !Renderer.MaterialHandle {
-        const img = image orelse self.white_pixel_texture;
+    pub fn createUiMaterial(self: *DisplayDevice, image: ?Renderer.ImageRegion, r: f32, g: f32, b: f32, a: f32) !Renderer.MaterialHandle {
+        const img = image orelse Renderer.ImageRegion{ .image = self.white_pixel_texture, .fully_opaque = true };
         return try self.renderer.createUiMaterial(img, r, g, b, a);
     }
 
@@ -500,7 +693,20 @@ pub fn createChessboard(renderer: *Renderer) Renderer.ImageHandle {
             checkerboard[(y * width + x) * 4 + 3] = 0xFF;
         }
     }
-    return renderer.createImage(&checkerboard, width, height);
+    return renderer.createImage(&checkerboard, width, height, 0);
+}
+
+// a fraction of the window's resolution, in (0, 1]
+fn parseRenderScale(value: []const u8) !f32 {
+    const scale = try std.fmt.parseFloat(f32, value);
+    if (!(scale > 0 and scale <= 1)) return error.InvalidRenderScale;
+    return scale;
+}
+
+fn parseCaptureSize(value: []const u8) !u32 {
+    const size = try std.fmt.parseInt(u32, value, 10);
+    if (size == 0 or size > 4096) return error.InvalidCaptureSize;
+    return size;
 }
 
 fn perspective_transform(x: f32, y: f32, transform: *const DMat3) @Vector(2, f32) {
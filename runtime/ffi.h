@@ -24,11 +24,16 @@ const unsigned char *text_vertex_bytes(void);
 size_t text_vertex_len(void);
 const unsigned char *text_fragment_bytes(void);
 size_t text_fragment_len(void);
+const unsigned char *text_slot_fragment_bytes(void);
+size_t text_slot_fragment_len(void);
 
 const unsigned char *model_vertex_bytes(void);
 size_t model_vertex_len(void);
 const unsigned char *model_fragment_bytes(void);
 size_t model_fragment_len(void);
+
+const unsigned char *cull_compute_bytes(void);
+size_t cull_compute_len(void);
 #endif
 
 #ifdef __cplusplus
@@ -39,19 +44,29 @@ class Mat;
 using OpenCvMat = cv::Mat;
 
 namespace simulo {
+class RenderContext;
 class Renderer;
+class LayerRecorder;
 class Gpu;
 class Window;
 } // namespace simulo
+using RenderContext = simulo::RenderContext;
 using Renderer = simulo::Renderer;
+using LayerRecorder = simulo::LayerRecorder;
 using Gpu = simulo::Gpu;
 using Window = simulo::Window;
 
 #else
 
+struct SimuloRenderContext;
+typedef struct SimuloRenderContext RenderContext;
+
 struct SimuloRenderer;
 typedef struct SimuloRenderer Renderer;
 
+struct SimuloLayerRecorder;
+typedef struct SimuloLayerRecorder LayerRecorder;
+
 struct SimuloGpu;
 typedef struct SimuloGpu Gpu;
 
@@ -60,7 +75,12 @@ typedef struct SimuloWindow Window;
 
 #endif
 
-typedef uint16_t IndexBufferType;
+// Width of a mesh's indices. 32-bit indices are only needed by meshes with more than 65536
+// vertices.
+typedef enum {
+   INDEX_TYPE_UINT16,
+   INDEX_TYPE_UINT32,
+} IndexType;
 
 typedef struct {
 #ifdef VKAD_APPLE
@@ -74,12 +94,10 @@ typedef struct {
 
 #else
 
-#ifdef VK_VERSION_1_0
-   VkDescriptorSet descriptor_set;
-#else
-   void *descriptor_set;
-#endif
-   size_t uniform_buffer_index;
+   // Slot of the material's texture in the texture table, which is the image's id
+   uint32_t texture;
+   uint32_t pipeline;
+   uint64_t upload_ticket;
 
 #endif
 } Material;
@@ -93,62 +111,264 @@ typedef struct {
    void *buffer;
 #endif
    size_t indices_start;
-   IndexBufferType num_indices;
+   uint32_t num_indices;
+   IndexType index_type;
 
 #else
 
-#ifdef VK_VERSION_1_0
-   VkBuffer buffer;
-   VkDeviceMemory allocation;
-#else
-   void *buffer;
-   void *allocation;
-#endif
-   IndexBufferType num_indices;
+   // Which of the render context's shared vertex and index buffers hold the mesh
+   uint32_t vertex_block;
+   uint32_t index_block;
+   // Index of the mesh's first vertex and first index within those buffers
+   int32_t vertex_offset;
+   uint32_t first_index;
+   uint32_t vertex_size;
+   uint32_t num_indices;
+   IndexType index_type;
    size_t vertex_data_size;
+   uint64_t upload_ticket;
+   // Mesh-space box around the vertex positions, used to cull instances on the GPU. Inverted, with
+   // min above max, for meshes that are never culled.
+   float bounds_min[3];
+   float bounds_max[3];
 
 #endif
 } Mesh;
 
-Renderer *create_renderer(Gpu *gpu, const Window *window);
+// Falls back to the default if the surface doesn't support the requested mode
+typedef enum {
+   // MAILBOX where supported, otherwise FIFO
+   PRESENT_MODE_DEFAULT,
+   PRESENT_MODE_MAILBOX,
+   PRESENT_MODE_FIFO,
+   PRESENT_MODE_FIFO_RELAXED,
+   PRESENT_MODE_IMMEDIATE,
+} PresentMode;
+
+typedef struct {
+   // Number of frames the CPU may record ahead of the GPU. Clamped to [1, 3].
+   uint32_t frames_in_flight;
+   // File the pipeline cache is loaded from and saved to, or null to not persist it
+   const char *pipeline_cache_path;
+} RenderContextOptions;
+
+// Device, memory, uploads and images shared by every renderer created on it, whose frames are
+// submitted together by submit_frames. `window` is the first window that will be rendered to, which
+// picks the queue frames are presented from, or null for a headless Gpu. Returns null if the Gpu
+// can't present to the window.
+RenderContext *create_render_context(
+    Gpu *gpu, const Window *window, const RenderContextOptions *options
+);
+// Every renderer created on the context must have been destroyed first
+void destroy_render_context(RenderContext *context);
+// Submits and presents the frames every renderer on the context ended since the last call, and
+// moves on to the next frame slot. Called once per frame after each renderer's end_render.
+void submit_frames(RenderContext *context);
+
+typedef struct {
+   PresentMode present_mode;
+   // Minimum number of swapchain images, clamped to what the surface allows. 0 uses one more than
+   // the surface's minimum.
+   uint32_t swapchain_images;
+   // Cull instances against the view frustum in a compute pass and draw them indirectly, where the
+   // device supports it. Otherwise every instance is drawn directly.
+   bool gpu_culling;
+   // Give the renderer a depth buffer, cleared at the start of every layer, which opaque draws
+   // write and every draw is tested against
+   bool depth_buffer;
+   // Fraction of the window's width and height frames are drawn at, in (0, 1]. Frames drawn
+   // smaller are upscaled into the window with a bilinear blit, where the device supports it.
+   float render_scale;
+   // Lowest scale set_render_scale may pick later, in (0, render_scale]. Frames are drawn into an
+   // intermediate image whenever either is below 1, even while the scale is back at 1.
+   float min_render_scale;
+   // Read back every capture_interval-th frame presented, scaled to capture_width by
+   // capture_height, for poll_readback. 0 disables captures, as does a device that can't copy
+   // from the window's images. Headless renderers read back every frame at full size instead.
+   uint32_t capture_interval;
+   uint32_t capture_width;
+   uint32_t capture_height;
+} RendererOptions;
+
+// Returns null if the window can't be presented to from the context's queue
+Renderer *
+create_renderer(RenderContext *context, const Window *window, const RendererOptions *options);
+// Renders into offscreen images instead of a window. Returns null where unsupported.
+Renderer *create_headless_renderer(
+    RenderContext *context, uint32_t width, uint32_t height, const RendererOptions *options
+);
 void destroy_renderer(Renderer *renderer);
 
 Material create_ui_material(Renderer *renderer, uint32_t image);
 uint32_t create_mesh_material(Renderer *renderer, float r, float g, float b);
-void clear_ui_materials(Renderer *renderer);
+// Frames already submitted may still draw the material, but none begun after this call may
 void delete_material(Renderer *renderer, Material *material);
+bool material_ready(Renderer *renderer, const Material *material);
+// Whether each instance samples the texture named in its InstanceData, so instances on different
+// images can share a draw. Otherwise every draw samples the texture bound with set_material.
+bool bindless_textures(Renderer *renderer);
 
+// `vertex_size` is the stride of the mesh's vertices, which must match the pipelines drawing it.
+// `index_data` holds `index_count` indices of `index_type`.
 Mesh create_mesh(
-    Renderer *renderer, uint8_t *vertex_data, size_t vertex_data_size, IndexBufferType *index_data,
-    size_t index_count
+    Renderer *renderer, const uint8_t *vertex_data, size_t vertex_data_size, uint32_t vertex_size,
+    const void *index_data, size_t index_count, IndexType index_type
+);
+// Creates a mesh without its data, which is then written in any number of parts with
+// write_mesh_vertices and write_mesh_indices, so meshes too large to hold in memory can be streamed
+// in. Writes are uploaded in order, and mesh_ready reports whether the last one has finished, so
+// a mesh shouldn't be drawn until all of it has been written. Writes aren't synchronized with
+// frames reading the mesh, so a mesh may not be written once it has been drawn.
+Mesh create_empty_mesh(
+    Renderer *renderer, size_t vertex_data_size, uint32_t vertex_size, size_t index_count,
+    IndexType index_type
+);
+// `offset` is in bytes and must start on a whole vertex
+void write_mesh_vertices(
+    Renderer *renderer, Mesh *mesh, size_t offset, const uint8_t *vertex_data, size_t size
 );
+void write_mesh_indices(
+    Renderer *renderer, Mesh *mesh, size_t first_index, const void *index_data, size_t count
+);
+// Frames already submitted may still draw the mesh, but none begun after this call may
 void delete_mesh(Renderer *renderer, Mesh *mesh);
+bool mesh_ready(Renderer *renderer, const Mesh *mesh);
 uint32_t
 add_object(Renderer *renderer, uint32_t mesh_id, const float *transform, uint32_t material_id);
 void delete_object(Renderer *renderer, uint32_t object_id);
-uint32_t create_image(Renderer *renderer, uint8_t *img_data, int width, int height);
+// Creates a texture from RGBA8 pixels, with a mip chain of at most `max_mip_levels` levels, or a
+// full one if 0
+uint32_t create_image(
+    Renderer *renderer, uint8_t *img_data, int width, int height, uint32_t max_mip_levels
+);
+
+// Block-compressed texture formats, all with 4x4 texel blocks of 16 bytes
+typedef enum {
+   COMPRESSED_FORMAT_BC7,
+   COMPRESSED_FORMAT_ETC2_RGBA8,
+   COMPRESSED_FORMAT_ASTC_4X4,
+} CompressedFormat;
+
+bool supports_compressed_format(Renderer *renderer, CompressedFormat format);
+// `data` holds `mip_levels` levels back to back, largest first, each as tightly packed rows of
+// blocks. Returns the image id like create_image. The format must be supported.
+uint32_t create_compressed_image(
+    Renderer *renderer, CompressedFormat format, const uint8_t *data, size_t size, int width,
+    int height, uint32_t mip_levels
+);
 bool render(
     Renderer *renderer, const float *ui_view_projection, const float *world_view_projection
 );
 
+// Per-object data, kept in each frame slot's object buffer at the object's id
 typedef struct {
    float transform[16];
    float color[4];
-} PushConstants;
-
+   // Sub-rectangle of the texture that the mesh's 0-1 texture coordinates map to, as the u, v of
+   // its top-left corner followed by its width and height
+   float uv_rect[4];
+   // Image the instance samples where bindless_textures holds. The padding keeps the size a
+   // multiple of 16, the alignment shaders give the struct.
+   uint32_t texture;
+   uint32_t padding[3];
+} InstanceData;
+
+// Constants shared by every draw in a material pass
+typedef struct {
+   float view_projection[16];
+} PassConstants;
+
+// Waits for what begin_render would otherwise block on: the frames last submitted in the next
+// frame slot, and the next image of the renderer's swapchain. Unlike begin_render it needs no lock
+// shared with other threads using the renderer, so it can run before the lock is taken, on the
+// thread that calls submit_frames. Returns false if the swapchain is out of date, in which case
+// begin_render fails too. The swapchain must not be recreated between the two calls.
+bool acquire_frame(Renderer *renderer);
 bool begin_render(Renderer *renderer);
-void set_pipeline(Renderer *renderer, uint32_t pipeline_id);
-void set_material(Renderer *renderer, Material *material);
-void set_mesh(Renderer *renderer, Mesh *mesh);
-void render_object(Renderer *renderer, const PushConstants *push_constants);
+// Frame slot being recorded, in [0, frame_slot_count). Each slot has its own object buffer.
+uint32_t frame_slot(Renderer *renderer);
+uint32_t frame_slot_count(Renderer *renderer);
+// Returns the current frame slot's persistently mapped object buffer, grown to hold at least
+// `capacity` objects. Contents written in earlier frames of the same slot are kept. Must be called
+// after begin_render and before begin_layer.
+InstanceData *map_object_buffer(Renderer *renderer, uint32_t capacity);
+// Sizes the current frame's instance and draw buffers for every layer that will be begun this
+// frame, so that begin_layer doesn't need to grow them. Must be called after begin_render and
+// before begin_layer; with GPU culling, layers can't reserve more than the frame has in total.
+void reserve_frame(Renderer *renderer, uint32_t instance_count, uint32_t draw_count);
+
+#define MAX_RENDER_LAYERS 32
+#define PRESENT_LATENCY_BUCKETS 64
+
+// Starts recording the draws of one render layer, each of which may be begun once per frame.
+// Layers are executed in ascending layer order whatever order they are recorded in. Called on the
+// render thread between begin_render and end_render, reserving room for up to `instance_count`
+// instances and `draw_count` render_instances calls across the layer.
+LayerRecorder *
+begin_layer(Renderer *renderer, uint32_t layer, uint32_t instance_count, uint32_t draw_count);
+// Variant of a pipeline to draw with. Opaque draws overwrite the target and write depth, while
+// transparent ones are alpha blended and only test depth. Without a depth buffer both are blended.
+typedef enum {
+   BLEND_MODE_TRANSPARENT,
+   BLEND_MODE_OPAQUE,
+} BlendMode;
+
+// The functions below up to end_layer record into a single layer. Different layers may be
+// recorded on different threads at the same time, but a layer only on one thread at a time.
+void set_pipeline(LayerRecorder *recorder, uint32_t pipeline_id, BlendMode blend_mode);
+void set_material(LayerRecorder *recorder, Material *material);
+void set_mesh(LayerRecorder *recorder, Mesh *mesh);
+void set_pass_constants(LayerRecorder *recorder, const PassConstants *constants);
+// Draws the bound mesh once for each object id with a single instanced draw call. With GPU culling
+// the draw is indirect and only counts the instances that are in view, and consecutive draws that
+// share a pipeline, material and pass constants are issued together.
+void render_instances(LayerRecorder *recorder, const uint32_t *object_ids, uint32_t count);
+// Finishes recording a layer. Every begun layer must be ended before end_render.
+void end_layer(LayerRecorder *recorder);
+// Queues the frame on the renderer's context, to be submitted and presented by submit_frames
 void end_render(Renderer *renderer);
 
+// Counters for the profiler. Backends fill in the ones they track and leave the rest zero.
+typedef struct {
+   // Descriptor pools owned by the renderer and the sets allocated from them
+   uint32_t descriptor_pools;
+   uint32_t descriptor_sets;
+   // Descriptor pools created because every existing one was full
+   uint32_t descriptor_pool_growths;
+   // Device memory allocated from the driver and the part of it in use, across the whole context
+   uint64_t memory_reserved;
+   uint64_t memory_used;
+   // GPU time of the most recent frame whose timestamps have been read back, which lags the frame
+   // being recorded by the number of frames in flight. Zero if the device has no timestamps.
+   uint64_t gpu_frame_ns;
+   // GPU time of each render layer in that frame, zero for layers that weren't drawn
+   uint64_t gpu_layer_ns[MAX_RENDER_LAYERS];
+   // Frames by the time from their start to reaching the display, in 1 ms buckets with the last
+   // also counting slower frames. All zero unless the device supports VK_KHR_present_wait.
+   uint32_t present_latency_ms[PRESENT_LATENCY_BUCKETS];
+} RendererStats;
+
+void get_renderer_stats(Renderer *renderer, RendererStats *stats);
+
 #ifndef VKAD_APPLE
 void recreate_swapchain(Renderer *renderer, int32_t width, int32_t height, void *surface);
+// Clamped to [min_render_scale, 1]. When the drawn size changes, the images sized to it are
+// replaced right away and the old ones freed once the frames in flight are done with them. Called
+// between frames.
+void set_render_scale(Renderer *renderer, float scale);
 #endif
 void wait_idle(Renderer *renderer);
 
+// Copies the oldest finished frame read back, every frame of a headless renderer or every capture
+// of one with a window, into pixels as tightly packed RGBA8, returning false if none has finished
+// since the last call. Frames are dropped if they aren't polled before their slot is rendered to
+// again.
+bool poll_readback(Renderer *renderer, uint8_t *pixels, size_t size, uint64_t *frame_number);
+
 Gpu *create_gpu(void);
+// Gpu without presentation support, which may also pick integrated or software devices. Returns
+// null if there is no device to pick.
+Gpu *create_headless_gpu(void);
 void destroy_gpu(Gpu *gpu);
 
 Window *create_window(const Gpu *gpu, const char *title);
@@ -9,6 +9,12 @@ pub const Gpu = struct {
         return Gpu{ .handle = ffi.create_gpu().? };
     }
 
+    // without presentation support, so it can run on machines with no display or only a software
+    // Vulkan device. fails if there is no device at all.
+    pub fn initHeadless() error{NoDevice}!Gpu {
+        return Gpu{ .handle = ffi.create_headless_gpu() orelse return error.NoDevice };
+    }
+
     pub fn deinit(self: *Gpu) void {
         ffi.destroy_gpu(self.handle);
     }
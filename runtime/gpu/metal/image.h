@@ -7,15 +7,31 @@
 #include <cstdint>
 #include <span>
 
+#include "ffi.h"
 #include "gpu/gpu.h"
+#include "gpu/metal/command_queue.h"
 
 namespace simulo {
 
 class Image {
 public:
-   Image(const Gpu &gpu, std::span<const uint8_t> data, int width, int height);
+   // Uploads RGBA8 pixels and fills the rest of a mip chain on the GPU, which is full unless
+   // `max_mip_levels` is nonzero
+   Image(
+       const Gpu &gpu, const CommandQueue &command_queue, std::span<const uint8_t> data, int width,
+       int height, uint32_t max_mip_levels
+   );
+
+   // Uploads pre-compressed data holding `mip_levels` levels back to back, largest first
+   Image(
+       const Gpu &gpu, CompressedFormat format, std::span<const uint8_t> data, int width,
+       int height, uint32_t mip_levels
+   );
+
    ~Image();
 
+   static bool supports_compressed_format(const Gpu &gpu, CompressedFormat format);
+
 #ifdef __OBJC__
    id<MTLTexture> _Nonnull texture() const {
       return texture_;
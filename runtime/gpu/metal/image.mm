@@ -1,7 +1,10 @@
 #include "image.h"
 
+#include <algorithm>
+#include <format>
 #include <iostream>
 #include <span>
+#include <stdexcept>
 
 #include <Metal/Metal.h>
 #include <objc/NSObjCRuntime.h>
@@ -10,11 +13,48 @@
 
 using namespace simulo;
 
-Image::Image(const Gpu &gpu, std::span<const uint8_t> data, int width, int height) {
+namespace {
+
+// Every compressed format has 4x4 blocks of 16 bytes
+constexpr NSUInteger kBlockDimension = 4;
+constexpr NSUInteger kBlockSize = 16;
+
+MTLPixelFormat mt_pixel_format(CompressedFormat format) {
+   switch (format) {
+   case COMPRESSED_FORMAT_BC7:
+      return MTLPixelFormatBC7_RGBAUnorm;
+   case COMPRESSED_FORMAT_ETC2_RGBA8:
+      return MTLPixelFormatEAC_RGBA8;
+   case COMPRESSED_FORMAT_ASTC_4X4:
+      return MTLPixelFormatASTC_4x4_LDR;
+   }
+   throw std::runtime_error(std::format("unknown compressed format {}", (int)format));
+}
+
+NSUInteger full_mip_chain(int width, int height) {
+   NSUInteger levels = 1;
+   for (int size = std::max(width, height); size > 1; size /= 2) {
+      ++levels;
+   }
+   return levels;
+}
+
+} // namespace
+
+Image::Image(
+    const Gpu &gpu, const CommandQueue &command_queue, std::span<const uint8_t> data, int width,
+    int height, uint32_t max_mip_levels
+) {
+   NSUInteger mip_levels = full_mip_chain(width, height);
+   if (max_mip_levels > 0) {
+      mip_levels = std::min(mip_levels, static_cast<NSUInteger>(max_mip_levels));
+   }
+
    MTLTextureDescriptor *texture_desc = [[MTLTextureDescriptor alloc] init];
    texture_desc.pixelFormat = MTLPixelFormatRGBA8Unorm;
    texture_desc.width = width;
    texture_desc.height = height;
+   texture_desc.mipmapLevelCount = mip_levels;
 
    texture_ = [gpu.device() newTextureWithDescriptor:texture_desc];
    [texture_desc release];
@@ -27,8 +67,68 @@ Image::Image(const Gpu &gpu, std::span<const uint8_t> data, int width, int heigh
                mipmapLevel:0
                  withBytes:data.data()
                bytesPerRow:width * 4];
+
+   if (texture_.mipmapLevelCount > 1) {
+      // Command buffers on one queue run in order, so frames committed later see every level
+      id<MTLCommandBuffer> cmd_buf = command_queue.command_buffer();
+      id<MTLBlitCommandEncoder> blit = [cmd_buf blitCommandEncoder];
+      [blit generateMipmapsForTexture:texture_];
+      [blit endEncoding];
+      [cmd_buf commit];
+   }
+}
+
+Image::Image(
+    const Gpu &gpu, CompressedFormat format, std::span<const uint8_t> data, int width, int height,
+    uint32_t mip_levels
+) {
+   MTLTextureDescriptor *texture_desc = [[MTLTextureDescriptor alloc] init];
+   texture_desc.pixelFormat = mt_pixel_format(format);
+   texture_desc.width = width;
+   texture_desc.height = height;
+   texture_desc.mipmapLevelCount = mip_levels;
+
+   texture_ = [gpu.device() newTextureWithDescriptor:texture_desc];
+   [texture_desc release];
+
+   if (texture_ == nullptr) {
+      throw std::runtime_error("Failed to create compressed texture");
+   }
+
+   size_t offset = 0;
+   for (uint32_t level = 0; level < mip_levels; ++level) {
+      NSUInteger level_width = std::max(1, width >> level);
+      NSUInteger level_height = std::max(1, height >> level);
+      NSUInteger bytes_per_row = (level_width + kBlockDimension - 1) / kBlockDimension * kBlockSize;
+      NSUInteger level_size =
+          bytes_per_row * ((level_height + kBlockDimension - 1) / kBlockDimension);
+      if (offset + level_size > data.size()) {
+         [texture_ release];
+         throw std::runtime_error(std::format(
+             "compressed image has {} bytes, which ends partway through level {}", data.size(),
+             level
+         ));
+      }
+
+      [texture_ replaceRegion:MTLRegionMake3D(0, 0, 0, level_width, level_height, 1)
+                  mipmapLevel:level
+                    withBytes:data.data() + offset
+                  bytesPerRow:bytes_per_row];
+      offset += level_size;
+   }
 }
 
 Image::~Image() {
    [texture_ release];
 }
+
+bool Image::supports_compressed_format(const Gpu &gpu, CompressedFormat format) {
+   switch (format) {
+   case COMPRESSED_FORMAT_BC7:
+      return gpu.device().supportsBCTextureCompression;
+   case COMPRESSED_FORMAT_ETC2_RGBA8:
+   case COMPRESSED_FORMAT_ASTC_4X4:
+      return [gpu.device() supportsFamily:MTLGPUFamilyApple2];
+   }
+   return false;
+}
@@ -1,6 +1,7 @@
 #include "buffer.h"
 
 #include <cstring>
+#include <vector>
 
 #include <vulkan/vulkan_core.h>
 
@@ -11,114 +12,151 @@
 using namespace simulo;
 
 void simulo::buffer_init(
-    VkBuffer *buffer, VkDeviceMemory *allocation, size_t size, VkBufferUsageFlags usage,
-    VkMemoryPropertyFlagBits memory_properties, VkDevice device,
-    const Gpu &gpu
+    VkBuffer *buffer, MemoryAllocation *allocation, size_t size, VkBufferUsageFlags usage,
+    VkMemoryPropertyFlagBits memory_properties, MemoryAllocator &allocator
 ) {
+   std::vector<uint32_t> queue_families = allocator.gpu().resource_queue_families();
    VkBufferCreateInfo create_info = {
        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
        .size = size,
        .usage = usage,
-       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+       .sharingMode =
+           queue_families.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+       .queueFamilyIndexCount = static_cast<uint32_t>(queue_families.size()),
+       .pQueueFamilyIndices = queue_families.data(),
    };
-   VKAD_VK(vkCreateBuffer(device, &create_info, nullptr, buffer));
+   VKAD_VK(vkCreateBuffer(allocator.device(), &create_info, nullptr, buffer));
 
    VkMemoryRequirements requirements;
-   vkGetBufferMemoryRequirements(device, *buffer, &requirements);
+   vkGetBufferMemoryRequirements(allocator.device(), *buffer, &requirements);
 
-   VkMemoryAllocateInfo alloc_info = {
-       .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-       .allocationSize = requirements.size,
-       .memoryTypeIndex =
-           gpu.find_memory_type_index(requirements.memoryTypeBits, memory_properties),
-   };
-
-   VKAD_VK(vkAllocateMemory(device, &alloc_info, nullptr, allocation));
-   VKAD_VK(vkBindBufferMemory(device, *buffer, *allocation, 0));
+   *allocation = allocator.allocate(requirements, memory_properties, false);
+   VKAD_VK(
+       vkBindBufferMemory(allocator.device(), *buffer, allocation->memory, allocation->offset)
+   );
 }
 
-void simulo::buffer_destroy(VkBuffer *buffer, VkDeviceMemory *allocation, VkDevice device) {
-   vkDestroyBuffer(device, *buffer, nullptr);
-   vkFreeMemory(device, *allocation, nullptr);
+void simulo::buffer_destroy(
+    VkBuffer *buffer, const MemoryAllocation &allocation, MemoryAllocator &allocator
+) {
+   vkDestroyBuffer(allocator.device(), *buffer, nullptr);
+   allocator.free(allocation);
 }
 
-StagingBuffer::StagingBuffer(
-    VkDeviceSize capacity, VkDevice device, const Gpu &gpu
-)
-    : capacity_(capacity), size_(0), device_(device) {
-
+StagingBuffer::StagingBuffer(VkDeviceSize capacity, MemoryAllocator &allocator)
+    : allocator_(&allocator), capacity_(capacity), head_(0), tail_(0) {
    buffer_init(
        &buffer_, &allocation_, capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
        static_cast<VkMemoryPropertyFlagBits>(
            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
        ),
-       device, gpu
+       allocator
    );
-   vkMapMemory(device, allocation_, 0, capacity, 0, &mem_map_);
 }
 
 StagingBuffer::StagingBuffer(StagingBuffer &&other)
-    : device_(other.device_),
+    : allocator_(other.allocator_),
       buffer_(other.buffer_),
       allocation_(other.allocation_),
       capacity_(other.capacity_),
-      size_(other.size_),
-      mem_map_(other.mem_map_) {
-   other.device_ = VK_NULL_HANDLE;
+      head_(other.head_),
+      tail_(other.tail_),
+      regions_(std::move(other.regions_)) {
+   other.allocator_ = nullptr;
    other.buffer_ = VK_NULL_HANDLE;
-   other.allocation_ = VK_NULL_HANDLE;
    other.capacity_ = 0;
-   other.size_ = 0;
-   other.mem_map_ = nullptr;
 }
 
-void StagingBuffer::upload_mesh(
-    const std::span<uint8_t> vertex_data, const std::span<IndexBufferType> index_data
-) {
-   size_ = vertex_data.size_bytes() + index_data.size_bytes();
+StagingBuffer::~StagingBuffer() {
+   bool buffer_was_moved = allocator_ == nullptr;
+   if (!buffer_was_moved) {
+      buffer_destroy(&buffer_, allocation_, *allocator_);
+   }
+}
 
-   std::memcpy(mem_map_, vertex_data.data(), vertex_data.size_bytes());
-   std::memcpy(
-       reinterpret_cast<uint8_t *>(mem_map_) + vertex_data.size_bytes(), index_data.data(),
-       index_data.size_bytes()
-   );
+std::optional<VkDeviceSize>
+StagingBuffer::allocate(VkDeviceSize size, VkDeviceSize alignment, UploadTicket ticket) {
+   if (size > capacity_) {
+      return std::nullopt;
+   }
+
+   VkDeviceSize offset;
+   if (regions_.empty()) {
+      head_ = 0;
+      tail_ = 0;
+      offset = 0;
+   } else if (head_ > tail_) {
+      // Free space is after the head and before the tail
+      offset = align_to(head_, alignment);
+      if (offset + size > capacity_) {
+         if (size > tail_) {
+            return std::nullopt;
+         }
+         offset = 0;
+      }
+   } else {
+      // Wrapped around, so the only free space is between the head and the tail
+      offset = align_to(head_, alignment);
+      if (offset + size > tail_) {
+         return std::nullopt;
+      }
+   }
+
+   head_ = offset + size;
+   if (!regions_.empty() && regions_.back().ticket == ticket) {
+      regions_.back().end = head_;
+   } else {
+      regions_.push_back({.ticket = ticket, .end = head_});
+   }
+   return offset;
+}
+
+void StagingBuffer::release(UploadTicket retired) {
+   while (!regions_.empty() && regions_.front().ticket <= retired) {
+      tail_ = regions_.front().end;
+      regions_.pop_front();
+   }
 }
 
 UniformBuffer::UniformBuffer(
-    VkDeviceSize element_size, VkDeviceSize num_elements, VkDevice device,
-    const Gpu &gpu
+    VkDeviceSize element_size, VkDeviceSize num_elements, MemoryAllocator &allocator
 )
-    : element_size_(align_to(element_size, gpu.min_uniform_alignment())),
-      device_(device) {
-
+    : allocator_(&allocator),
+      element_size_(align_to(element_size, allocator.gpu().min_uniform_alignment())) {
    buffer_init(
        &buffer_, &allocation_, element_size_ * num_elements, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-       static_cast<VkMemoryPropertyFlagBits>(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT), device,
-       gpu
+       static_cast<VkMemoryPropertyFlagBits>(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT), allocator
    );
-
-   vkMapMemory(device, allocation_, 0, element_size_ * num_elements, 0, &mem_map_);
 }
 
 UniformBuffer::UniformBuffer(UniformBuffer &&other)
-    : device_(other.device_),
+    : allocator_(other.allocator_),
       buffer_(other.buffer_),
       allocation_(other.allocation_),
-      element_size_(other.element_size_),
-      mem_map_(other.mem_map_) {
-   other.device_ = VK_NULL_HANDLE;
+      element_size_(other.element_size_) {
+   other.allocator_ = nullptr;
    other.buffer_ = VK_NULL_HANDLE;
-   other.allocation_ = VK_NULL_HANDLE;
    other.element_size_ = 0;
-   other.mem_map_ = nullptr;
 }
 
 UniformBuffer &UniformBuffer::operator=(UniformBuffer &&other) {
-   buffer_destroy(&buffer_, &allocation_, device_);
-   device_ = other.device_;
+   bool buffer_was_moved = allocator_ == nullptr;
+   if (!buffer_was_moved) {
+      buffer_destroy(&buffer_, allocation_, *allocator_);
+   }
+
+   allocator_ = other.allocator_;
    buffer_ = other.buffer_;
    allocation_ = other.allocation_;
    element_size_ = other.element_size_;
-   mem_map_ = other.mem_map_;
+   other.allocator_ = nullptr;
+   other.buffer_ = VK_NULL_HANDLE;
    return *this;
 }
+
+UniformBuffer::~UniformBuffer() {
+   bool buffer_was_moved = allocator_ == nullptr;
+   if (!buffer_was_moved) {
+      buffer_destroy(&buffer_, allocation_, *allocator_);
+   }
+}
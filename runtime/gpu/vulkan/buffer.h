@@ -1,27 +1,31 @@
 #pragma once
 
 #include <cstring>
-#include <span>
+#include <deque>
+#include <optional>
 
 #include <vulkan/vulkan_core.h>
 
 #include "ffi.h"
 #include "gpu.h"
+#include "memory_allocator.h"
+#include "upload_queue.h"
 
 namespace simulo {
 
 void buffer_init(
-    VkBuffer *buffer, VkDeviceMemory *allocation, size_t size, VkBufferUsageFlags usage,
-    VkMemoryPropertyFlagBits memory_properties, VkDevice device,
-    const Gpu &gpu
+    VkBuffer *buffer, MemoryAllocation *allocation, size_t size, VkBufferUsageFlags usage,
+    VkMemoryPropertyFlagBits memory_properties, MemoryAllocator &allocator
+);
+void buffer_destroy(
+    VkBuffer *buffer, const MemoryAllocation &allocation, MemoryAllocator &allocator
 );
-void buffer_destroy(VkBuffer *buffer, VkDeviceMemory *allocation, VkDevice device);
 
+// Host-visible ring that upload data is copied through. Each allocation is tagged with the ticket
+// of the upload batch that reads it, and regions are recycled once that ticket retires.
 class StagingBuffer {
 public:
-   explicit StagingBuffer(
-       VkDeviceSize capacity, VkDevice device, const Gpu &gpu
-   );
+   explicit StagingBuffer(VkDeviceSize capacity, MemoryAllocator &allocator);
 
    StagingBuffer(const StagingBuffer &) = delete;
    StagingBuffer &operator=(const StagingBuffer &) = delete;
@@ -30,39 +34,54 @@ public:
 
    StagingBuffer &operator=(StagingBuffer &&other);
 
-   inline void upload_raw(void *data, size_t size) const {
-      std::memcpy(mem_map_, data, size);
+   ~StagingBuffer();
+
+   // Reserves an aligned region that stays valid until `ticket` retires. Returns nullopt if the
+   // ring doesn't currently have a large enough contiguous free region.
+   std::optional<VkDeviceSize>
+   allocate(VkDeviceSize size, VkDeviceSize alignment, UploadTicket ticket);
+
+   // Recycles the regions of every ticket up to and including `retired`
+   void release(UploadTicket retired);
+
+   inline void write(VkDeviceSize offset, const void *data, size_t size) const {
+      std::memcpy(reinterpret_cast<uint8_t *>(allocation_.mapped) + offset, data, size);
    }
 
-   void
-   upload_mesh(const std::span<uint8_t> vertex_data, const std::span<IndexBufferType> index_data);
+   // Ticket of the oldest region still in use, or 0 if the ring is empty
+   inline UploadTicket oldest_ticket() const {
+      return regions_.empty() ? 0 : regions_.front().ticket;
+   }
 
    inline VkDeviceSize capacity() const {
       return capacity_;
    }
 
-   inline VkDeviceSize size() const {
-      return size_;
-   }
-
    inline VkBuffer buffer() const {
       return buffer_;
    }
 
 private:
-   VkDevice device_;
+   MemoryAllocator *allocator_;
    VkBuffer buffer_;
-   VkDeviceMemory allocation_;
+   MemoryAllocation allocation_;
    VkDeviceSize capacity_;
-   VkDeviceSize size_;
-   void *mem_map_;
+
+   struct Region {
+      UploadTicket ticket;
+      VkDeviceSize end;
+   };
+
+   // Live data starts at tail_ and ends at head_, wrapping around the end of the buffer
+   VkDeviceSize head_;
+   VkDeviceSize tail_;
+   std::deque<Region> regions_;
 };
 
 class UniformBuffer {
 public:
    explicit UniformBuffer(
-       VkDeviceSize element_size, VkDeviceSize num_elements, VkDevice device,
-       const Gpu &gpu
+       VkDeviceSize element_size, VkDeviceSize num_elements, MemoryAllocator &allocator
    );
 
    UniformBuffer(const UniformBuffer &) = delete;
@@ -71,15 +90,11 @@ public:
    UniformBuffer(UniformBuffer &&other);
    UniformBuffer &operator=(UniformBuffer &&other);
 
-   inline ~UniformBuffer() {
-      bool buffer_was_moved = allocation_ == nullptr;
-      if (!buffer_was_moved) {
-         vkUnmapMemory(device_, allocation_);
-      }
-   }
+   ~UniformBuffer();
 
    inline void upload_memory(void *data, size_t size, size_t element_index) {
-      uint8_t *start = reinterpret_cast<uint8_t *>(mem_map_) + element_index * element_size_;
+      uint8_t *start =
+          reinterpret_cast<uint8_t *>(allocation_.mapped) + element_index * element_size_;
       std::memcpy(start, data, size);
    }
 
@@ -92,11 +107,10 @@ public:
    }
 
 private:
-   VkDevice device_;
+   MemoryAllocator *allocator_;
    VkBuffer buffer_;
-   VkDeviceMemory allocation_;
+   MemoryAllocation allocation_;
    VkDeviceSize element_size_;
-   void *mem_map_;
 };
 
 } // namespace simulo
@@ -23,11 +23,11 @@ void CommandPool::deinit() {
    }
 }
 
-VkCommandBuffer CommandPool::allocate() {
+VkCommandBuffer CommandPool::allocate(VkCommandBufferLevel level) {
    VkCommandBufferAllocateInfo alloc_info = {
        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
        .commandPool = command_pool_,
-       .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+       .level = level,
        .commandBufferCount = 1,
    };
 
@@ -36,3 +36,7 @@ VkCommandBuffer CommandPool::allocate() {
 
    return result;
 }
+
+void CommandPool::reset() {
+   VKAD_VK(vkResetCommandPool(device_, command_pool_, 0));
+}
@@ -17,7 +17,11 @@ public:
 
    void deinit();
 
-   VkCommandBuffer allocate();
+   VkCommandBuffer allocate(VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+   // Returns every command buffer allocated from the pool to the initial state. None of them may
+   // be pending execution.
+   void reset();
 
 private:
    VkDevice device_;
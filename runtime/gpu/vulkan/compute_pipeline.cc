@@ -0,0 +1,52 @@
+#include "compute_pipeline.h"
+
+#include <vulkan/vulkan_core.h>
+
+#include "status.h"
+
+using namespace simulo;
+
+ComputePipeline::ComputePipeline(
+    VkDevice device, VkPipelineCache cache, VkShaderModule compute_shader,
+    const std::vector<VkDescriptorSetLayout> &descriptor_layouts, uint32_t push_constant_size
+)
+    : layout_(VK_NULL_HANDLE), pipeline_(VK_NULL_HANDLE), device_(device) {
+
+   VkPushConstantRange push_constants = {
+       .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+       .offset = 0,
+       .size = push_constant_size,
+   };
+
+   VkPipelineLayoutCreateInfo layout_create = {
+       .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+       .setLayoutCount = static_cast<uint32_t>(descriptor_layouts.size()),
+       .pSetLayouts = descriptor_layouts.data(),
+       .pushConstantRangeCount = 1,
+       .pPushConstantRanges = &push_constants,
+   };
+   VKAD_VK(vkCreatePipelineLayout(device, &layout_create, nullptr, &layout_));
+
+   VkComputePipelineCreateInfo create_info = {
+       .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+       .stage =
+           {
+               .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+               .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+               .module = compute_shader,
+               .pName = "main",
+           },
+       .layout = layout_,
+   };
+   VKAD_VK(vkCreateComputePipelines(device, cache, 1, &create_info, nullptr, &pipeline_));
+}
+
+ComputePipeline::~ComputePipeline() {
+   if (pipeline_ != VK_NULL_HANDLE) {
+      vkDestroyPipeline(device_, pipeline_, nullptr);
+   }
+
+   if (layout_ != VK_NULL_HANDLE) {
+      vkDestroyPipelineLayout(device_, layout_, nullptr);
+   }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "vulkan/vulkan_core.h"
+
+namespace simulo {
+
+class ComputePipeline {
+public:
+   // The layout has a single push constant range of `push_constant_size` bytes, visible to the
+   // compute stage
+   explicit ComputePipeline(
+       VkDevice device, VkPipelineCache cache, VkShaderModule compute_shader,
+       const std::vector<VkDescriptorSetLayout> &descriptor_layouts, uint32_t push_constant_size
+   );
+
+   inline ComputePipeline(ComputePipeline &&other) {
+      layout_ = other.layout_;
+      other.layout_ = VK_NULL_HANDLE;
+      pipeline_ = other.pipeline_;
+      other.pipeline_ = VK_NULL_HANDLE;
+      device_ = other.device_;
+   }
+
+   ComputePipeline(const ComputePipeline &other) = delete;
+
+   ~ComputePipeline();
+
+   ComputePipeline &operator=(const ComputePipeline &other) = delete;
+
+   inline VkPipeline handle() const {
+      return pipeline_;
+   }
+
+   inline VkPipelineLayout layout() const {
+      return layout_;
+   }
+
+private:
+   VkPipelineLayout layout_;
+   VkPipeline pipeline_;
+   VkDevice device_;
+};
+
+} // namespace simulo
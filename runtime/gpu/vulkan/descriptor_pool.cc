@@ -1,48 +1,91 @@
 #include "descriptor_pool.h"
 
+#include <algorithm>
+#include <utility>
+
 #include <vulkan/vulkan_core.h>
 
 #include "status.h"
 
 using namespace simulo;
 
-VkDescriptorPool simulo::create_descriptor_pool(
-    VkDevice device, VkDescriptorSetLayout layout, const std::vector<VkDescriptorPoolSize> &sizes,
-    uint32_t num_sets
-) {
-   VkDescriptorPoolCreateInfo create_info = {
-       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-       .maxSets = num_sets,
-       .poolSizeCount = static_cast<uint32_t>(sizes.size()),
-       .pPoolSizes = sizes.data(),
-   };
+namespace {
 
-   VkDescriptorPool result;
-   VKAD_VK(vkCreateDescriptorPool(device, &create_info, nullptr, &result));
-   return result;
-}
+constexpr uint32_t kMaxSetsPerPool = 4096;
 
-void simulo::delete_descriptor_pool(VkDevice device, VkDescriptorPool pool) {
-   vkDestroyDescriptorPool(device, pool, nullptr);
+} // namespace
+
+DescriptorAllocator::DescriptorAllocator(
+    VkDevice device, std::vector<VkDescriptorPoolSize> sizes, uint32_t initial_sets
+)
+    : device_(device), sizes_(std::move(sizes)), next_pool_sets_(initial_sets),
+      current_(VK_NULL_HANDLE), set_count_(0) {}
+
+DescriptorAllocator::~DescriptorAllocator() {
+   if (current_ != VK_NULL_HANDLE) {
+      vkDestroyDescriptorPool(device_, current_, nullptr);
+   }
+   for (VkDescriptorPool pool : full_pools_) {
+      vkDestroyDescriptorPool(device_, pool, nullptr);
+   }
 }
 
-VkDescriptorSet simulo::allocate_descriptor_set(
-    VkDevice device, VkDescriptorPool pool, VkDescriptorSetLayout layout
-) {
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout) {
+   if (current_ == VK_NULL_HANDLE) {
+      current_ = next_pool();
+   }
+
    VkDescriptorSetAllocateInfo alloc_info = {
        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-       .descriptorPool = pool,
+       .descriptorPool = current_,
        .descriptorSetCount = 1,
        .pSetLayouts = &layout,
    };
 
    VkDescriptorSet descriptor_set;
-   VKAD_VK(vkAllocateDescriptorSets(device, &alloc_info, &descriptor_set));
+   VkResult result = vkAllocateDescriptorSets(device_, &alloc_info, &descriptor_set);
+   if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+      full_pools_.push_back(current_);
+      current_ = next_pool();
+      alloc_info.descriptorPool = current_;
+      result = vkAllocateDescriptorSets(device_, &alloc_info, &descriptor_set);
+   }
+   VKAD_VK(result);
+
+   ++set_count_;
    return descriptor_set;
 }
 
-void simulo::free_descriptor_set(VkDevice device, VkDescriptorPool pool, VkDescriptorSet set) {
-   vkFreeDescriptorSets(device, pool, 1, &set);
+DescriptorStats DescriptorAllocator::stats() const {
+   uint32_t pool_count =
+       static_cast<uint32_t>(full_pools_.size() + (current_ != VK_NULL_HANDLE ? 1 : 0));
+   return {
+       .pool_count = pool_count,
+       .set_count = set_count_,
+       .growths = pool_count > 0 ? pool_count - 1 : 0,
+   };
+}
+
+VkDescriptorPool DescriptorAllocator::next_pool() {
+   std::vector<VkDescriptorPoolSize> pool_sizes = sizes_;
+   for (VkDescriptorPoolSize &size : pool_sizes) {
+      size.descriptorCount *= next_pool_sets_;
+   }
+
+   VkDescriptorPoolCreateInfo create_info = {
+       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+       .maxSets = next_pool_sets_,
+       .poolSizeCount = static_cast<uint32_t>(pool_sizes.size()),
+       .pPoolSizes = pool_sizes.data(),
+   };
+
+   VkDescriptorPool pool;
+   VKAD_VK(vkCreateDescriptorPool(device_, &create_info, nullptr, &pool));
+
+   // Each pool is twice the size of the last, so a steadily growing number of sets only needs
+   // a logarithmic number of pools
+   next_pool_sets_ = std::min(next_pool_sets_ * 2, kMaxSetsPerPool);
+   return pool;
 }
 
 void simulo::write_descriptor_set(
@@ -52,6 +95,14 @@ void simulo::write_descriptor_set(
    for (int i = 0; i < writes.size(); ++i) {
       write_commands[i] = writes[i].write;
       write_commands[i].dstSet = set;
+
+      // The info pointers were taken before the DescriptorWrite was copied into `writes`
+      if (write_commands[i].pBufferInfo != nullptr) {
+         write_commands[i].pBufferInfo = &writes[i].buffer_info;
+      }
+      if (write_commands[i].pImageInfo != nullptr) {
+         write_commands[i].pImageInfo = &writes[i].image_info;
+      }
    }
 
    vkUpdateDescriptorSets(
@@ -96,6 +147,34 @@ VkDescriptorSetLayoutBinding simulo::combined_image_sampler(uint32_t binding) {
    };
 }
 
+VkDescriptorSetLayoutBinding simulo::storage_buffer(uint32_t binding, VkShaderStageFlags stages) {
+   return VkDescriptorSetLayoutBinding{
+       .binding = binding,
+       .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+       .descriptorCount = 1,
+       .stageFlags = stages,
+   };
+}
+
+DescriptorWrite simulo::write_storage_buffer(VkBuffer buffer, uint32_t binding) {
+   DescriptorWrite write = {
+       .buffer_info =
+           {
+               .buffer = buffer,
+               .offset = 0,
+               .range = VK_WHOLE_SIZE,
+           },
+       .write = {
+           .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+           .dstBinding = binding,
+           .descriptorCount = 1,
+           .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+           .pBufferInfo = &write.buffer_info,
+       },
+   };
+   return write;
+}
+
 DescriptorWrite simulo::write_combined_image_sampler(VkSampler sampler, const Image &image) {
    DescriptorWrite write = {
        .image_info =
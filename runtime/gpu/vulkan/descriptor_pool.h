@@ -17,17 +17,43 @@ struct DescriptorWrite {
    VkWriteDescriptorSet write;
 };
 
-VkDescriptorPool create_descriptor_pool(
-    VkDevice device, VkDescriptorSetLayout layout, const std::vector<VkDescriptorPoolSize> &sizes,
-    uint32_t num_sets
-);
+struct DescriptorStats {
+   // Pools owned by the allocator
+   uint32_t pool_count;
+   // Sets handed out so far
+   uint32_t set_count;
+   // Pools created because every existing one was full, which excludes the first
+   uint32_t growths;
+};
+
+// Hands out descriptor sets from a list of pools, creating a larger pool whenever the current one
+// runs out. Sets are never freed, and every pool is destroyed with the allocator, so it's meant to
+// hold sets that live as long as it does, such as the renderer's.
+class DescriptorAllocator {
+public:
+   // `sizes` are the descriptors needed by one set. The first pool fits `initial_sets` of them.
+   DescriptorAllocator(
+       VkDevice device, std::vector<VkDescriptorPoolSize> sizes, uint32_t initial_sets
+   );
+   ~DescriptorAllocator();
+
+   DescriptorAllocator(const DescriptorAllocator &other) = delete;
+   DescriptorAllocator &operator=(const DescriptorAllocator &other) = delete;
 
-void delete_descriptor_pool(VkDevice device, VkDescriptorPool pool);
+   VkDescriptorSet allocate(VkDescriptorSetLayout layout);
 
-VkDescriptorSet
-allocate_descriptor_set(VkDevice device, VkDescriptorPool pool, VkDescriptorSetLayout layout);
+   DescriptorStats stats() const;
 
-void free_descriptor_set(VkDevice device, VkDescriptorPool pool, VkDescriptorSet set);
+private:
+   VkDescriptorPool next_pool();
+
+   VkDevice device_;
+   std::vector<VkDescriptorPoolSize> sizes_;
+   uint32_t next_pool_sets_;
+   VkDescriptorPool current_;
+   std::vector<VkDescriptorPool> full_pools_;
+   uint32_t set_count_;
+};
 
 void write_descriptor_set(
     VkDevice device, VkDescriptorSet set, const std::vector<DescriptorWrite> &writes
@@ -39,6 +65,11 @@ VkDescriptorSetLayoutBinding uniform_buffer_dynamic(uint32_t binding);
 
 VkDescriptorSetLayoutBinding combined_image_sampler(uint32_t binding);
 
+VkDescriptorSetLayoutBinding
+storage_buffer(uint32_t binding, VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT);
+
+DescriptorWrite write_storage_buffer(VkBuffer buffer, uint32_t binding);
+
 DescriptorWrite write_combined_image_sampler(VkSampler sampler, const Image &image);
 
 } // namespace simulo
@@ -12,7 +12,7 @@ using namespace simulo;
 
 Device::Device(const Gpu &gpu) {
    std::set<uint32_t> unique_queue_families = {
-       gpu.graphics_queue(), gpu.present_queue()
+       gpu.graphics_queue(), gpu.present_queue(), gpu.transfer_queue()
    };
 
    std::vector<VkDeviceQueueCreateInfo> create_queues;
@@ -28,25 +28,96 @@ Device::Device(const Gpu &gpu) {
       });
    }
 
-   VkPhysicalDeviceFeatures physical_device_features = {};
+   // Compressed texture formats are enabled wherever the device has them, and callers check for
+   // support per format before uploading one. The indirect draw features are only used for GPU
+   // culling, see Gpu::supports_gpu_culling. Without full 32-bit indices, meshes are limited to the
+   // device's maxDrawIndexedIndexValue.
+   VkPhysicalDeviceFeatures physical_device_features = {
+       .fullDrawIndexUint32 = gpu.features().fullDrawIndexUint32,
+       .multiDrawIndirect = gpu.features().multiDrawIndirect,
+       .drawIndirectFirstInstance = gpu.features().drawIndirectFirstInstance,
+       .textureCompressionETC2 = gpu.features().textureCompressionETC2,
+       .textureCompressionASTC_LDR = gpu.features().textureCompressionASTC_LDR,
+       .textureCompressionBC = gpu.features().textureCompressionBC,
+   };
+
+   // Descriptor indexing for the bindless texture table, on devices that support it
+   VkPhysicalDeviceVulkan12Features features_12 = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+       .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+       .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+       .descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+       .descriptorBindingPartiallyBound = VK_TRUE,
+       .runtimeDescriptorArray = VK_TRUE,
+   };
+
+   // Presents are tagged with ids and waited on to measure when frames reach the display
+   VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+       .presentWait = VK_TRUE,
+   };
+   VkPhysicalDevicePresentIdFeaturesKHR present_id_features = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+       .pNext = &present_wait_features,
+       .presentId = VK_TRUE,
+   };
+
+   VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+       .dynamicRendering = VK_TRUE,
+   };
+
+   // Each supported feature struct is put at the front of the chain
+   void *features = nullptr;
+   std::vector<const char *> extensions;
+   if (!gpu.headless()) {
+      extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+   }
+   if (gpu.supports_descriptor_indexing()) {
+      features_12.pNext = features;
+      features = &features_12;
+   }
+   if (gpu.supports_present_wait()) {
+      extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+      extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+      present_wait_features.pNext = features;
+      features = &present_id_features;
+   }
+   if (gpu.supports_dynamic_rendering()) {
+      extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+      dynamic_rendering_features.pNext = features;
+      features = &dynamic_rendering_features;
+   }
 
-   static const char *swapchain_extension = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
    VkDeviceCreateInfo create_info = {
        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+       .pNext = features,
        .queueCreateInfoCount = static_cast<uint32_t>(create_queues.size()),
        .pQueueCreateInfos = create_queues.data(),
 #ifdef VKAD_DEBUG
        .enabledLayerCount = VKAD_ARRAY_LEN(kValidationLayers),
        .ppEnabledLayerNames = kValidationLayers,
 #endif
-       .enabledExtensionCount = 1,
-       .ppEnabledExtensionNames = &swapchain_extension,
+       .enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
+       .ppEnabledExtensionNames = extensions.data(),
        .pEnabledFeatures = &physical_device_features,
    };
    VKAD_VK(vkCreateDevice(gpu.physical_device(), &create_info, nullptr, &device_));
 
    vkGetDeviceQueue(device_, gpu.graphics_queue(), 0, &graphics_queue_);
    vkGetDeviceQueue(device_, gpu.present_queue(), 0, &present_queue_);
+   vkGetDeviceQueue(device_, gpu.transfer_queue(), 0, &transfer_queue_);
+
+   begin_rendering_ = nullptr;
+   end_rendering_ = nullptr;
+   if (gpu.supports_dynamic_rendering()) {
+      begin_rendering_ = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+          vkGetDeviceProcAddr(device_, "vkCmdBeginRenderingKHR")
+      );
+      end_rendering_ = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+          vkGetDeviceProcAddr(device_, "vkCmdEndRenderingKHR")
+      );
+   }
 }
 
 Device::~Device() {
@@ -26,14 +26,35 @@ public:
       return present_queue_;
    }
 
+   inline VkQueue transfer_queue() const {
+      return transfer_queue_;
+   }
+
    inline void wait_idle() const {
       vkDeviceWaitIdle(device_);
    }
 
+   // Whether begin_rendering and end_rendering can be used, see Gpu::supports_dynamic_rendering
+   inline bool has_dynamic_rendering() const {
+      return begin_rendering_ != nullptr;
+   }
+
+   inline void begin_rendering(VkCommandBuffer command_buffer, const VkRenderingInfoKHR &info) {
+      begin_rendering_(command_buffer, &info);
+   }
+
+   inline void end_rendering(VkCommandBuffer command_buffer) {
+      end_rendering_(command_buffer);
+   }
+
 private:
    VkDevice device_;
    VkQueue graphics_queue_;
    VkQueue present_queue_;
+   VkQueue transfer_queue_;
+   // Loaded from the device since the loader doesn't export extension commands
+   PFN_vkCmdBeginRenderingKHR begin_rendering_;
+   PFN_vkCmdEndRenderingKHR end_rendering_;
 };
 
 } // namespace simulo
@@ -1,5 +1,6 @@
 #include "gpu.h"
 
+#include <algorithm>
 #include <cstring>
 #include <format>
 #include <iostream>
@@ -18,6 +19,116 @@ using namespace simulo;
 
 namespace {
 
+// Features the bindless texture table relies on, all part of Vulkan 1.2's descriptor indexing.
+// Instances pick their texture, so the index isn't uniform across a draw.
+bool supports_descriptor_indexing(VkPhysicalDevice device, uint32_t api_version) {
+   if (api_version < VK_API_VERSION_1_2) {
+      return false;
+   }
+
+   VkPhysicalDeviceVulkan12Features features_12 = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+   };
+   VkPhysicalDeviceFeatures2 features = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+       .pNext = &features_12,
+   };
+   vkGetPhysicalDeviceFeatures2(device, &features);
+
+   return features_12.runtimeDescriptorArray && features_12.descriptorBindingPartiallyBound &&
+          features_12.descriptorBindingSampledImageUpdateAfterBind &&
+          features_12.descriptorBindingUpdateUnusedWhilePending &&
+          features_12.shaderSampledImageArrayNonUniformIndexing;
+}
+
+uint32_t max_bindless_textures(VkPhysicalDevice device) {
+   VkPhysicalDeviceVulkan12Properties properties_12 = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+   };
+   VkPhysicalDeviceProperties2 properties = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+       .pNext = &properties_12,
+   };
+   vkGetPhysicalDeviceProperties2(device, &properties);
+
+   // Combined image samplers count against both the sampler and the sampled image limits
+   return std::min({
+       properties_12.maxPerStageDescriptorUpdateAfterBindSamplers,
+       properties_12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+       properties_12.maxDescriptorSetUpdateAfterBindSamplers,
+       properties_12.maxDescriptorSetUpdateAfterBindSampledImages,
+   });
+}
+
+bool has_device_extension(VkPhysicalDevice device, const char *name) {
+   uint32_t num_extensions;
+   vkEnumerateDeviceExtensionProperties(device, nullptr, &num_extensions, nullptr);
+   std::vector<VkExtensionProperties> extensions(num_extensions);
+   vkEnumerateDeviceExtensionProperties(device, nullptr, &num_extensions, extensions.data());
+
+   return std::any_of(extensions.begin(), extensions.end(), [name](const auto &ext) {
+      return strcmp(ext.extensionName, name) == 0;
+   });
+}
+
+// VK_KHR_present_id and VK_KHR_present_wait, which together report when a frame reached the display
+bool supports_present_wait(VkPhysicalDevice device) {
+   if (!has_device_extension(device, VK_KHR_PRESENT_ID_EXTENSION_NAME) ||
+       !has_device_extension(device, VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+      return false;
+   }
+
+   VkPhysicalDevicePresentWaitFeaturesKHR present_wait = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+   };
+   VkPhysicalDevicePresentIdFeaturesKHR present_id = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+       .pNext = &present_wait,
+   };
+   VkPhysicalDeviceFeatures2 features = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+       .pNext = &present_id,
+   };
+   vkGetPhysicalDeviceFeatures2(device, &features);
+   return present_id.presentId && present_wait.presentWait;
+}
+
+// The instance targets Vulkan 1.2, so dynamic rendering is used through the extension, which 1.3
+// drivers expose alongside the core version
+bool supports_dynamic_rendering(VkPhysicalDevice device) {
+   if (!has_device_extension(device, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+      return false;
+   }
+
+   VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+   };
+   VkPhysicalDeviceFeatures2 features = {
+       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+       .pNext = &dynamic_rendering,
+   };
+   vkGetPhysicalDeviceFeatures2(device, &features);
+   return dynamic_rendering.dynamicRendering;
+}
+
+// Higher is preferred, and negative ranks aren't used at all. With a window only discrete GPUs are
+// fast enough to drive a projector. Headless rendering takes whatever is available, down to
+// software implementations such as lavapipe.
+int device_type_rank(VkPhysicalDeviceType type, bool headless) {
+   switch (type) {
+   case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+      return 3;
+   case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+      return headless ? 2 : -1;
+   case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+      return headless ? 1 : -1;
+   case VK_PHYSICAL_DEVICE_TYPE_CPU:
+      return headless ? 0 : -1;
+   default:
+      return -1;
+   }
+}
+
 #ifdef VKAD_DEBUG
 
 void ensure_validation_layers_supported() {
@@ -46,15 +157,15 @@ void ensure_validation_layers_supported() {
 
 } // namespace
 
-Gpu::Gpu() {
+Gpu::Gpu(bool headless) : headless_(headless) {
    VkApplicationInfo app_info = {
        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
        .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
        .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-       .apiVersion = VK_API_VERSION_1_0,
+       .apiVersion = VK_API_VERSION_1_2,
    };
 
-   const char *extensions[] = {
+   const char *surface_extensions[] = {
        "VK_KHR_surface",
 #ifdef VKAD_WINDOWS
        "VK_KHR_win32_surface",
@@ -73,8 +184,10 @@ Gpu::Gpu() {
    VkInstanceCreateInfo create_info = {
        .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
        .pApplicationInfo = &app_info,
-       .enabledExtensionCount = static_cast<uint32_t>(VKAD_ARRAY_LEN(extensions)),
-       .ppEnabledExtensionNames = extensions,
+       // Headless instances never create a surface
+       .enabledExtensionCount =
+           headless ? 0 : static_cast<uint32_t>(VKAD_ARRAY_LEN(surface_extensions)),
+       .ppEnabledExtensionNames = surface_extensions,
    };
 
 #ifdef VKAD_DEBUG
@@ -95,21 +208,40 @@ Gpu::Gpu() {
    std::vector<VkPhysicalDevice> devices(num_devices);
    vkEnumeratePhysicalDevices(instance_, &num_devices, devices.data());
 
+   int best_rank = -1;
    for (const auto &device : devices) {
       VkPhysicalDeviceProperties properties;
       vkGetPhysicalDeviceProperties(device, &properties);
 
-      if (properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+      int rank = device_type_rank(properties.deviceType, headless);
+      // Without descriptor indexing textures are bound one set at a time, which 1.1 devices
+      // manage too
+      if (rank <= best_rank || properties.apiVersion < VK_API_VERSION_1_1) {
          continue;
       }
 
+      best_rank = rank;
       physical_device_ = device;
-      min_uniform_alignment_ = properties.limits.minUniformBufferOffsetAlignment;
-      vkGetPhysicalDeviceMemoryProperties(device, &mem_properties_);
-      return;
+      properties_ = properties;
+   }
+
+   if (best_rank < 0) {
+      throw std::runtime_error("no suitable physical device");
    }
 
-   throw std::runtime_error("no suitable physical device");
+   vkGetPhysicalDeviceFeatures(physical_device_, &features_);
+   supports_descriptor_indexing_ =
+       supports_descriptor_indexing(physical_device_, properties_.apiVersion);
+   max_bindless_textures_ =
+       supports_descriptor_indexing_ ? max_bindless_textures(physical_device_) : 0;
+   supports_present_wait_ = !headless && supports_present_wait(physical_device_);
+   supports_dynamic_rendering_ = supports_dynamic_rendering(physical_device_);
+   vkGetPhysicalDeviceMemoryProperties(physical_device_, &mem_properties_);
+
+   // Windowed queue families depend on the surface and are found in initialize_surface
+   if (headless && !find_queue_families(physical_device_, VK_NULL_HANDLE)) {
+      throw std::runtime_error("headless device has no graphics queue");
+   }
 }
 
 bool Gpu::initialize_surface(VkSurfaceKHR surface) {
@@ -127,13 +259,23 @@ bool Gpu::find_queue_families(VkPhysicalDevice candidate_device, VkSurfaceKHR su
 
    bool graphics_found = false;
    bool presentation_found = false;
+   bool transfer_found = false;
    for (int i = 0; i < queue_families.size(); ++i) {
+      VkQueueFlags flags = queue_families[i].queueFlags;
+      bool transfer_only = (flags & VK_QUEUE_TRANSFER_BIT) != 0 &&
+                           (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0;
+      if (!transfer_found && transfer_only) {
+         transfer_queue_ = i;
+         transfer_found = true;
+      }
+
       if (!graphics_found && (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0) {
          graphics_queue_ = i;
+         timestamp_valid_bits_ = queue_families[i].timestampValidBits;
          graphics_found = true;
       }
 
-      if (!presentation_found) {
+      if (!presentation_found && surface != VK_NULL_HANDLE) {
          VkBool32 supported = false;
          vkGetPhysicalDeviceSurfaceSupportKHR(candidate_device, i, surface, &supported);
          if (supported) {
@@ -143,9 +285,38 @@ bool Gpu::find_queue_families(VkPhysicalDevice candidate_device, VkSurfaceKHR su
       }
    }
 
+   if (!transfer_found) {
+      transfer_queue_ = graphics_queue_;
+   }
+
+   // Nothing is presented without a surface
+   if (surface == VK_NULL_HANDLE) {
+      present_queue_ = graphics_queue_;
+      presentation_found = graphics_found;
+   }
+
    return graphics_found && presentation_found;
 }
 
+bool Gpu::supports_gpu_culling() const {
+   if (features_.drawIndirectFirstInstance != VK_TRUE) {
+      return false;
+   }
+
+   uint32_t family_count = 0;
+   vkGetPhysicalDeviceQueueFamilyProperties(physical_device_, &family_count, nullptr);
+   std::vector<VkQueueFamilyProperties> families(family_count);
+   vkGetPhysicalDeviceQueueFamilyProperties(physical_device_, &family_count, families.data());
+   return (families[graphics_queue_].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+}
+
+std::vector<uint32_t> Gpu::resource_queue_families() const {
+   if (has_dedicated_transfer_queue()) {
+      return {graphics_queue_, transfer_queue_};
+   }
+   return {graphics_queue_};
+}
+
 uint32_t Gpu::find_memory_type_index(
     uint32_t supported_bits, VkMemoryPropertyFlagBits extra
 ) const {
@@ -161,4 +332,10 @@ uint32_t Gpu::find_memory_type_index(
    throw std::runtime_error(std::format(
        "no suitable memory type for bits {} and extra flags {}", supported_bits, (int)extra
    ));
-}
\ No newline at end of file
+}
+
+bool Gpu::supports_format(VkFormat format, VkFormatFeatureFlags required) const {
+   VkFormatProperties properties;
+   vkGetPhysicalDeviceFormatProperties(physical_device_, format, &properties);
+   return (properties.optimalTilingFeatures & required) == required;
+}
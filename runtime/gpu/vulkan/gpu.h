@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include <vulkan/vulkan_core.h>
 
 namespace simulo {
@@ -11,7 +13,9 @@ constexpr const char *kValidationLayers[] = {
 
 class Gpu {
 public:
-   Gpu();
+   // Headless GPUs render without a window. Surface extensions aren't enabled, and any device type
+   // is accepted so that software implementations such as lavapipe work.
+   explicit Gpu(bool headless = false);
 
    inline ~Gpu() {
       vkDestroyInstance(instance_, nullptr);
@@ -20,6 +24,10 @@ public:
    Gpu(const Gpu &other) = delete;
    Gpu &operator=(const Gpu &other) = delete;
 
+   inline bool headless() const {
+      return headless_;
+   }
+
    inline VkInstance instance() const {
       return instance_;
    }
@@ -28,8 +36,64 @@ public:
       return physical_device_;
    }
 
+   inline const VkPhysicalDeviceProperties &properties() const {
+      return properties_;
+   }
+
+   inline const VkPhysicalDeviceFeatures &features() const {
+      return features_;
+   }
+
    inline VkDeviceSize min_uniform_alignment() const {
-      return min_uniform_alignment_;
+      return properties_.limits.minUniformBufferOffsetAlignment;
+   }
+
+   // Whether the graphics queue can write timestamps, which count in units of timestamp_period()
+   // nanoseconds and wrap after timestamp_valid_bits() bits
+   inline bool supports_timestamps() const {
+      return timestamp_valid_bits_ > 0 && properties_.limits.timestampPeriod > 0.0f;
+   }
+
+   inline uint32_t timestamp_valid_bits() const {
+      return timestamp_valid_bits_;
+   }
+
+   inline float timestamp_period() const {
+      return properties_.limits.timestampPeriod;
+   }
+
+   // Whether presents can be tagged with ids and waited on, through VK_KHR_present_id and
+   // VK_KHR_present_wait. Never set for headless GPUs.
+   inline bool supports_present_wait() const {
+      return supports_present_wait_;
+   }
+
+   // Whether frames can be drawn with VK_KHR_dynamic_rendering instead of render pass and
+   // framebuffer objects
+   inline bool supports_dynamic_rendering() const {
+      return supports_dynamic_rendering_;
+   }
+
+   // Whether instances can be culled by a compute pass on the graphics queue that writes the
+   // instance counts of indirect draws, which then need drawIndirectFirstInstance to find their
+   // instances. Only valid once the queue families have been found.
+   bool supports_gpu_culling() const;
+
+   // Whether one vkCmdDrawIndexedIndirect can issue more than one draw
+   inline bool supports_multi_draw_indirect() const {
+      return features_.multiDrawIndirect == VK_TRUE;
+   }
+
+   // Whether every texture can be sampled from one update-after-bind descriptor array, indexed
+   // per instance. Needs Vulkan 1.2's descriptor indexing features.
+   inline bool supports_descriptor_indexing() const {
+      return supports_descriptor_indexing_;
+   }
+
+   // Number of textures that fit in one update-after-bind descriptor array, or 0 without
+   // descriptor indexing
+   inline uint32_t max_bindless_textures() const {
+      return max_bindless_textures_;
    }
 
    inline VkPhysicalDeviceMemoryProperties mem_properties() const {
@@ -46,17 +110,41 @@ public:
       return present_queue_;
    }
 
+   // A transfer-only queue family if the device has one, otherwise the graphics family
+   inline uint32_t transfer_queue() const {
+      return transfer_queue_;
+   }
+
+   inline bool has_dedicated_transfer_queue() const {
+      return transfer_queue_ != graphics_queue_;
+   }
+
+   // Queue families that read or write buffers and images. Resources are shared concurrently
+   // between them so uploads don't need queue ownership transfers.
+   std::vector<uint32_t> resource_queue_families() const;
+
    uint32_t find_memory_type_index(uint32_t supported_bits, VkMemoryPropertyFlagBits extra) const;
 
+   // Whether optimally tiled images of `format` support every feature in `required`
+   bool supports_format(VkFormat format, VkFormatFeatureFlags required) const;
+
 private:
    bool find_queue_families(VkPhysicalDevice candidate_device, VkSurfaceKHR surface);
 
+   bool headless_;
    VkInstance instance_;
    VkPhysicalDevice physical_device_;
-   VkDeviceSize min_uniform_alignment_;
+   VkPhysicalDeviceProperties properties_;
+   VkPhysicalDeviceFeatures features_;
+   bool supports_descriptor_indexing_;
+   uint32_t max_bindless_textures_;
+   bool supports_present_wait_;
+   bool supports_dynamic_rendering_;
    VkPhysicalDeviceMemoryProperties mem_properties_;
    uint32_t graphics_queue_;
+   uint32_t timestamp_valid_bits_;
    uint32_t present_queue_;
+   uint32_t transfer_queue_;
 };
 
 } // namespace simulo
@@ -1,45 +1,63 @@
 #include "image.h"
 
+#include <bit>
+#include <format>
+#include <stdexcept>
+#include <vector>
+
 #include <vulkan/vulkan_core.h>
 
 #include "status.h"
 
 using namespace simulo;
 
+FormatBlock simulo::format_block(VkFormat format) {
+   switch (format) {
+   case VK_FORMAT_R8G8B8A8_UNORM:
+   case VK_FORMAT_B8G8R8A8_UNORM:
+      return {.width = 1, .height = 1, .size = 4};
+
+   case VK_FORMAT_BC7_UNORM_BLOCK:
+   case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+   case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+      return {.width = 4, .height = 4, .size = 16};
+
+   default:
+      throw std::runtime_error(std::format("no block size known for format {}", (int)format));
+   }
+}
+
 Image::Image(
-    const Gpu &gpu, VkDevice device, VkImageUsageFlags usage,
-    VkFormat format, uint32_t width, uint32_t height
+    MemoryAllocator &allocator, VkImageUsageFlags usage, VkFormat format, uint32_t width,
+    uint32_t height, uint32_t mip_levels
 )
-    : view_(VK_NULL_HANDLE), format_(format), device_(device), layout_(VK_IMAGE_LAYOUT_UNDEFINED),
-      width_(width), height_(height) {
+    : view_(VK_NULL_HANDLE), format_(format), width_(width), height_(height),
+      mip_levels_(mip_levels), device_(allocator.device()), allocator_(allocator),
+      layout_(VK_IMAGE_LAYOUT_UNDEFINED) {
+   std::vector<uint32_t> queue_families = allocator.gpu().resource_queue_families();
    VkImageCreateInfo image_create = {
        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
        .imageType = VK_IMAGE_TYPE_2D,
        .format = format,
        .extent = {width, height, 1},
-       .mipLevels = 1,
+       .mipLevels = mip_levels,
        .arrayLayers = 1,
        .samples = VK_SAMPLE_COUNT_1_BIT,
        .tiling = VK_IMAGE_TILING_OPTIMAL,
        .usage = usage,
-       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+       .sharingMode =
+           queue_families.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+       .queueFamilyIndexCount = static_cast<uint32_t>(queue_families.size()),
+       .pQueueFamilyIndices = queue_families.data(),
        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
    };
-   VKAD_VK(vkCreateImage(device, &image_create, nullptr, &image_));
+   VKAD_VK(vkCreateImage(device_, &image_create, nullptr, &image_));
 
    VkMemoryRequirements img_mem;
-   vkGetImageMemoryRequirements(device, image_, &img_mem);
-
-   VkMemoryAllocateInfo alloc = {
-       .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-       .allocationSize = img_mem.size,
-       .memoryTypeIndex = gpu.find_memory_type_index(
-           img_mem.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-       ),
-   };
+   vkGetImageMemoryRequirements(device_, image_, &img_mem);
 
-   VKAD_VK(vkAllocateMemory(device, &alloc, nullptr, &allocation_));
-   VKAD_VK(vkBindImageMemory(device, image_, allocation_, 0));
+   allocation_ = allocator.allocate(img_mem, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+   VKAD_VK(vkBindImageMemory(device_, image_, allocation_.memory, allocation_.offset));
 }
 
 Image::~Image() {
@@ -48,10 +66,10 @@ Image::~Image() {
    }
 
    vkDestroyImage(device_, image_, nullptr);
-   vkFreeMemory(device_, allocation_, nullptr);
+   allocator_.free(allocation_);
 }
 
-void Image::init_view() {
+void Image::init_view(VkImageAspectFlags aspect) {
    VkImageViewCreateInfo view_create = {
        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
        .image = image_,
@@ -59,9 +77,9 @@ void Image::init_view() {
        .format = format_,
        .subresourceRange =
            {
-               .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+               .aspectMask = aspect,
                .baseMipLevel = 0,
-               .levelCount = 1,
+               .levelCount = mip_levels_,
                .baseArrayLayer = 0,
                .layerCount = 1,
            },
@@ -69,7 +87,9 @@ void Image::init_view() {
    VKAD_VK(vkCreateImageView(device_, &view_create, nullptr, &view_));
 }
 
-void Image::queue_transfer_layout(VkImageLayout layout, VkCommandBuffer cmd_buf) {
+void Image::queue_transfer_layout(
+    VkImageLayout layout, VkCommandBuffer cmd_buf, bool transfer_only
+) {
    VkImageMemoryBarrier barrier = {
        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
        .oldLayout = layout_,
@@ -81,7 +101,7 @@ void Image::queue_transfer_layout(VkImageLayout layout, VkCommandBuffer cmd_buf)
            {
                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                .baseMipLevel = 0,
-               .levelCount = 1,
+               .levelCount = mip_levels_,
                .baseArrayLayer = 0,
                .layerCount = 1,
            },
@@ -110,8 +130,14 @@ void Image::queue_transfer_layout(VkImageLayout layout, VkCommandBuffer cmd_buf)
       break;
 
    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-      dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+      if (transfer_only) {
+         // Transfer queues can't wait on shader stages. The image isn't sampled until the upload's
+         // fence has signaled, which orders the read instead.
+         dst_stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+      } else {
+         barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+         dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+      }
       break;
 
    default:
@@ -121,3 +147,97 @@ void Image::queue_transfer_layout(VkImageLayout layout, VkCommandBuffer cmd_buf)
    layout_ = layout;
    vkCmdPipelineBarrier(cmd_buf, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 }
+
+void Image::queue_generate_mips(VkCommandBuffer cmd_buf) {
+   VkImageMemoryBarrier barrier = {
+       .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+       .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+       .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+       .image = image_,
+       .subresourceRange =
+           {
+               .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+               .levelCount = 1,
+               .baseArrayLayer = 0,
+               .layerCount = 1,
+           },
+   };
+
+   for (uint32_t level = 1; level < mip_levels_; ++level) {
+      // The previous level has been written by a copy or the last blit and is now read from
+      barrier.subresourceRange.baseMipLevel = level - 1;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+      vkCmdPipelineBarrier(
+          cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+          0, nullptr, 1, &barrier
+      );
+
+      VkImageBlit blit = {
+          .srcSubresource =
+              {
+                  .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                  .mipLevel = level - 1,
+                  .baseArrayLayer = 0,
+                  .layerCount = 1,
+              },
+          .srcOffsets =
+              {
+                  {0, 0, 0},
+                  {static_cast<int32_t>(level_width(level - 1)),
+                   static_cast<int32_t>(level_height(level - 1)), 1},
+              },
+          .dstSubresource =
+              {
+                  .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                  .mipLevel = level,
+                  .baseArrayLayer = 0,
+                  .layerCount = 1,
+              },
+          .dstOffsets =
+              {
+                  {0, 0, 0},
+                  {static_cast<int32_t>(level_width(level)),
+                   static_cast<int32_t>(level_height(level)), 1},
+              },
+      };
+      vkCmdBlitImage(
+          cmd_buf, image_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image_,
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR
+      );
+
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      vkCmdPipelineBarrier(
+          cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0,
+          nullptr, 0, nullptr, 1, &barrier
+      );
+   }
+
+   barrier.subresourceRange.baseMipLevel = mip_levels_ - 1;
+   barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+   barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+   barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+   barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+   vkCmdPipelineBarrier(
+       cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0,
+       nullptr, 0, nullptr, 1, &barrier
+   );
+
+   layout_ = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+}
+
+VkDeviceSize Image::level_size(uint32_t level) const {
+   FormatBlock block = format_block(format_);
+   VkDeviceSize blocks_x = (level_width(level) + block.width - 1) / block.width;
+   VkDeviceSize blocks_y = (level_height(level) + block.height - 1) / block.height;
+   return blocks_x * blocks_y * block.size;
+}
+
+uint32_t Image::full_mip_chain(uint32_t width, uint32_t height) {
+   return std::bit_width(std::max(width, height));
+}
@@ -1,15 +1,29 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+
 #include "gpu.h"
+#include "memory_allocator.h"
 #include <vulkan/vulkan_core.h>
 
 namespace simulo {
 
+// Texels of compressed formats are stored in fixed-size blocks. Uncompressed formats have 1x1
+// blocks the size of one texel.
+struct FormatBlock {
+   uint32_t width;
+   uint32_t height;
+   uint32_t size;
+};
+
+FormatBlock format_block(VkFormat format);
+
 class Image {
 public:
    Image(
-       const Gpu &gpu, VkDevice device, VkImageUsageFlags usage,
-       VkFormat format, uint32_t width, uint32_t height
+       MemoryAllocator &allocator, VkImageUsageFlags usage, VkFormat format, uint32_t width,
+       uint32_t height, uint32_t mip_levels
    );
 
    ~Image();
@@ -17,9 +31,19 @@ public:
    Image(const Image &other) = delete;
    Image &operator=(const Image &other) = delete;
 
-   void init_view();
+   void init_view(VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT);
 
-   void queue_transfer_layout(VkImageLayout layout, VkCommandBuffer cmd_buf);
+   // transfer_only must be set when cmd_buf will be submitted to a queue without graphics support
+   void
+   queue_transfer_layout(VkImageLayout layout, VkCommandBuffer cmd_buf, bool transfer_only = false);
+
+   // Fills every mip level after the first by blitting each level into the next. All levels must
+   // be in TRANSFER_DST layout and are left in SHADER_READ_ONLY. cmd_buf must be submitted to a
+   // queue with graphics support, and the image needs TRANSFER_SRC usage.
+   void queue_generate_mips(VkCommandBuffer cmd_buf);
+
+   // Number of levels in a full mip chain down to 1x1
+   static uint32_t full_mip_chain(uint32_t width, uint32_t height);
 
    inline VkImage handle() const {
       return image_;
@@ -41,14 +65,35 @@ public:
       return height_;
    }
 
+   inline VkFormat format() const {
+      return format_;
+   }
+
+   inline uint32_t mip_levels() const {
+      return mip_levels_;
+   }
+
+   inline uint32_t level_width(uint32_t level) const {
+      return std::max(1u, width_ >> level);
+   }
+
+   inline uint32_t level_height(uint32_t level) const {
+      return std::max(1u, height_ >> level);
+   }
+
+   // Bytes of tightly packed texel blocks in one mip level
+   VkDeviceSize level_size(uint32_t level) const;
+
 private:
    VkImage image_;
    VkImageView view_;
    VkFormat format_;
-   VkDeviceMemory allocation_;
+   MemoryAllocation allocation_;
    uint32_t width_;
    uint32_t height_;
+   uint32_t mip_levels_;
    VkDevice device_;
+   MemoryAllocator &allocator_;
    VkImageLayout layout_;
 };
 
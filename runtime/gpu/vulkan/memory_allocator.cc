@@ -0,0 +1,230 @@
+#include "memory_allocator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <stdexcept>
+
+#include <vulkan/vulkan_core.h>
+
+#include "status.h"
+#include "util/memory.h"
+
+using namespace simulo;
+
+namespace {
+
+constexpr VkDeviceSize kDefaultBlockSize = 1024 * 1024 * 64;
+
+} // namespace
+
+MemoryAllocator::MemoryAllocator(VkDevice device, const Gpu &gpu) : device_(device), gpu_(gpu) {
+   VkPhysicalDeviceMemoryProperties mem_properties = gpu.mem_properties();
+   for (uint32_t i = 0; i < mem_properties.memoryHeapCount; ++i) {
+      // Small heaps, such as the 256 MB of device-local host-visible memory without resizable BAR,
+      // shouldn't be taken up by a few mostly empty blocks
+      block_sizes_[i] = std::min(kDefaultBlockSize, mem_properties.memoryHeaps[i].size / 8);
+   }
+}
+
+MemoryAllocator::~MemoryAllocator() {
+   for (std::vector<std::unique_ptr<Block>> &pool : pools_) {
+      for (std::unique_ptr<Block> &block : pool) {
+         destroy_block(*block);
+      }
+   }
+}
+
+MemoryAllocation MemoryAllocator::allocate(
+    const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool optimal
+) {
+   uint32_t memory_type = gpu_.find_memory_type_index(
+       requirements.memoryTypeBits, static_cast<VkMemoryPropertyFlagBits>(properties)
+   );
+   uint32_t pool_index = memory_type * 2 + (optimal ? 1 : 0);
+   std::vector<std::unique_ptr<Block>> &pool = pools_[pool_index];
+
+   VkDeviceSize offset;
+   Block *target = nullptr;
+   for (std::unique_ptr<Block> &block : pool) {
+      if (!block->dedicated &&
+          allocate_from(*block, requirements.size, requirements.alignment, &offset)) {
+         target = block.get();
+         break;
+      }
+   }
+
+   if (target == nullptr) {
+      uint32_t heap = gpu_.mem_properties().memoryTypes[memory_type].heapIndex;
+      VkDeviceSize block_size = block_sizes_[heap];
+      bool dedicated = requirements.size > block_size / 2;
+
+      target = &create_block(
+          pool_index, memory_type, dedicated ? requirements.size : block_size, dedicated
+      );
+      if (!allocate_from(*target, requirements.size, requirements.alignment, &offset)) {
+         throw std::runtime_error(
+             std::format("allocation of {} bytes doesn't fit a new block", requirements.size)
+         );
+      }
+   }
+
+   return {
+       .memory = target->memory,
+       .offset = offset,
+       .mapped = target->mapped == nullptr ? nullptr
+                                           : reinterpret_cast<uint8_t *>(target->mapped) + offset,
+   };
+}
+
+void MemoryAllocator::free(VkDeviceMemory memory, VkDeviceSize offset) {
+   auto block_it = blocks_by_memory_.find(memory);
+   if (block_it == blocks_by_memory_.end()) {
+      throw std::runtime_error("freed memory that wasn't allocated by this allocator");
+   }
+   Block &block = *block_it->second;
+
+   auto alloc_it = block.allocations.find(offset);
+   if (alloc_it == block.allocations.end()) {
+      throw std::runtime_error(std::format("no allocation at offset {}", offset));
+   }
+   VkDeviceSize size = alloc_it->second;
+   block.allocations.erase(alloc_it);
+   block.used -= size;
+
+   auto next = std::lower_bound(
+       block.free_ranges.begin(), block.free_ranges.end(), offset,
+       [](const Range &range, VkDeviceSize target) { return range.offset < target; }
+   );
+   auto inserted = block.free_ranges.insert(next, {.offset = offset, .size = size});
+
+   auto after = inserted + 1;
+   if (after != block.free_ranges.end() && inserted->offset + inserted->size == after->offset) {
+      inserted->size += after->size;
+      block.free_ranges.erase(after);
+   }
+   if (inserted != block.free_ranges.begin()) {
+      auto before = inserted - 1;
+      if (before->offset + before->size == inserted->offset) {
+         before->size += inserted->size;
+         block.free_ranges.erase(inserted);
+      }
+   }
+
+   if (!block.allocations.empty()) {
+      return;
+   }
+
+   // Keep one empty block per pool around so a pool that is repeatedly emptied and refilled
+   // doesn't allocate from the driver every time
+   std::vector<std::unique_ptr<Block>> &pool = pools_[block.pool];
+   bool other_empty_block = std::any_of(
+       pool.begin(), pool.end(),
+       [&block](const std::unique_ptr<Block> &other) {
+          return other.get() != &block && !other->dedicated && other->allocations.empty();
+       }
+   );
+   if (block.dedicated || other_empty_block) {
+      destroy_block(block);
+      std::erase_if(pool, [&block](const std::unique_ptr<Block> &other) {
+         return other.get() == &block;
+      });
+   }
+}
+
+MemoryStats MemoryAllocator::stats() const {
+   MemoryStats stats = {};
+   VkDeviceSize total_free = 0;
+   VkDeviceSize largest_free = 0;
+
+   for (const std::vector<std::unique_ptr<Block>> &pool : pools_) {
+      for (const std::unique_ptr<Block> &block : pool) {
+         stats.reserved += block->size;
+         stats.used += block->used;
+         stats.block_count++;
+         stats.allocation_count += static_cast<uint32_t>(block->allocations.size());
+
+         for (const Range &range : block->free_ranges) {
+            total_free += range.size;
+            largest_free = std::max(largest_free, range.size);
+         }
+      }
+   }
+
+   if (total_free > 0) {
+      stats.fragmentation =
+          1.0f - static_cast<float>(largest_free) / static_cast<float>(total_free);
+   }
+   return stats;
+}
+
+MemoryAllocator::Block &MemoryAllocator::create_block(
+    uint32_t pool, uint32_t memory_type, VkDeviceSize size, bool dedicated
+) {
+   VkMemoryAllocateInfo alloc_info = {
+       .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+       .allocationSize = size,
+       .memoryTypeIndex = memory_type,
+   };
+
+   auto block = std::make_unique<Block>();
+   VKAD_VK(vkAllocateMemory(device_, &alloc_info, nullptr, &block->memory));
+   block->size = size;
+   block->used = 0;
+   block->mapped = nullptr;
+   block->pool = pool;
+   block->dedicated = dedicated;
+   block->free_ranges.push_back({.offset = 0, .size = size});
+
+   VkMemoryPropertyFlags flags = gpu_.mem_properties().memoryTypes[memory_type].propertyFlags;
+   if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0) {
+      VKAD_VK(vkMapMemory(device_, block->memory, 0, size, 0, &block->mapped));
+   }
+
+   Block &result = *block;
+   blocks_by_memory_[result.memory] = &result;
+   pools_[pool].push_back(std::move(block));
+   return result;
+}
+
+void MemoryAllocator::destroy_block(Block &block) {
+   if (block.mapped != nullptr) {
+      vkUnmapMemory(device_, block.memory);
+   }
+   vkFreeMemory(device_, block.memory, nullptr);
+   blocks_by_memory_.erase(block.memory);
+}
+
+bool MemoryAllocator::allocate_from(
+    Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset
+) {
+   for (auto it = block.free_ranges.begin(); it != block.free_ranges.end(); ++it) {
+      VkDeviceSize aligned = align_to(it->offset, alignment);
+      VkDeviceSize range_end = it->offset + it->size;
+      if (aligned + size > range_end) {
+         continue;
+      }
+
+      // Padding before the aligned start stays in the free list
+      VkDeviceSize padding = aligned - it->offset;
+      VkDeviceSize remaining = range_end - (aligned + size);
+      if (padding == 0 && remaining == 0) {
+         block.free_ranges.erase(it);
+      } else if (padding == 0) {
+         it->offset = aligned + size;
+         it->size = remaining;
+      } else {
+         it->size = padding;
+         if (remaining > 0) {
+            block.free_ranges.insert(it + 1, {.offset = aligned + size, .size = remaining});
+         }
+      }
+
+      block.allocations[aligned] = size;
+      block.used += size;
+      *offset = aligned;
+      return true;
+   }
+   return false;
+}
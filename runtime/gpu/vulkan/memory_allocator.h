@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "gpu.h"
+
+namespace simulo {
+
+struct MemoryAllocation {
+   VkDeviceMemory memory;
+   VkDeviceSize offset;
+   // Start of the allocation if its memory is host visible, otherwise null
+   void *mapped;
+};
+
+struct MemoryStats {
+   // Bytes of device memory allocated from the driver
+   VkDeviceSize reserved;
+   // Bytes handed out to buffers and images
+   VkDeviceSize used;
+   uint32_t block_count;
+   uint32_t allocation_count;
+   // 0 when all free memory is contiguous, approaching 1 as it is split into smaller ranges
+   float fragmentation;
+};
+
+// Sub-allocates buffers and images out of large blocks of device memory, so the number of
+// vkAllocateMemory calls stays well under the driver's limit. Blocks are grouped by memory type
+// and by whether they hold linear or optimal resources, which keeps bufferImageGranularity from
+// having to be considered within a block. Host-visible blocks are mapped once for their lifetime.
+class MemoryAllocator {
+public:
+   MemoryAllocator(VkDevice device, const Gpu &gpu);
+   ~MemoryAllocator();
+
+   MemoryAllocator(const MemoryAllocator &other) = delete;
+   MemoryAllocator &operator=(const MemoryAllocator &other) = delete;
+
+   MemoryAllocation allocate(
+       const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool optimal
+   );
+
+   void free(VkDeviceMemory memory, VkDeviceSize offset);
+
+   inline void free(const MemoryAllocation &allocation) {
+      free(allocation.memory, allocation.offset);
+   }
+
+   MemoryStats stats() const;
+
+   inline VkDevice device() const {
+      return device_;
+   }
+
+   inline const Gpu &gpu() const {
+      return gpu_;
+   }
+
+private:
+   struct Range {
+      VkDeviceSize offset;
+      VkDeviceSize size;
+   };
+
+   struct Block {
+      VkDeviceMemory memory;
+      VkDeviceSize size;
+      VkDeviceSize used;
+      void *mapped;
+      uint32_t pool;
+      // Blocks made for a single large allocation are released as soon as it is freed
+      bool dedicated;
+      // Sorted by offset, with adjacent ranges always merged
+      std::vector<Range> free_ranges;
+      // Offset to size of each live allocation
+      std::unordered_map<VkDeviceSize, VkDeviceSize> allocations;
+   };
+
+   Block &create_block(uint32_t pool, uint32_t memory_type, VkDeviceSize size, bool dedicated);
+   void destroy_block(Block &block);
+
+   static bool
+   allocate_from(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset);
+
+   VkDevice device_;
+   const Gpu &gpu_;
+   std::array<VkDeviceSize, VK_MAX_MEMORY_HEAPS> block_sizes_;
+   // Indexed by memory type * 2 + optimal
+   std::array<std::vector<std::unique_ptr<Block>>, VK_MAX_MEMORY_TYPES * 2> pools_;
+   std::unordered_map<VkDeviceMemory, Block *> blocks_by_memory_;
+};
+
+} // namespace simulo
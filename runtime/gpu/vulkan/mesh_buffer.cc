@@ -0,0 +1,121 @@
+#include "mesh_buffer.h"
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+#include <vulkan/vulkan_core.h>
+
+#include "buffer.h"
+
+using namespace simulo;
+
+namespace {
+
+// Vertex strides such as 20 or 24 bytes aren't powers of two, so util's align_to can't be used
+VkDeviceSize round_up(VkDeviceSize value, VkDeviceSize multiple) {
+   return (value + multiple - 1) / multiple * multiple;
+}
+
+} // namespace
+
+MeshBufferPool::MeshBufferPool(
+    MemoryAllocator &allocator, VkBufferUsageFlags usage, VkDeviceSize block_size
+)
+    : allocator_(allocator), usage_(usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT),
+      block_size_(block_size) {}
+
+MeshBufferPool::~MeshBufferPool() {
+   for (Block &block : blocks_) {
+      buffer_destroy(&block.buffer, block.allocation, allocator_);
+   }
+}
+
+MeshBufferRange MeshBufferPool::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+   // Ranges are looked up by offset when freed, so even empty ones take up a byte
+   size = std::max<VkDeviceSize>(size, 1);
+   VkDeviceSize offset;
+   for (uint32_t i = 0; i < blocks_.size(); ++i) {
+      if (allocate_from(blocks_[i], size, alignment, &offset)) {
+         return {.block = i, .offset = offset};
+      }
+   }
+
+   // Meshes larger than a block get a buffer of their own size. Buffers are kept for the pool's
+   // lifetime, so the block index of every live mesh stays valid.
+   VkDeviceSize buffer_size = std::max(block_size_, size);
+   Block &block = blocks_.emplace_back();
+   buffer_init(
+       &block.buffer, &block.allocation, buffer_size, usage_,
+       static_cast<VkMemoryPropertyFlagBits>(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT), allocator_
+   );
+   block.free_ranges.push_back({.offset = 0, .size = buffer_size});
+
+   if (!allocate_from(block, size, alignment, &offset)) {
+      throw std::runtime_error(
+          std::format("mesh range of {} bytes doesn't fit a new buffer", size)
+      );
+   }
+   return {.block = static_cast<uint32_t>(blocks_.size() - 1), .offset = offset};
+}
+
+void MeshBufferPool::free(const MeshBufferRange &range) {
+   Block &block = blocks_[range.block];
+   auto alloc_it = block.allocations.find(range.offset);
+   if (alloc_it == block.allocations.end()) {
+      throw std::runtime_error(std::format("no mesh range at offset {}", range.offset));
+   }
+   VkDeviceSize size = alloc_it->second;
+   block.allocations.erase(alloc_it);
+
+   auto next = std::lower_bound(
+       block.free_ranges.begin(), block.free_ranges.end(), range.offset,
+       [](const Range &free_range, VkDeviceSize target) { return free_range.offset < target; }
+   );
+   auto inserted = block.free_ranges.insert(next, {.offset = range.offset, .size = size});
+
+   auto after = inserted + 1;
+   if (after != block.free_ranges.end() && inserted->offset + inserted->size == after->offset) {
+      inserted->size += after->size;
+      block.free_ranges.erase(after);
+   }
+   if (inserted != block.free_ranges.begin()) {
+      auto before = inserted - 1;
+      if (before->offset + before->size == inserted->offset) {
+         before->size += inserted->size;
+         block.free_ranges.erase(inserted);
+      }
+   }
+}
+
+bool MeshBufferPool::allocate_from(
+    Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset
+) {
+   for (auto it = block.free_ranges.begin(); it != block.free_ranges.end(); ++it) {
+      VkDeviceSize aligned = round_up(it->offset, alignment);
+      VkDeviceSize range_end = it->offset + it->size;
+      if (aligned + size > range_end) {
+         continue;
+      }
+
+      // Padding before the aligned start stays in the free list
+      VkDeviceSize padding = aligned - it->offset;
+      VkDeviceSize remaining = range_end - (aligned + size);
+      if (padding == 0 && remaining == 0) {
+         block.free_ranges.erase(it);
+      } else if (padding == 0) {
+         it->offset = aligned + size;
+         it->size = remaining;
+      } else {
+         it->size = padding;
+         if (remaining > 0) {
+            block.free_ranges.insert(it + 1, {.offset = aligned + size, .size = remaining});
+         }
+      }
+
+      block.allocations[aligned] = size;
+      *offset = aligned;
+      return true;
+   }
+   return false;
+}
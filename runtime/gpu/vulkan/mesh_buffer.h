@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "memory_allocator.h"
+
+namespace simulo {
+
+struct MeshBufferRange {
+   // Index of the pool's buffer holding the range
+   uint32_t block;
+   VkDeviceSize offset;
+};
+
+// Sub-allocates the vertices or indices of every mesh out of a few large device-local buffers, so
+// draws of different meshes only differ in their vertexOffset and firstIndex and the buffers
+// rarely need rebinding. A new buffer is only added when no existing one has room.
+class MeshBufferPool {
+public:
+   MeshBufferPool(MemoryAllocator &allocator, VkBufferUsageFlags usage, VkDeviceSize block_size);
+   ~MeshBufferPool();
+
+   MeshBufferPool(const MeshBufferPool &other) = delete;
+   MeshBufferPool &operator=(const MeshBufferPool &other) = delete;
+
+   // `alignment` need not be a power of two, so vertex ranges can start on a whole vertex
+   MeshBufferRange allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+   void free(const MeshBufferRange &range);
+
+   inline VkBuffer buffer(uint32_t block) const {
+      return blocks_[block].buffer;
+   }
+
+   inline uint32_t block_count() const {
+      return static_cast<uint32_t>(blocks_.size());
+   }
+
+private:
+   struct Range {
+      VkDeviceSize offset;
+      VkDeviceSize size;
+   };
+
+   struct Block {
+      VkBuffer buffer;
+      MemoryAllocation allocation;
+      // Sorted by offset, with adjacent ranges always merged
+      std::vector<Range> free_ranges;
+      // Offset to size of each live range
+      std::unordered_map<VkDeviceSize, VkDeviceSize> allocations;
+   };
+
+   static bool
+   allocate_from(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset);
+
+   MemoryAllocator &allocator_;
+   VkBufferUsageFlags usage_;
+   VkDeviceSize block_size_;
+   std::vector<Block> blocks_;
+};
+
+} // namespace simulo
@@ -0,0 +1,24 @@
+#include "offscreen_target.h"
+
+#include <memory>
+
+#include <vulkan/vulkan_core.h>
+
+using namespace simulo;
+
+OffscreenTarget::OffscreenTarget(
+    MemoryAllocator &allocator, uint32_t width, uint32_t height, uint32_t num_images
+)
+    : extent_{.width = width, .height = height} {
+   images_.reserve(num_images);
+   for (uint32_t i = 0; i < num_images; ++i) {
+      auto image = std::make_unique<Image>(
+          allocator,
+          VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+              VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+          kFormat, width, height, 1
+      );
+      image->init_view();
+      images_.push_back(std::move(image));
+   }
+}
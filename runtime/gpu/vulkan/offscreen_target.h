@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "image.h"
+#include "memory_allocator.h"
+
+namespace simulo {
+
+// Color images that a headless renderer draws into in place of a swapchain's, or blits scaled
+// frames into. Rendered images are left in TRANSFER_SRC layout so they can be copied out for
+// readback.
+class OffscreenTarget {
+public:
+   OffscreenTarget(
+       MemoryAllocator &allocator, uint32_t width, uint32_t height, uint32_t num_images
+   );
+
+   OffscreenTarget(const OffscreenTarget &other) = delete;
+   OffscreenTarget &operator=(const OffscreenTarget &other) = delete;
+
+   inline int num_images() const {
+      return images_.size();
+   }
+
+   inline VkImage image(int index) const {
+      return images_[index]->handle();
+   }
+
+   inline VkImageView image_view(int index) const {
+      return images_[index]->view();
+   }
+
+   inline VkFormat img_format() const {
+      return kFormat;
+   }
+
+   inline VkExtent2D extent() const {
+      return extent_;
+   }
+
+   // Bytes of tightly packed RGBA8 pixels in one image
+   inline VkDeviceSize image_size() const {
+      return static_cast<VkDeviceSize>(extent_.width) * extent_.height * 4;
+   }
+
+   static constexpr VkFormat kFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+private:
+   std::vector<std::unique_ptr<Image>> images_;
+   VkExtent2D extent_;
+};
+
+} // namespace simulo
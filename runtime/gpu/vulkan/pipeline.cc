@@ -10,10 +10,12 @@
 using namespace simulo;
 
 Pipeline::Pipeline(
-    VkDevice device, VkVertexInputBindingDescription vertex_binding,
+    VkDevice device, VkPipelineCache cache,
+    const std::vector<VkVertexInputBindingDescription> &vertex_bindings,
     const std::vector<VkVertexInputAttributeDescription> &vertex_attributes,
-    const Shader &vertex_shader, const Shader &fragment_shader,
-    VkDescriptorSetLayout descriptor_layout, VkRenderPass render_pass
+    VkShaderModule vertex_shader, VkShaderModule fragment_shader,
+    const std::vector<VkDescriptorSetLayout> &descriptor_layouts, VkRenderPass render_pass,
+    VkFormat color_format, VkFormat depth_format, BlendMode blend_mode
 )
     : layout_(VK_NULL_HANDLE), pipeline_(VK_NULL_HANDLE), device_(device) {
 
@@ -21,21 +23,21 @@ Pipeline::Pipeline(
        VkPipelineShaderStageCreateInfo{
            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
            .stage = VK_SHADER_STAGE_VERTEX_BIT,
-           .module = vertex_shader.module(),
+           .module = vertex_shader,
            .pName = "main",
        },
        VkPipelineShaderStageCreateInfo{
            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-           .module = fragment_shader.module(),
+           .module = fragment_shader,
            .pName = "main",
        },
    };
 
    VkPipelineVertexInputStateCreateInfo vertex_input_create = {
        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-       .vertexBindingDescriptionCount = 1,
-       .pVertexBindingDescriptions = &vertex_binding,
+       .vertexBindingDescriptionCount = static_cast<uint32_t>(vertex_bindings.size()),
+       .pVertexBindingDescriptions = vertex_bindings.data(),
        .vertexAttributeDescriptionCount = static_cast<uint32_t>(vertex_attributes.size()),
        .pVertexAttributeDescriptions = vertex_attributes.data(),
    };
@@ -64,8 +66,19 @@ Pipeline::Pipeline(
        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
    };
 
+   // Opaque draws replace what's behind them, so only they write depth. Fragments at the same
+   // depth still pass, letting later draws of coplanar objects land on top as without depth.
+   VkPipelineDepthStencilStateCreateInfo depth_stencil_create = {
+       .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+       .depthTestEnable = VK_TRUE,
+       .depthWriteEnable = blend_mode == BLEND_MODE_OPAQUE ? VK_TRUE : VK_FALSE,
+       .depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
+       .minDepthBounds = 0.0f,
+       .maxDepthBounds = 1.0f,
+   };
+
    VkPipelineColorBlendAttachmentState color_blend_attachment = {
-       .blendEnable = VK_TRUE,
+       .blendEnable = blend_mode == BLEND_MODE_TRANSPARENT ? VK_TRUE : VK_FALSE,
        .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
        .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
        .colorBlendOp = VK_BLEND_OP_ADD,
@@ -92,20 +105,28 @@ Pipeline::Pipeline(
    VkPushConstantRange push_constants = {
        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
        .offset = 0,
-       .size = sizeof(PushConstants),
+       .size = sizeof(PassConstants),
    };
 
    VkPipelineLayoutCreateInfo layout_create = {
        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-       .setLayoutCount = 1,
-       .pSetLayouts = &descriptor_layout,
+       .setLayoutCount = static_cast<uint32_t>(descriptor_layouts.size()),
+       .pSetLayouts = descriptor_layouts.data(),
        .pushConstantRangeCount = 1,
        .pPushConstantRanges = &push_constants,
    };
    VKAD_VK(vkCreatePipelineLayout(device, &layout_create, nullptr, &layout_));
 
+   VkPipelineRenderingCreateInfoKHR rendering_create = {
+       .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+       .colorAttachmentCount = 1,
+       .pColorAttachmentFormats = &color_format,
+       .depthAttachmentFormat = depth_format,
+   };
+
    VkGraphicsPipelineCreateInfo create_info = {
        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+       .pNext = render_pass == VK_NULL_HANDLE ? &rendering_create : nullptr,
        .stageCount = static_cast<uint32_t>(shader_stages.size()),
        .pStages = shader_stages.data(),
        .pVertexInputState = &vertex_input_create,
@@ -113,14 +134,15 @@ Pipeline::Pipeline(
        .pViewportState = &viewport_create,
        .pRasterizationState = &rasterizer_create,
        .pMultisampleState = &multisample_create,
-       .pDepthStencilState = nullptr,
+       .pDepthStencilState =
+           depth_format != VK_FORMAT_UNDEFINED ? &depth_stencil_create : nullptr,
        .pColorBlendState = &color_blend_create,
        .pDynamicState = &dynamic_create,
        .layout = layout_,
        .renderPass = render_pass,
        .subpass = 0,
    };
-   VKAD_VK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline_));
+   VKAD_VK(vkCreateGraphicsPipelines(device, cache, 1, &create_info, nullptr, &pipeline_));
 }
 
 Pipeline::~Pipeline() {
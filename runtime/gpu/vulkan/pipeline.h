@@ -4,20 +4,26 @@
 
 #include "vulkan/vulkan_core.h"
 
-#include "shader.h"
+#include "ffi.h"
 
 namespace simulo {
 
 class Pipeline {
 public:
+   // Takes shader modules rather than Shaders so that it can be compiled on another thread while
+   // the renderer owns them. A null render pass makes the pipeline for dynamic rendering into a
+   // single attachment of color_format. Pipelines drawn with a depth attachment are given its
+   // format, or VK_FORMAT_UNDEFINED without one, in which case depth is neither tested nor written.
    explicit Pipeline(
-       VkDevice device, VkVertexInputBindingDescription vertex_binding,
+       VkDevice device, VkPipelineCache cache,
+       const std::vector<VkVertexInputBindingDescription> &vertex_bindings,
        const std::vector<VkVertexInputAttributeDescription> &vertex_attributes,
-       const Shader &vertex_shader, const Shader &fragment_shader,
-       VkDescriptorSetLayout descriptor_layout, VkRenderPass render_pass
+       VkShaderModule vertex_shader, VkShaderModule fragment_shader,
+       const std::vector<VkDescriptorSetLayout> &descriptor_layouts, VkRenderPass render_pass,
+       VkFormat color_format, VkFormat depth_format, BlendMode blend_mode
    );
 
-   explicit inline Pipeline(Pipeline &&other) {
+   inline Pipeline(Pipeline &&other) {
       layout_ = other.layout_;
       other.layout_ = VK_NULL_HANDLE;
       pipeline_ = other.pipeline_;
@@ -0,0 +1,138 @@
+#include "pipeline_cache.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "status.h"
+
+using namespace simulo;
+
+namespace {
+
+constexpr uint32_t kFileMagic = 0x4c505356; // "VSPL"
+
+// Written ahead of the driver's data. The driver version isn't part of the Vulkan header, and the
+// checksum catches files that were cut short or corrupted.
+struct FileHeader {
+   uint32_t magic;
+   uint32_t driver_version;
+   uint64_t data_size;
+   uint64_t checksum;
+};
+
+uint64_t fnv1a(std::span<const uint8_t> data) {
+   uint64_t hash = 0xcbf29ce484222325;
+   for (uint8_t byte : data) {
+      hash = (hash ^ byte) * 0x100000001b3;
+   }
+   return hash;
+}
+
+// Returns the driver's cache data if the file holds a cache this device and driver can use,
+// otherwise an empty vector
+std::vector<uint8_t> read_cache_file(const std::string &path, const Gpu &gpu) {
+   std::ifstream file(path, std::ios::binary);
+   if (!file) {
+      return {};
+   }
+
+   std::vector<uint8_t> contents{
+       std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()
+   };
+   if (contents.size() < sizeof(FileHeader) + sizeof(VkPipelineCacheHeaderVersionOne)) {
+      return {};
+   }
+
+   FileHeader header;
+   std::memcpy(&header, contents.data(), sizeof(FileHeader));
+   std::span<const uint8_t> data(contents.begin() + sizeof(FileHeader), contents.end());
+
+   const VkPhysicalDeviceProperties &properties = gpu.properties();
+   if (header.magic != kFileMagic || header.driver_version != properties.driverVersion ||
+       header.data_size != data.size() || header.checksum != fnv1a(data)) {
+      return {};
+   }
+
+   VkPipelineCacheHeaderVersionOne vk_header;
+   std::memcpy(&vk_header, data.data(), sizeof(vk_header));
+   if (vk_header.headerSize < sizeof(vk_header) ||
+       vk_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+       vk_header.vendorID != properties.vendorID || vk_header.deviceID != properties.deviceID ||
+       std::memcmp(vk_header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+      return {};
+   }
+
+   return std::vector<uint8_t>(data.begin(), data.end());
+}
+
+} // namespace
+
+PipelineCache::PipelineCache(VkDevice device, const Gpu &gpu, std::string path)
+    : device_(device), gpu_(gpu), path_(std::move(path)), cache_(VK_NULL_HANDLE), saved_size_(0) {
+   std::vector<uint8_t> initial_data;
+   if (!path_.empty()) {
+      initial_data = read_cache_file(path_, gpu_);
+   }
+
+   VkPipelineCacheCreateInfo create_info = {
+       .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+       .initialDataSize = initial_data.size(),
+       .pInitialData = initial_data.empty() ? nullptr : initial_data.data(),
+   };
+   VKAD_VK(vkCreatePipelineCache(device_, &create_info, nullptr, &cache_));
+   saved_size_ = initial_data.size();
+}
+
+PipelineCache::~PipelineCache() {
+   vkDestroyPipelineCache(device_, cache_, nullptr);
+}
+
+void PipelineCache::save() {
+   if (path_.empty()) {
+      return;
+   }
+
+   size_t size;
+   VKAD_VK(vkGetPipelineCacheData(device_, cache_, &size, nullptr));
+   if (size <= saved_size_) {
+      return;
+   }
+
+   std::vector<uint8_t> data(size);
+   VKAD_VK(vkGetPipelineCacheData(device_, cache_, &size, data.data()));
+   data.resize(size);
+
+   FileHeader header = {
+       .magic = kFileMagic,
+       .driver_version = gpu_.properties().driverVersion,
+       .data_size = data.size(),
+       .checksum = fnv1a(data),
+   };
+
+   // Failing to save only costs compile time on the next start, so it isn't worth an exception
+   std::string tmp_path = path_ + ".tmp";
+   {
+      std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+      file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char *>(data.data()), data.size());
+      file.close();
+      if (!file) {
+         return;
+      }
+   }
+
+   std::error_code err;
+   std::filesystem::rename(tmp_path, path_, err);
+   if (!err) {
+      saved_size_ = size;
+   }
+}
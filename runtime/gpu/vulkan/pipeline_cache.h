@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <vulkan/vulkan_core.h>
+
+#include "gpu.h"
+
+namespace simulo {
+
+// Pipeline cache that persists across runs. The saved data is only loaded back if it came from the
+// same vendor, device and driver, and passes a checksum, so a file left half written by a power cut
+// or a driver update just means compiling from scratch once.
+class PipelineCache {
+public:
+   // An empty path keeps the cache in memory only
+   PipelineCache(VkDevice device, const Gpu &gpu, std::string path);
+   ~PipelineCache();
+
+   PipelineCache(const PipelineCache &other) = delete;
+   PipelineCache &operator=(const PipelineCache &other) = delete;
+
+   inline VkPipelineCache handle() const {
+      return cache_;
+   }
+
+   // Writes the cache to disk if it grew since it was loaded or last saved. The file is replaced
+   // with a rename so readers never see a partial write.
+   void save();
+
+private:
+   VkDevice device_;
+   const Gpu &gpu_;
+   std::string path_;
+   VkPipelineCache cache_;
+   size_t saved_size_;
+};
+
+} // namespace simulo
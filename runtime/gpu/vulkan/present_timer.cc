@@ -0,0 +1,105 @@
+#include "present_timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <vulkan/vulkan_core.h>
+
+using namespace simulo;
+
+namespace {
+
+// A present that never completes, such as one to a window that was hidden, shouldn't hold up the
+// ones after it for long
+constexpr auto kWaitTimeout = std::chrono::seconds(1);
+// Below the 1 ms histogram buckets, so polling barely shifts the measured latency
+constexpr auto kPollInterval = std::chrono::microseconds(250);
+
+} // namespace
+
+PresentTimer::PresentTimer(VkDevice device, std::mutex &swapchain_mutex)
+    : device_(device), swapchain_mutex_(swapchain_mutex), next_id_(1), waiting_(false),
+      stopping_(false), buckets_{} {
+   wait_for_present_ = reinterpret_cast<PFN_vkWaitForPresentKHR>(
+       vkGetDeviceProcAddr(device, "vkWaitForPresentKHR")
+   );
+   if (wait_for_present_ == nullptr) {
+      throw std::runtime_error("vkWaitForPresentKHR not available");
+   }
+   worker_ = std::thread(&PresentTimer::run, this);
+}
+
+PresentTimer::~PresentTimer() {
+   {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+   }
+   wake_.notify_one();
+   worker_.join();
+}
+
+void PresentTimer::track(
+    VkSwapchainKHR swapchain, uint64_t present_id, std::chrono::steady_clock::time_point start
+) {
+   {
+      std::lock_guard lock(mutex_);
+      pending_.push_back({.swapchain = swapchain, .id = present_id, .start = start});
+   }
+   wake_.notify_one();
+}
+
+void PresentTimer::drain() {
+   std::unique_lock lock(mutex_);
+   drained_.wait(lock, [this] { return pending_.empty() && !waiting_; });
+}
+
+void PresentTimer::histogram(uint32_t (&buckets)[kBuckets]) const {
+   for (uint32_t i = 0; i < kBuckets; ++i) {
+      buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+   }
+}
+
+void PresentTimer::run() {
+   std::unique_lock lock(mutex_);
+   while (true) {
+      wake_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+      if (stopping_) {
+         return;
+      }
+
+      Pending present = pending_.front();
+      pending_.pop_front();
+      waiting_ = true;
+      lock.unlock();
+
+      VkResult res;
+      auto now = std::chrono::steady_clock::now();
+      auto deadline = now + kWaitTimeout;
+      while (true) {
+         {
+            std::lock_guard swapchain_lock(swapchain_mutex_);
+            res = wait_for_present_(device_, present.swapchain, present.id, 0);
+         }
+         now = std::chrono::steady_clock::now();
+         if (res != VK_TIMEOUT || now >= deadline) {
+            break;
+         }
+         std::this_thread::sleep_for(kPollInterval);
+      }
+      // Timeouts and out of date swapchains just leave the present unmeasured
+      if (res == VK_SUCCESS) {
+         auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(now - present.start);
+         int64_t bucket = std::clamp<int64_t>(latency.count(), 0, kBuckets - 1);
+         buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+      }
+
+      lock.lock();
+      waiting_ = false;
+      if (pending_.empty()) {
+         drained_.notify_all();
+      }
+   }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <vulkan/vulkan_core.h>
+
+namespace simulo {
+
+// Measures how long frames take to reach the display. Each present is tagged with an id, and a
+// worker thread waits on the ids in order with VK_KHR_present_wait, adding the time from the
+// frame's start to the wait returning into a histogram of 1 ms buckets. Waits may not overlap
+// acquires and presents on the same swapchain, so the worker polls with a zero timeout while
+// holding the mutex those are made under, and sleeps between polls without it.
+class PresentTimer {
+public:
+   static constexpr uint32_t kBuckets = 64;
+
+   PresentTimer(VkDevice device, std::mutex &swapchain_mutex);
+   ~PresentTimer();
+
+   PresentTimer(const PresentTimer &other) = delete;
+   PresentTimer &operator=(const PresentTimer &other) = delete;
+
+   // Id to chain into a present through VkPresentIdKHR. Ids increase for the life of the timer,
+   // which satisfies the per-swapchain ordering the extension requires.
+   inline uint64_t next_present_id() {
+      return next_id_++;
+   }
+
+   // Queues a wait for a present that was accepted by the queue, of a frame started at `start`
+   void track(
+       VkSwapchainKHR swapchain, uint64_t present_id, std::chrono::steady_clock::time_point start
+   );
+
+   // Blocks until every tracked present has been waited on, so their swapchain can be destroyed
+   void drain();
+
+   // Number of presents that took [i, i + 1) ms, with the last bucket also counting slower ones
+   void histogram(uint32_t (&buckets)[kBuckets]) const;
+
+private:
+   struct Pending {
+      VkSwapchainKHR swapchain;
+      uint64_t id;
+      std::chrono::steady_clock::time_point start;
+   };
+
+   void run();
+
+   VkDevice device_;
+   std::mutex &swapchain_mutex_;
+   PFN_vkWaitForPresentKHR wait_for_present_;
+   uint64_t next_id_;
+
+   std::mutex mutex_;
+   std::condition_variable wake_;
+   std::condition_variable drained_;
+   std::deque<Pending> pending_;
+   bool waiting_;
+   bool stopping_;
+
+   std::array<std::atomic<uint32_t>, kBuckets> buckets_;
+   std::thread worker_;
+};
+
+} // namespace simulo
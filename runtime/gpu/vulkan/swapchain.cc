@@ -46,7 +46,14 @@ VkSurfaceFormatKHR best_surface_format(const std::vector<VkSurfaceFormatKHR> &fo
    return formats.at(0);
 }
 
-VkPresentModeKHR best_present_mode(const std::vector<VkPresentModeKHR> &present_modes) {
+VkPresentModeKHR best_present_mode(
+    const std::vector<VkPresentModeKHR> &present_modes, std::optional<VkPresentModeKHR> preferred
+) {
+   if (preferred && std::find(present_modes.begin(), present_modes.end(), *preferred) !=
+                        present_modes.end()) {
+      return *preferred;
+   }
+
    for (const auto mode : present_modes) {
       if (mode == VK_PRESENT_MODE_MAILBOX_KHR) {
          return mode;
@@ -70,7 +77,7 @@ create_swap_extent(const VkSurfaceCapabilitiesKHR &capa, uint32_t width, uint32_
 
 Swapchain::Swapchain(
     const std::vector<uint32_t> &queue_families, VkPhysicalDevice physical_device, VkDevice device,
-    VkSurfaceKHR surface, uint32_t width, uint32_t height
+    VkSurfaceKHR surface, uint32_t width, uint32_t height, const SwapchainConfig &config
 )
     : device_(device), swapchain_(VK_NULL_HANDLE) {
 
@@ -91,7 +98,9 @@ Swapchain::Swapchain(
    VkSurfaceCapabilitiesKHR capabilities;
    VKAD_VK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &capabilities));
 
-   uint32_t image_count = capabilities.minImageCount + 1;
+   uint32_t image_count = config.image_count == 0
+                              ? capabilities.minImageCount + 1
+                              : std::max(config.image_count, capabilities.minImageCount);
    if (capabilities.maxImageCount != 0 && image_count > capabilities.maxImageCount) {
       image_count = capabilities.maxImageCount;
    }
@@ -100,6 +109,17 @@ Swapchain::Swapchain(
    img_format_ = format.format;
 
    extent_ = create_swap_extent(capabilities, width, height);
+   present_mode_ = best_present_mode(present_modes, config.present_mode);
+
+   usage_ = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+   if (config.blit_target &&
+       (capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0) {
+      usage_ |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+   }
+   if (config.capture_source &&
+       (capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0) {
+      usage_ |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+   }
 
    VkSwapchainCreateInfoKHR create_info = {
        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
@@ -109,10 +129,10 @@ Swapchain::Swapchain(
        .imageColorSpace = format.colorSpace,
        .imageExtent = extent_,
        .imageArrayLayers = 1,
-       .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+       .imageUsage = usage_,
        .preTransform = capabilities.currentTransform,
        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-       .presentMode = best_present_mode(present_modes),
+       .presentMode = present_mode_,
        .clipped = VK_TRUE,
    };
 
@@ -154,6 +174,8 @@ Swapchain &Swapchain::operator=(Swapchain &&other) {
    swapchain_ = other.swapchain_;
    img_format_ = other.img_format_;
    extent_ = other.extent_;
+   present_mode_ = other.present_mode_;
+   usage_ = other.usage_;
 
    other.image_views_.clear();
    other.swapchain_ = VK_NULL_HANDLE;
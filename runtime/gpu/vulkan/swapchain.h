@@ -1,15 +1,31 @@
 #pragma once
 
+#include <cstdint>
+#include <optional>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
 namespace simulo {
 
+struct SwapchainConfig {
+   // Used when the surface supports it. Otherwise, and when unset, MAILBOX is preferred over FIFO.
+   std::optional<VkPresentModeKHR> present_mode;
+   // Minimum number of images, clamped to what the surface allows. 0 requests one more than the
+   // surface's minimum.
+   uint32_t image_count;
+   // Also let frames be blitted into the images, where the surface allows it. Check usage() for
+   // whether it did.
+   bool blit_target;
+   // Also let the images be copied from, likewise
+   bool capture_source;
+};
+
 class Swapchain {
 public:
    Swapchain(
        const std::vector<uint32_t> &queue_families, VkPhysicalDevice physical_device,
-       VkDevice device, VkSurfaceKHR surface, uint32_t width, uint32_t height
+       VkDevice device, VkSurfaceKHR surface, uint32_t width, uint32_t height,
+       const SwapchainConfig &config
    );
 
    Swapchain &operator=(const Swapchain &other) = delete;
@@ -30,6 +46,10 @@ public:
       return images_.size();
    }
 
+   inline VkImage image(int index) const {
+      return images_[index];
+   }
+
    inline VkImageView image_view(int index) const {
       return image_views_[index];
    }
@@ -42,6 +62,14 @@ public:
       return extent_;
    }
 
+   inline VkPresentModeKHR present_mode() const {
+      return present_mode_;
+   }
+
+   inline VkImageUsageFlags usage() const {
+      return usage_;
+   }
+
    static bool is_supported_on(VkPhysicalDevice device, VkSurfaceKHR surface);
 
 private:
@@ -51,6 +79,8 @@ private:
    std::vector<VkImageView> image_views_;
    VkFormat img_format_;
    VkExtent2D extent_;
+   VkPresentModeKHR present_mode_;
+   VkImageUsageFlags usage_;
 };
 
 } // namespace simulo
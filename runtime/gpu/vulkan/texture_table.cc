@@ -0,0 +1,119 @@
+#include "texture_table.h"
+
+#include <vulkan/vulkan_core.h>
+
+#include "status.h"
+
+using namespace simulo;
+
+namespace {
+
+// Sets in the first pool of a table without descriptor indexing
+constexpr uint32_t kInitialSlotSets = 64;
+
+} // namespace
+
+TextureTable::TextureTable(VkDevice device, uint32_t capacity, bool bindless)
+    : device_(device), bindless_(bindless), layout_(VK_NULL_HANDLE), pool_(VK_NULL_HANDLE),
+      set_(VK_NULL_HANDLE),
+      slot_allocator_(
+          device, {{.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, .descriptorCount = 1}},
+          kInitialSlotSets
+      ),
+      capacity_(capacity) {
+   VkDescriptorSetLayoutBinding binding = {
+       .binding = 0,
+       .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+       .descriptorCount = bindless_ ? capacity_ : 1,
+       .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+   };
+
+   if (!bindless_) {
+      VkDescriptorSetLayoutCreateInfo layout_create = {
+          .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+          .bindingCount = 1,
+          .pBindings = &binding,
+      };
+      VKAD_VK(vkCreateDescriptorSetLayout(device_, &layout_create, nullptr, &layout_));
+      return;
+   }
+
+   // Slots past the last texture are never written, and textures are added while earlier frames
+   // that bound the set are still executing
+   VkDescriptorBindingFlags binding_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                                            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                                            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+   VkDescriptorSetLayoutBindingFlagsCreateInfo flags_create = {
+       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+       .bindingCount = 1,
+       .pBindingFlags = &binding_flags,
+   };
+
+   VkDescriptorSetLayoutCreateInfo layout_create = {
+       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+       .pNext = &flags_create,
+       .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+       .bindingCount = 1,
+       .pBindings = &binding,
+   };
+   VKAD_VK(vkCreateDescriptorSetLayout(device_, &layout_create, nullptr, &layout_));
+
+   VkDescriptorPoolSize pool_size = {
+       .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+       .descriptorCount = capacity_,
+   };
+   VkDescriptorPoolCreateInfo pool_create = {
+       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+       .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+       .maxSets = 1,
+       .poolSizeCount = 1,
+       .pPoolSizes = &pool_size,
+   };
+   VKAD_VK(vkCreateDescriptorPool(device_, &pool_create, nullptr, &pool_));
+
+   VkDescriptorSetAllocateInfo alloc_info = {
+       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+       .descriptorPool = pool_,
+       .descriptorSetCount = 1,
+       .pSetLayouts = &layout_,
+   };
+   VKAD_VK(vkAllocateDescriptorSets(device_, &alloc_info, &set_));
+}
+
+TextureTable::~TextureTable() {
+   if (pool_ != VK_NULL_HANDLE) {
+      vkDestroyDescriptorPool(device_, pool_, nullptr);
+   }
+   vkDestroyDescriptorSetLayout(device_, layout_, nullptr);
+}
+
+void TextureTable::write(uint32_t index, VkSampler sampler, const Image &image) {
+   VkDescriptorSet set = set_;
+   uint32_t element = index;
+   if (!bindless_) {
+      if (index >= slot_sets_.size()) {
+         slot_sets_.resize(index + 1, VK_NULL_HANDLE);
+      }
+      if (slot_sets_[index] == VK_NULL_HANDLE) {
+         slot_sets_[index] = slot_allocator_.allocate(layout_);
+      }
+      set = slot_sets_[index];
+      element = 0;
+   }
+
+   VkDescriptorImageInfo image_info = {
+       .sampler = sampler,
+       .imageView = image.view(),
+       .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+   };
+   VkWriteDescriptorSet write = {
+       .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+       .dstSet = set,
+       .dstBinding = 0,
+       .dstArrayElement = element,
+       .descriptorCount = 1,
+       .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+       .pImageInfo = &image_info,
+   };
+   vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+}
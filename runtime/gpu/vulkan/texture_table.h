@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "descriptor_pool.h"
+#include "image.h"
+
+namespace simulo {
+
+// Descriptors of every sampled texture, each at its own slot. A bindless table is one descriptor
+// set holding all of them in a single runtime-sized array, which is bound once per frame while
+// shaders pick a texture by index. Slots that no draw in flight reads may be written at any time.
+// Devices without descriptor indexing get a set per slot instead, holding just that texture, which
+// is bound whenever a draw samples a different texture. Both are laid out as set 0 of the
+// pipelines.
+class TextureTable {
+public:
+   TextureTable(VkDevice device, uint32_t capacity, bool bindless);
+   ~TextureTable();
+
+   TextureTable(const TextureTable &other) = delete;
+   TextureTable &operator=(const TextureTable &other) = delete;
+
+   // Points slot `index` at the image, which must already be in its shader read layout
+   void write(uint32_t index, VkSampler sampler, const Image &image);
+
+   inline bool bindless() const {
+      return bindless_;
+   }
+
+   inline VkDescriptorSetLayout layout() const {
+      return layout_;
+   }
+
+   // The set holding every slot of a bindless table
+   inline VkDescriptorSet set() const {
+      return set_;
+   }
+
+   // The set holding only slot `index`, for tables that aren't bindless
+   inline VkDescriptorSet slot_set(uint32_t index) const {
+      return slot_sets_[index];
+   }
+
+   inline uint32_t capacity() const {
+      return capacity_;
+   }
+
+private:
+   VkDevice device_;
+   bool bindless_;
+   VkDescriptorSetLayout layout_;
+   VkDescriptorPool pool_;
+   VkDescriptorSet set_;
+   // Slots are never freed, since images live as long as the table
+   DescriptorAllocator slot_allocator_;
+   std::vector<VkDescriptorSet> slot_sets_;
+   uint32_t capacity_;
+};
+
+} // namespace simulo
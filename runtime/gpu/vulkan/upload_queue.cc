@@ -0,0 +1,114 @@
+#include "upload_queue.h"
+
+#include <cstdint>
+
+#include <vulkan/vulkan_core.h>
+
+#include "status.h"
+
+using namespace simulo;
+
+UploadQueue::UploadQueue(VkDevice device, VkQueue queue, uint32_t queue_family, bool transfer_only)
+    : device_(device),
+      queue_(queue),
+      transfer_only_(transfer_only),
+      recording_(false),
+      next_ticket_(1),
+      retired_(0) {
+   command_pool_.init(device, queue_family);
+}
+
+UploadQueue::~UploadQueue() {
+   if (recording_) {
+      free_batches_.push_back(recording_batch_);
+   }
+
+   for (const Batch &batch : in_flight_) {
+      vkWaitForFences(device_, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+      free_batches_.push_back(batch);
+   }
+
+   for (const Batch &batch : free_batches_) {
+      vkDestroyFence(device_, batch.fence, nullptr);
+   }
+
+   command_pool_.deinit();
+}
+
+UploadQueue::Batch UploadQueue::acquire_batch() {
+   if (!free_batches_.empty()) {
+      Batch batch = free_batches_.back();
+      free_batches_.pop_back();
+      VKAD_VK(vkResetCommandBuffer(batch.command_buffer, 0));
+      VKAD_VK(vkResetFences(device_, 1, &batch.fence));
+      return batch;
+   }
+
+   Batch batch = {.command_buffer = command_pool_.allocate()};
+   VkFenceCreateInfo fence_create = {.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+   VKAD_VK(vkCreateFence(device_, &fence_create, nullptr, &batch.fence));
+   return batch;
+}
+
+VkCommandBuffer UploadQueue::commands() {
+   if (recording_) {
+      return recording_batch_.command_buffer;
+   }
+
+   recording_batch_ = acquire_batch();
+   recording_batch_.ticket = next_ticket_;
+   recording_ = true;
+
+   VkCommandBufferBeginInfo begin_info = {
+       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+       .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+   };
+   VKAD_VK(vkBeginCommandBuffer(recording_batch_.command_buffer, &begin_info));
+   return recording_batch_.command_buffer;
+}
+
+UploadTicket UploadQueue::flush() {
+   if (!recording_) {
+      return next_ticket_ - 1;
+   }
+
+   VKAD_VK(vkEndCommandBuffer(recording_batch_.command_buffer));
+
+   VkSubmitInfo submit_info = {
+       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+       .commandBufferCount = 1,
+       .pCommandBuffers = &recording_batch_.command_buffer,
+   };
+   VKAD_VK(vkQueueSubmit(queue_, 1, &submit_info, recording_batch_.fence));
+
+   in_flight_.push_back(recording_batch_);
+   recording_ = false;
+   return next_ticket_++;
+}
+
+void UploadQueue::poll() {
+   while (!in_flight_.empty()) {
+      const Batch &batch = in_flight_.front();
+      VkResult status = vkGetFenceStatus(device_, batch.fence);
+      if (status == VK_NOT_READY) {
+         break;
+      }
+      VKAD_VK(status);
+
+      retired_ = batch.ticket;
+      free_batches_.push_back(batch);
+      in_flight_.pop_front();
+   }
+}
+
+void UploadQueue::wait(UploadTicket ticket) {
+   if (recording_ && ticket >= recording_batch_.ticket) {
+      flush();
+   }
+
+   while (!is_retired(ticket) && !in_flight_.empty()) {
+      const Batch &batch = in_flight_.front();
+      VKAD_VK(vkWaitForFences(device_, 1, &batch.fence, VK_TRUE, UINT64_MAX));
+      poll();
+   }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "command_pool.h"
+
+namespace simulo {
+
+// Identifies the batch an upload was recorded into. Ticket 0 is never issued and is always retired.
+using UploadTicket = uint64_t;
+
+// Records resource uploads into one command buffer per batch and submits each batch with a fence.
+// Completion is observed by polling the fences, so nothing ever waits on the whole queue.
+class UploadQueue {
+public:
+   UploadQueue(VkDevice device, VkQueue queue, uint32_t queue_family, bool transfer_only);
+   ~UploadQueue();
+
+   UploadQueue(const UploadQueue &other) = delete;
+   UploadQueue &operator=(const UploadQueue &other) = delete;
+
+   // Command buffer of the batch being recorded. The batch is started on first use.
+   VkCommandBuffer commands();
+
+   // Ticket that uploads recorded with commands() will retire with
+   inline UploadTicket pending_ticket() const {
+      return next_ticket_;
+   }
+
+   // Submits the batch being recorded, if any, and returns the ticket of the newest submitted batch
+   UploadTicket flush();
+
+   // Recycles batches whose fences have signaled
+   void poll();
+
+   // Blocks on batch fences until the given ticket has retired
+   void wait(UploadTicket ticket);
+
+   inline bool is_retired(UploadTicket ticket) const {
+      return ticket <= retired_;
+   }
+
+   // Newest ticket whose batch has finished executing
+   inline UploadTicket retired() const {
+      return retired_;
+   }
+
+   inline bool idle() const {
+      return !recording_ && in_flight_.empty();
+   }
+
+   // Whether the queue lacks graphics support, which restricts the barriers it can record
+   inline bool transfer_only() const {
+      return transfer_only_;
+   }
+
+private:
+   struct Batch {
+      VkCommandBuffer command_buffer;
+      VkFence fence;
+      UploadTicket ticket;
+   };
+
+   Batch acquire_batch();
+
+   VkDevice device_;
+   VkQueue queue_;
+   bool transfer_only_;
+   CommandPool command_pool_;
+   std::vector<Batch> free_batches_;
+   std::deque<Batch> in_flight_;
+   Batch recording_batch_;
+   bool recording_;
+   UploadTicket next_ticket_;
+   UploadTicket retired_;
+};
+
+} // namespace simulo
@@ -0,0 +1,178 @@
+const std = @import("std");
+
+const CompressedFormat = @import("../render/renderer.zig").Renderer.CompressedFormat;
+
+const identifier = [_]u8{ 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+const header_len = 64;
+
+// glInternalFormat values of the supported compressed formats
+const gl_compressed_rgba_bptc_unorm = 0x8E8C;
+const gl_compressed_rgba8_etc2_eac = 0x9278;
+const gl_compressed_rgba_astc_4x4 = 0x93B0;
+
+// every supported format stores 4x4 texel blocks of 16 bytes
+const block_texels = 4;
+const block_bytes = 16;
+// largest side accepted, which every device that samples these formats can create an image of
+const max_dimension = 16384;
+
+pub const KtxInfo = struct {
+    format: CompressedFormat,
+    width: i32,
+    height: i32,
+    mip_levels: u32,
+    // Every level back to back with the KTX size prefixes and padding removed. Owned by the caller.
+    data: []u8,
+};
+
+// Reads a little-endian KTX 1 file holding a single 2D compressed texture and its mip levels.
+// Sizes and level counts are checked against the format here, so the renderer is only handed
+// data it can upload as is.
+pub fn loadKtx(allocator: std.mem.Allocator, file: []const u8) !KtxInfo {
+    if (file.len < header_len or !std.mem.eql(u8, file[0..identifier.len], &identifier)) {
+        return error.NotKtx;
+    }
+
+    const endianness = readU32(file, 12);
+    if (endianness != 0x04030201) {
+        return error.UnsupportedEndianness;
+    }
+
+    const format: CompressedFormat = switch (readU32(file, 28)) {
+        gl_compressed_rgba_bptc_unorm => .bc7,
+        gl_compressed_rgba8_etc2_eac => .etc2_rgba8,
+        gl_compressed_rgba_astc_4x4 => .astc_4x4,
+        else => return error.UnsupportedFormat,
+    };
+
+    const width = readU32(file, 36);
+    const height = readU32(file, 40);
+    const depth = readU32(file, 44);
+    const array_elements = readU32(file, 48);
+    const faces = readU32(file, 52);
+    const mip_levels = @max(1, readU32(file, 56));
+    if (width == 0 or height == 0 or depth > 1 or array_elements > 0 or faces != 1) {
+        return error.UnsupportedLayout;
+    }
+    if (width > max_dimension or height > max_dimension) {
+        return error.TooLarge;
+    }
+    if (mip_levels > @as(u32, std.math.log2_int(u32, @max(width, height))) + 1) {
+        return error.TooManyMipLevels;
+    }
+
+    var offset: usize = header_len + readU32(file, 60);
+    var data = try std.ArrayList(u8).initCapacity(allocator, file.len -| offset);
+    errdefer data.deinit(allocator);
+
+    for (0..mip_levels) |level| {
+        if (offset + 4 > file.len) {
+            return error.Truncated;
+        }
+        const image_size = readU32(file, offset);
+        offset += 4;
+        if (image_size != levelSize(width, height, @intCast(level))) {
+            return error.WrongLevelSize;
+        }
+        if (offset + image_size > file.len) {
+            return error.Truncated;
+        }
+
+        try data.appendSlice(allocator, file[offset..][0..image_size]);
+        offset = std.mem.alignForward(usize, offset + image_size, 4);
+    }
+
+    return .{
+        .format = format,
+        .width = @intCast(width),
+        .height = @intCast(height),
+        .mip_levels = mip_levels,
+        .data = try data.toOwnedSlice(allocator),
+    };
+}
+
+fn levelSize(width: u32, height: u32, level: u5) usize {
+    const level_width = @max(1, width >> level);
+    const level_height = @max(1, height >> level);
+    const blocks_x = std.math.divCeil(usize, level_width, block_texels) catch unreachable;
+    const blocks_y = std.math.divCeil(usize, level_height, block_texels) catch unreachable;
+    return blocks_x * blocks_y * block_bytes;
+}
+
+fn readU32(bytes: []const u8, offset: usize) u32 {
+    return std.mem.readInt(u32, bytes[offset..][0..4], .little);
+}
+
+const testing = std.testing;
+
+// builds a bc7 KTX file with the given level sizes, each level filled with its index
+fn testFile(width: u32, height: u32, level_sizes: []const u32) ![]u8 {
+    var file: std.ArrayList(u8) = .empty;
+    errdefer file.deinit(testing.allocator);
+
+    var header = [_]u8{0} ** header_len;
+    @memcpy(header[0..identifier.len], &identifier);
+    const fields = [_]struct { usize, u32 }{
+        .{ 12, 0x04030201 },
+        .{ 28, gl_compressed_rgba_bptc_unorm },
+        .{ 36, width },
+        .{ 40, height },
+        .{ 52, 1 },
+        .{ 56, @intCast(level_sizes.len) },
+    };
+    for (fields) |field| {
+        std.mem.writeInt(u32, header[field[0]..][0..4], field[1], .little);
+    }
+    try file.appendSlice(testing.allocator, &header);
+
+    for (level_sizes, 0..) |size, level| {
+        var prefix: [4]u8 = undefined;
+        std.mem.writeInt(u32, &prefix, size, .little);
+        try file.appendSlice(testing.allocator, &prefix);
+        try file.appendNTimes(testing.allocator, @intCast(level), std.mem.alignForward(u32, size, 4));
+    }
+    return file.toOwnedSlice(testing.allocator);
+}
+
+test "Loads every mip level" {
+    // 8x8, 4x4, 2x2 and 1x1, the last two padded to a whole block
+    const file = try testFile(8, 8, &.{ 64, 16, 16, 16 });
+    defer testing.allocator.free(file);
+
+    const ktx = try loadKtx(testing.allocator, file);
+    defer testing.allocator.free(ktx.data);
+    try testing.expectEqual(CompressedFormat.bc7, ktx.format);
+    try testing.expectEqual(@as(i32, 8), ktx.width);
+    try testing.expectEqual(@as(u32, 4), ktx.mip_levels);
+    try testing.expectEqual(@as(usize, 112), ktx.data.len);
+    try testing.expectEqual(@as(u8, 0), ktx.data[63]);
+    try testing.expectEqual(@as(u8, 1), ktx.data[64]);
+    try testing.expectEqual(@as(u8, 3), ktx.data[111]);
+}
+
+test "Rejects a truncated file" {
+    const file = try testFile(8, 8, &.{ 64, 16 });
+    defer testing.allocator.free(file);
+
+    try testing.expectError(error.Truncated, loadKtx(testing.allocator, file[0 .. file.len - 1]));
+    try testing.expectError(error.NotKtx, loadKtx(testing.allocator, file[0 .. header_len - 1]));
+}
+
+test "Rejects levels of the wrong size" {
+    // the total matches two correct levels, but each level alone doesn't
+    const shifted = try testFile(8, 8, &.{ 48, 32 });
+    defer testing.allocator.free(shifted);
+    try testing.expectError(error.WrongLevelSize, loadKtx(testing.allocator, shifted));
+
+    const too_many = try testFile(4, 4, &.{ 16, 16, 16, 16 });
+    defer testing.allocator.free(too_many);
+    try testing.expectError(error.TooManyMipLevels, loadKtx(testing.allocator, too_many));
+}
+
+test "Rejects a bad identifier" {
+    const file = try testFile(4, 4, &.{16});
+    defer testing.allocator.free(file);
+
+    file[5] = '2';
+    try testing.expectError(error.NotKtx, loadKtx(testing.allocator, file));
+}
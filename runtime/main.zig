@@ -74,15 +74,23 @@ pub fn main() !void {
 const vulkan = builtin.target.os.tag == .windows or builtin.target.os.tag == .linux;
 const text_vert = if (vulkan) @embedFile("shader/text.vert.spv") else &[_]u8{0};
 const text_frag = if (vulkan) @embedFile("shader/text.frag.spv") else &[_]u8{0};
+const text_slot_frag = if (vulkan) @embedFile("shader/text_slot.frag.spv") else &[_]u8{0};
 const model_vert = if (vulkan) @embedFile("shader/model.vert.spv") else &[_]u8{0};
 const model_frag = if (vulkan) @embedFile("shader/model.frag.spv") else &[_]u8{0};
+const cull_comp = if (vulkan) @embedFile("shader/cull.comp.spv") else &[_]u8{0};
 const arial = @embedFile("res/arial.ttf");
 
 test {
     comptime {
         _ = ini;
+        _ = @import("image/ktx.zig");
         _ = @import("io/event_loop.zig");
         _ = @import("log.zig");
+        _ = @import("render/atlas.zig");
+        _ = @import("render/capture_stream.zig");
+        _ = @import("render/latency_histogram.zig");
+        _ = @import("render/renderer.zig");
+        _ = @import("render/render_scale.zig");
     }
 }
 
@@ -102,6 +110,14 @@ pub export fn text_fragment_len() usize {
     return text_frag.len;
 }
 
+pub export fn text_slot_fragment_bytes() *const u8 {
+    return &text_slot_frag[0];
+}
+
+pub export fn text_slot_fragment_len() usize {
+    return text_slot_frag.len;
+}
+
 pub export fn model_vertex_bytes() *const u8 {
     return &model_vert[0];
 }
@@ -118,6 +134,14 @@ pub export fn model_fragment_len() usize {
     return model_frag.len;
 }
 
+pub export fn cull_compute_bytes() *const u8 {
+    return &cull_comp[0];
+}
+
+pub export fn cull_compute_len() usize {
+    return cull_comp.len;
+}
+
 pub export fn arial_bytes() *const u8 {
     return &arial[0];
 }
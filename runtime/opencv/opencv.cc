@@ -114,6 +114,27 @@ CvStatus mat_decode(CvMat *dst, const unsigned char *data, int data_len, CvImrea
    return StatOk;
 }
 
+CvStatus mat_encode_jpeg(
+    const CvMat *in, int quality, unsigned char *out, size_t capacity, size_t *out_len
+) {
+   try {
+      std::vector<unsigned char> encoded;
+      cv::imencode(".jpg", *in, encoded, {cv::IMWRITE_JPEG_QUALITY, quality});
+      *out_len = encoded.size();
+      if (encoded.size() > capacity) {
+         return StatOutOfRange;
+      }
+      std::memcpy(out, encoded.data(), encoded.size());
+   } catch (const cv::Exception &e) {
+      return static_cast<CvStatus>(e.code);
+   } catch (const std::exception &e) {
+      return StatStdException;
+   } catch (...) {
+      return StatUnknownException;
+   }
+   return StatOk;
+}
+
 CvStatus mat_flip(CvMat *out, const CvMat *in, int flip_code) {
    try {
       cv::Mat *in_mat = reinterpret_cast<cv::Mat *>(const_cast<CvMat *>(in));
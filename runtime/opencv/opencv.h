@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 
@@ -385,6 +386,11 @@ CvStatus mat_copy(CvMat *out, const CvMat *in);
 CvStatus mat_sub(CvMat *out, CvMat *in1, CvMat *in2);
 
 CvStatus mat_decode(CvMat *dst, const unsigned char *data, int data_len, CvImreadFlags flags);
+// Encodes a BGR or grayscale mat as a JPEG into out, setting out_len to its size. Fails with
+// StatOutOfRange, leaving out untouched, if the image doesn't fit in capacity bytes.
+CvStatus mat_encode_jpeg(
+    const CvMat *in, int quality, unsigned char *out, size_t capacity, size_t *out_len
+);
 
 CvStatus mat_flip(CvMat *out, const CvMat *in, int flip_code);
 
@@ -21,6 +21,16 @@ pub const Mat = struct {
         };
     }
 
+    // a mat over pixels that stay owned by the caller, and must outlive it
+    pub fn wrap(pixels: [*]u8, rows: i32, cols: i32, mat_type: c.CvMatType) !Mat {
+        var mat: ?*opencv.CvMat = null;
+        const status = opencv.mat_wrap(&mat, pixels, rows, cols, mat_type);
+        try tryStatus(status);
+        return Mat{
+            .mat = mat.?,
+        };
+    }
+
     pub fn deinit(self: *Mat) void {
         const status = opencv.mat_release(self.mat);
         tryStatus(status) catch |err| {
@@ -56,10 +66,14 @@ pub const Mat = struct {
         try tryStatus(status);
     }
 
-    //pub fn wrap(self: *Mat, data: [*]u8, rows: i32, cols: i32, mat_type: opencv.CvMatType) !void {
-    //    const status = opencv.mat_wrap(self.mat, data, rows, cols, mat_type);
-    //    try tryStatus(status);
-    //}
+    // encodes the mat, which must be BGR or grayscale, into out and returns the part written.
+    // fails with CvOutOfRange if out is too small.
+    pub fn encodeJpeg(self: *Mat, quality: i32, out: []u8) ![]u8 {
+        var len: usize = 0;
+        const status = opencv.mat_encode_jpeg(self.mat, quality, out.ptr, out.len, &len);
+        try tryStatus(status);
+        return out[0..len];
+    }
 
     pub fn findChessboardTransform(
         self: *Mat,
@@ -0,0 +1,169 @@
+const std = @import("std");
+
+// Packs small RGBA8 images into shared pages so sprites drawn with the same page share one
+// material pass and one draw. Images are placed on shelves, rows as tall as the first image put on
+// them, which packs well when images are added from tallest to shortest.
+pub const AtlasBuilder = struct {
+    allocator: std.mem.Allocator,
+    pages: std.ArrayList(Page),
+
+    pub const page_size = 2048;
+    // larger images are cheap enough to draw on their own and would waste most of a page
+    pub const max_image_size = 256;
+    // border around each image filled with copies of its edge texels, so linear filtering and the
+    // first couple of mip levels don't blend in neighbouring images
+    pub const padding = 4;
+    // pages only get the mip levels their padding covers. each level halves the border, so at
+    // level log2(padding) it's a single texel, and any further level would blend images together.
+    pub const mip_levels = std.math.log2_int(u32, padding) + 1;
+
+    pub const Page = struct {
+        pixels: []u8,
+        shelf_y: u32 = 0,
+        shelf_height: u32 = 0,
+        cursor_x: u32 = 0,
+    };
+
+    pub const Placement = struct {
+        page: u32,
+        // u, v of the image's top-left corner followed by its width and height in uv units
+        uv_rect: [4]f32,
+    };
+
+    pub fn init(allocator: std.mem.Allocator) AtlasBuilder {
+        return .{ .allocator = allocator, .pages = .empty };
+    }
+
+    pub fn deinit(self: *AtlasBuilder) void {
+        for (self.pages.items) |page| {
+            self.allocator.free(page.pixels);
+        }
+        self.pages.deinit(self.allocator);
+    }
+
+    pub fn fits(width: i32, height: i32) bool {
+        return width > 0 and height > 0 and width <= max_image_size and height <= max_image_size;
+    }
+
+    // copies the image into the first page with room for it, starting a new page if none has
+    pub fn add(self: *AtlasBuilder, data: []const u8, width: i32, height: i32) error{OutOfMemory}!Placement {
+        std.debug.assert(fits(width, height));
+        const w: u32 = @intCast(width);
+        const h: u32 = @intCast(height);
+        const padded_w = w + padding * 2;
+        const padded_h = h + padding * 2;
+
+        for (self.pages.items, 0..) |*page, i| {
+            if (reserve(page, padded_w, padded_h)) |origin| {
+                return place(page, @intCast(i), origin, data, w, h);
+            }
+        }
+
+        const pixels = try self.allocator.alloc(u8, page_size * page_size * 4);
+        errdefer self.allocator.free(pixels);
+        @memset(pixels, 0);
+
+        const page = try self.pages.addOne(self.allocator);
+        page.* = .{ .pixels = pixels };
+        const origin = reserve(page, padded_w, padded_h).?;
+        return place(page, @intCast(self.pages.items.len - 1), origin, data, w, h);
+    }
+
+    // returns the top-left corner of a padded_w x padded_h area on the page, opening a new shelf
+    // below the current one when the image doesn't fit next to the images already on it
+    fn reserve(page: *Page, padded_w: u32, padded_h: u32) ?[2]u32 {
+        const fits_shelf = page.cursor_x + padded_w <= page_size and padded_h <= page.shelf_height;
+        if (!fits_shelf) {
+            // a shelf with nothing on it yet can still grow to the image's height
+            const shelf_y = if (page.cursor_x == 0) page.shelf_y else page.shelf_y + page.shelf_height;
+            if (shelf_y + padded_h > page_size) return null;
+
+            page.shelf_y = shelf_y;
+            page.shelf_height = padded_h;
+            page.cursor_x = 0;
+        }
+
+        const origin = [2]u32{ page.cursor_x, page.shelf_y };
+        page.cursor_x += padded_w;
+        return origin;
+    }
+
+    fn place(page: *Page, page_index: u32, origin: [2]u32, data: []const u8, w: u32, h: u32) Placement {
+        const x0 = origin[0] + padding;
+        const y0 = origin[1] + padding;
+
+        // every padded texel takes the value of the nearest texel of the image
+        var y: u32 = 0;
+        while (y < h + padding * 2) : (y += 1) {
+            const src_y = @min(h - 1, y -| padding);
+            var x: u32 = 0;
+            while (x < w + padding * 2) : (x += 1) {
+                const src_x = @min(w - 1, x -| padding);
+                const src = (src_y * w + src_x) * 4;
+                const dst = ((origin[1] + y) * page_size + origin[0] + x) * 4;
+                @memcpy(page.pixels[dst..][0..4], data[src..][0..4]);
+            }
+        }
+
+        const size: f32 = @floatFromInt(page_size);
+        return .{
+            .page = page_index,
+            .uv_rect = .{
+                @as(f32, @floatFromInt(x0)) / size,
+                @as(f32, @floatFromInt(y0)) / size,
+                @as(f32, @floatFromInt(w)) / size,
+                @as(f32, @floatFromInt(h)) / size,
+            },
+        };
+    }
+};
+
+const testing = std.testing;
+
+test "Places images side by side on a shelf" {
+    var atlas = AtlasBuilder.init(testing.allocator);
+    defer atlas.deinit();
+
+    const pixels = [_]u8{0xFF} ** (16 * 16 * 4);
+    const first = try atlas.add(&pixels, 16, 16);
+    const second = try atlas.add(&pixels, 16, 16);
+
+    try testing.expectEqual(@as(u32, 0), first.page);
+    try testing.expectEqual(@as(u32, 0), second.page);
+    try testing.expectEqual(first.uv_rect[1], second.uv_rect[1]);
+    try testing.expect(second.uv_rect[0] > first.uv_rect[0] + first.uv_rect[2]);
+}
+
+test "Extrudes edge texels into the padding" {
+    var atlas = AtlasBuilder.init(testing.allocator);
+    defer atlas.deinit();
+
+    const pixels = [_]u8{ 1, 2, 3, 4, 5, 6, 7, 8 };
+    _ = try atlas.add(&pixels, 2, 1);
+
+    const page = atlas.pages.items[0].pixels;
+    // top-left corner of the padding repeats the first texel, bottom-right repeats the last
+    try testing.expectEqualSlices(u8, &.{ 1, 2, 3, 4 }, page[0..4]);
+    const last_row = AtlasBuilder.padding * 2;
+    const last_col = 1 + AtlasBuilder.padding * 2;
+    const last = (last_row * AtlasBuilder.page_size + last_col) * 4;
+    try testing.expectEqualSlices(u8, &.{ 5, 6, 7, 8 }, page[last..][0..4]);
+}
+
+test "Starts a new page when one is full" {
+    var atlas = AtlasBuilder.init(testing.allocator);
+    defer atlas.deinit();
+
+    const side = AtlasBuilder.max_image_size;
+    const pixels = try testing.allocator.alloc(u8, side * side * 4);
+    defer testing.allocator.free(pixels);
+    @memset(pixels, 0);
+
+    const per_row = AtlasBuilder.page_size / (side + AtlasBuilder.padding * 2);
+    const per_page = per_row * per_row;
+    var last_page: u32 = 0;
+    for (0..per_page + 1) |_| {
+        last_page = (try atlas.add(pixels, side, side)).page;
+    }
+    try testing.expectEqual(@as(u32, 1), last_page);
+}
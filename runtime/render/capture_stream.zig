@@ -0,0 +1,203 @@
+const std = @import("std");
+
+const opencv = @import("../opencv/opencv.zig");
+const Mat = opencv.Mat;
+const Logger = @import("../log.zig").Logger;
+
+// frames captured from a display, jpeg-encoded on a worker thread of their own so the render loop
+// never waits on the encoder. only the latest frame matters: one arriving while another is being
+// encoded replaces whichever was waiting, and each encoded frame replaces the one before.
+pub const CaptureStream = struct {
+    allocator: std.mem.Allocator,
+    width: u32,
+    height: u32,
+    quality: u8,
+    worker: std.Thread,
+    logger: Logger("capture", 512),
+    // the three frame-sized buffers below and the two jpeg buffers, each swapped only with
+    // buffers of its own kind
+    buffers: []u8,
+    // the caller reads the next frame into this before submitting it. not guarded by lock, since the
+    // worker never touches it.
+    pixels: []u8,
+
+    // everything below is guarded by lock. ready is signaled when a raw frame is waiting or the
+    // stream is stopping.
+    lock: std.Thread.Mutex = .{},
+    ready: std.Thread.Condition = .{},
+    running: bool = true,
+    // RGBA8 pixels of the newest frame submitted, with its frame number while it's waiting
+    raw: []u8,
+    raw_frame: ?u64 = null,
+    // the frame being encoded, only touched by the worker
+    encoding: []u8,
+    encoded: []u8,
+    // latest encoded frame, swapped with encoded once the next one is done
+    jpeg: []u8,
+    jpeg_len: usize = 0,
+    jpeg_frame: ?u64 = null,
+
+    pub fn init(allocator: std.mem.Allocator, width: u32, height: u32, quality: u8) !*CaptureStream {
+        const frame_size = @as(usize, width) * height * 4;
+        const self = try allocator.create(CaptureStream);
+        errdefer allocator.destroy(self);
+
+        // small or noisy frames can encode larger than their raw pixels, since headers and
+        // quantization tables take the same room whatever the size. the slack covers them, and a
+        // frame that still doesn't fit fails to encode and is logged.
+        const jpeg_size = frame_size + 64 * 1024;
+        const buffers = try allocator.alloc(u8, frame_size * 3 + jpeg_size * 2);
+        errdefer allocator.free(buffers);
+
+        self.* = .{
+            .allocator = allocator,
+            .width = width,
+            .height = height,
+            .quality = quality,
+            .worker = undefined,
+            .logger = Logger("capture", 512).init(),
+            .buffers = buffers,
+            .pixels = buffers[frame_size * 2 ..][0..frame_size],
+            .raw = buffers[0..frame_size],
+            .encoding = buffers[frame_size..][0..frame_size],
+            .encoded = buffers[frame_size * 3 ..][0..jpeg_size],
+            .jpeg = buffers[frame_size * 3 + jpeg_size ..][0..jpeg_size],
+        };
+        self.worker = try std.Thread.spawn(.{}, encodeLoop, .{self});
+        return self;
+    }
+
+    pub fn deinit(self: *CaptureStream) void {
+        {
+            self.lock.lock();
+            defer self.lock.unlock();
+            self.running = false;
+            self.ready.signal();
+        }
+        self.worker.join();
+        self.allocator.free(self.buffers);
+        self.allocator.destroy(self);
+    }
+
+    // hands over the frame read into pixels, which is encoded before long, and leaves pixels
+    // pointing at a buffer to read the next frame into
+    pub fn submit(self: *CaptureStream, frame_number: u64) void {
+        self.lock.lock();
+        defer self.lock.unlock();
+        std.mem.swap([]u8, &self.pixels, &self.raw);
+        self.raw_frame = frame_number;
+        self.ready.signal();
+    }
+
+    // copies the latest encoded frame into out and returns its frame number, or null if no frame
+    // has been encoded yet
+    pub fn latest(self: *CaptureStream, allocator: std.mem.Allocator, out: *std.ArrayList(u8)) error{OutOfMemory}!?u64 {
+        self.lock.lock();
+        defer self.lock.unlock();
+        const frame_number = self.jpeg_frame orelse return null;
+        out.clearRetainingCapacity();
+        try out.appendSlice(allocator, self.jpeg[0..self.jpeg_len]);
+        return frame_number;
+    }
+
+    fn encodeLoop(self: *CaptureStream) void {
+        self.lock.lock();
+        defer self.lock.unlock();
+        while (self.running) {
+            const frame_number = self.raw_frame orelse {
+                self.ready.wait(&self.lock);
+                continue;
+            };
+            self.raw_frame = null;
+            std.mem.swap([]u8, &self.raw, &self.encoding);
+
+            self.lock.unlock();
+            const result = self.encode();
+            self.lock.lock();
+
+            const jpeg = result catch |err| {
+                self.logger.err("failed to encode frame {d}: {s}", .{ frame_number, @errorName(err) });
+                continue;
+            };
+            self.jpeg_len = jpeg.len;
+            self.jpeg_frame = frame_number;
+            std.mem.swap([]u8, &self.jpeg, &self.encoded);
+        }
+    }
+
+    fn encode(self: *CaptureStream) ![]u8 {
+        const rows: i32 = @intCast(self.height);
+        const cols: i32 = @intCast(self.width);
+
+        var rgba = try Mat.wrap(self.encoding.ptr, rows, cols, opencv.c.Type8UC4);
+        defer rgba.deinit();
+        var bgr = try Mat.init(rows, cols, opencv.c.Type8UC3);
+        defer bgr.deinit();
+        try rgba.convert(opencv.c.ConvertRGBA2BGR, &bgr);
+        return bgr.encodeJpeg(self.quality, self.encoded);
+    }
+};
+
+const testing = std.testing;
+
+test "Drops frames the encoder hasn't reached" {
+    const stream = try CaptureStream.init(testing.allocator, 64, 36, 80);
+    defer stream.deinit();
+
+    const frames = 1000;
+    const first = @intFromPtr(stream.buffers.ptr);
+    for (0..frames) |frame_number| {
+        @memset(stream.pixels, @truncate(frame_number));
+        stream.submit(frame_number);
+
+        // however far behind the encoder is, frames are read into the same few buffers
+        const pixels = @intFromPtr(stream.pixels.ptr);
+        try testing.expect(pixels >= first and pixels + stream.pixels.len <= first + stream.buffers.len);
+    }
+
+    {
+        stream.lock.lock();
+        defer stream.lock.unlock();
+        if (stream.raw_frame) |waiting| try testing.expectEqual(@as(u64, frames - 1), waiting);
+    }
+
+    // the newest frame is encoded in the end, whichever ones before it were skipped
+    var jpeg: std.ArrayList(u8) = .empty;
+    defer jpeg.deinit(testing.allocator);
+    var timer = try std.time.Timer.start();
+    while (true) {
+        if (try stream.latest(testing.allocator, &jpeg)) |frame_number| {
+            if (frame_number == frames - 1) break;
+        }
+        if (timer.read() > 10 * std.time.ns_per_s) return error.Timeout;
+        std.Thread.sleep(std.time.ns_per_ms);
+    }
+    try testing.expect(std.mem.startsWith(u8, jpeg.items, &.{ 0xff, 0xd8 }));
+}
+
+test "Encodes frames smaller than their jpeg" {
+    // a 2x2 frame is 16 bytes, far less than the headers of any jpeg
+    const stream = try CaptureStream.init(testing.allocator, 2, 2, 80);
+    defer stream.deinit();
+    @memset(stream.pixels, 0x80);
+    stream.submit(0);
+
+    var jpeg: std.ArrayList(u8) = .empty;
+    defer jpeg.deinit(testing.allocator);
+    var timer = try std.time.Timer.start();
+    while (try stream.latest(testing.allocator, &jpeg) == null) {
+        if (timer.read() > 10 * std.time.ns_per_s) return error.Timeout;
+        std.Thread.sleep(std.time.ns_per_ms);
+    }
+    try testing.expect(jpeg.items.len > stream.pixels.len);
+}
+
+test "Stops with frames still waiting to be encoded" {
+    const stream = try CaptureStream.init(testing.allocator, 640, 360, 80);
+    for (0..8) |frame_number| {
+        @memset(stream.pixels, @truncate(frame_number));
+        stream.submit(frame_number);
+    }
+    // joins the worker mid-encode or with a frame waiting, and frees every buffer either way
+    stream.deinit();
+}
@@ -0,0 +1,36 @@
+const std = @import("std");
+
+// returns the bucket that the given fraction of all samples fall at or below, such as 0.95 for the
+// 95th percentile, or null if the histogram is empty
+pub fn percentile(buckets: []const u32, fraction: f32) ?usize {
+    var total: u64 = 0;
+    for (buckets) |count| total += count;
+    if (total == 0) return null;
+
+    const target: u64 = @max(1, @as(u64, @intFromFloat(@ceil(@as(f64, @floatFromInt(total)) * fraction))));
+    var seen: u64 = 0;
+    for (buckets, 0..) |count, i| {
+        seen += count;
+        if (seen >= target) return i;
+    }
+    return buckets.len - 1;
+}
+
+const testing = std.testing;
+
+test "Empty histogram has no percentiles" {
+    const buckets = [_]u32{0} ** 8;
+    try testing.expectEqual(@as(?usize, null), percentile(&buckets, 0.5));
+}
+
+test "Finds the bucket holding each percentile" {
+    var buckets = [_]u32{0} ** 8;
+    buckets[2] = 90;
+    buckets[5] = 9;
+    buckets[7] = 1;
+
+    try testing.expectEqual(@as(?usize, 2), percentile(&buckets, 0.5));
+    try testing.expectEqual(@as(?usize, 2), percentile(&buckets, 0.9));
+    try testing.expectEqual(@as(?usize, 5), percentile(&buckets, 0.95));
+    try testing.expectEqual(@as(?usize, 7), percentile(&buckets, 1.0));
+}
@@ -65,6 +65,29 @@ struct MaterialPipeline {
    Pipeline pipeline;
 };
 
+// Metal renderers don't share devices or resources and present as soon as they end a frame, so the
+// context only carries the Gpu they are created on
+class RenderContext {
+public:
+   explicit RenderContext(Gpu &gpu) : gpu_(gpu) {}
+
+   inline Gpu &gpu() {
+      return gpu_;
+   }
+
+private:
+   Gpu &gpu_;
+};
+
+class Renderer;
+
+// Metal layers all encode into the renderer's single render encoder, so they are recorded one
+// after another and the recorder only carries the renderer
+class LayerRecorder {
+public:
+   Renderer *renderer;
+};
+
 class Renderer {
 public:
    Renderer(Gpu &gpu, void *pipeline_pixel_format, void *metal_layer);
@@ -81,11 +104,24 @@ public:
       return do_create_material(pipeline_id, &data, sizeof(data), image);
    }
 
-   RenderImage create_image(std::span<uint8_t> img_data, int width, int height) {
-      int id = images_.emplace(gpu_, img_data, width, height);
+   RenderImage
+   create_image(std::span<uint8_t> img_data, int width, int height, uint32_t max_mip_levels) {
+      int id = images_.emplace(gpu_, command_queue_, img_data, width, height, max_mip_levels);
+      return static_cast<RenderImage>(id);
+   }
+
+   RenderImage create_compressed_image(
+       std::span<const uint8_t> data, CompressedFormat format, int width, int height,
+       uint32_t mip_levels
+   ) {
+      int id = images_.emplace(gpu_, format, data, width, height, mip_levels);
       return static_cast<RenderImage>(id);
    }
 
+   bool supports_compressed_format(CompressedFormat format) const {
+      return Image::supports_compressed_format(gpu_, format);
+   }
+
    bool render(Mat4 ui_view_projection, Mat4 world_view_projection);
 
    void recreate_swapchain() const {}
@@ -108,6 +144,11 @@ public:
    _Nullable id<CAMetalDrawable> drawable_ = nil;
    _Nullable id<MTLCommandBuffer> cmd_buf_ = nil;
    _Nullable id<MTLRenderCommandEncoder> render_encoder_ = nil;
+   // Object ids of the frame being encoded. end_render waits for the GPU, so it is reused from
+   // the start every frame.
+   _Nullable id<MTLBuffer> instance_buffer_ = nil;
+   // InstanceData indexed by object id. There is only one frame slot since end_render waits.
+   _Nullable id<MTLBuffer> object_buffer_ = nil;
 #else
    void *metal_layer_;
    void *depth_stencil_state_;
@@ -116,11 +157,17 @@ public:
    void *drawable_;
    void *cmd_buf_;
    void *render_encoder_;
+   void *instance_buffer_;
+   void *object_buffer_;
 #endif
+   size_t instance_capacity_ = 0;
+   size_t instance_count_ = 0;
+   size_t object_capacity_ = 0;
 
    std::vector<MaterialPipeline> render_pipelines_;
    Slab<Image> images_;
    Mesh *last_binded_mesh_;
+   LayerRecorder layer_recorder_;
    Pipelines pipelines_;
    CommandQueue command_queue_;
 };
@@ -2,6 +2,7 @@
 #include "model.h"
 
 #include <Foundation/Foundation.h>
+#include <algorithm>
 #include <format>
 #include <ranges>
 #include <stdexcept>
@@ -22,7 +23,13 @@
 
 using namespace simulo;
 
-namespace {} // namespace
+namespace {
+
+size_t index_type_size(IndexType type) {
+   return type == INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
+} // namespace
 
 Renderer::Renderer(Gpu &gpu, void *pipeline_pixel_format, void *metal_layer)
     : gpu_(gpu),
@@ -53,7 +60,10 @@ Renderer::Renderer(Gpu &gpu, void *pipeline_pixel_format, void *metal_layer)
    }
 }
 
-Renderer::~Renderer() {}
+Renderer::~Renderer() {
+   [instance_buffer_ release];
+   [object_buffer_ release];
+}
 
 Material
 Renderer::do_create_material(RenderPipeline pipeline_id, void *data, size_t size, int image) {
@@ -75,25 +85,50 @@ Material create_ui_material(Renderer *renderer, uint32_t image) {
 }
 
 Mesh create_mesh(
-    Renderer *renderer, uint8_t *vertex_data, size_t vertex_data_size, IndexBufferType *index_data,
-    size_t index_count
+    Renderer *renderer, const uint8_t *vertex_data, size_t vertex_data_size, uint32_t vertex_size,
+    const void *index_data, size_t index_count, IndexType index_type
 ) {
-   size_t indices_start = align_to(vertex_data_size, (size_t)4);
-   size_t indices_size = index_count * sizeof(IndexBufferType);
+   Mesh mesh = create_empty_mesh(renderer, vertex_data_size, vertex_size, index_count, index_type);
+   write_mesh_vertices(renderer, &mesh, 0, vertex_data, vertex_data_size);
+   write_mesh_indices(renderer, &mesh, 0, index_data, index_count);
+   return mesh;
+}
 
-   std::vector<uint8_t> data(indices_start + indices_size);
-   memcpy(data.data(), vertex_data, vertex_data_size);
-   memcpy(data.data() + indices_start, index_data, indices_size);
+// Each Metal mesh still has a buffer of its own, so the vertex stride isn't needed. The buffer is
+// shared with the CPU, so writes land in it directly.
+Mesh create_empty_mesh(
+    Renderer *renderer, size_t vertex_data_size, uint32_t vertex_size, size_t index_count,
+    IndexType index_type
+) {
+   size_t indices_start = align_to(vertex_data_size, (size_t)4);
+   size_t indices_size = index_count * index_type_size(index_type);
 
    return Mesh{
-       .buffer = [renderer->gpu_.device() newBufferWithBytes:data.data()
-                                                      length:data.size()
-                                                     options:MTLResourceStorageModeShared],
+       .buffer = [renderer->gpu_.device() newBufferWithLength:indices_start + indices_size
+                                                      options:MTLResourceStorageModeShared],
        .indices_start = indices_start,
-       .num_indices = static_cast<IndexBufferType>(index_count),
+       .num_indices = static_cast<uint32_t>(index_count),
+       .index_type = index_type,
    };
 }
 
+void write_mesh_vertices(
+    Renderer *renderer, Mesh *mesh, size_t offset, const uint8_t *vertex_data, size_t size
+) {
+   memcpy(reinterpret_cast<uint8_t *>([mesh->buffer contents]) + offset, vertex_data, size);
+}
+
+void write_mesh_indices(
+    Renderer *renderer, Mesh *mesh, size_t first_index, const void *index_data, size_t count
+) {
+   size_t index_size = index_type_size(mesh->index_type);
+   memcpy(
+       reinterpret_cast<uint8_t *>([mesh->buffer contents]) + mesh->indices_start +
+           first_index * index_size,
+       index_data, count * index_size
+   );
+}
+
 void delete_mesh(Renderer *renderer, Mesh *mesh) {
    [mesh->buffer release];
 }
@@ -102,8 +137,28 @@ void delete_material(Renderer *renderer, Material *material) {
    [material->uniform_buffer release];
 }
 
+// Metal buffers and textures are created with their contents, so they are usable immediately
+bool mesh_ready(Renderer *renderer, const Mesh *mesh) {
+   return true;
+}
+
+bool material_ready(Renderer *renderer, const Material *material) {
+   return true;
+}
+
+// Each material's texture is bound by set_material
+bool bindless_textures(Renderer *renderer) {
+   return false;
+}
+
+// nextDrawable is left to begin_render, since Metal renderers draw on the thread that polls
+bool acquire_frame(Renderer *renderer) {
+   return true;
+}
+
 bool begin_render(Renderer *renderer) {
    renderer->render_pool_ = [[NSAutoreleasePool alloc] init];
+   renderer->instance_count_ = 0;
 
    renderer->drawable_ = [renderer->metal_layer_ nextDrawable];
 
@@ -133,13 +188,30 @@ void end_render(Renderer *renderer) {
    [renderer->render_pool_ drain];
 }
 
-void set_pipeline(Renderer *renderer, uint32_t pipeline_id_unused) {
+// Instances aren't culled on Metal and the instance buffer grows as draws are encoded, so there is
+// nothing to reserve up front
+void reserve_frame(Renderer *renderer, uint32_t instance_count, uint32_t draw_count) {}
+
+// GPU timestamps aren't collected on Metal, so layers are left untimed. Every draw is direct, so
+// the reserved instance and draw counts aren't needed.
+LayerRecorder *
+begin_layer(Renderer *renderer, uint32_t layer, uint32_t instance_count, uint32_t draw_count) {
+   renderer->layer_recorder_.renderer = renderer;
+   return &renderer->layer_recorder_;
+}
+
+void end_layer(LayerRecorder *recorder) {}
+
+// Metal renderers have no depth buffer, so both blend modes draw with the blended pipeline
+void set_pipeline(LayerRecorder *recorder, uint32_t pipeline_id_unused, BlendMode blend_mode) {
+   Renderer *renderer = recorder->renderer;
    auto pipeline_id = renderer->pipelines_.ui; // TODO
    const MaterialPipeline &mat_pipeline = renderer->render_pipelines_[pipeline_id];
    [renderer->render_encoder_ setRenderPipelineState:mat_pipeline.pipeline.pipeline_state()];
 }
 
-void set_material(Renderer *renderer, Material *material) {
+void set_material(LayerRecorder *recorder, Material *material) {
+   Renderer *renderer = recorder->renderer;
    [renderer->render_encoder_ setFragmentBuffer:material->uniform_buffer offset:0 atIndex:0];
 
    if (material->image != -1) {
@@ -148,23 +220,88 @@ void set_material(Renderer *renderer, Material *material) {
    }
 }
 
-void set_mesh(Renderer *renderer, Mesh *mesh) {
+void set_mesh(LayerRecorder *recorder, Mesh *mesh) {
+   Renderer *renderer = recorder->renderer;
    renderer->last_binded_mesh_ = mesh;
    [renderer->render_encoder_ setVertexBuffer:mesh->buffer offset:0 atIndex:0];
 }
 
-void render_object(Renderer *renderer, const PushConstants *push_constants) {
-   [renderer->render_encoder_ setVertexBytes:reinterpret_cast<const void *>(push_constants)
-                                      length:sizeof(PushConstants)
-                                     atIndex:1];
+uint32_t frame_slot(Renderer *renderer) {
+   return 0;
+}
+
+uint32_t frame_slot_count(Renderer *renderer) {
+   return 1;
+}
+
+// Headless rendering isn't implemented for Metal, so there is never a frame to read back
+bool poll_readback(Renderer *renderer, uint8_t *pixels, size_t size, uint64_t *frame_number) {
+   return false;
+}
 
-   static_assert(sizeof(IndexBufferType) == 2, "IndexBufferType != MTLIndexTypeUInt16");
+// Metal has no descriptor pools and allocates each buffer and texture on its own
+void get_renderer_stats(Renderer *renderer, RendererStats *stats) {
+   *stats = {};
+}
 
-   [renderer->render_encoder_ drawIndexedPrimitives:MTLPrimitiveTypeTriangle
-                                         indexCount:renderer->last_binded_mesh_->num_indices
-                                          indexType:MTLIndexTypeUInt16
-                                        indexBuffer:renderer->last_binded_mesh_->buffer
-                                  indexBufferOffset:renderer->last_binded_mesh_->indices_start];
+InstanceData *map_object_buffer(Renderer *renderer, uint32_t capacity) {
+   if (capacity > renderer->object_capacity_) {
+      size_t new_capacity = std::max(renderer->object_capacity_ * 2, (size_t)capacity);
+      id<MTLBuffer> buffer =
+          [renderer->gpu_.device() newBufferWithLength:new_capacity * sizeof(InstanceData)
+                                               options:MTLResourceStorageModeShared];
+      if (renderer->object_buffer_ != nil) {
+         memcpy(
+             [buffer contents], [renderer->object_buffer_ contents],
+             renderer->object_capacity_ * sizeof(InstanceData)
+         );
+         [renderer->object_buffer_ release];
+      }
+      renderer->object_buffer_ = buffer;
+      renderer->object_capacity_ = new_capacity;
+   }
+   return reinterpret_cast<InstanceData *>([renderer->object_buffer_ contents]);
+}
+
+void set_pass_constants(LayerRecorder *recorder, const PassConstants *constants) {
+   Renderer *renderer = recorder->renderer;
+   [renderer->render_encoder_ setVertexBuffer:renderer->object_buffer_ offset:0 atIndex:1];
+   [renderer->render_encoder_ setVertexBytes:constants length:sizeof(PassConstants) atIndex:3];
 }
 
-void clear_ui_materials(Renderer *renderer) {}
+void render_instances(LayerRecorder *recorder, const uint32_t *object_ids, uint32_t count) {
+   Renderer *renderer = recorder->renderer;
+   if (count == 0) {
+      return;
+   }
+
+   if (renderer->instance_count_ + count > renderer->instance_capacity_) {
+      // The command buffer retains the old buffer for the draws already encoded with it
+      [renderer->instance_buffer_ release];
+      renderer->instance_capacity_ = std::max(renderer->instance_capacity_ * 2, (size_t)count);
+      renderer->instance_buffer_ =
+          [renderer->gpu_.device() newBufferWithLength:renderer->instance_capacity_ *
+                                                       sizeof(uint32_t)
+                                               options:MTLResourceStorageModeShared];
+      renderer->instance_count_ = 0;
+   }
+
+   size_t offset = renderer->instance_count_ * sizeof(uint32_t);
+   memcpy(
+       reinterpret_cast<uint8_t *>([renderer->instance_buffer_ contents]) + offset, object_ids,
+       count * sizeof(uint32_t)
+   );
+   renderer->instance_count_ += count;
+
+   [renderer->render_encoder_ setVertexBuffer:renderer->instance_buffer_ offset:offset atIndex:2];
+
+   const Mesh *mesh = renderer->last_binded_mesh_;
+   MTLIndexType index_type =
+       mesh->index_type == INDEX_TYPE_UINT32 ? MTLIndexTypeUInt32 : MTLIndexTypeUInt16;
+   [renderer->render_encoder_ drawIndexedPrimitives:MTLPrimitiveTypeTriangle
+                                         indexCount:mesh->num_indices
+                                          indexType:index_type
+                                        indexBuffer:mesh->buffer
+                                  indexBufferOffset:mesh->indices_start
+                                      instanceCount:count];
+}
@@ -0,0 +1,128 @@
+const std = @import("std");
+
+// picks a render scale from the gpu time of each frame: a step down while frames run over the
+// budget, a step back up once they've stayed well under it. every change waits out a number of
+// frames first, so a single slow frame doesn't cause one, and the scale doesn't flip back and forth
+// between two steps. frames that were already in flight when the scale changed were drawn at the
+// old one, so their times are skipped.
+pub const ScaleController = struct {
+    const step = 0.1;
+    // frames must take under this fraction of the budget before the scale climbs. the time taken
+    // grows with the pixels drawn, so the margin leaves room for the larger scale.
+    const headroom = 0.7;
+    const frames_to_drop = 3;
+    const frames_to_climb = 60;
+
+    budget_ns: u64,
+    min_scale: f32,
+    max_scale: f32,
+    frames_in_flight: u32,
+    scale: f32,
+    over_budget: u32 = 0,
+    under_budget: u32 = 0,
+    // measured frames left to skip since the last change
+    settling: u32 = 0,
+
+    pub fn init(budget_ns: u64, min_scale: f32, max_scale: f32, frames_in_flight: u32) ScaleController {
+        return .{
+            .budget_ns = budget_ns,
+            .min_scale = min_scale,
+            .max_scale = max_scale,
+            .frames_in_flight = frames_in_flight,
+            .scale = max_scale,
+        };
+    }
+
+    // returns the new scale if it changed. frames with no gpu time measured are ignored.
+    pub fn update(self: *ScaleController, gpu_frame_ns: u64) ?f32 {
+        if (gpu_frame_ns == 0) return null;
+        if (self.settling > 0) {
+            self.settling -= 1;
+            return null;
+        }
+
+        const frame: f64 = @floatFromInt(gpu_frame_ns);
+        const budget: f64 = @floatFromInt(self.budget_ns);
+        if (frame > budget) {
+            self.under_budget = 0;
+            self.over_budget += 1;
+            if (self.over_budget < frames_to_drop or self.scale <= self.min_scale) return null;
+            self.scale = @max(self.min_scale, self.scale - step);
+            return self.changed();
+        }
+
+        self.over_budget = 0;
+        if (frame > budget * headroom) {
+            self.under_budget = 0;
+            return null;
+        }
+        self.under_budget += 1;
+        if (self.under_budget < frames_to_climb or self.scale >= self.max_scale) return null;
+        self.scale = @min(self.max_scale, self.scale + step);
+        return self.changed();
+    }
+
+    fn changed(self: *ScaleController) f32 {
+        self.over_budget = 0;
+        self.under_budget = 0;
+        self.settling = self.frames_in_flight;
+        return self.scale;
+    }
+};
+
+const testing = std.testing;
+const ms = std.time.ns_per_ms;
+
+test "Drops the scale after consecutive slow frames" {
+    var controller = ScaleController.init(10 * ms, 0.5, 1.0, 0);
+    try testing.expectEqual(@as(?f32, null), controller.update(12 * ms));
+    try testing.expectEqual(@as(?f32, null), controller.update(12 * ms));
+    try testing.expectApproxEqAbs(@as(f32, 0.9), controller.update(12 * ms).?, 0.001);
+
+    // a fast frame in between starts the count over
+    _ = controller.update(12 * ms);
+    _ = controller.update(5 * ms);
+    _ = controller.update(12 * ms);
+    try testing.expectEqual(@as(?f32, null), controller.update(12 * ms));
+}
+
+test "Stays within the scale limits" {
+    var controller = ScaleController.init(10 * ms, 0.75, 1.0, 0);
+    for (0..30) |_| _ = controller.update(20 * ms);
+    try testing.expectEqual(@as(f32, 0.75), controller.scale);
+
+    for (0..1000) |_| _ = controller.update(1 * ms);
+    try testing.expectEqual(@as(f32, 1.0), controller.scale);
+}
+
+test "Only climbs back with headroom" {
+    var controller = ScaleController.init(10 * ms, 0.5, 1.0, 0);
+    for (0..3) |_| _ = controller.update(12 * ms);
+    try testing.expect(controller.scale < 1.0);
+
+    // under budget, but not by enough
+    for (0..200) |_| try testing.expectEqual(@as(?f32, null), controller.update(9 * ms));
+    for (0..59) |_| try testing.expectEqual(@as(?f32, null), controller.update(5 * ms));
+    try testing.expectApproxEqAbs(@as(f32, 1.0), controller.update(5 * ms).?, 0.001);
+}
+
+test "Ignores frames without a measurement" {
+    var controller = ScaleController.init(10 * ms, 0.5, 1.0, 0);
+    for (0..10) |_| try testing.expectEqual(@as(?f32, null), controller.update(0));
+    try testing.expectEqual(@as(f32, 1.0), controller.scale);
+}
+
+test "Skips frames in flight at the old scale" {
+    var controller = ScaleController.init(10 * ms, 0.5, 1.0, 2);
+    for (0..2) |_| _ = controller.update(12 * ms);
+    try testing.expectApproxEqAbs(@as(f32, 0.9), controller.update(12 * ms).?, 0.001);
+
+    // the two frames already in flight were drawn at 1.0 and don't count towards another drop
+    try testing.expectEqual(@as(?f32, null), controller.update(12 * ms));
+    try testing.expectEqual(@as(?f32, null), controller.update(12 * ms));
+    try testing.expectEqual(@as(f32, 0.9), controller.scale);
+    try testing.expectEqual(@as(u32, 0), controller.over_budget);
+
+    for (0..2) |_| try testing.expectEqual(@as(?f32, null), controller.update(12 * ms));
+    try testing.expectApproxEqAbs(@as(f32, 0.8), controller.update(12 * ms).?, 0.001);
+}
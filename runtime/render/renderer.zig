@@ -17,12 +17,23 @@ const ffi = @cImport({
 
 const Gpu = @import("../gpu/gpu.zig").Gpu;
 const Window = @import("../window/window.zig").Window;
+const latency_histogram = @import("latency_histogram.zig");
+const ScaleController = @import("render_scale.zig").ScaleController;
+const CaptureStream = @import("capture_stream.zig").CaptureStream;
 const Mat4 = @import("engine").math.Mat4;
 const Slab = util.Slab;
 const IntSet = util.IntSet;
 
-const MAX_RENDER_LAYERS = 32;
+const MAX_RENDER_LAYERS = ffi.MAX_RENDER_LAYERS;
+// layers are only recorded on the pool once a frame has enough instances for it to pay off
+const PARALLEL_RECORD_MIN_INSTANCES = 4096;
+const MAX_RECORD_THREADS = 4;
 const MAX_OBJECT_PASSES = 1024;
+const MAX_FRAME_SLOTS = 3;
+// pass key of every material when textures are bindless, see Renderer.passKey
+const ALL_IMAGES = std.math.maxInt(ImageId);
+// one being built, one being drawn, and the newest published one waiting between them
+const SNAPSHOT_COUNT = 3;
 
 const Object = struct {
     transform: Mat4,
@@ -35,8 +46,109 @@ const Object = struct {
 const Material = struct {
     object_count: u32 = 0,
     material_dropped: bool = false,
+    // set once the material's image has uploaded. objects aren't batched until then.
+    ready: bool = false,
     handle: ffi.Material,
+    image: ImageId,
+    uv_rect: [4]f32,
     color: @Vector(4, f32),
+    fully_opaque: bool,
+};
+
+const Mesh = struct {
+    handle: ffi.Mesh,
+    // set once the mesh is first batched. frames in flight may be reading it from then on, so its
+    // vertices and indices can no longer be written.
+    drawn: bool = false,
+};
+
+// an object's place in a depth-sorted draw order, by the depth of its origin
+const DepthKey = struct {
+    depth: f32,
+    object: ObjectId,
+
+    fn nearerFirst(_: void, a: DepthKey, b: DepthKey) bool {
+        return a.depth < b.depth;
+    }
+
+    // equally deep objects keep a stable order from frame to frame, so they don't flicker
+    fn fartherFirst(_: void, a: DepthKey, b: DepthKey) bool {
+        if (a.depth != b.depth) return a.depth > b.depth;
+        return a.object < b.object;
+    }
+};
+
+// one draw of a snapshot: instances of a mesh whose materials share a pass key, see
+// Renderer.passKey
+const Batch = struct {
+    pass_key: ImageId,
+    // copies, so the render thread never reads the renderer's slabs
+    material: ffi.Material,
+    mesh: ffi.Mesh,
+    blend_mode: ffi.BlendMode,
+    // range of the snapshot's instances
+    first_instance: u32,
+    instance_count: u32,
+};
+
+const LayerBatches = struct {
+    first_batch: u32 = 0,
+    batch_count: u32 = 0,
+    instance_count: u32 = 0,
+};
+
+// everything needed to draw a frame, built from the renderer's objects by the thread that changes
+// them. once published it isn't written again until the render thread has moved on to a newer one.
+const Snapshot = struct {
+    // data of every object id, as the object buffer holds it. entries of deleted objects are stale
+    // and never drawn.
+    objects: std.ArrayList(ffi.InstanceData) = .empty,
+    // the object's version when its entry was copied, see Renderer.object_versions
+    versions: std.ArrayList(u32) = .empty,
+    batches: std.ArrayList(Batch) = .empty,
+    instances: std.ArrayList(ObjectId) = .empty,
+    layers: [MAX_RENDER_LAYERS]LayerBatches = [_]LayerBatches{.{}} ** MAX_RENDER_LAYERS,
+    view_projection: Mat4 = undefined,
+    // size of the window the snapshot was built for, which the swapchain is resized to
+    width: i32 = 0,
+    height: i32 = 0,
+    // counts up with each publish, see Renderer.generation
+    generation: u64 = 0,
+
+    fn deinit(self: *Snapshot, allocator: std.mem.Allocator) void {
+        self.objects.deinit(allocator);
+        self.versions.deinit(allocator);
+        self.batches.deinit(allocator);
+        self.instances.deinit(allocator);
+    }
+};
+
+// hands snapshots from the thread that builds them to the render thread without either waiting on
+// the other. one is built while another is drawn, and the newest published one waits between them,
+// so the render thread always takes the latest and snapshots it never got to are skipped.
+const SnapshotBuffer = struct {
+    snapshots: [SNAPSHOT_COUNT]Snapshot = [_]Snapshot{.{}} ** SNAPSHOT_COUNT,
+    // owned by the building thread
+    back: u8 = 0,
+    // owned by the render thread
+    front: u8 = 1,
+    // the snapshot between them, with FRESH set until the render thread takes it
+    middle: u8 = 2,
+
+    const FRESH: u8 = 0x80;
+
+    fn publish(self: *SnapshotBuffer) void {
+        const previous = @atomicRmw(u8, &self.middle, .Xchg, self.back | FRESH, .acq_rel);
+        self.back = previous & ~FRESH;
+    }
+
+    // whether there was a snapshot newer than front, which it then becomes
+    fn take(self: *SnapshotBuffer) bool {
+        if (@atomicLoad(u8, &self.middle, .monotonic) & FRESH == 0) return false;
+        const previous = @atomicRmw(u8, &self.middle, .Xchg, self.front, .acq_rel);
+        self.front = previous & ~FRESH;
+        return true;
+    }
 };
 
 const MeshPass = struct {
@@ -68,11 +180,13 @@ const MaterialPass = struct {
 };
 
 const RenderCollection = struct {
-    material_passes: std.AutoHashMap(MaterialId, MeshPassId),
+    // keyed by Renderer.passKey of the pass' materials. materials only differ in per-object data,
+    // so all materials with one key, such as sprites on one atlas page, are drawn together.
+    material_passes: std.AutoHashMap(ImageId, MaterialPassId),
 
     pub fn init(allocator: std.mem.Allocator) RenderCollection {
         return RenderCollection{
-            .material_passes = std.AutoHashMap(MaterialId, MeshPassId).init(allocator),
+            .material_passes = std.AutoHashMap(ImageId, MaterialPassId).init(allocator),
         };
     }
 
@@ -81,15 +195,323 @@ const RenderCollection = struct {
     }
 };
 
+// device memory, uploads, images and the pipeline cache shared by every renderer created on it.
+// frames its renderers end are only submitted by submitFrames, which submits and presents all of
+// them at once.
+pub const RenderContext = struct {
+    handle: *ffi.RenderContext,
+    // the context isn't thread-safe, so it and every renderer on it are only used with this held.
+    // renderers take it for their own calls, and whoever draws them holds it while recording,
+    // though not while waiting for the gpu or the display, see RenderTarget.acquire.
+    lock: std.Thread.Mutex = .{},
+
+    pub const Options = struct {
+        // number of frames the CPU may record while the GPU is still drawing earlier ones (1-3)
+        frames_in_flight: u32 = 2,
+        // compiled pipelines are saved here so later starts skip most shader compilation
+        pipeline_cache_path: ?[:0]const u8 = null,
+    };
+
+    // window is the first one that will be rendered to, which picks the queue frames are presented
+    // from. null for a gpu from Gpu.initHeadless.
+    pub fn init(gpu: *const Gpu, window: ?*const Window, options: Options) !RenderContext {
+        const ffi_options = ffi.RenderContextOptions{
+            .frames_in_flight = options.frames_in_flight,
+            .pipeline_cache_path = if (options.pipeline_cache_path) |path| path.ptr else null,
+        };
+        const window_handle: ?*const ffi.Window = if (window) |w| @ptrCast(w.handle) else null;
+        const handle = ffi.create_render_context(@ptrCast(gpu.handle), window_handle, &ffi_options) orelse
+            return error.SurfaceUnsupported;
+        return .{ .handle = handle };
+    }
+
+    // every renderer on the context must be deinitialized first
+    pub fn deinit(self: *RenderContext) void {
+        ffi.destroy_render_context(self.handle);
+    }
+
+    // called once per frame, after every renderer on the context has rendered
+    pub fn submitFrames(self: *RenderContext) void {
+        ffi.submit_frames(self.handle);
+    }
+};
+
+// the part of a renderer that draws its snapshots, on the render thread where there is one. it stays
+// at one address, so the render thread can keep pointing at it while the renderer moves.
+pub const RenderTarget = struct {
+    allocator: std.mem.Allocator,
+    handle: *ffi.Renderer,
+    // null for a headless renderer
+    surface: ?*anyopaque,
+    snapshots: SnapshotBuffer = .{},
+    // records layers on several threads. null where recording has to stay on one thread.
+    record_pool: ?*std.Thread.Pool,
+    // each frame slot keeps its own copy of object data on the GPU, along with the version of each
+    // object it has, so only objects that changed since the slot was last drawn are copied
+    frame_slots: u32,
+    slot_versions: [MAX_FRAME_SLOTS]std.ArrayList(u32) = [_]std.ArrayList(u32){.empty} ** MAX_FRAME_SLOTS,
+    // size the swapchain was last made for
+    width: i32 = 0,
+    height: i32 = 0,
+    // gpu time of the latest frame with resolved timestamps, read without the context's lock
+    gpu_frame_ns: u64 = 0,
+    // set when the render scale follows gpu time
+    scale_controller: ?ScaleController,
+    // set when the last frame left out batches whose uploads hadn't retired, or wasn't drawn at
+    // all, so the snapshot is drawn again even if no newer one is published. written by layers
+    // recording in parallel.
+    incomplete: bool = false,
+    // generation of the snapshot each frame slot last drew
+    slot_generations: [MAX_FRAME_SLOTS]u64 = [_]u64{0} ** MAX_FRAME_SLOTS,
+    // no frame in flight or yet to be drawn uses a snapshot older than this one, so resources
+    // deleted before it was built can be released. read by the renderer without the context's lock.
+    retired_generation: u64 = 0,
+    // set when frames shown on the window are captured
+    capture: ?*CaptureStream,
+
+    fn deinit(self: *RenderTarget) void {
+        if (self.capture) |stream| stream.deinit();
+        if (self.record_pool) |pool| {
+            pool.deinit();
+            self.allocator.destroy(pool);
+        }
+        for (&self.slot_versions) |*versions| {
+            versions.deinit(self.allocator);
+        }
+        for (&self.snapshots.snapshots) |*snapshot| {
+            snapshot.deinit(self.allocator);
+        }
+    }
+
+    // makes the newest published snapshot the one draw uses. false if none was published since the
+    // last one taken and the last frame drew all of it, in which case drawing again would show
+    // nothing new.
+    pub fn takeSnapshot(self: *RenderTarget) bool {
+        const fresh = self.snapshots.take();
+        return fresh or @atomicLoad(bool, &self.incomplete, .monotonic);
+    }
+
+    // waits for the frame slot and swapchain image the next draw uses, which draw would otherwise
+    // wait for with the context's lock held. called without the lock, between takeSnapshot and
+    // draw, on the thread that submits frames. a swapchain about to be resized is left to draw.
+    pub fn acquire(self: *RenderTarget) void {
+        const snapshot = &self.snapshots.snapshots[self.snapshots.front];
+        if (self.surface != null and (snapshot.width != self.width or snapshot.height != self.height)) return;
+        // out of date swapchains are recreated by draw, whose begin_render fails the same way
+        _ = ffi.acquire_frame(self.handle);
+    }
+
+    // records a frame of the snapshot last taken, for the context to submit. the context's lock
+    // must be held.
+    pub fn draw(self: *RenderTarget) !void {
+        const snapshot = &self.snapshots.snapshots[self.snapshots.front];
+
+        const object_count = snapshot.versions.items.len;
+        for (self.slot_versions[0..self.frame_slots]) |*versions| {
+            if (versions.items.len < object_count) {
+                try versions.appendNTimes(self.allocator, 0, object_count - versions.items.len);
+            }
+        }
+
+        if (self.surface) |surface| {
+            if (snapshot.width != self.width or snapshot.height != self.height) {
+                self.width = snapshot.width;
+                self.height = snapshot.height;
+                ffi.recreate_swapchain(self.handle, self.width, self.height, surface);
+            }
+        }
+
+        if (comptime util.vulkan) {
+            if (self.scale_controller) |*controller| {
+                if (controller.update(self.gpu_frame_ns)) |scale| {
+                    ffi.set_render_scale(self.handle, scale);
+                }
+            }
+        }
+
+        // a capture is dropped once its slot is drawn again, so it's collected before that
+        if (self.capture) |stream| {
+            var frame_number: u64 = undefined;
+            if (ffi.poll_readback(self.handle, stream.pixels.ptr, stream.pixels.len, &frame_number)) {
+                stream.submit(frame_number);
+            }
+        }
+
+        @atomicStore(bool, &self.incomplete, false, .monotonic);
+        if (!ffi.begin_render(self.handle)) {
+            if (comptime builtin.os.tag == .macos) {
+                @atomicStore(bool, &self.incomplete, true, .monotonic);
+                return;
+            }
+
+            const surface = self.surface orelse return error.RenderFailed;
+            ffi.recreate_swapchain(self.handle, self.width, self.height, surface);
+
+            if (!ffi.begin_render(self.handle)) {
+                return error.RenderFailed;
+            }
+        }
+
+        // begin_render waited for the frame the slot last drew, and frames finish in order, so
+        // every frame still in flight draws that frame's snapshot or a newer one
+        const slot = ffi.frame_slot(self.handle);
+        const retired = @max(self.retired_generation, self.slot_generations[slot]);
+        @atomicStore(u64, &self.retired_generation, retired, .release);
+        self.slot_generations[slot] = snapshot.generation;
+
+        self.flushObjects(snapshot);
+
+        // the whole frame is reserved before any layer begins, since with gpu culling the frame's
+        // buffers can't grow afterwards
+        var total_instances: usize = 0;
+        var total_draws: usize = 0;
+        for (&snapshot.layers) |*layer| {
+            total_instances += layer.instance_count;
+            total_draws += layer.batch_count;
+        }
+        ffi.reserve_frame(self.handle, @intCast(total_instances), @intCast(total_draws));
+
+        var recorders: [MAX_RENDER_LAYERS]?*ffi.LayerRecorder = [_]?*ffi.LayerRecorder{null} ** MAX_RENDER_LAYERS;
+        var layer_count: usize = 0;
+        for (&snapshot.layers, 0..) |*layer, index| {
+            if (layer.batch_count == 0) continue;
+            recorders[index] = ffi.begin_layer(self.handle, @intCast(index), layer.instance_count, layer.batch_count);
+            layer_count += 1;
+        }
+
+        const parallel = layer_count > 1 and total_instances >= PARALLEL_RECORD_MIN_INSTANCES;
+        if (if (parallel) self.record_pool else null) |pool| {
+            var wait_group: std.Thread.WaitGroup = .{};
+            for (recorders, 0..) |maybe_recorder, layer| {
+                const recorder = maybe_recorder orelse continue;
+                pool.spawnWg(&wait_group, recordLayer, .{ self, snapshot, layer, recorder });
+            }
+            pool.waitAndWork(&wait_group);
+        } else {
+            for (recorders, 0..) |maybe_recorder, layer| {
+                const recorder = maybe_recorder orelse continue;
+                self.recordLayer(snapshot, layer, recorder);
+            }
+        }
+
+        ffi.end_render(self.handle);
+
+        var counters: ffi.RendererStats = undefined;
+        ffi.get_renderer_stats(self.handle, &counters);
+        @atomicStore(u64, &self.gpu_frame_ns, counters.gpu_frame_ns, .monotonic);
+    }
+
+    // copies the objects whose version differs from the one the current frame slot has into its
+    // object buffer
+    fn flushObjects(self: *RenderTarget, snapshot: *const Snapshot) void {
+        const slot = ffi.frame_slot(self.handle);
+        const object_count = snapshot.versions.items.len;
+        const object_data = ffi.map_object_buffer(self.handle, @intCast(object_count));
+
+        const slot_versions = self.slot_versions[slot].items[0..object_count];
+        for (snapshot.versions.items, slot_versions, 0..) |version, *slot_version, object_id| {
+            if (version == slot_version.*) continue;
+            object_data[object_id] = snapshot.objects.items[object_id];
+            slot_version.* = version;
+        }
+    }
+
+    // may run on any thread, at the same time as other layers are recorded
+    fn recordLayer(self: *RenderTarget, snapshot: *Snapshot, layer: usize, recorder: *ffi.LayerRecorder) void {
+        defer ffi.end_layer(recorder);
+
+        var pass_constants: ffi.PassConstants = undefined;
+        @memcpy(&pass_constants.view_projection, snapshot.view_projection.ptr());
+
+        var blend_mode: ?ffi.BlendMode = null;
+        var pass_key: ?ImageId = null;
+        const range = snapshot.layers[layer];
+        for (snapshot.batches.items[range.first_batch..][0..range.batch_count]) |*batch| {
+            // objects appear once their texture and mesh uploads have retired
+            if (!ffi.material_ready(self.handle, &batch.material) or !ffi.mesh_ready(self.handle, &batch.mesh)) {
+                @atomicStore(bool, &self.incomplete, true, .monotonic);
+                continue;
+            }
+
+            if (blend_mode == null or blend_mode.? != batch.blend_mode) {
+                ffi.set_pipeline(recorder, 0, batch.blend_mode); // pipeline id not currently used
+                ffi.set_pass_constants(recorder, &pass_constants);
+                blend_mode = batch.blend_mode;
+                pass_key = null;
+            }
+            // with bindless textures every batch has the same key, and instances pick their own
+            if (pass_key == null or pass_key.? != batch.pass_key) {
+                ffi.set_material(recorder, &batch.material);
+                pass_key = batch.pass_key;
+            }
+
+            ffi.set_mesh(recorder, &batch.mesh);
+            const instances = snapshot.instances.items[batch.first_instance..][0..batch.instance_count];
+            ffi.render_instances(recorder, instances.ptr, batch.instance_count);
+        }
+    }
+};
+
+// changes to objects are made on the calling thread, and reach the screen through snapshots of them
+// published once a frame by publish, which the renderer's target draws, possibly on a thread of its
+// own. calls that reach the gpu take the context's lock.
 pub const Renderer = struct {
     allocator: std.mem.Allocator,
     handle: *ffi.Renderer,
+    context_lock: *std.Thread.Mutex,
+    target: *RenderTarget,
     objects: Slab(Object),
-    meshes: Slab(ffi.Mesh),
+    meshes: Slab(Mesh),
     mesh_passes: Slab(MeshPass),
     materials: Slab(Material),
     material_passes: Slab(MaterialPass),
     render_collections: [MAX_RENDER_LAYERS]RenderCollection = undefined,
+    // whether instances sample the image named in their own data, so objects on every image can
+    // share a batch, see ffi.bindless_textures
+    bindless_textures: bool,
+    // materials created since the last publish that found them ready, see Material.ready
+    pending_materials: std.ArrayList(MaterialId) = .empty,
+    // with a depth buffer, the opaque objects of the mesh pass being batched, sorted front to back,
+    // and every transparent object of the layer, drawn back to front after all opaque ones
+    depth_buffer: bool,
+    opaque_keys: std.ArrayList(DepthKey),
+    transparent_keys: std.ArrayList(DepthKey),
+    // each snapshot keeps its own copy of object data. dirty_snapshots has a bit per snapshot for
+    // every object id, set when the object changed and cleared once that snapshot has the change.
+    dirty_snapshots: std.ArrayList(u8),
+    dirty_objects: [SNAPSHOT_COUNT]std.ArrayList(ObjectId),
+    // bumped whenever an object id's data changes, so frame slots can tell which objects they're
+    // missing, however many snapshots they were skipped past
+    object_versions: std.ArrayList(u32),
+    // set by any change to objects, materials or meshes since the last publish. while it's clear
+    // and the view is the one last published, publish skips the frame, since it would look the
+    // same as the last.
+    scene_changed: bool = true,
+    published_view: ?PublishedView = null,
+    // generation of the last snapshot published
+    generation: u64 = 0,
+    // meshes and materials deleted while older snapshots may still draw them, released once the
+    // target's retired generation reaches the first snapshot built without them
+    dead_meshes: std.ArrayList(Dead(ffi.Mesh)) = .empty,
+    dead_materials: std.ArrayList(Dead(ffi.Material)) = .empty,
+
+    fn Dead(comptime T: type) type {
+        return struct {
+            handle: T,
+            generation: u64,
+        };
+    }
+
+    const PublishedView = struct {
+        view_projection: Mat4,
+        width: i32,
+        height: i32,
+
+        fn eql(self: *const PublishedView, view_projection: *const Mat4, width: i32, height: i32) bool {
+            return self.width == width and self.height == height and
+                std.mem.eql(f32, self.view_projection.ptr()[0..16], view_projection.ptr()[0..16]);
+        }
+    };
 
     pub const PipelineHandle = struct { id: PipelineId };
     pub const MaterialHandle = struct { id: MaterialId };
@@ -97,14 +519,135 @@ pub const Renderer = struct {
     pub const ObjectHandle = struct { id: ObjectId };
     pub const ImageHandle = struct { id: ImageId };
 
-    pub fn init(gpu: *const Gpu, window: *const Window, allocator: std.mem.Allocator) !Renderer {
-        const renderer = ffi.create_renderer(@ptrCast(gpu.handle), @ptrCast(window.handle)).?;
-        errdefer ffi.destroy_renderer(renderer);
+    // the part of an image a material samples, such as one sprite on an atlas page
+    pub const ImageRegion = struct {
+        image: ImageHandle,
+        // u, v of the top-left corner followed by the width and height in uv units
+        uv_rect: [4]f32 = .{ 0.0, 0.0, 1.0, 1.0 },
+        // every texel of the region has full alpha, see opaquePixels. objects of such materials
+        // are drawn without blending, and with a depth buffer, front to back.
+        fully_opaque: bool = false,
+    };
+
+    // Block-compressed texture formats, all with 4x4 blocks of 16 bytes
+    pub const CompressedFormat = enum(c_uint) {
+        bc7 = ffi.COMPRESSED_FORMAT_BC7,
+        etc2_rgba8 = ffi.COMPRESSED_FORMAT_ETC2_RGBA8,
+        astc_4x4 = ffi.COMPRESSED_FORMAT_ASTC_4X4,
+    };
+
+    // how finished frames are queued for the display, trading latency against tearing. Falls back
+    // to the default when the display doesn't support the mode.
+    pub const PresentMode = enum(c_uint) {
+        // mailbox where supported, otherwise fifo
+        default = ffi.PRESENT_MODE_DEFAULT,
+        mailbox = ffi.PRESENT_MODE_MAILBOX,
+        fifo = ffi.PRESENT_MODE_FIFO,
+        fifo_relaxed = ffi.PRESENT_MODE_FIFO_RELAXED,
+        immediate = ffi.PRESENT_MODE_IMMEDIATE,
+    };
+
+    pub const Options = struct {
+        present_mode: PresentMode = .default,
+        // minimum number of swapchain images, fewer meaning less queued latency. 0 picks one more
+        // than the display's minimum.
+        swapchain_images: u32 = 0,
+        // cull instances against the view on the gpu and draw them indirectly, on devices that
+        // support it
+        gpu_culling: bool = true,
+        // test draws against a depth buffer, so opaque objects hide what's behind them without
+        // it being shaded. each layer is still drawn over the layers below it.
+        depth_buffer: bool = false,
+        // fraction of the window's resolution frames are drawn at, then upscaled to fill it.
+        // vulkan only, and drawn at full size where the device can't upscale.
+        render_scale: f32 = 1.0,
+        // when set, the scale follows gpu time: it drops towards min_render_scale while frames
+        // take longer than this, and climbs back to render_scale once they're well under it
+        gpu_budget_ns: u64 = 0,
+        min_render_scale: f32 = 0.5,
+        // when set, every capture_interval-th frame drawn to the window is scaled to
+        // capture_width by capture_height and jpeg-encoded, for latestCapture. vulkan only.
+        capture_interval: u32 = 0,
+        capture_width: u32 = 480,
+        capture_height: u32 = 270,
+        capture_quality: u8 = 80,
+    };
+
+    pub const Stats = struct {
+        counters: ffi.RendererStats,
+
+        pub fn format(self: *const Stats, writer: anytype) !void {
+            const c = self.counters;
+            try writer.print("descriptor pools: {d} ({d} sets, {d} grown), memory: {d} of {d} bytes used, gpu: {D}", .{
+                c.descriptor_pools,
+                c.descriptor_sets,
+                c.descriptor_pool_growths,
+                c.memory_used,
+                c.memory_reserved,
+                c.gpu_frame_ns,
+            });
+            for (c.gpu_layer_ns, 0..) |ns, layer| {
+                if (ns == 0) continue;
+                try writer.print("\n  gpu layer {d}: {D}", .{ layer, ns });
+            }
+            if (latency_histogram.percentile(&c.present_latency_ms, 0.5)) |p50| {
+                // the last bucket also holds everything slower
+                try writer.print("\n  present latency: p50 {d}ms, p95 {d}ms, p99 {d}ms", .{
+                    p50,
+                    latency_histogram.percentile(&c.present_latency_ms, 0.95).?,
+                    latency_histogram.percentile(&c.present_latency_ms, 0.99).?,
+                });
+            }
+        }
+    };
+
+    // frames are queued on the context and only reach the window once the context submits them
+    pub fn init(context: *RenderContext, window: *const Window, allocator: std.mem.Allocator, options: Options) !Renderer {
+        const ffi_options = ffiOptions(options);
+        const renderer = blk: {
+            context.lock.lock();
+            defer context.lock.unlock();
+            break :blk ffi.create_renderer(context.handle, @ptrCast(window.handle), &ffi_options) orelse
+                return error.SurfaceUnsupported;
+        };
+        const surface: ?*anyopaque = if (comptime util.vulkan) window.surface() else null;
+        return initWithHandle(context, renderer, surface, allocator, options);
+    }
+
+    // renders into offscreen images of the given size, read back with pollReadback once the context
+    // has submitted the frame. The context's gpu should come from Gpu.initHeadless.
+    pub fn initHeadless(context: *RenderContext, width: u32, height: u32, allocator: std.mem.Allocator, options: Options) !Renderer {
+        const ffi_options = ffiOptions(options);
+        const renderer = blk: {
+            context.lock.lock();
+            defer context.lock.unlock();
+            break :blk ffi.create_headless_renderer(context.handle, width, height, &ffi_options) orelse
+                return error.HeadlessUnsupported;
+        };
+        return initWithHandle(context, renderer, null, allocator, options);
+    }
+
+    fn ffiOptions(options: Options) ffi.RendererOptions {
+        return .{
+            .present_mode = @intFromEnum(options.present_mode),
+            .swapchain_images = options.swapchain_images,
+            .gpu_culling = options.gpu_culling,
+            .depth_buffer = options.depth_buffer,
+            .render_scale = options.render_scale,
+            .min_render_scale = if (options.gpu_budget_ns != 0) @min(options.min_render_scale, options.render_scale) else options.render_scale,
+            .capture_interval = options.capture_interval,
+            .capture_width = options.capture_width,
+            .capture_height = options.capture_height,
+        };
+    }
+
+    fn initWithHandle(context: *RenderContext, renderer: *ffi.Renderer, surface: ?*anyopaque, allocator: std.mem.Allocator, options: Options) !Renderer {
+        errdefer destroyHandle(&context.lock, renderer);
 
         var objects = try Slab(Object).init(allocator, 1024);
         errdefer objects.deinit();
 
-        var meshes = try Slab(ffi.Mesh).init(allocator, 32);
+        var meshes = try Slab(Mesh).init(allocator, 32);
         errdefer meshes.deinit();
 
         var mesh_passes = try Slab(MeshPass).init(allocator, 64);
@@ -116,14 +659,58 @@ pub const Renderer = struct {
         var material_passes = try Slab(MaterialPass).init(allocator, 32);
         errdefer material_passes.deinit();
 
+        var dirty_snapshots = try std.ArrayList(u8).initCapacity(allocator, 1024);
+        errdefer dirty_snapshots.deinit(allocator);
+
+        var object_versions = try std.ArrayList(u32).initCapacity(allocator, 1024);
+        errdefer object_versions.deinit(allocator);
+
+        const record_pool = try initRecordPool(allocator);
+        errdefer if (record_pool) |pool| {
+            pool.deinit();
+            allocator.destroy(pool);
+        };
+
+        const capture = if (util.vulkan and surface != null and options.capture_interval != 0)
+            try CaptureStream.init(allocator, options.capture_width, options.capture_height, options.capture_quality)
+        else
+            null;
+        errdefer if (capture) |stream| stream.deinit();
+
+        const frame_slots = ffi.frame_slot_count(renderer);
+        const target = try allocator.create(RenderTarget);
+        target.* = .{
+            .allocator = allocator,
+            .handle = renderer,
+            .surface = surface,
+            .record_pool = record_pool,
+            .frame_slots = frame_slots,
+            .scale_controller = if (util.vulkan and options.gpu_budget_ns != 0)
+                ScaleController.init(options.gpu_budget_ns, @min(options.min_render_scale, options.render_scale), options.render_scale, frame_slots)
+            else
+                null,
+            .capture = capture,
+        };
+        std.debug.assert(target.frame_slots <= MAX_FRAME_SLOTS);
+
         var result = Renderer{
             .allocator = allocator,
             .handle = renderer,
+            .context_lock = &context.lock,
+            .target = target,
             .objects = objects,
             .meshes = meshes,
             .mesh_passes = mesh_passes,
             .materials = materials,
             .material_passes = material_passes,
+            .bindless_textures = ffi.bindless_textures(renderer),
+            // metal renderers have no depth buffer, so objects are drawn as without one
+            .depth_buffer = options.depth_buffer and util.vulkan,
+            .opaque_keys = .empty,
+            .transparent_keys = .empty,
+            .dirty_snapshots = dirty_snapshots,
+            .dirty_objects = [_]std.ArrayList(ObjectId){.empty} ** SNAPSHOT_COUNT,
+            .object_versions = object_versions,
         };
 
         for (&result.render_collections) |*collection| {
@@ -133,8 +720,36 @@ pub const Renderer = struct {
         return result;
     }
 
+    fn destroyHandle(context_lock: *std.Thread.Mutex, renderer: *ffi.Renderer) void {
+        context_lock.lock();
+        defer context_lock.unlock();
+        ffi.destroy_renderer(renderer);
+    }
+
+    // metal encodes every layer into one render encoder, so only vulkan records in parallel
+    fn initRecordPool(allocator: std.mem.Allocator) !?*std.Thread.Pool {
+        if (comptime !util.vulkan) return null;
+        const cpu_count = std.Thread.getCpuCount() catch 1;
+        // the render thread records too while it waits
+        const n_jobs = @min(cpu_count -| 1, MAX_RECORD_THREADS);
+        if (n_jobs == 0) return null;
+
+        // threads keep a pointer to the pool, so it can't move with the renderer
+        const pool = try allocator.create(std.Thread.Pool);
+        errdefer allocator.destroy(pool);
+        try pool.init(.{ .allocator = allocator, .n_jobs = n_jobs });
+        return pool;
+    }
+
+    // the target must no longer be drawn
     pub fn deinit(self: *Renderer) void {
-        ffi.destroy_renderer(self.handle);
+        self.releaseDead(std.math.maxInt(u64));
+        self.dead_meshes.deinit(self.allocator);
+        self.dead_materials.deinit(self.allocator);
+        self.pending_materials.deinit(self.allocator);
+        destroyHandle(self.context_lock, self.handle);
+        self.target.deinit();
+        self.allocator.destroy(self.target);
 
         for (&self.render_collections) |*collection| {
             var material_passes = collection.material_passes.valueIterator();
@@ -158,40 +773,104 @@ pub const Renderer = struct {
         self.mesh_passes.deinit();
         self.materials.deinit();
         self.material_passes.deinit();
+        self.opaque_keys.deinit(self.allocator);
+        self.transparent_keys.deinit(self.allocator);
+        self.dirty_snapshots.deinit(self.allocator);
+        for (&self.dirty_objects) |*dirty| {
+            dirty.deinit(self.allocator);
+        }
+        self.object_versions.deinit(self.allocator);
     }
 
-    pub fn createUiMaterial(self: *Renderer, image: ImageHandle, r: f32, g: f32, b: f32, a: f32) error{OutOfMemory}!MaterialHandle {
-        const mat = ffi.create_ui_material(self.handle, image.id);
+    pub fn createUiMaterial(self: *Renderer, region: ImageRegion, r: f32, g: f32, b: f32, a: f32) error{OutOfMemory}!MaterialHandle {
+        const mat = blk: {
+            self.context_lock.lock();
+            defer self.context_lock.unlock();
+            break :blk ffi.create_ui_material(self.handle, region.image.id);
+        };
         const key, _ = try self.materials.insert(.{
             .handle = mat,
+            .image = region.image.id,
+            .uv_rect = region.uv_rect,
             .color = .{ r, g, b, a },
+            .fully_opaque = region.fully_opaque,
         });
+        errdefer self.materials.delete(key) catch unreachable;
+        try self.pending_materials.append(self.allocator, @intCast(key));
         return .{ .id = @intCast(key) };
     }
 
-    pub fn clearUiMaterials(self: *Renderer) void {
-        ffi.clear_ui_materials(self.handle);
-    }
-
     //pub fn createMeshMaterial(self: *Renderer, r: f32, g: f32, b: f32) !MaterialHandle {
     //    const id = ffi.create_mesh_material(self.handle, r, g, b);
     //    const key, _ = try self.materials.append(id);
     //    return .{ .id = key };
     //}
 
-    pub fn createMesh(self: *Renderer, vertices: []const u8, indices: []const u16) error{OutOfMemory}!MeshHandle {
-        const mesh = ffi.create_mesh(self.handle, @ptrCast(@constCast(vertices.ptr)), vertices.len, @ptrCast(@constCast(indices.ptr)), indices.len);
-        const key, _ = try self.meshes.insert(mesh);
+    // meshes share a few large vertex buffers, where they start on a multiple of the vertex size.
+    // Index is u16, or u32 for meshes with more than 65536 vertices.
+    pub fn createMesh(self: *Renderer, comptime Vertex: type, vertices: []const Vertex, comptime Index: type, indices: []const Index) error{OutOfMemory}!MeshHandle {
+        const bytes = std.mem.sliceAsBytes(vertices);
+        const mesh = blk: {
+            self.context_lock.lock();
+            defer self.context_lock.unlock();
+            break :blk ffi.create_mesh(self.handle, bytes.ptr, bytes.len, @sizeOf(Vertex), indices.ptr, indices.len, indexType(Index));
+        };
+        const key, _ = try self.meshes.insert(.{ .handle = mesh });
+        return MeshHandle{ .id = @intCast(key) };
+    }
+
+    // reserves room for a mesh whose vertices and indices are written afterwards, in as many parts
+    // as needed, so large meshes can be streamed in without holding all of their data at once. the
+    // mesh shouldn't be drawn until it has been written in full, and can't be written once it has
+    // been, see Mesh.drawn. meshes that change are replaced with a new one instead.
+    pub fn createEmptyMesh(self: *Renderer, comptime Vertex: type, vertex_count: usize, comptime Index: type, index_count: usize) error{OutOfMemory}!MeshHandle {
+        const mesh = blk: {
+            self.context_lock.lock();
+            defer self.context_lock.unlock();
+            break :blk ffi.create_empty_mesh(self.handle, vertex_count * @sizeOf(Vertex), @sizeOf(Vertex), index_count, indexType(Index));
+        };
+        const key, _ = try self.meshes.insert(.{ .handle = mesh });
         return MeshHandle{ .id = @intCast(key) };
     }
 
+    pub fn writeMeshVertices(self: *Renderer, id: MeshHandle, comptime Vertex: type, first_vertex: usize, vertices: []const Vertex) void {
+        const mesh = self.meshes.get(id.id).?;
+        std.debug.assert(!mesh.drawn);
+        const bytes = std.mem.sliceAsBytes(vertices);
+        self.scene_changed = true;
+        self.context_lock.lock();
+        defer self.context_lock.unlock();
+        ffi.write_mesh_vertices(self.handle, &mesh.handle, first_vertex * @sizeOf(Vertex), bytes.ptr, bytes.len);
+    }
+
+    // Index must match the type the mesh was created with
+    pub fn writeMeshIndices(self: *Renderer, id: MeshHandle, comptime Index: type, first_index: usize, indices: []const Index) void {
+        const mesh = self.meshes.get(id.id).?;
+        std.debug.assert(!mesh.drawn);
+        std.debug.assert(mesh.handle.index_type == indexType(Index));
+        self.scene_changed = true;
+        self.context_lock.lock();
+        defer self.context_lock.unlock();
+        ffi.write_mesh_indices(self.handle, &mesh.handle, first_index, indices.ptr, indices.len);
+    }
+
+    fn indexType(comptime Index: type) ffi.IndexType {
+        return switch (Index) {
+            u16 => ffi.INDEX_TYPE_UINT16,
+            u32 => ffi.INDEX_TYPE_UINT32,
+            else => @compileError("mesh indices must be u16 or u32"),
+        };
+    }
+
     pub fn deleteMesh(self: *Renderer, id: MeshHandle) void {
         const mesh = self.meshes.get(id.id).?;
-        ffi.delete_mesh(self.handle, mesh);
+        self.scene_changed = true;
+        self.dead_meshes.append(self.allocator, .{ .handle = mesh.handle, .generation = self.generation + 1 }) catch |err| util.crash.oom(err);
     }
 
     pub fn addObject(self: *Renderer, mesh: MeshHandle, transform: Mat4, material: MaterialHandle, render_order: RenderOrder) error{OutOfMemory}!ObjectHandle {
-        const material_pass = try self.getOrInsertMaterialPass(&self.render_collections[render_order], material.id);
+        const key = self.passKey(self.materials.get(material.id).?);
+        const material_pass = try self.getOrInsertMaterialPass(&self.render_collections[render_order], key);
         const mesh_pass = try self.getOrInsertMeshPass(material_pass, mesh.id);
 
         const obj_id, _ = try self.objects.insert(.{
@@ -203,6 +882,7 @@ pub const Renderer = struct {
         });
         self.materials.get(material.id).?.object_count += 1;
         try mesh_pass.objects.put(self.allocator, @intCast(obj_id));
+        try self.markObjectDirty(@intCast(obj_id));
         return ObjectHandle{ .id = @intCast(obj_id) };
     }
 
@@ -211,43 +891,115 @@ pub const Renderer = struct {
 
         if (obj.material.id == material.id) return;
 
-        self.unrefMaterial(obj.material);
+        const old_material = obj.material;
+        const new_key = self.passKey(self.materials.get(material.id).?);
         self.materials.get(material.id).?.object_count += 1;
 
         const collection = &self.render_collections[obj.render_order];
-        const material_pass_id = collection.material_passes.get(obj.material.id).?;
-        const material_pass = self.material_passes.get(material_pass_id).?;
-        const mesh_pass_id = material_pass.mesh_passes.get(obj.mesh).?;
-        const mesh_pass = self.mesh_passes.get(mesh_pass_id).?;
+        const mesh_pass = self.objectMeshPass(collection, obj);
         std.debug.assert(mesh_pass.objects.delete(object.id));
 
         obj.material = material;
-        const new_mat_pass = try self.getOrInsertMaterialPass(collection, material.id);
+        const new_mat_pass = try self.getOrInsertMaterialPass(collection, new_key);
         const new_mesh_pass = try self.getOrInsertMeshPass(new_mat_pass, obj.mesh);
         try new_mesh_pass.objects.put(self.allocator, object.id);
+        // the object's uv rect, color and image come from its material
+        try self.markObjectDirty(object.id);
+
+        // only once the object has left the old material's pass, which may be deleted with it
+        self.unrefMaterial(old_material);
     }
 
     pub fn updateMaterial(self: *Renderer, material: MaterialHandle, r: f32, g: f32, b: f32, a: f32) void {
-        self.materials.get(material.id).?.color = .{ r, g, b, a };
+        const mat = self.materials.get(material.id).?;
+        const color = @Vector(4, f32){ r, g, b, a };
+        if (@reduce(.And, mat.color == color)) return;
+        mat.color = color;
+
+        // material colors are folded into the color of each object, since objects of different
+        // materials share draws. the material's objects are found among those of its pass.
+        for (&self.render_collections) |*collection| {
+            const material_pass_id = collection.material_passes.get(self.passKey(mat)) orelse continue;
+            var mesh_passes = self.material_passes.get(material_pass_id).?.mesh_passes.valueIterator();
+            while (mesh_passes.next()) |mesh_pass_id| {
+                var objects = self.mesh_passes.get(mesh_pass_id.*).?.objects.iterator();
+                while (objects.next()) |object_id| {
+                    if (self.objects.get(object_id).?.material.id != material.id) continue;
+                    self.markObjectDirty(object_id) catch |err| util.crash.oom(err);
+                }
+            }
+        }
     }
 
     pub fn setObjectTransform(self: *Renderer, object: ObjectHandle, transform: Mat4) void {
         self.objects.get(object.id).?.transform = transform;
+        self.markObjectDirty(object.id) catch |err| util.crash.oom(err);
     }
 
     pub fn setObjectColor(self: *Renderer, object: ObjectHandle, color: @Vector(4, f32)) void {
         self.objects.get(object.id).?.color = color;
+        self.markObjectDirty(object.id) catch |err| util.crash.oom(err);
+    }
+
+    fn markObjectDirty(self: *Renderer, object_id: ObjectId) error{OutOfMemory}!void {
+        if (object_id >= self.dirty_snapshots.items.len) {
+            const added = object_id + 1 - self.dirty_snapshots.items.len;
+            try self.dirty_snapshots.ensureUnusedCapacity(self.allocator, added);
+            try self.object_versions.ensureUnusedCapacity(self.allocator, added);
+            self.dirty_snapshots.appendNTimesAssumeCapacity(0, added);
+            self.object_versions.appendNTimesAssumeCapacity(0, added);
+        }
+        self.object_versions.items[object_id] +%= 1;
+        self.scene_changed = true;
+
+        const dirty = &self.dirty_snapshots.items[object_id];
+        for (0..SNAPSHOT_COUNT) |index| {
+            const bit = @as(u8, 1) << @intCast(index);
+            if (dirty.* & bit != 0) continue;
+            try self.dirty_objects[index].append(self.allocator, object_id);
+            dirty.* |= bit;
+        }
+    }
+
+    // copies the objects that changed since the snapshot was last built into it
+    fn updateSnapshotObjects(self: *Renderer, snapshot: *Snapshot, index: usize) error{OutOfMemory}!void {
+        const object_count = self.dirty_snapshots.items.len;
+        if (snapshot.versions.items.len < object_count) {
+            const added = object_count - snapshot.versions.items.len;
+            try snapshot.objects.ensureUnusedCapacity(self.allocator, added);
+            try snapshot.versions.ensureUnusedCapacity(self.allocator, added);
+            snapshot.objects.appendNTimesAssumeCapacity(undefined, added);
+            snapshot.versions.appendNTimesAssumeCapacity(0, added);
+        }
+
+        const bit = @as(u8, 1) << @intCast(index);
+        for (self.dirty_objects[index].items) |object_id| {
+            // the bit is cleared when an object is deleted, and duplicates are skipped after the first
+            const dirty = &self.dirty_snapshots.items[object_id];
+            if (dirty.* & bit == 0) continue;
+            dirty.* &= ~bit;
+
+            const object = self.objects.get(object_id).?;
+            const material = self.materials.get(object.material.id).?;
+            const color = object.color * material.color;
+            const data = &snapshot.objects.items[object_id];
+            @memcpy(&data.transform, object.transform.ptr());
+            data.color = .{ color[0], color[1], color[2], color[3] };
+            data.uv_rect = material.uv_rect;
+            // images are at their own id in the texture table
+            data.texture = material.image;
+            snapshot.versions.items[object_id] = self.object_versions.items[object_id];
+        }
+        self.dirty_objects[index].clearRetainingCapacity();
     }
 
     pub fn deleteObject(self: *Renderer, object: ObjectHandle) void {
         const obj = self.objects.get(object.id).?;
-        const collection = &self.render_collections[obj.render_order];
-        const material_pass_id = collection.material_passes.get(obj.material.id).?;
-        const material_pass = self.material_passes.get(material_pass_id).?;
-        const mesh_pass_id = material_pass.mesh_passes.get(obj.mesh).?;
-        const mesh_pass = self.mesh_passes.get(mesh_pass_id).?;
+        const mesh_pass = self.objectMeshPass(&self.render_collections[obj.render_order], obj);
         std.debug.assert(mesh_pass.objects.delete(object.id));
         self.objects.delete(object.id) catch unreachable;
+        self.dirty_snapshots.items[object.id] = 0;
+        self.scene_changed = true;
         self.unrefMaterial(obj.material);
     }
 
@@ -265,6 +1017,8 @@ pub const Renderer = struct {
                 while (objects.next()) |object_id| {
                     const object = self.objects.get(object_id).?;
                     self.objects.delete(object_id) catch unreachable;
+                    self.dirty_snapshots.items[object_id] = 0;
+                    self.scene_changed = true;
                     self.unrefMaterial(object.material);
                 }
                 mesh_pass.objects.clear();
@@ -282,25 +1036,27 @@ pub const Renderer = struct {
         const mat = self.materials.get(material.id).?;
         if (!(mat.object_count == 0 and mat.material_dropped)) return;
 
+        // passes are shared by every material with the same key, so they stay until none has
+        // objects
+        const key = self.passKey(mat);
         for (&self.render_collections) |*collection| {
-            const material_pass_id = collection.material_passes.get(material.id) orelse continue;
+            const material_pass_id = collection.material_passes.get(key) orelse continue;
             const material_pass = self.material_passes.get(material_pass_id).?;
-            defer {
-                material_pass.deinit();
-                _ = collection.material_passes.remove(material.id);
-            }
+            if (!self.materialPassEmpty(material_pass)) continue;
 
-            var mesh_it = material_pass.mesh_passes.iterator();
-            while (mesh_it.next()) |entry| {
-                const mesh_pass = self.mesh_passes.get(entry.value_ptr.*).?;
-                std.debug.assert(mesh_pass.objects.count == 0);
+            var mesh_it = material_pass.mesh_passes.valueIterator();
+            while (mesh_it.next()) |mesh_pass_id| {
+                const mesh_pass = self.mesh_passes.get(mesh_pass_id.*).?;
                 mesh_pass.deinit(self.allocator);
+                self.mesh_passes.delete(mesh_pass_id.*) catch unreachable;
             }
 
-            std.debug.assert(collection.material_passes.remove(material.id));
+            material_pass.deinit();
+            self.material_passes.delete(material_pass_id) catch unreachable;
+            std.debug.assert(collection.material_passes.remove(key));
         }
 
-        ffi.delete_material(self.handle, &mat.handle);
+        self.dead_materials.append(self.allocator, .{ .handle = mat.handle, .generation = self.generation + 1 }) catch |err| util.crash.oom(err);
         self.materials.delete(material.id) catch unreachable;
     }
 
@@ -309,66 +1065,258 @@ pub const Renderer = struct {
         self.deleteMaterialIfUnreferenced(material);
     }
 
-    pub fn createImage(self: *Renderer, image_data: []const u8, width: i32, height: i32) ImageHandle {
-        const id = ffi.create_image(self.handle, @ptrCast(@constCast(image_data.ptr)), width, height);
+    // whether RGBA8 pixels all have full alpha, for ImageRegion.fully_opaque
+    pub fn opaquePixels(pixels: []const u8) bool {
+        var i: usize = 3;
+        while (i < pixels.len) : (i += 4) {
+            if (pixels[i] != 0xFF) return false;
+        }
+        return true;
+    }
+
+    // the image gets a full mip chain, or at most max_mip_levels levels if that's nonzero
+    pub fn createImage(self: *Renderer, image_data: []const u8, width: i32, height: i32, max_mip_levels: u32) ImageHandle {
+        self.context_lock.lock();
+        defer self.context_lock.unlock();
+        const id = ffi.create_image(self.handle, @ptrCast(@constCast(image_data.ptr)), width, height, max_mip_levels);
         return ImageHandle{ .id = id };
     }
 
-    pub fn render(self: *Renderer, window: *const Window, ui_view_projection: *const Mat4, world_view_projection: *const Mat4) !void {
-        _ = world_view_projection;
+    pub fn supportsCompressedFormat(self: *Renderer, format: CompressedFormat) bool {
+        self.context_lock.lock();
+        defer self.context_lock.unlock();
+        return ffi.supports_compressed_format(self.handle, @intFromEnum(format));
+    }
 
-        if (!ffi.begin_render(self.handle)) {
-            if (comptime builtin.os.tag == .macos) {
-                return;
+    // `data` holds every mip level back to back, largest first. The format must be supported.
+    pub fn createCompressedImage(self: *Renderer, format: CompressedFormat, data: []const u8, width: i32, height: i32, mip_levels: u32) ImageHandle {
+        self.context_lock.lock();
+        defer self.context_lock.unlock();
+        const id = ffi.create_compressed_image(self.handle, @intFromEnum(format), data.ptr, data.len, width, height, mip_levels);
+        return ImageHandle{ .id = id };
+    }
+
+    // builds a snapshot of the objects as they are now, for the target to draw from then on. width
+    // and height are the window's, which the swapchain is resized to along with the snapshot.
+    // when nothing changed since the last snapshot, none is published, so the target has nothing
+    // new to draw and the last frame stays on screen
+    pub fn publish(self: *Renderer, view_projection: *const Mat4, width: i32, height: i32) error{OutOfMemory}!void {
+        self.releaseDead(@atomicLoad(u64, &self.target.retired_generation, .acquire));
+        if (self.pollPendingMaterials()) self.scene_changed = true;
+
+        // frames are still drawn while anything deleted waits on them, so it's released without
+        // waiting for the next change
+        const releasing = self.dead_meshes.items.len > 0 or self.dead_materials.items.len > 0;
+        if (!self.scene_changed and !releasing) {
+            if (self.published_view) |*view| {
+                if (view.eql(view_projection, width, height)) return;
             }
+        }
 
-            ffi.recreate_swapchain(self.handle, window.getWidth(), window.getHeight(), window.surface());
+        const index = self.target.snapshots.back;
+        const snapshot = &self.target.snapshots.snapshots[index];
+        try self.updateSnapshotObjects(snapshot, index);
+        try self.buildBatches(snapshot, view_projection);
+        snapshot.view_projection = view_projection.*;
+        snapshot.width = width;
+        snapshot.height = height;
+        self.generation += 1;
+        snapshot.generation = self.generation;
+        self.target.snapshots.publish();
+
+        self.scene_changed = false;
+        self.published_view = .{ .view_projection = view_projection.*, .width = width, .height = height };
+    }
 
-            if (!ffi.begin_render(self.handle)) {
-                return error.RenderFailed;
+    // marks the pending materials whose image has uploaded as ready, and returns whether there were
+    // any. objects only join batches once their material is ready, since with bindless textures
+    // they share draws with objects whose images were uploaded long ago.
+    fn pollPendingMaterials(self: *Renderer) bool {
+        if (self.pending_materials.items.len == 0) return false;
+
+        self.context_lock.lock();
+        defer self.context_lock.unlock();
+
+        var any_ready = false;
+        var i: usize = 0;
+        while (i < self.pending_materials.items.len) {
+            // deleted materials are dropped, and ids reused by newer ones are pending twice
+            const mat = self.materials.get(self.pending_materials.items[i]) orelse {
+                _ = self.pending_materials.swapRemove(i);
+                continue;
+            };
+            if (!mat.ready and !ffi.material_ready(self.handle, &mat.handle)) {
+                i += 1;
+                continue;
             }
+            mat.ready = true;
+            any_ready = true;
+            _ = self.pending_materials.swapRemove(i);
         }
+        return any_ready;
+    }
 
-        ffi.set_pipeline(self.handle, 0); // pipeline id not currently used
+    // releases the meshes and materials no snapshot from the given generation on draws
+    fn releaseDead(self: *Renderer, retired_generation: u64) void {
+        const dead_meshes = self.dead_meshes.items;
+        const dead_materials = self.dead_materials.items;
+        if (dead_meshes.len == 0 and dead_materials.len == 0) return;
 
-        for (&self.render_collections) |*collection| {
-            var material_passes = collection.material_passes.iterator();
-            while (material_passes.next()) |mat| {
-                const mat_id = mat.key_ptr.*;
-                const mat_pass_id = mat.value_ptr.*;
+        self.context_lock.lock();
+        defer self.context_lock.unlock();
+
+        // deleted in generation order, so whatever can be released is at the front
+        var meshes: usize = 0;
+        while (meshes < dead_meshes.len and dead_meshes[meshes].generation <= retired_generation) : (meshes += 1) {
+            ffi.delete_mesh(self.handle, &dead_meshes[meshes].handle);
+        }
+        self.dead_meshes.replaceRangeAssumeCapacity(0, meshes, &.{});
+
+        var materials: usize = 0;
+        while (materials < dead_materials.len and dead_materials[materials].generation <= retired_generation) : (materials += 1) {
+            ffi.delete_material(self.handle, &dead_materials[materials].handle);
+        }
+        self.dead_materials.replaceRangeAssumeCapacity(0, materials, &.{});
+    }
 
-                const material = self.materials.get(mat_id).?;
-                ffi.set_material(self.handle, &material.handle);
+    fn buildBatches(self: *Renderer, snapshot: *Snapshot, view_projection: *const Mat4) error{OutOfMemory}!void {
+        snapshot.batches.clearRetainingCapacity();
+        snapshot.instances.clearRetainingCapacity();
+
+        // with a depth buffer, passes only draw their opaque objects, and the transparent ones are
+        // drawn after all of them. without one, everything is blended in pass order.
+        const blend_mode: ffi.BlendMode = if (self.depth_buffer) ffi.BLEND_MODE_OPAQUE else ffi.BLEND_MODE_TRANSPARENT;
+
+        for (&self.render_collections, &snapshot.layers) |*collection, *layer| {
+            const first_batch = snapshot.batches.items.len;
+            const first_instance = snapshot.instances.items.len;
+            self.transparent_keys.clearRetainingCapacity();
+
+            var material_passes = collection.material_passes.valueIterator();
+            while (material_passes.next()) |mat_pass_id| {
+                const material_pass = self.material_passes.get(mat_pass_id.*).?;
+                const material = self.passMaterial(material_pass) orelse continue;
 
-                const material_pass = self.material_passes.get(mat_pass_id).?;
                 var mesh_passes = material_pass.mesh_passes.iterator();
                 while (mesh_passes.next()) |mesh_entry| {
                     const mesh_id = mesh_entry.key_ptr.*;
-                    const mesh_pass_id = mesh_entry.value_ptr.*;
-
-                    const mesh = self.meshes.get(mesh_id).?;
-                    ffi.set_mesh(self.handle, mesh);
+                    const mesh_pass = self.mesh_passes.get(mesh_entry.value_ptr.*).?;
+                    const batch_start = snapshot.instances.items.len;
 
-                    const mesh_pass = self.mesh_passes.get(mesh_pass_id).?;
                     var it = mesh_pass.objects.iterator();
-                    while (it.next()) |instance| {
-                        const object = self.objects.get(instance).?;
-                        const transform = ui_view_projection.matmul(&object.transform);
-                        var push_constants: ffi.PushConstants = undefined;
-                        @memcpy(&push_constants.transform, transform.ptr());
-                        const color = material.color * object.color;
-                        push_constants.color = .{ color[0], color[1], color[2], color[3] };
-                        ffi.render_object(self.handle, &push_constants);
+                    if (self.depth_buffer) {
+                        self.opaque_keys.clearRetainingCapacity();
+                        while (it.next()) |instance| {
+                            if (!self.objectReady(instance)) continue;
+                            const key = self.depthKey(instance, view_projection);
+                            if (self.objectOpaque(instance)) {
+                                try self.opaque_keys.append(self.allocator, key);
+                            } else {
+                                try self.transparent_keys.append(self.allocator, key);
+                            }
+                        }
+
+                        // nearer objects fill in the depth buffer first, so less of what they hide
+                        // is shaded
+                        std.mem.sort(DepthKey, self.opaque_keys.items, {}, DepthKey.nearerFirst);
+                        for (self.opaque_keys.items) |key| {
+                            try snapshot.instances.append(self.allocator, key.object);
+                        }
+                    } else {
+                        while (it.next()) |instance| {
+                            if (!self.objectReady(instance)) continue;
+                            try snapshot.instances.append(self.allocator, instance);
+                        }
                     }
+
+                    try self.appendBatch(snapshot, material, mesh_id, blend_mode, batch_start);
                 }
             }
+
+            if (self.depth_buffer) {
+                try self.appendTransparentBatches(snapshot);
+            }
+
+            layer.* = .{
+                .first_batch = @intCast(first_batch),
+                .batch_count = @intCast(snapshot.batches.items.len - first_batch),
+                .instance_count = @intCast(snapshot.instances.items.len - first_instance),
+            };
         }
+    }
 
-        ffi.end_render(self.handle);
+    // draws the layer's transparent objects from back to front, so each blends over whatever is
+    // behind it. consecutive objects with the same pass key and mesh share a batch.
+    fn appendTransparentBatches(self: *Renderer, snapshot: *Snapshot) error{OutOfMemory}!void {
+        const keys = self.transparent_keys.items;
+        std.mem.sort(DepthKey, keys, {}, DepthKey.fartherFirst);
+
+        var start: usize = 0;
+        while (start < keys.len) {
+            const first = self.objects.get(keys[start].object).?;
+            const material = self.materials.get(first.material.id).?;
+            var end = start + 1;
+            while (end < keys.len) : (end += 1) {
+                const object = self.objects.get(keys[end].object).?;
+                if (object.mesh != first.mesh) break;
+                if (self.passKey(self.materials.get(object.material.id).?) != self.passKey(material)) break;
+            }
+
+            const batch_start = snapshot.instances.items.len;
+            for (keys[start..end]) |key| {
+                try snapshot.instances.append(self.allocator, key.object);
+            }
+            try self.appendBatch(snapshot, material, first.mesh, ffi.BLEND_MODE_TRANSPARENT, batch_start);
+            start = end;
+        }
+    }
+
+    // batches the instances added since first_instance, if there are any
+    fn appendBatch(self: *Renderer, snapshot: *Snapshot, material: *const Material, mesh_id: MeshId, blend_mode: ffi.BlendMode, first_instance: usize) error{OutOfMemory}!void {
+        const instance_count = snapshot.instances.items.len - first_instance;
+        if (instance_count == 0) return;
+        const mesh = self.meshes.get(mesh_id).?;
+        mesh.drawn = true;
+        try snapshot.batches.append(self.allocator, .{
+            .pass_key = self.passKey(material),
+            .material = material.handle,
+            .mesh = mesh.handle,
+            .blend_mode = blend_mode,
+            .first_instance = @intCast(first_instance),
+            .instance_count = @intCast(instance_count),
+        });
+    }
+
+    fn objectReady(self: *Renderer, object_id: ObjectId) bool {
+        const object = self.objects.get(object_id).?;
+        return self.materials.get(object.material.id).?.ready;
+    }
+
+    // materials are batched by the key of their pass. with bindless textures each instance names
+    // its own image, so every material shares one pass and batches only split by mesh and blend
+    // mode. otherwise a batch's image is bound with its material, so each image has a pass.
+    fn passKey(self: *const Renderer, material: *const Material) ImageId {
+        return if (self.bindless_textures) ALL_IMAGES else material.image;
     }
 
-    fn getOrInsertMaterialPass(self: *Renderer, collection: *RenderCollection, material_id: MaterialId) error{OutOfMemory}!*MaterialPass {
-        if (collection.material_passes.get(material_id)) |mat_pass_id| {
+    // whether the object covers what's behind it, from its alpha and its material's image
+    fn objectOpaque(self: *Renderer, object_id: ObjectId) bool {
+        const object = self.objects.get(object_id).?;
+        const material = self.materials.get(object.material.id).?;
+        return material.fully_opaque and object.color[3] * material.color[3] >= 1.0;
+    }
+
+    // sorts by the clip-space depth of the object's origin. objects whose origin is behind the eye
+    // sort as farthest.
+    fn depthKey(self: *Renderer, object_id: ObjectId, view_projection: *const Mat4) DepthKey {
+        const object = self.objects.get(object_id).?;
+        const clip = view_projection.vecmul(object.transform.column(3));
+        const depth = if (clip[3] > 0.0) clip[2] / clip[3] else std.math.inf(f32);
+        return .{ .depth = depth, .object = object_id };
+    }
+
+    fn getOrInsertMaterialPass(self: *Renderer, collection: *RenderCollection, key: ImageId) error{OutOfMemory}!*MaterialPass {
+        if (collection.material_passes.get(key)) |mat_pass_id| {
             return self.material_passes.get(mat_pass_id).?;
         } else {
             var new_pass = MaterialPass.init(self.allocator);
@@ -377,11 +1325,38 @@ pub const Renderer = struct {
             const mat_pass_id, const result = try self.material_passes.insert(new_pass);
             errdefer self.material_passes.delete(mat_pass_id) catch unreachable;
 
-            try collection.material_passes.put(material_id, @intCast(mat_pass_id));
+            try collection.material_passes.put(key, @intCast(mat_pass_id));
             return result;
         }
     }
 
+    fn objectMeshPass(self: *Renderer, collection: *const RenderCollection, object: *const Object) *MeshPass {
+        const key = self.passKey(self.materials.get(object.material.id).?);
+        const material_pass = self.material_passes.get(collection.material_passes.get(key).?).?;
+        return self.mesh_passes.get(material_pass.mesh_passes.get(object.mesh).?).?;
+    }
+
+    // the material of any object in the pass. every material in a pass has the same pipeline, and
+    // binds the same image unless textures are bindless, so it stands in for all of them.
+    fn passMaterial(self: *Renderer, pass: *const MaterialPass) ?*Material {
+        var mesh_passes = pass.mesh_passes.valueIterator();
+        while (mesh_passes.next()) |mesh_pass_id| {
+            var objects = self.mesh_passes.get(mesh_pass_id.*).?.objects.iterator();
+            if (objects.next()) |object_id| {
+                return self.materials.get(self.objects.get(object_id).?.material.id).?;
+            }
+        }
+        return null;
+    }
+
+    fn materialPassEmpty(self: *Renderer, pass: *const MaterialPass) bool {
+        var mesh_passes = pass.mesh_passes.valueIterator();
+        while (mesh_passes.next()) |mesh_pass_id| {
+            if (!self.mesh_passes.get(mesh_pass_id.*).?.objects.empty()) return false;
+        }
+        return true;
+    }
+
     fn getOrInsertMeshPass(self: *Renderer, pass: *MaterialPass, mesh_id: MeshId) error{OutOfMemory}!*MeshPass {
         if (pass.mesh_passes.get(mesh_id)) |mesh_pass_id| {
             return self.mesh_passes.get(mesh_pass_id).?;
@@ -397,11 +1372,251 @@ pub const Renderer = struct {
         }
     }
 
-    pub fn handleResize(self: *Renderer, width: i32, height: i32, surface: *anyopaque) void {
-        ffi.recreate_swapchain(self.handle, width, height, surface);
+    // copies the oldest finished headless frame into pixels as RGBA8 rows and returns its frame
+    // number, or null if no frame finished since the last poll. Frames not polled before their
+    // slot is reused are dropped, so call this once per drawn snapshot to see every frame.
+    pub fn pollReadback(self: *Renderer, pixels: []u8) ?u64 {
+        self.context_lock.lock();
+        defer self.context_lock.unlock();
+        var frame_number: u64 = undefined;
+        if (!ffi.poll_readback(self.handle, pixels.ptr, pixels.len, &frame_number)) {
+            return null;
+        }
+        return frame_number;
+    }
+
+    // copies the latest captured frame into out as a jpeg and returns its frame number, or null if
+    // none was captured yet or captures are off. doesn't wait on drawing.
+    pub fn latestCapture(self: *Renderer, out: *std.ArrayList(u8)) !?u64 {
+        const stream = self.target.capture orelse return null;
+        return stream.latest(self.allocator, out);
+    }
+
+    // waits for the context's lock, so for a frame's worth of drawing at worst
+    pub fn stats(self: *Renderer) Stats {
+        self.context_lock.lock();
+        defer self.context_lock.unlock();
+        var result = Stats{ .counters = undefined };
+        ffi.get_renderer_stats(self.handle, &result.counters);
+        return result;
+    }
+
+    // gpu time of the latest drawn frame with resolved timestamps, without waiting on the lock
+    pub fn gpuFrameNs(self: *const Renderer) u64 {
+        return @atomicLoad(u64, &self.target.gpu_frame_ns, .monotonic);
     }
 
     pub fn waitIdle(self: *Renderer) void {
+        self.context_lock.lock();
+        defer self.context_lock.unlock();
         ffi.wait_idle(self.handle);
     }
 };
+
+const testing = std.testing;
+
+test "Takes the snapshot last published" {
+    var buffer: SnapshotBuffer = .{};
+    buffer.snapshots[buffer.back].generation = 1;
+    buffer.publish();
+
+    try testing.expect(buffer.take());
+    try testing.expectEqual(@as(u64, 1), buffer.snapshots[buffer.front].generation);
+    // nothing newer was published
+    try testing.expect(!buffer.take());
+    try testing.expectEqual(@as(u64, 1), buffer.snapshots[buffer.front].generation);
+}
+
+test "Skips snapshots published before the newest" {
+    var buffer: SnapshotBuffer = .{};
+    for (1..5) |generation| {
+        buffer.snapshots[buffer.back].generation = generation;
+        buffer.publish();
+    }
+
+    try testing.expect(buffer.take());
+    try testing.expectEqual(@as(u64, 4), buffer.snapshots[buffer.front].generation);
+    try testing.expect(!buffer.take());
+}
+
+test "Never hands the same snapshot to both threads" {
+    const Shared = struct {
+        buffer: SnapshotBuffer = .{},
+        // which thread is using each snapshot, 0 for neither
+        owners: [SNAPSHOT_COUNT]std.atomic.Value(u8) = [_]std.atomic.Value(u8){.init(0)} ** SNAPSHOT_COUNT,
+        done: std.atomic.Value(bool) = .init(false),
+
+        const builder = 1;
+        const drawer = 2;
+        const publishes = 100_000;
+
+        fn claim(self: *@This(), index: u8, thread: u8) void {
+            const previous = self.owners[index].cmpxchgStrong(0, thread, .acquire, .monotonic);
+            if (previous != null) std.debug.panic("snapshot {d} already used by thread {d}", .{ index, previous.? });
+        }
+
+        fn release(self: *@This(), index: u8) void {
+            self.owners[index].store(0, .release);
+        }
+
+        fn build(self: *@This()) void {
+            self.claim(self.buffer.back, builder);
+            for (1..publishes + 1) |generation| {
+                self.buffer.snapshots[self.buffer.back].generation = generation;
+                self.release(self.buffer.back);
+                self.buffer.publish();
+                self.claim(self.buffer.back, builder);
+            }
+            self.done.store(true, .release);
+        }
+
+        fn draw(self: *@This()) void {
+            var last: u64 = 0;
+            self.claim(self.buffer.front, drawer);
+            while (true) {
+                const finished = self.done.load(.acquire);
+                self.release(self.buffer.front);
+                const fresh = self.buffer.take();
+                self.claim(self.buffer.front, drawer);
+                if (fresh) {
+                    // each snapshot taken is newer than the last, and fully written
+                    const generation = self.buffer.snapshots[self.buffer.front].generation;
+                    if (generation <= last) std.debug.panic("took {d} after {d}", .{ generation, last });
+                    last = generation;
+                }
+                if (finished and !fresh) break;
+            }
+            if (last != publishes) std.debug.panic("last snapshot taken was {d}", .{last});
+        }
+    };
+
+    var shared: Shared = .{};
+    const draw_thread = try std.Thread.spawn(.{}, Shared.draw, .{&shared});
+    const build_thread = try std.Thread.spawn(.{}, Shared.build, .{&shared});
+    build_thread.join();
+    draw_thread.join();
+}
+
+test "Reads back a headless frame" {
+    var gpu = Gpu.initHeadless() catch return error.SkipZigTest;
+    defer gpu.deinit();
+    var context = try RenderContext.init(&gpu, null, .{});
+    defer context.deinit();
+    var renderer = Renderer.initHeadless(&context, 4, 4, testing.allocator, .{}) catch |err| switch (err) {
+        error.HeadlessUnsupported => return error.SkipZigTest,
+        else => return err,
+    };
+    defer renderer.deinit();
+
+    try renderer.publish(&Mat4.identity(), 4, 4);
+    {
+        context.lock.lock();
+        defer context.lock.unlock();
+        try testing.expect(renderer.target.takeSnapshot());
+        try renderer.target.draw();
+        context.submitFrames();
+    }
+    renderer.waitIdle();
+
+    var pixels: [4 * 4 * 4]u8 = undefined;
+    try testing.expectEqual(@as(?u64, 0), renderer.pollReadback(&pixels));
+    // each frame is only returned once
+    try testing.expectEqual(@as(?u64, null), renderer.pollReadback(&pixels));
+}
+
+test "Draws only the objects in view, with and without gpu culling" {
+    var gpu = Gpu.initHeadless() catch return error.SkipZigTest;
+    defer gpu.deinit();
+    var context = try RenderContext.init(&gpu, null, .{});
+    defer context.deinit();
+
+    for ([_]bool{ false, true }) |gpu_culling| {
+        var renderer = Renderer.initHeadless(&context, 4, 4, testing.allocator, .{ .gpu_culling = gpu_culling }) catch |err| switch (err) {
+            error.HeadlessUnsupported => return error.SkipZigTest,
+            else => return err,
+        };
+        defer renderer.deinit();
+
+        const white = renderer.createImage(&[_]u8{ 0xFF, 0xFF, 0xFF, 0xFF }, 1, 1, 0);
+        const material = try renderer.createUiMaterial(.{ .image = white, .fully_opaque = true }, 1.0, 1.0, 1.0, 1.0);
+        const mesh = try renderer.createMesh(TestVertex, &test_quad, u16, &[_]u16{ 0, 1, 2, 2, 3, 0 });
+        // the left half of the frame, a quad far to the right of it, and one scaled to nothing
+        _ = try renderer.addObject(mesh, Mat4.scale(.{ 2.0, 4.0, 1.0 }), material, 0);
+        _ = try renderer.addObject(mesh, Mat4.translate(.{ 100.0, 0.0, 0.0 }), material, 0);
+        _ = try renderer.addObject(mesh, Mat4.zero(), material, 0);
+
+        var pixels: [4 * 4 * 4]u8 = undefined;
+        try drawUploadedTestFrame(&renderer, &context, &pixels);
+        try expectLeftHalfLit(&pixels);
+    }
+}
+
+test "Draws a mesh streamed in parts with u32 indices" {
+    var gpu = Gpu.initHeadless() catch return error.SkipZigTest;
+    defer gpu.deinit();
+    var context = try RenderContext.init(&gpu, null, .{});
+    defer context.deinit();
+    var renderer = Renderer.initHeadless(&context, 4, 4, testing.allocator, .{}) catch |err| switch (err) {
+        error.HeadlessUnsupported => return error.SkipZigTest,
+        else => return err,
+    };
+    defer renderer.deinit();
+
+    const white = renderer.createImage(&[_]u8{ 0xFF, 0xFF, 0xFF, 0xFF }, 1, 1, 0);
+    const material = try renderer.createUiMaterial(.{ .image = white, .fully_opaque = true }, 1.0, 1.0, 1.0, 1.0);
+    const mesh = try renderer.createEmptyMesh(TestVertex, test_quad.len, u32, 6);
+    renderer.writeMeshVertices(mesh, TestVertex, 0, test_quad[0..2]);
+    renderer.writeMeshVertices(mesh, TestVertex, 2, test_quad[2..]);
+    renderer.writeMeshIndices(mesh, u32, 0, &[_]u32{ 0, 1, 2 });
+    renderer.writeMeshIndices(mesh, u32, 3, &[_]u32{ 2, 3, 0 });
+    _ = try renderer.addObject(mesh, Mat4.scale(.{ 2.0, 4.0, 1.0 }), material, 0);
+
+    var pixels: [4 * 4 * 4]u8 = undefined;
+    try drawUploadedTestFrame(&renderer, &context, &pixels);
+    try expectLeftHalfLit(&pixels);
+}
+
+const TestVertex = struct {
+    position: @Vector(3, f32) align(16),
+    tex_coord: @Vector(2, f32) align(8),
+};
+
+const test_quad = [_]TestVertex{
+    .{ .position = .{ 0.0, 0.0, 0.0 }, .tex_coord = .{ 0.0, 0.0 } },
+    .{ .position = .{ 1.0, 0.0, 0.0 }, .tex_coord = .{ 1.0, 0.0 } },
+    .{ .position = .{ 1.0, 1.0, 0.0 }, .tex_coord = .{ 1.0, 1.0 } },
+    .{ .position = .{ 0.0, 1.0, 0.0 }, .tex_coord = .{ 0.0, 1.0 } },
+};
+
+// draws frames of a 4x4 headless renderer until every object's image and mesh have uploaded,
+// which retire between frames, and reads back the last
+fn drawUploadedTestFrame(renderer: *Renderer, context: *RenderContext, pixels: []u8) !void {
+    const view_projection = Mat4.ortho(4.0, 4.0, -1.0, 1.0);
+    var frames: usize = 0;
+    while (true) : (frames += 1) {
+        try testing.expect(frames < 64);
+        try renderer.publish(&view_projection, 4, 4);
+        {
+            context.lock.lock();
+            defer context.lock.unlock();
+            _ = renderer.target.takeSnapshot();
+            try renderer.target.draw();
+            context.submitFrames();
+        }
+        renderer.waitIdle();
+        try testing.expect(renderer.pollReadback(pixels) != null);
+
+        const ready = renderer.pending_materials.items.len == 0;
+        if (ready and !@atomicLoad(bool, &renderer.target.incomplete, .monotonic)) return;
+    }
+}
+
+fn expectLeftHalfLit(pixels: []const u8) !void {
+    for (0..4) |y| {
+        for (0..4) |x| {
+            const pixel = pixels[(y * 4 + x) * 4 ..][0..3];
+            const expected: u8 = if (x < 2) 0xFF else 0x00;
+            try testing.expectEqualSlices(u8, &[_]u8{ expected, expected, expected }, pixel);
+        }
+    }
+}
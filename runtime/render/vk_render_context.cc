@@ -0,0 +1,559 @@
+#include "vk_render_context.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "ffi.h"
+#include "gpu/vulkan/status.h"
+#include "gpu/vulkan/swapchain.h"
+
+using namespace simulo;
+
+namespace {
+
+uint32_t frames_in_flight_from_options(const RenderContextOptions &options) {
+   if (options.frames_in_flight == 0) {
+      return kDefaultFramesInFlight;
+   }
+   return std::clamp(options.frames_in_flight, 1u, kMaxFramesInFlight);
+}
+
+// Grows a bounding box to fit the positions at the start of each vertex, which every vertex layout
+// stores as three floats. Boxes of vertices too small to hold one stay inverted and are never
+// culled.
+void expand_mesh_bounds(
+    std::span<const uint8_t> vertex_data, uint32_t vertex_size, float *bounds_min,
+    float *bounds_max
+) {
+   if (vertex_size < sizeof(float) * 3) {
+      return;
+   }
+
+   for (size_t offset = 0; offset < vertex_data.size(); offset += vertex_size) {
+      float position[3];
+      std::memcpy(position, vertex_data.data() + offset, sizeof(position));
+      for (int axis = 0; axis < 3; ++axis) {
+         bounds_min[axis] = std::min(bounds_min[axis], position[axis]);
+         bounds_max[axis] = std::max(bounds_max[axis], position[axis]);
+      }
+   }
+}
+
+// Format features needed to fill mip levels by blitting and to sample between them
+constexpr VkFormatFeatureFlags kMipBlitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                                  VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                                  VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+VkFormat vk_format(CompressedFormat format) {
+   switch (format) {
+   case COMPRESSED_FORMAT_BC7:
+      return VK_FORMAT_BC7_UNORM_BLOCK;
+   case COMPRESSED_FORMAT_ETC2_RGBA8:
+      return VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK;
+   case COMPRESSED_FORMAT_ASTC_4X4:
+      return VK_FORMAT_ASTC_4x4_UNORM_BLOCK;
+   }
+   throw std::runtime_error(std::format("unknown compressed format {}", (int)format));
+}
+
+// Halves RGBA8 pixels in each dimension with a 2x2 box filter. Odd edges repeat their last
+// texel, and dimensions already at 1 stay at 1.
+std::vector<uint8_t>
+downsample_rgba8(std::span<const uint8_t> src, uint32_t width, uint32_t height) {
+   uint32_t dst_width = std::max(1u, width / 2);
+   uint32_t dst_height = std::max(1u, height / 2);
+   std::vector<uint8_t> dst(static_cast<size_t>(dst_width) * dst_height * 4);
+
+   for (uint32_t y = 0; y < dst_height; ++y) {
+      uint32_t y0 = std::min(y * 2, height - 1);
+      uint32_t y1 = std::min(y * 2 + 1, height - 1);
+      for (uint32_t x = 0; x < dst_width; ++x) {
+         uint32_t x0 = std::min(x * 2, width - 1);
+         uint32_t x1 = std::min(x * 2 + 1, width - 1);
+         for (uint32_t c = 0; c < 4; ++c) {
+            uint32_t sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c] +
+                           src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+            dst[(y * dst_width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+         }
+      }
+   }
+   return dst;
+}
+
+} // namespace
+
+RenderContext::RenderContext(Gpu &gpu, const RenderContextOptions &options)
+    : gpu_(gpu),
+      device_(gpu_),
+      allocator_(device_.handle(), gpu_),
+      vertex_buffers_(allocator_, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, kVertexBlockSize),
+      index_buffers_(allocator_, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, kIndexBlockSize),
+      pipeline_cache_(
+          device_.handle(), gpu_,
+          options.pipeline_cache_path == nullptr ? "" : options.pipeline_cache_path
+      ),
+      images_(4),
+      texture_table_(
+          device_.handle(),
+          gpu_.supports_descriptor_indexing()
+              ? std::min(kMaxTextures, gpu_.max_bindless_textures())
+              : kMaxTextures,
+          gpu_.supports_descriptor_indexing()
+      ),
+      staging_buffer_(kStagingBufferSize, allocator_),
+      upload_queue_(
+          device_.handle(), device_.transfer_queue(), gpu_.transfer_queue(),
+          gpu_.has_dedicated_transfer_queue()
+      ),
+      frames_in_flight_(frames_in_flight_from_options(options)),
+      frame_slot_(0),
+      frame_fences_{} {
+   // Uncompressed images are RGBA8, and compressed formats are only accepted with linear
+   // filtering, so RGBA8 decides whether the shared sampler can filter
+   bool linear = gpu_.supports_format(
+       VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+   );
+   VkSamplerCreateInfo sampler_create = {
+       .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+       .magFilter = linear ? VK_FILTER_LINEAR : VK_FILTER_NEAREST,
+       .minFilter = linear ? VK_FILTER_LINEAR : VK_FILTER_NEAREST,
+       .mipmapMode = linear ? VK_SAMPLER_MIPMAP_MODE_LINEAR : VK_SAMPLER_MIPMAP_MODE_NEAREST,
+       .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+       .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+       .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+       .minLod = 0.0f,
+       .maxLod = VK_LOD_CLAMP_NONE,
+   };
+   VKAD_VK(vkCreateSampler(device_.handle(), &sampler_create, nullptr, &sampler_));
+
+   VkFenceCreateInfo fence_create = {
+       .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, .flags = VK_FENCE_CREATE_SIGNALED_BIT
+   };
+   for (uint32_t i = 0; i < frames_in_flight_; ++i) {
+      VKAD_VK(vkCreateFence(device_.handle(), &fence_create, nullptr, &frame_fences_[i]));
+   }
+}
+
+RenderContext::~RenderContext() {
+   device_.wait_idle();
+   upload_queue_.poll();
+   pipeline_cache_.save();
+
+   for (uint32_t i = 0; i < frames_in_flight_; ++i) {
+      vkDestroyFence(device_.handle(), frame_fences_[i], nullptr);
+   }
+   vkDestroySampler(device_.handle(), sampler_, nullptr);
+}
+
+bool RenderContext::supports_surface(VkSurfaceKHR surface) const {
+   if (!Swapchain::is_supported_on(gpu_.physical_device(), surface)) {
+      return false;
+   }
+   VkBool32 supported = VK_FALSE;
+   VKAD_VK(vkGetPhysicalDeviceSurfaceSupportKHR(
+       gpu_.physical_device(), gpu_.present_queue(), surface, &supported
+   ));
+   return supported == VK_TRUE;
+}
+
+RenderImage RenderContext::create_image(
+    std::span<uint8_t> img_data, int width, int height, uint32_t max_mip_levels
+) {
+   uint32_t mip_levels = Image::full_mip_chain(width, height);
+   if (max_mip_levels > 0) {
+      mip_levels = std::min(mip_levels, max_mip_levels);
+   }
+   int image_id = images_.emplace(
+       allocator_,
+       VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+           VK_IMAGE_USAGE_SAMPLED_BIT,
+       VK_FORMAT_R8G8B8A8_UNORM, width, height, mip_levels
+   );
+   Image &image = images_.get(image_id);
+
+   bool transfer_only = upload_queue_.transfer_only();
+   image.queue_transfer_layout(
+       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, upload_queue_.commands(), transfer_only
+   );
+   upload_texture(img_data, image, 0);
+
+   // Blits need a queue with graphics support. Uploads on a dedicated transfer queue downsample
+   // on the CPU and copy every level instead.
+   bool blit_mips =
+       !transfer_only && gpu_.supports_format(VK_FORMAT_R8G8B8A8_UNORM, kMipBlitFeatures);
+   if (blit_mips) {
+      // The copy may have been split across several batches, so record into whichever is current
+      image.queue_generate_mips(upload_queue_.commands());
+   } else {
+      std::vector<uint8_t> level_data;
+      std::span<const uint8_t> previous = img_data;
+      for (uint32_t level = 1; level < mip_levels; ++level) {
+         level_data = downsample_rgba8(
+             previous, image.level_width(level - 1), image.level_height(level - 1)
+         );
+         upload_texture(level_data, image, level);
+         previous = level_data;
+      }
+      image.queue_transfer_layout(
+          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, upload_queue_.commands(), transfer_only
+      );
+   }
+
+   return register_image(image_id);
+}
+
+RenderImage RenderContext::create_compressed_image(
+    std::span<const uint8_t> data, CompressedFormat format, int width, int height,
+    uint32_t mip_levels
+) {
+   if (!supports_compressed_format(format)) {
+      throw std::runtime_error(std::format("compressed format {} isn't supported", (int)format));
+   }
+
+   int image_id = images_.emplace(
+       allocator_, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+       vk_format(format), width, height, mip_levels
+   );
+   Image &image = images_.get(image_id);
+
+   VkDeviceSize total_size = 0;
+   for (uint32_t level = 0; level < mip_levels; ++level) {
+      total_size += image.level_size(level);
+   }
+   if (data.size() < total_size) {
+      images_.release(image_id);
+      throw std::runtime_error(std::format(
+          "compressed image has {} bytes but its {} levels need {}", data.size(), mip_levels,
+          total_size
+      ));
+   }
+
+   bool transfer_only = upload_queue_.transfer_only();
+   image.queue_transfer_layout(
+       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, upload_queue_.commands(), transfer_only
+   );
+   VkDeviceSize offset = 0;
+   for (uint32_t level = 0; level < mip_levels; ++level) {
+      VkDeviceSize size = image.level_size(level);
+      upload_texture(data.subspan(offset, size), image, level);
+      offset += size;
+   }
+   image.queue_transfer_layout(
+       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, upload_queue_.commands(), transfer_only
+   );
+
+   return register_image(image_id);
+}
+
+bool RenderContext::supports_compressed_format(CompressedFormat format) const {
+   return gpu_.supports_format(
+       vk_format(format),
+       VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+   );
+}
+
+RenderImage RenderContext::register_image(int image_id) {
+   Image &image = images_.get(image_id);
+   if (image_id >= image_tickets_.size()) {
+      image_tickets_.resize(image_id + 1);
+   }
+   image_tickets_[image_id] = upload_queue_.pending_ticket();
+
+   image.init_view();
+
+   if (image_id >= texture_table_.capacity()) {
+      throw std::runtime_error(
+          std::format("texture table is full at {} textures", texture_table_.capacity())
+      );
+   }
+   texture_table_.write(image_id, sampler_, image);
+   return static_cast<RenderImage>(image_id);
+}
+
+Mesh RenderContext::create_mesh(
+    VkDeviceSize vertex_data_size, uint32_t vertex_size, uint32_t index_count,
+    IndexType index_type
+) {
+   VKAD_ASSERT(vertex_size > 0, "vertex size must be > 0");
+   VKAD_ASSERT(
+       vertex_data_size % vertex_size == 0, "vertex data isn't a whole number of vertices"
+   );
+
+   // Without fullDrawIndexUint32, 32-bit indices are limited to 24 bits
+   VkDeviceSize vertex_count = vertex_data_size / vertex_size;
+   VkDeviceSize max_index = gpu_.properties().limits.maxDrawIndexedIndexValue;
+   if (vertex_count > max_index + 1) {
+      throw std::runtime_error(std::format(
+          "mesh has {} vertices but the device can only index {}", vertex_count, max_index + 1
+      ));
+   }
+
+   // Vertex ranges start on a whole vertex so they can be addressed with vertexOffset, and index
+   // ranges on a whole index for firstIndex
+   VkDeviceSize index_size = index_type_size(index_type);
+   MeshBufferRange vertices = vertex_buffers_.allocate(vertex_data_size, vertex_size);
+   MeshBufferRange indices = index_buffers_.allocate(index_count * index_size, index_size);
+
+   Mesh mesh = {
+       .vertex_block = vertices.block,
+       .index_block = indices.block,
+       .vertex_offset = static_cast<int32_t>(vertices.offset / vertex_size),
+       .first_index = static_cast<uint32_t>(indices.offset / index_size),
+       .vertex_size = vertex_size,
+       .num_indices = index_count,
+       .index_type = index_type,
+       .vertex_data_size = vertex_data_size,
+       .upload_ticket = upload_queue_.pending_ticket(),
+   };
+   for (int axis = 0; axis < 3; ++axis) {
+      mesh.bounds_min[axis] = std::numeric_limits<float>::max();
+      mesh.bounds_max[axis] = std::numeric_limits<float>::lowest();
+   }
+   return mesh;
+}
+
+void RenderContext::free_mesh(const Mesh &mesh) {
+   vertex_buffers_.free({
+       .block = mesh.vertex_block,
+       .offset = static_cast<VkDeviceSize>(mesh.vertex_offset) * mesh.vertex_size,
+   });
+   index_buffers_.free({
+       .block = mesh.index_block,
+       .offset = mesh.first_index * index_type_size(mesh.index_type),
+   });
+}
+
+void RenderContext::write_mesh_vertices(
+    Mesh &mesh, VkDeviceSize offset, std::span<const uint8_t> vertex_data
+) {
+   VKAD_ASSERT(
+       offset % mesh.vertex_size == 0 && vertex_data.size() % mesh.vertex_size == 0,
+       "mesh vertices must be written whole"
+   );
+   VKAD_ASSERT(
+       offset + vertex_data.size() <= mesh.vertex_data_size,
+       "mesh vertices written past the range the mesh was created with"
+   );
+   upload_buffer(
+       vertex_buffers_.buffer(mesh.vertex_block),
+       static_cast<VkDeviceSize>(mesh.vertex_offset) * mesh.vertex_size + offset,
+       vertex_data.data(), vertex_data.size()
+   );
+   expand_mesh_bounds(vertex_data, mesh.vertex_size, mesh.bounds_min, mesh.bounds_max);
+   mesh.upload_ticket = upload_queue_.pending_ticket();
+}
+
+void RenderContext::write_mesh_indices(
+    Mesh &mesh, uint32_t first_index, std::span<const uint8_t> index_data
+) {
+   VkDeviceSize index_size = index_type_size(mesh.index_type);
+   VKAD_ASSERT(index_data.size() % index_size == 0, "mesh indices must be written whole");
+   VKAD_ASSERT(
+       first_index + index_data.size() / index_size <= mesh.num_indices,
+       "mesh indices written past the range the mesh was created with"
+   );
+   upload_buffer(
+       index_buffers_.buffer(mesh.index_block), (mesh.first_index + first_index) * index_size,
+       index_data.data(), index_data.size()
+   );
+   mesh.upload_ticket = upload_queue_.pending_ticket();
+}
+
+VkDeviceSize RenderContext::reserve_staging(VkDeviceSize size) {
+   // Buffer-to-image copies need offsets aligned to the texel size
+   const VkDeviceSize alignment = 16;
+
+   if (size > staging_buffer_.capacity()) {
+      throw std::runtime_error(std::format(
+          "upload of {} bytes exceeds staging capacity of {}", size, staging_buffer_.capacity()
+      ));
+   }
+
+   while (true) {
+      std::optional<VkDeviceSize> offset =
+          staging_buffer_.allocate(size, alignment, upload_queue_.pending_ticket());
+      if (offset.has_value()) {
+         return *offset;
+      }
+
+      // Only wait for the oldest uploads still holding staging memory instead of draining the
+      // whole queue. wait() submits the current batch if that's the one holding it.
+      upload_queue_.wait(staging_buffer_.oldest_ticket());
+      staging_buffer_.release(upload_queue_.retired());
+   }
+}
+
+void RenderContext::upload_buffer(
+    VkBuffer dst, VkDeviceSize dst_offset, const uint8_t *data, VkDeviceSize size
+) {
+   for (VkDeviceSize copied = 0; copied < size;) {
+      VkDeviceSize chunk_size = std::min(size - copied, kStagingChunkSize);
+      VkDeviceSize staging_offset = reserve_staging(chunk_size);
+      staging_buffer_.write(staging_offset, data + copied, chunk_size);
+
+      VkBufferCopy copy_region = {
+          .srcOffset = staging_offset,
+          .dstOffset = dst_offset + copied,
+          .size = chunk_size,
+      };
+      vkCmdCopyBuffer(upload_queue_.commands(), staging_buffer_.buffer(), dst, 1, &copy_region);
+      copied += chunk_size;
+   }
+}
+
+void RenderContext::upload_texture(std::span<const uint8_t> data, Image &image, uint32_t level) {
+   const FormatBlock block = format_block(image.format());
+   const uint32_t width = image.level_width(level);
+   const uint32_t height = image.level_height(level);
+   const uint32_t block_rows = (height + block.height - 1) / block.height;
+   const VkDeviceSize row_size =
+       static_cast<VkDeviceSize>((width + block.width - 1) / block.width) * block.size;
+   const uint32_t rows_per_chunk =
+       static_cast<uint32_t>(std::max<VkDeviceSize>(1, kStagingChunkSize / row_size));
+
+   for (uint32_t row = 0; row < block_rows;) {
+      uint32_t num_rows = std::min(block_rows - row, rows_per_chunk);
+      VkDeviceSize chunk_size = num_rows * row_size;
+      VkDeviceSize staging_offset = reserve_staging(chunk_size);
+      staging_buffer_.write(staging_offset, data.data() + row * row_size, chunk_size);
+
+      // Extents are in texels, and may stop short of a whole block at the edge of the image
+      uint32_t y = row * block.height;
+      VkBufferImageCopy region = {
+          .bufferOffset = staging_offset,
+          .imageSubresource =
+              {
+                  .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                  .mipLevel = level,
+                  .baseArrayLayer = 0,
+                  .layerCount = 1,
+              },
+          .imageOffset = {.x = 0, .y = static_cast<int32_t>(y), .z = 0},
+          .imageExtent = {
+              .width = width,
+              .height = std::min(num_rows * block.height, height - y),
+              .depth = 1,
+          },
+      };
+
+      vkCmdCopyBufferToImage(
+          upload_queue_.commands(), staging_buffer_.buffer(), image.handle(),
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region
+      );
+      row += num_rows;
+   }
+}
+
+void RenderContext::pump_uploads() {
+   upload_queue_.flush();
+   upload_queue_.poll();
+   staging_buffer_.release(upload_queue_.retired());
+}
+
+void RenderContext::queue_frame(const QueuedFrame &frame) {
+   VKAD_ASSERT(!has_queued_frame(frame.owner), "renderer queued two frames in one batch");
+   queued_frames_.push_back(frame);
+}
+
+bool RenderContext::has_queued_frame(const void *owner) const {
+   return std::any_of(queued_frames_.begin(), queued_frames_.end(), [owner](const QueuedFrame &f) {
+      return f.owner == owner;
+   });
+}
+
+void RenderContext::cancel_frames(const void *owner) {
+   std::erase_if(queued_frames_, [owner](const QueuedFrame &f) { return f.owner == owner; });
+}
+
+void RenderContext::submit_frames() {
+   if (queued_frames_.empty()) {
+      return;
+   }
+
+   // Frames drawn at a render scale are blitted into the acquired image rather than drawn to it
+   VkPipelineStageFlags wait_stage =
+       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+   std::vector<VkSubmitInfo> submits;
+   submits.reserve(queued_frames_.size());
+   for (const QueuedFrame &frame : queued_frames_) {
+      // Offscreen images aren't acquired or presented, so there is nothing to wait on or signal
+      bool presenting = frame.swapchain != VK_NULL_HANDLE;
+      submits.push_back({
+          .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+          .waitSemaphoreCount = presenting ? 1u : 0u,
+          .pWaitSemaphores = &frame.image_available,
+          .pWaitDstStageMask = &wait_stage,
+          .commandBufferCount = 1,
+          .pCommandBuffers = &frame.command_buffer,
+          .signalSemaphoreCount = presenting ? 1u : 0u,
+          .pSignalSemaphores = &frame.render_complete,
+      });
+   }
+
+   VkFence fence = frame_fences_[frame_slot_];
+   VKAD_VK(vkResetFences(device_.handle(), 1, &fence));
+   VKAD_VK(vkQueueSubmit(
+       device_.graphics_queue(), static_cast<uint32_t>(submits.size()), submits.data(), fence
+   ));
+   frame_slot_ = (frame_slot_ + 1) % frames_in_flight_;
+
+   std::vector<VkSemaphore> wait_semaphores;
+   std::vector<VkSwapchainKHR> swapchains;
+   std::vector<uint32_t> image_indices;
+   std::vector<uint64_t> present_ids;
+   std::vector<const QueuedFrame *> presented;
+   bool any_present_id = false;
+   for (const QueuedFrame &frame : queued_frames_) {
+      if (frame.swapchain == VK_NULL_HANDLE) {
+         continue;
+      }
+      wait_semaphores.push_back(frame.render_complete);
+      swapchains.push_back(frame.swapchain);
+      image_indices.push_back(frame.image_index);
+      // Id 0 leaves a swapchain's present untagged
+      present_ids.push_back(frame.present_timer != nullptr ? frame.present_id : 0);
+      any_present_id |= frame.present_timer != nullptr;
+      presented.push_back(&frame);
+   }
+
+   if (!swapchains.empty()) {
+      std::vector<VkResult> results(swapchains.size());
+      VkPresentIdKHR present_id_info = {
+          .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+          .swapchainCount = static_cast<uint32_t>(swapchains.size()),
+          .pPresentIds = present_ids.data(),
+      };
+      VkPresentInfoKHR present_info = {
+          .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+          .pNext = any_present_id ? &present_id_info : nullptr,
+          .waitSemaphoreCount = static_cast<uint32_t>(wait_semaphores.size()),
+          .pWaitSemaphores = wait_semaphores.data(),
+          .swapchainCount = static_cast<uint32_t>(swapchains.size()),
+          .pSwapchains = swapchains.data(),
+          .pImageIndices = image_indices.data(),
+          .pResults = results.data(),
+      };
+
+      // Swapchains that are out of date are recreated when their next image is acquired
+      {
+         std::lock_guard lock(swapchain_mutex_);
+         vkQueuePresentKHR(device_.present_queue(), &present_info);
+      }
+      for (size_t i = 0; i < presented.size(); ++i) {
+         const QueuedFrame &frame = *presented[i];
+         if (frame.present_timer != nullptr &&
+             (results[i] == VK_SUCCESS || results[i] == VK_SUBOPTIMAL_KHR)) {
+            frame.present_timer->track(frame.swapchain, frame.present_id, frame.started);
+         }
+      }
+   }
+
+   queued_frames_.clear();
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "ffi.h"
+#include "gpu/vulkan/buffer.h"
+#include "gpu/vulkan/device.h"
+#include "gpu/vulkan/gpu.h"
+#include "gpu/vulkan/image.h"
+#include "gpu/vulkan/memory_allocator.h"
+#include "gpu/vulkan/mesh_buffer.h"
+#include "gpu/vulkan/pipeline_cache.h"
+#include "gpu/vulkan/present_timer.h"
+#include "gpu/vulkan/texture_table.h"
+#include "gpu/vulkan/upload_queue.h"
+#include "util/slab.h"
+
+namespace simulo {
+
+enum RenderImage : int {};
+
+constexpr uint32_t kMaxFramesInFlight = 3;
+constexpr uint32_t kDefaultFramesInFlight = 2;
+
+inline VkDeviceSize index_type_size(IndexType type) {
+   return type == INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
+// A frame recorded by one renderer, waiting for submit_frames
+struct QueuedFrame {
+   // Renderer the frame belongs to, only used to tell renderers apart
+   const void *owner;
+   VkCommandBuffer command_buffer;
+   // Acquire and render-complete semaphores, or VK_NULL_HANDLE for offscreen frames
+   VkSemaphore image_available;
+   VkSemaphore render_complete;
+   // VK_NULL_HANDLE for offscreen frames, which aren't presented
+   VkSwapchainKHR swapchain;
+   uint32_t image_index;
+   // Set when the renderer measures present latency, along with the id to present with
+   PresentTimer *present_timer;
+   uint64_t present_id;
+   std::chrono::steady_clock::time_point started;
+};
+
+// Device-level state shared by every renderer drawing with one Gpu: the logical device, device
+// memory, the upload queue, the pipeline cache, and images, which any renderer on the context can
+// sample. Renderers keep their own swapchains and frame resources, but step through frame slots
+// together, and the frames they record are submitted and presented in one batch by submit_frames.
+class RenderContext {
+public:
+   // Unless the Gpu is headless, its queue families must already have been found for the first
+   // surface with Gpu::initialize_surface, which picks the queue frames are presented from
+   RenderContext(Gpu &gpu, const RenderContextOptions &options);
+   ~RenderContext();
+
+   RenderContext(const RenderContext &other) = delete;
+   RenderContext &operator=(const RenderContext &other) = delete;
+
+   // Whether frames can be presented to `surface` from the context's present queue
+   bool supports_surface(VkSurfaceKHR surface) const;
+
+   inline Gpu &gpu() {
+      return gpu_;
+   }
+
+   inline Device &device() {
+      return device_;
+   }
+
+   inline MemoryAllocator &allocator() {
+      return allocator_;
+   }
+
+   inline PipelineCache &pipeline_cache() {
+      return pipeline_cache_;
+   }
+
+   inline TextureTable &texture_table() {
+      return texture_table_;
+   }
+
+   inline UploadQueue &upload_queue() {
+      return upload_queue_;
+   }
+
+   inline VkSampler image_sampler() const {
+      return sampler_;
+   }
+
+   // Device memory usage of every buffer and image on the context, across all its renderers
+   inline MemoryStats memory_stats() const {
+      return allocator_.stats();
+   }
+
+   // Creates a texture from RGBA8 pixels with a mip chain of at most `max_mip_levels` levels, or a
+   // full one if 0
+   RenderImage
+   create_image(std::span<uint8_t> img_data, int width, int height, uint32_t max_mip_levels);
+
+   // Creates a texture from pre-compressed data holding `mip_levels` levels back to back, largest
+   // first, each tightly packed in rows of blocks
+   RenderImage create_compressed_image(
+       std::span<const uint8_t> data, CompressedFormat format, int width, int height,
+       uint32_t mip_levels
+   );
+
+   // Whether images of a compressed format can be created and sampled with linear filtering
+   bool supports_compressed_format(CompressedFormat format) const;
+
+   // Ticket of the upload that makes the image sampleable
+   inline UploadTicket image_ticket(RenderImage image) const {
+      return image_tickets_[image];
+   }
+
+   // Sub-allocates room for the mesh in the shared vertex and index buffers. Its data is written
+   // with write_mesh_vertices and write_mesh_indices, as a whole or in parts, so large meshes can
+   // be streamed through the staging ring without being held in memory at once.
+   Mesh create_mesh(
+       VkDeviceSize vertex_data_size, uint32_t vertex_size, uint32_t index_count,
+       IndexType index_type
+   );
+
+   // Returns the mesh's ranges to the shared buffers, once no frame in flight draws it
+   void free_mesh(const Mesh &mesh);
+
+   // Meshes that are still being drawn must not be written; the copy is not ordered against
+   // frames that are in flight. Each write moves the mesh's upload ticket to its own, and also
+   // grows the mesh's bounds to fit the new vertices. `offset` is in bytes.
+   void write_mesh_vertices(Mesh &mesh, VkDeviceSize offset, std::span<const uint8_t> vertex_data);
+
+   // `index_data` holds whole indices of the mesh's index type
+   void write_mesh_indices(Mesh &mesh, uint32_t first_index, std::span<const uint8_t> index_data);
+
+   inline VkBuffer vertex_buffer(uint32_t block) const {
+      return vertex_buffers_.buffer(block);
+   }
+
+   inline VkBuffer index_buffer(uint32_t block) const {
+      return index_buffers_.buffer(block);
+   }
+
+   // Reserves staging memory for an upload recorded into the upload queue's current batch. If the
+   // staging ring is full, the oldest pending uploads are submitted and waited on first, so the
+   // current batch may change and upload_queue_.commands() must be fetched again afterwards.
+   VkDeviceSize reserve_staging(VkDeviceSize size);
+
+   // Copies data into `dst` through the staging ring, in chunks of at most kStagingChunkSize
+   void
+   upload_buffer(VkBuffer dst, VkDeviceSize dst_offset, const uint8_t *data, VkDeviceSize size);
+
+   // Copies one tightly packed mip level into an image in TRANSFER_DST layout, in bands of rows
+   // of texel blocks
+   void upload_texture(std::span<const uint8_t> data, Image &image, uint32_t level);
+
+   // Submits the uploads recorded since the last frame and retires finished ones
+   void pump_uploads();
+
+   inline uint32_t frames_in_flight() const {
+      return frames_in_flight_;
+   }
+
+   // Slot the frames being recorded belong to, in [0, frames_in_flight). Advanced by
+   // submit_frames.
+   inline uint32_t frame_slot() const {
+      return frame_slot_;
+   }
+
+   // Signaled once every frame submitted in the slot has finished. Only reset by submit_frames,
+   // right before the slot is submitted again, so waiting on it never blocks on unsubmitted work.
+   inline VkFence frame_fence(uint32_t slot) const {
+      return frame_fences_[slot];
+   }
+
+   // Held around every acquire and present on the context's swapchains, which present timers
+   // must not wait on at the same time
+   inline std::mutex &swapchain_mutex() {
+      return swapchain_mutex_;
+   }
+
+   // Adds a recorded frame to the next batch. Each renderer queues at most one frame per batch.
+   void queue_frame(const QueuedFrame &frame);
+
+   bool has_queued_frame(const void *owner) const;
+
+   // Drops the frame a renderer queued but that hasn't been submitted, before it is destroyed
+   void cancel_frames(const void *owner);
+
+   // Submits every queued frame with one vkQueueSubmit, presents the ones with swapchains with one
+   // vkQueuePresentKHR, and moves on to the next frame slot
+   void submit_frames();
+
+private:
+   RenderImage register_image(int image_id);
+
+   // Upper bound on the texture table. Bindless tables are further limited by the device.
+   static constexpr uint32_t kMaxTextures = 16384;
+   static constexpr VkDeviceSize kStagingBufferSize = 1024 * 1024 * 8;
+   // Large uploads are split so that a single one never needs the whole ring to itself
+   static constexpr VkDeviceSize kStagingChunkSize = kStagingBufferSize / 4;
+   static constexpr VkDeviceSize kVertexBlockSize = 1024 * 1024 * 32;
+   static constexpr VkDeviceSize kIndexBlockSize = 1024 * 1024 * 8;
+
+   Gpu &gpu_;
+   Device device_;
+   // Declared before every resource it backs so it outlives them
+   MemoryAllocator allocator_;
+   MeshBufferPool vertex_buffers_;
+   MeshBufferPool index_buffers_;
+   PipelineCache pipeline_cache_;
+   Slab<Image> images_;
+   VkSampler sampler_;
+   TextureTable texture_table_;
+   StagingBuffer staging_buffer_;
+   UploadQueue upload_queue_;
+   std::vector<UploadTicket> image_tickets_;
+
+   uint32_t frames_in_flight_;
+   uint32_t frame_slot_;
+   std::array<VkFence, kMaxFramesInFlight> frame_fences_;
+   std::vector<QueuedFrame> queued_frames_;
+   std::mutex swapchain_mutex_;
+};
+
+} // namespace simulo
@@ -1,5 +1,15 @@
 #include "vk_renderer.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <stdexcept>
 #include <vector>
 
@@ -18,94 +28,232 @@
 
 using namespace simulo;
 
-Renderer::Renderer(
-    Gpu &vk_instance, VkSurfaceKHR surface, uint32_t initial_width, uint32_t initial_height
-)
-    : vk_instance_(vk_instance),
-      device_(vk_instance_),
-      swapchain_(
-          {vk_instance_.graphics_queue(), vk_instance_.present_queue()},
-          vk_instance_.physical_device(), device_.handle(), surface, initial_width, initial_height
-      ),
-      render_pass_(VK_NULL_HANDLE),
-      images_(4),
-      staging_buffer_(1024 * 1024 * 8, device_.handle(), vk_instance_) {
+namespace {
 
-   VkAttachmentDescription color_attachment = {
-       .format = swapchain_.img_format(),
-       .samples = VK_SAMPLE_COUNT_1_BIT,
-       .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-       .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-       .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-       .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-       .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-       .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-   };
+// Vertex attribute location of the per-instance object id, after the mesh's own attributes
+constexpr uint32_t kInstanceAttributeLocation = 2;
 
-   VkAttachmentReference color_attachment_ref = {
-       .attachment = 0,
-       .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+SwapchainConfig swapchain_config_from_options(const RendererOptions &options) {
+   SwapchainConfig config = {
+       .image_count = options.swapchain_images,
+       .blit_target = options.min_render_scale < 1.0f,
+       .capture_source = options.capture_interval > 0,
    };
+   switch (options.present_mode) {
+   case PRESENT_MODE_DEFAULT:
+      break;
+   case PRESENT_MODE_MAILBOX:
+      config.present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+      break;
+   case PRESENT_MODE_FIFO:
+      config.present_mode = VK_PRESENT_MODE_FIFO_KHR;
+      break;
+   case PRESENT_MODE_FIFO_RELAXED:
+      config.present_mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+      break;
+   case PRESENT_MODE_IMMEDIATE:
+      config.present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+      break;
+   }
+   return config;
+}
 
-   VkSubpassDescription subpass = {
-       .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-       .colorAttachmentCount = 1,
-       .pColorAttachments = &color_attachment_ref,
-   };
+// Vulkan guarantees D16 and one of the other two as depth attachments. D32 is preferred for the
+// precision it keeps across the long depth ranges of venue-sized scenes.
+VkFormat pick_depth_format(const Gpu &gpu) {
+   for (VkFormat format :
+        {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM}) {
+      if (gpu.supports_format(format, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
+         return format;
+      }
+   }
+   throw std::runtime_error("no depth attachment format is supported");
+}
 
-   VkSubpassDependency subpass_dependency = {
-       .srcSubpass = VK_SUBPASS_EXTERNAL,
-       .dstSubpass = 0,
-       .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-       .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-       .srcAccessMask = 0,
-       .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-   };
+// Captures keep the target's encoding, so the bytes read back are the ones presented
+VkFormat capture_format(VkFormat target_format) {
+   switch (target_format) {
+   case VK_FORMAT_R8G8B8A8_SRGB:
+   case VK_FORMAT_B8G8R8A8_SRGB:
+   case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+      return VK_FORMAT_R8G8B8A8_SRGB;
+   default:
+      return VK_FORMAT_R8G8B8A8_UNORM;
+   }
+}
 
-   VkRenderPassCreateInfo render_create = {
-       .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-       .attachmentCount = 1,
-       .pAttachments = &color_attachment,
-       .subpassCount = 1,
-       .pSubpasses = &subpass,
-       .dependencyCount = 1,
-       .pDependencies = &subpass_dependency,
-   };
+// Issues the indirect commands render_instances wrote since the last flush, with the pipeline state
+// they were recorded under
+void flush_draws(LayerRecorder *recorder) {
+   if (recorder->pending_draw_count == 0) {
+      return;
+   }
+   vkCmdDrawIndexedIndirect(
+       recorder->command_buffer, recorder->draw_buffer,
+       recorder->pending_first_draw * sizeof(VkDrawIndexedIndirectCommand),
+       recorder->pending_draw_count, sizeof(VkDrawIndexedIndirectCommand)
+   );
+   recorder->pending_draw_count = 0;
+}
 
-   VKAD_VK(vkCreateRenderPass(device_.handle(), &render_create, nullptr, &render_pass_));
+} // namespace
 
-   create_framebuffers();
+Renderer::Renderer(
+    RenderContext &context, VkSurfaceKHR surface, uint32_t initial_width, uint32_t initial_height,
+    const RendererOptions &options
+)
+    : context_(context),
+      vk_instance_(context.gpu()),
+      swapchain_config_(swapchain_config_from_options(options)),
+      render_pass_(VK_NULL_HANDLE),
+      depth_format_(
+          options.depth_buffer ? pick_depth_format(context.gpu()) : VK_FORMAT_UNDEFINED
+      ),
+      scaled_(false),
+      render_scale_(options.render_scale),
+      min_render_scale_(options.min_render_scale),
+      requested_capture_interval_(options.capture_interval),
+      capture_interval_(0),
+      capture_extent_{options.capture_width, options.capture_height},
+      image_acquired_(false),
+      gpu_culling_(options.gpu_culling && context.gpu().supports_gpu_culling()),
+      max_indirect_draws_(
+          context.gpu().supports_multi_draw_indirect()
+              ? context.gpu().properties().limits.maxDrawIndirectCount
+              : 1
+      ),
+      cull_set_layout_(VK_NULL_HANDLE),
+      // Each frame slot has an object set and a cull set, the larger of which needs a storage
+      // buffer for every cull binding
+      descriptor_allocator_(
+          context.device().handle(),
+          {{.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, .descriptorCount = kCullBindingCount}},
+          kMaxFramesInFlight * 2
+      ),
+      frames_{},
+      frames_in_flight_(context.frames_in_flight()),
+      current_frame_(context.frame_slot()),
+      frames_rendered_(0),
+      timestamp_pool_(VK_NULL_HANDLE),
+      gpu_frame_ns_(0),
+      gpu_layer_ns_{} {
+
+   if (surface != VK_NULL_HANDLE) {
+      swapchain_.emplace(
+          std::vector<uint32_t>{vk_instance_.graphics_queue(), vk_instance_.present_queue()},
+          vk_instance_.physical_device(), device().handle(), surface, initial_width,
+          initial_height, swapchain_config_
+      );
+      if (vk_instance_.supports_present_wait()) {
+         present_timer_.emplace(device().handle(), context.swapchain_mutex());
+      }
+   } else {
+      VKAD_ASSERT(vk_instance_.headless(), "rendering without a surface needs a headless Gpu");
+      // One image per frame slot, so a slot's fence also guards its image and readback
+      offscreen_.emplace(allocator(), initial_width, initial_height, frames_in_flight_);
+   }
 
-   VkSamplerCreateInfo sampler_create = {
-       .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-       .magFilter = VK_FILTER_LINEAR, // TODO check for support
-       .minFilter = VK_FILTER_LINEAR,
-       .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-       .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-       .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-       .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
-   };
-   VKAD_VK(vkCreateSampler(device_.handle(), &sampler_create, nullptr, &sampler_));
+   VKAD_ASSERT(
+       min_render_scale_ > 0.0f && min_render_scale_ <= render_scale_ && render_scale_ <= 1.0f,
+       "render scales must be in (0, 1], the minimum no larger than the initial scale"
+   );
+   VKAD_ASSERT(
+       !swapchain_ || options.capture_interval == 0 ||
+           (capture_extent_.width > 0 && capture_extent_.height > 0),
+       "capture size must be nonzero"
+   );
+   pick_copy_paths();
+
+   // Dynamic rendering needs neither a render pass nor framebuffers, so resizing only replaces
+   // the swapchain
+   if (!device().has_dynamic_rendering()) {
+      create_render_pass();
+   }
 
-   command_pool_.init(device_.handle(), vk_instance_.graphics_queue());
-   command_buffer_ = command_pool_.allocate();
+   create_scaled_image();
+   create_depth_image();
+   create_framebuffers();
+   images_in_flight_.assign(target_image_count(), VK_NULL_HANDLE);
+
+   command_pool_.init(device().handle(), vk_instance_.graphics_queue());
 
    VkSemaphoreCreateInfo semaphore_create = {.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
-   VkFenceCreateInfo fence_create = {
-       .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, .flags = VK_FENCE_CREATE_SIGNALED_BIT
+
+   VkDescriptorSetLayoutBinding object_binding = storage_buffer(0);
+   VkDescriptorSetLayoutCreateInfo object_layout_create = {
+       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+       .bindingCount = 1,
+       .pBindings = &object_binding,
    };
+   VKAD_VK(vkCreateDescriptorSetLayout(
+       device().handle(), &object_layout_create, nullptr, &object_set_layout_
+   ));
+
+   if (gpu_culling_) {
+      std::array<VkDescriptorSetLayoutBinding, kCullBindingCount> cull_bindings;
+      for (uint32_t i = 0; i < kCullBindingCount; ++i) {
+         cull_bindings[i] = storage_buffer(i, VK_SHADER_STAGE_COMPUTE_BIT);
+      }
+      VkDescriptorSetLayoutCreateInfo cull_layout_create = {
+          .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+          .bindingCount = kCullBindingCount,
+          .pBindings = cull_bindings.data(),
+      };
+      VKAD_VK(vkCreateDescriptorSetLayout(
+          device().handle(), &cull_layout_create, nullptr, &cull_set_layout_
+      ));
+
+      Shader cull_shader(device(), std::span(cull_compute_bytes(), cull_compute_len()));
+      cull_pipeline_.emplace(
+          device().handle(), context_.pipeline_cache().handle(), cull_shader.module(),
+          std::vector<VkDescriptorSetLayout>{cull_set_layout_}, sizeof(uint32_t)
+      );
+   }
+   for (uint32_t i = 0; i < frames_in_flight_; ++i) {
+      Frame &frame = frames_[i];
+      frame.command_buffer = command_pool_.allocate();
+
+      if (vkCreateSemaphore(device().handle(), &semaphore_create, nullptr, &frame.sem_img_avail) !=
+              VK_SUCCESS ||
+          vkCreateSemaphore(
+              device().handle(), &semaphore_create, nullptr, &frame.sem_render_complete
+          ) != VK_SUCCESS) {
+         throw std::runtime_error("failed to create semaphore(s)");
+      }
+
+      create_instance_buffer(frame, kInitialInstanceCapacity);
+
+      frame.object_set = descriptor_allocator_.allocate(object_set_layout_);
+      create_object_buffer(frame, kInitialObjectCapacity);
+
+      frame.draw_buffer = VK_NULL_HANDLE;
+      frame.cull_draw_buffer = VK_NULL_HANDLE;
+      frame.draw_capacity = 0;
+      frame.draw_count = 0;
+      if (gpu_culling_) {
+         create_draw_buffers(frame, kInitialDrawCapacity);
+         frame.cull_set = descriptor_allocator_.allocate(cull_set_layout_);
+      }
+
+      frame.timestamps_written = false;
+      frame.recorded_layers = 0;
+
+      frame.readback_buffer = VK_NULL_HANDLE;
+      frame.readback_pending = false;
+      create_readback_resources(frame);
+   }
 
-   if (vkCreateSemaphore(device_.handle(), &semaphore_create, nullptr, &sem_img_avail) !=
-           VK_SUCCESS ||
-       vkCreateSemaphore(device_.handle(), &semaphore_create, nullptr, &sem_render_complete) !=
-           VK_SUCCESS ||
-       vkCreateFence(device_.handle(), &fence_create, nullptr, &draw_cycle_complete) !=
-           VK_SUCCESS) {
-      throw std::runtime_error("failed to create semaphore(s)");
+   if (vk_instance_.supports_timestamps()) {
+      VkQueryPoolCreateInfo query_pool_create = {
+          .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+          .queryType = VK_QUERY_TYPE_TIMESTAMP,
+          .queryCount = kTimestampsPerFrame * frames_in_flight_,
+      };
+      VKAD_VK(vkCreateQueryPool(device().handle(), &query_pool_create, nullptr, &timestamp_pool_));
    }
 
    pipeline_ids_.ui = create_pipeline(
-       sizeof(UiVertex), sizeof(UiUniform),
+       sizeof(UiVertex),
        {
            VkVertexInputAttributeDescription{
                .location = 0,
@@ -121,15 +269,14 @@ Renderer::Renderer(
            },
        },
        std::span(text_vertex_bytes(), text_vertex_len()),
-       std::span(text_fragment_bytes(), text_fragment_len()),
-       {
-           uniform_buffer_dynamic(0),
-           combined_image_sampler(1),
-       }
+       context_.texture_table().bindless()
+           ? std::span(text_fragment_bytes(), text_fragment_len())
+           : std::span(text_slot_fragment_bytes(), text_slot_fragment_len()),
+       false
    );
 
    pipeline_ids_.mesh = create_pipeline(
-       sizeof(ModelVertex), sizeof(ModelUniform),
+       sizeof(ModelVertex),
        {
            VkVertexInputAttributeDescription{
                .location = 0,
@@ -145,131 +292,144 @@ Renderer::Renderer(
            },
        },
        std::span(model_vertex_bytes(), model_vertex_len()),
-       std::span(model_fragment_bytes(), model_fragment_len()), {uniform_buffer_dynamic(0)}
+       std::span(model_fragment_bytes(), model_fragment_len()), true
    );
+
+   // The UI pipeline is all that's needed to show the first frame, so it's saved right away in
+   // case the process doesn't live long enough for the others
+   context_.pipeline_cache().save();
 }
 
 Renderer::~Renderer() {
-   device_.wait_idle();
-
-   for (const MaterialPipeline &mat : pipelines_) {
-      vkDestroyDescriptorSetLayout(device_.handle(), mat.descriptor_set_layout, nullptr);
+   // Frames queued since the last submit_frames reference this renderer's command buffers and
+   // semaphores, so they are dropped rather than submitted
+   context_.cancel_frames(this);
+   device().wait_idle();
+
+   // Compiles still running on the worker use the render pass destroyed below
+   for (MaterialPipeline &mat : pipelines_) {
+      if (mat.pending_variants.valid()) {
+         mat.pending_variants.wait();
+      }
+   }
+   context_.pipeline_cache().save();
+
+   for (uint32_t i = 0; i < frames_in_flight_; ++i) {
+      Frame &frame = frames_[i];
+      collect_garbage(frame);
+      buffer_destroy(&frame.instance_buffer, frame.instance_allocation, allocator());
+      if (frame.visible_buffer != VK_NULL_HANDLE) {
+         buffer_destroy(&frame.visible_buffer, frame.visible_allocation, allocator());
+      }
+      if (frame.draw_buffer != VK_NULL_HANDLE) {
+         buffer_destroy(&frame.draw_buffer, frame.draw_allocation, allocator());
+         buffer_destroy(&frame.cull_draw_buffer, frame.cull_draw_allocation, allocator());
+      }
+      buffer_destroy(&frame.object_buffer, frame.object_allocation, allocator());
+      if (frame.readback_buffer != VK_NULL_HANDLE) {
+         buffer_destroy(&frame.readback_buffer, frame.readback_allocation, allocator());
+      }
+      vkDestroySemaphore(device().handle(), frame.sem_img_avail, nullptr);
+      vkDestroySemaphore(device().handle(), frame.sem_render_complete, nullptr);
+      for (CommandPool &pool : frame.layer_pools) {
+         pool.deinit();
+      }
    }
 
-   vkDestroySemaphore(device_.handle(), sem_img_avail, nullptr);
-   vkDestroySemaphore(device_.handle(), sem_render_complete, nullptr);
-   vkDestroyFence(device_.handle(), draw_cycle_complete, nullptr);
+   if (timestamp_pool_ != VK_NULL_HANDLE) {
+      vkDestroyQueryPool(device().handle(), timestamp_pool_, nullptr);
+   }
 
-   vkDestroySampler(device_.handle(), sampler_, nullptr);
+   vkDestroyDescriptorSetLayout(device().handle(), object_set_layout_, nullptr);
+   if (cull_set_layout_ != VK_NULL_HANDLE) {
+      vkDestroyDescriptorSetLayout(device().handle(), cull_set_layout_, nullptr);
+   }
 
    for (const VkFramebuffer framebuffer : framebuffers_) {
-      vkDestroyFramebuffer(device_.handle(), framebuffer, nullptr);
+      vkDestroyFramebuffer(device().handle(), framebuffer, nullptr);
    }
 
    command_pool_.deinit();
 
    if (render_pass_ != VK_NULL_HANDLE) {
-      vkDestroyRenderPass(device_.handle(), render_pass_, nullptr);
+      vkDestroyRenderPass(device().handle(), render_pass_, nullptr);
    }
 }
 
 Mesh create_mesh(
-    Renderer *renderer, uint8_t *vertex_data, size_t vertex_data_size, IndexBufferType *index_data,
-    size_t index_count
+    Renderer *renderer, const uint8_t *vertex_data, size_t vertex_data_size, uint32_t vertex_size,
+    const void *index_data, size_t index_count, IndexType index_type
 ) {
-   Mesh mesh;
+   Mesh mesh = create_empty_mesh(renderer, vertex_data_size, vertex_size, index_count, index_type);
+   write_mesh_vertices(renderer, &mesh, 0, vertex_data, vertex_data_size);
+   write_mesh_indices(renderer, &mesh, 0, index_data, index_count);
+   return mesh;
+}
 
-   buffer_init(
-       &mesh.buffer, &mesh.allocation, vertex_data_size + index_count * sizeof(IndexBufferType),
-       static_cast<VkBufferUsageFlags>(
-           VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-           VK_BUFFER_USAGE_TRANSFER_DST_BIT
-       ),
-       static_cast<VkMemoryPropertyFlagBits>(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
-       renderer->device().handle(), renderer->vk_instance_
+Mesh create_empty_mesh(
+    Renderer *renderer, size_t vertex_data_size, uint32_t vertex_size, size_t index_count,
+    IndexType index_type
+) {
+   VKAD_ASSERT(index_count <= UINT32_MAX, "mesh has more indices than a draw can use");
+   return renderer->context().create_mesh(
+       vertex_data_size, vertex_size, static_cast<uint32_t>(index_count), index_type
    );
+}
 
-   mesh.num_indices = index_count;
-   mesh.vertex_data_size = vertex_data_size;
+void write_mesh_vertices(
+    Renderer *renderer, Mesh *mesh, size_t offset, const uint8_t *vertex_data, size_t size
+) {
+   renderer->context().write_mesh_vertices(*mesh, offset, std::span(vertex_data, size));
+}
 
-   renderer->update_mesh(
-       mesh, std::span(vertex_data, vertex_data_size), std::span(index_data, index_count)
+void write_mesh_indices(
+    Renderer *renderer, Mesh *mesh, size_t first_index, const void *index_data, size_t count
+) {
+   size_t size = count * index_type_size(mesh->index_type);
+   renderer->context().write_mesh_indices(
+       *mesh, static_cast<uint32_t>(first_index),
+       std::span(static_cast<const uint8_t *>(index_data), size)
    );
-   return mesh;
 }
 
-void delete_mesh(Renderer *renderer, Mesh &mesh) {
-   buffer_destroy(&mesh.buffer, &mesh.allocation, renderer->device().handle());
+void delete_mesh(Renderer *renderer, Mesh *mesh) {
+   renderer->frame().dead_meshes.push_back(*mesh);
 }
 
-void delete_material(Renderer *renderer, Material *material) {
-   const Renderer::MaterialPipeline &pipe = renderer->pipelines_[0];
-   free_descriptor_set(renderer->device().handle(), pipe.descriptor_pool, material->descriptor_set);
+bool mesh_ready(Renderer *renderer, const Mesh *mesh) {
+   return renderer->context().upload_queue().is_retired(mesh->upload_ticket);
 }
 
-RenderImage Renderer::create_image(std::span<uint8_t> img_data, int width, int height) {
-   int image_id = images_.emplace(
-       vk_instance_, device_.handle(),
-       VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_FORMAT_R8G8B8A8_UNORM,
-       width, height
-   );
-   Image &image = images_.get(image_id);
-
-   staging_buffer_.upload_raw(img_data.data(), img_data.size());
-   begin_preframe();
-   transfer_image_layout(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-   upload_texture(staging_buffer_, image);
-   transfer_image_layout(image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-   end_preframe();
-
-   image.init_view();
-   return static_cast<RenderImage>(image_id);
+bool material_ready(Renderer *renderer, const Material *material) {
+   return renderer->pipelines_[material->pipeline].variants.has_value() &&
+          renderer->context().upload_queue().is_retired(material->upload_ticket);
 }
 
-void Renderer::update_mesh(
-    Mesh &mesh, std::span<uint8_t> vertex_data, std::span<IndexBufferType> index_data
-) {
-   staging_buffer_.upload_mesh(vertex_data, index_data);
-   begin_preframe();
-   buffer_copy(staging_buffer_, mesh.buffer);
-   end_preframe();
+// Materials are only a texture slot and a pipeline. Slots, and the sets holding them without
+// descriptor indexing, belong to images, so there is nothing to release.
+void delete_material(Renderer *renderer, Material *material) {}
+
+bool bindless_textures(Renderer *renderer) {
+   return renderer->context().texture_table().bindless();
 }
 
-template <class Uniform>
 Material create_material(Renderer *renderer, int32_t pipeline_id, const MaterialProperties &props) {
-   Renderer::MaterialPipeline &pipe = renderer->pipelines_[pipeline_id];
    Material mat = {
-       .descriptor_set = allocate_descriptor_set(
-           renderer->device().handle(), pipe.descriptor_pool, pipe.descriptor_set_layout
-       ),
-   };
-
-   Uniform u(Uniform::from_props(props));
-   pipe.uniforms.upload_memory(&u, sizeof(Uniform), pipe.uniform_slot_usage);
-   mat.uniform_buffer_index = pipe.uniform_slot_usage++;
-
-   std::vector<DescriptorWrite> writes = {
-       write_uniform_buffer_dynamic(pipe.uniforms),
+       .texture = 0,
+       .pipeline = static_cast<uint32_t>(pipeline_id),
+       .upload_ticket = 0,
    };
 
    if (props.has("image")) {
       RenderImage image_id = props.get<RenderImage>("image");
-      writes.push_back(
-          write_combined_image_sampler(renderer->image_sampler(), renderer->images_.get(image_id))
-      );
+      mat.texture = static_cast<uint32_t>(image_id);
+      mat.upload_ticket = renderer->context().image_ticket(image_id);
    }
-
-   write_descriptor_set(renderer->device().handle(), mat.descriptor_set, writes);
    return mat;
 }
 
-void clear_ui_materials(Renderer *renderer) {
-   Renderer::MaterialPipeline &pipe = renderer->pipelines_[renderer->pipeline_ids_.ui];
-   pipe.uniform_slot_usage = 2;
-}
-
 Material create_ui_material(Renderer *renderer, uint32_t image) {
-   return create_material<UiUniform>(
+   return create_material(
        renderer, renderer->pipeline_ids_.ui,
        {
            {"image", static_cast<RenderImage>(image)},
@@ -278,49 +438,71 @@ Material create_ui_material(Renderer *renderer, uint32_t image) {
 }
 
 RenderPipeline Renderer::create_pipeline(
-    uint32_t vertex_size, VkDeviceSize uniform_size,
-    const std::vector<VkVertexInputAttributeDescription> &attrs,
+    uint32_t vertex_size, const std::vector<VkVertexInputAttributeDescription> &attrs,
     std::span<const uint8_t> vertex_shader, std::span<const uint8_t> fragment_shader,
-    const std::vector<VkDescriptorSetLayoutBinding> &bindings
+    bool compile_in_background
 ) {
-   const int material_capacity = 32;
-
-   VkVertexInputBindingDescription binding = {
-       .binding = 0,
-       .stride = vertex_size,
-       .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+   std::vector<VkVertexInputBindingDescription> vertex_bindings = {
+       {
+           .binding = 0,
+           .stride = vertex_size,
+           .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+       },
+       {
+           .binding = 1,
+           .stride = sizeof(uint32_t),
+           .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+       },
    };
 
-   VkDescriptorSetLayoutCreateInfo layout_create = {
-       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-       .bindingCount = static_cast<uint32_t>(bindings.size()),
-       .pBindings = bindings.data(),
+   // Every pipeline reads the object id of the instance after its own vertex attributes
+   std::vector<VkVertexInputAttributeDescription> vertex_attrs = attrs;
+   vertex_attrs.push_back({
+       .location = kInstanceAttributeLocation,
+       .binding = 1,
+       .format = VK_FORMAT_R32_UINT,
+       .offset = 0,
+   });
+
+   Shader vertex(device(), vertex_shader);
+   Shader fragment(device(), fragment_shader);
+
+   // Every pipeline shares the same set layouts and push constants, so the sets bound at the start
+   // of a frame stay valid across pipeline changes. Everything the compile needs is captured by
+   // value, since pipelines_ may be reallocated while it runs.
+   std::vector<VkDescriptorSetLayout> layouts = {
+       context_.texture_table().layout(), object_set_layout_
+   };
+   auto compile = [device = context_.device().handle(),
+                   cache = context_.pipeline_cache().handle(), vertex_bindings, vertex_attrs,
+                   vertex_module = vertex.module(), fragment_module = fragment.module(), layouts,
+                   render_pass = render_pass_, color_format = target_format(),
+                   depth_format = depth_format_]() {
+      auto variant = [&](BlendMode blend_mode) {
+         return Pipeline(
+             device, cache, vertex_bindings, vertex_attrs, vertex_module, fragment_module, layouts,
+             render_pass, color_format, depth_format, blend_mode
+         );
+      };
+      PipelineVariants variants = {.transparent = variant(BLEND_MODE_TRANSPARENT)};
+      if (depth_format != VK_FORMAT_UNDEFINED) {
+         variants.opaque.emplace(variant(BLEND_MODE_OPAQUE));
+      }
+      return variants;
    };
-   VkDescriptorSetLayout layout;
-   VKAD_VK(vkCreateDescriptorSetLayout(device_.handle(), &layout_create, nullptr, &layout));
 
-   std::vector<VkDescriptorPoolSize> sizes;
-   sizes.reserve(bindings.size());
-   for (const auto &binding : bindings) {
-      sizes.push_back({
-          .type = binding.descriptorType,
-          .descriptorCount = binding.descriptorCount * material_capacity,
-      });
+   std::optional<PipelineVariants> variants;
+   std::future<PipelineVariants> pending_variants;
+   if (compile_in_background) {
+      pending_variants = std::async(std::launch::async, std::move(compile));
+   } else {
+      variants.emplace(compile());
    }
 
-   Shader vertex(device_, vertex_shader);
-   Shader fragment(device_, fragment_shader);
-
    pipelines_.emplace_back(
        MaterialPipeline{
-           .descriptor_set_layout = layout,
-           .pipeline =
-               Pipeline(device_.handle(), binding, attrs, vertex, fragment, layout, render_pass_),
-           .descriptor_pool =
-               create_descriptor_pool(device_.handle(), layout, sizes, material_capacity),
-           .uniform_slot_usage = 0,
-           .uniforms =
-               UniformBuffer(uniform_size, material_capacity, device_.handle(), vk_instance_),
+           .variants = std::move(variants),
+           .pending_variants = std::move(pending_variants),
            .vertex_shader = std::move(vertex),
            .fragment_shader = std::move(fragment),
        }
@@ -332,42 +514,407 @@ void recreate_swapchain(Renderer *renderer, int32_t width, int32_t height, void
    VKAD_ASSERT(width >= 0, "width must be >= 0");
    VKAD_ASSERT(height >= 0, "height must be >= 0");
 
+   // Offscreen images keep the size they were created with
+   if (!renderer->swapchain_) {
+      return;
+   }
+
    auto surface = reinterpret_cast<VkSurfaceKHR>(surface_ptr);
+   VKAD_ASSERT(
+       !renderer->context().has_queued_frame(renderer),
+       "swapchain recreated while a frame on it is queued"
+   );
 
-   renderer->swapchain_.dispose();
-   renderer->swapchain_ = std::move(Swapchain(
-       {renderer->vk_instance_.graphics_queue(), renderer->vk_instance_.present_queue()},
-       renderer->vk_instance_.physical_device(), renderer->device().handle(), surface, width, height
-   ));
+   // An acquired image's semaphore would be left signaled with nothing to wait on it
+   VKAD_ASSERT(!renderer->image_acquired_, "swapchain recreated with an image acquired");
 
-   for (const VkFramebuffer framebuffer : renderer->framebuffers_) {
-      vkDestroyFramebuffer(renderer->device().handle(), framebuffer, nullptr);
+   // Frames still in flight may be presenting or rendering to the old images
+   renderer->device().wait_idle();
+   if (renderer->present_timer_) {
+      renderer->present_timer_->drain();
    }
+   renderer->swapchain_.reset();
+   renderer->swapchain_.emplace(
+       std::vector<uint32_t>{
+           renderer->vk_instance_.graphics_queue(), renderer->vk_instance_.present_queue()
+       },
+       renderer->vk_instance_.physical_device(), renderer->device().handle(), surface, width,
+       height, renderer->swapchain_config_
+   );
+   renderer->images_in_flight_.assign(renderer->target_image_count(), VK_NULL_HANDLE);
 
-   renderer->create_framebuffers();
+   // The new swapchain may allow blits and copies the old one didn't, or the other way around
+   bool was_scaled = renderer->scaled_;
+   renderer->pick_copy_paths();
+   for (uint32_t i = 0; i < renderer->frames_in_flight_; ++i) {
+      renderer->create_readback_resources(renderer->frames_[i]);
+   }
+   if (renderer->scaled_ != was_scaled && renderer->render_pass_ != VK_NULL_HANDLE) {
+      renderer->recreate_render_pass();
+   }
+   renderer->recreate_draw_images();
 }
 
-void Renderer::begin_preframe() {
-   preframe_cmd_buf_ = command_pool_.allocate();
+void set_render_scale(Renderer *renderer, float scale) {
+   if (!renderer->scaled_) {
+      return;
+   }
 
-   VkCommandBufferBeginInfo begin_info = {
-       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-       .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+   scale = std::clamp(scale, renderer->min_render_scale_, 1.0f);
+   VkExtent2D old_extent = renderer->scaled_extent();
+   renderer->render_scale_ = scale;
+   VkExtent2D new_extent = renderer->scaled_extent();
+   if (new_extent.width == old_extent.width && new_extent.height == old_extent.height) {
+      return;
+   }
+
+   VKAD_ASSERT(
+       !renderer->context().has_queued_frame(renderer),
+       "render scale changed while a frame is queued"
+   );
+   renderer->recreate_draw_images();
+}
+
+void Renderer::poll_pipelines() {
+   bool compiled = false;
+   for (MaterialPipeline &pipe : pipelines_) {
+      if (!pipe.pending_variants.valid() ||
+          pipe.pending_variants.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+         continue;
+      }
+
+      // Rethrows if the compile failed
+      pipe.variants.emplace(pipe.pending_variants.get());
+      compiled = true;
+   }
+
+   if (compiled) {
+      context_.pipeline_cache().save();
+   }
+}
+
+void Renderer::collect_garbage(Frame &frame) {
+   // A mesh can be dropped before its upload retires, in which case it waits for the next cycle
+   auto pending = std::remove_if(
+       frame.dead_meshes.begin(), frame.dead_meshes.end(),
+       [this](Mesh &mesh) {
+          if (!context_.upload_queue().is_retired(mesh.upload_ticket)) {
+             return false;
+          }
+          context_.free_mesh(mesh);
+          return true;
+       }
+   );
+   frame.dead_meshes.erase(pending, frame.dead_meshes.end());
+
+   for (auto &[buffer, allocation] : frame.dead_buffers) {
+      buffer_destroy(&buffer, allocation, allocator());
+   }
+   frame.dead_buffers.clear();
+
+   for (const VkFramebuffer framebuffer : frame.dead_framebuffers) {
+      vkDestroyFramebuffer(device().handle(), framebuffer, nullptr);
+   }
+   frame.dead_framebuffers.clear();
+   frame.dead_images.clear();
+}
+
+void Renderer::resolve_timestamps(Frame &frame) {
+   if (!frame.timestamps_written) {
+      return;
+   }
+   frame.timestamps_written = false;
+
+   // Each query is read as its value followed by its availability, since layers that weren't
+   // timed are never written
+   std::array<uint64_t, kTimestampsPerFrame * 2> results;
+   VkResult res = vkGetQueryPoolResults(
+       device().handle(), timestamp_pool_, current_frame_ * kTimestampsPerFrame,
+       kTimestampsPerFrame, sizeof(results), results.data(), sizeof(uint64_t) * 2,
+       VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+   );
+   if (res != VK_NOT_READY) {
+      VKAD_VK(res);
+   }
+
+   uint32_t valid_bits = vk_instance_.timestamp_valid_bits();
+   uint64_t mask = valid_bits >= 64 ? UINT64_MAX : (uint64_t{1} << valid_bits) - 1;
+   double period = vk_instance_.timestamp_period();
+   auto elapsed_ns = [&](uint32_t begin, uint32_t end) -> uint64_t {
+      if (results[begin * 2 + 1] == 0 || results[end * 2 + 1] == 0) {
+         return 0;
+      }
+      uint64_t ticks = (results[end * 2] - results[begin * 2]) & mask;
+      return static_cast<uint64_t>(static_cast<double>(ticks) * period);
    };
-   VKAD_VK(vkBeginCommandBuffer(preframe_cmd_buf_, &begin_info));
+
+   gpu_frame_ns_ = elapsed_ns(0, 1);
+   for (uint32_t layer = 0; layer < MAX_RENDER_LAYERS; ++layer) {
+      bool timed = (frame.recorded_layers & (1u << layer)) != 0;
+      gpu_layer_ns_[layer] = timed ? elapsed_ns(2 + layer * 2, 3 + layer * 2) : 0;
+   }
 }
 
-void Renderer::buffer_copy(const StagingBuffer &src, VkBuffer dst) {
-   VkBufferCopy copy_region = {
-       .srcOffset = 0,
-       .dstOffset = 0,
-       .size = src.size(),
+void Renderer::write_timestamp(
+    VkCommandBuffer command_buffer, VkPipelineStageFlagBits stage, uint32_t query
+) {
+   if (timestamp_pool_ == VK_NULL_HANDLE) {
+      return;
+   }
+   vkCmdWriteTimestamp(
+       command_buffer, stage, timestamp_pool_, current_frame_ * kTimestampsPerFrame + query
+   );
+}
+
+void Renderer::transition_target(bool to_attachment) {
+   // Matches the render pass's final layout and subpass dependencies
+   bool copied_out = scaled_ || !swapchain_;
+   VkImageLayout final_layout =
+       copied_out ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+   VkPipelineStageFlags final_stage =
+       copied_out ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+   VkAccessFlags final_access = copied_out ? VK_ACCESS_TRANSFER_READ_BIT : 0;
+
+   VkImageMemoryBarrier barrier = {
+       .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+       .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+       .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+       .image = draw_image(current_framebuffer_),
+       .subresourceRange =
+           {
+               .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+               .baseMipLevel = 0,
+               .levelCount = 1,
+               .baseArrayLayer = 0,
+               .layerCount = 1,
+           },
    };
-   vkCmdCopyBuffer(preframe_cmd_buf_, src.buffer(), dst, 1, &copy_region);
+
+   VkPipelineStageFlags src_stage;
+   VkPipelineStageFlags dst_stage;
+   if (to_attachment) {
+      // The old contents are cleared, and the wait on the acquire semaphore is at this stage. The
+      // scaled image is also still being blitted from by the last frame.
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+      src_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      if (scaled_) {
+         src_stage |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+      }
+      dst_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+   } else {
+      barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+      barrier.dstAccessMask = final_access;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+      barrier.newLayout = final_layout;
+      src_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      dst_stage = final_stage;
+   }
+
+   vkCmdPipelineBarrier(
+       frame().command_buffer, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier
+   );
+
+   // The depth image is only ever cleared and tested within a frame, so its old contents are
+   // discarded too. The last frame's depth tests may still be running on it.
+   if (to_attachment && depth_image_) {
+      VkImageMemoryBarrier depth_barrier = {
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                           VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+          .newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = depth_image_->handle(),
+          .subresourceRange =
+              {
+                  .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+                  .baseMipLevel = 0,
+                  .levelCount = 1,
+                  .baseArrayLayer = 0,
+                  .layerCount = 1,
+              },
+      };
+      vkCmdPipelineBarrier(
+          frame().command_buffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+          VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, 0,
+          0, nullptr, 0, nullptr, 1, &depth_barrier
+      );
+   }
 }
 
-void Renderer::upload_texture(const StagingBuffer &src, Image &image) {
+void Renderer::blit_to_target(Frame &frame) {
+   VkImageMemoryBarrier barrier = {
+       .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+       .srcAccessMask = 0,
+       .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+       .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+       .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+       .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+       .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+       .image = target_image(current_framebuffer_),
+       .subresourceRange =
+           {
+               .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+               .baseMipLevel = 0,
+               .levelCount = 1,
+               .baseArrayLayer = 0,
+               .layerCount = 1,
+           },
+   };
+   // The whole target is overwritten, and the wait on the acquire semaphore is at this stage
+   vkCmdPipelineBarrier(
+       frame.command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0,
+       nullptr, 0, nullptr, 1, &barrier
+   );
+
+   VkExtent2D src = draw_extent();
+   VkExtent2D dst = target_extent();
+   auto corner = [](VkExtent2D extent) {
+      return VkOffset3D{static_cast<int32_t>(extent.width), static_cast<int32_t>(extent.height), 1};
+   };
+   VkImageSubresourceLayers color_layer = {
+       .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+       .mipLevel = 0,
+       .baseArrayLayer = 0,
+       .layerCount = 1,
+   };
+   VkImageBlit region = {
+       .srcSubresource = color_layer,
+       .srcOffsets = {{0, 0, 0}, corner(src)},
+       .dstSubresource = color_layer,
+       .dstOffsets = {{0, 0, 0}, corner(dst)},
+   };
+   vkCmdBlitImage(
+       frame.command_buffer, scaled_image_->handle(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+       target_image(current_framebuffer_), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region,
+       VK_FILTER_LINEAR
+   );
+
+   // Into the layout the render pass would have left the target in
+   barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+   barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+   barrier.newLayout =
+       swapchain_ ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+   barrier.dstAccessMask = swapchain_ ? 0 : VK_ACCESS_TRANSFER_READ_BIT;
+   vkCmdPipelineBarrier(
+       frame.command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+       swapchain_ ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0,
+       nullptr, 0, nullptr, 1, &barrier
+   );
+}
+
+void Renderer::queue_capture(Frame &frame) {
+   VkImageSubresourceRange color_range = {
+       .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+       .baseMipLevel = 0,
+       .levelCount = 1,
+       .baseArrayLayer = 0,
+       .layerCount = 1,
+   };
+   VkImage target = target_image(current_framebuffer_);
+   VkImage capture = frame.capture_image->handle();
+
+   // Captures are rare enough that the copy waits on all earlier work, rather than on whichever of
+   // the render pass, dynamic rendering or the upscaling blit last wrote the target
+   VkImageMemoryBarrier to_copy[] = {
+       {
+           .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+           .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+           .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+           .oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+           .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+           .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+           .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+           .image = target,
+           .subresourceRange = color_range,
+       },
+       // The slot's last capture was read back before its fence signaled
+       {
+           .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+           .srcAccessMask = 0,
+           .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+           .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+           .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+           .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+           .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+           .image = capture,
+           .subresourceRange = color_range,
+       },
+   };
+   vkCmdPipelineBarrier(
+       frame.command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+       0, nullptr, 0, nullptr, VKAD_ARRAY_LEN(to_copy), to_copy
+   );
+
+   VkExtent2D src = target_extent();
+   auto corner = [](VkExtent2D extent) {
+      return VkOffset3D{static_cast<int32_t>(extent.width), static_cast<int32_t>(extent.height), 1};
+   };
+   VkImageSubresourceLayers color_layer = {
+       .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+       .mipLevel = 0,
+       .baseArrayLayer = 0,
+       .layerCount = 1,
+   };
+   VkImageBlit region = {
+       .srcSubresource = color_layer,
+       .srcOffsets = {{0, 0, 0}, corner(src)},
+       .dstSubresource = color_layer,
+       .dstOffsets = {{0, 0, 0}, corner(capture_extent_)},
+   };
+   vkCmdBlitImage(
+       frame.command_buffer, target, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, capture,
+       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR
+   );
+
+   VkImageMemoryBarrier after_copy[] = {
+       {
+           .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+           .srcAccessMask = 0,
+           .dstAccessMask = 0,
+           .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+           .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+           .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+           .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+           .image = target,
+           .subresourceRange = color_range,
+       },
+       {
+           .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+           .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+           .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+           .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+           .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+           .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+           .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+           .image = capture,
+           .subresourceRange = color_range,
+       },
+   };
+   vkCmdPipelineBarrier(
+       frame.command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+       VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
+       nullptr, VKAD_ARRAY_LEN(after_copy), after_copy
+   );
+
+   queue_readback(frame, capture, capture_extent_);
+}
+
+void Renderer::queue_readback(Frame &frame, VkImage image, VkExtent2D extent) {
+   frame.readback_pending = true;
+   frame.readback_frame = frames_rendered_;
+
+   // The image is in TRANSFER_SRC, with the copy ordered after its writes by the render pass, or
+   // by the barrier after whichever blit wrote it last
    VkBufferImageCopy region = {
+       .bufferOffset = 0,
+       .bufferRowLength = 0,
+       .bufferImageHeight = 0,
        .imageSubresource =
            {
                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -375,168 +922,957 @@ void Renderer::upload_texture(const StagingBuffer &src, Image &image) {
                .baseArrayLayer = 0,
                .layerCount = 1,
            },
-       .imageExtent = {
-           .width = static_cast<uint32_t>(image.width()),
-           .height = static_cast<uint32_t>(image.height()),
-           .depth = 1,
-       },
+       .imageExtent = {extent.width, extent.height, 1},
    };
+   vkCmdCopyImageToBuffer(
+       frame.command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+       frame.readback_buffer, 1, &region
+   );
 
-   vkCmdCopyBufferToImage(
-       preframe_cmd_buf_, src.buffer(), image.handle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
-       &region
+   VkBufferMemoryBarrier barrier = {
+       .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+       .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+       .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+       .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+       .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+       .buffer = frame.readback_buffer,
+       .offset = 0,
+       .size = VK_WHOLE_SIZE,
+   };
+   vkCmdPipelineBarrier(
+       frame.command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0,
+       nullptr, 1, &barrier, 0, nullptr
    );
 }
 
-void Renderer::end_preframe() {
-   vkEndCommandBuffer(preframe_cmd_buf_);
+void Renderer::create_instance_buffer(Frame &frame, uint32_t capacity) {
+   buffer_init(
+       &frame.instance_buffer, &frame.instance_allocation, capacity * sizeof(uint32_t),
+       VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+       static_cast<VkMemoryPropertyFlagBits>(
+           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+       ),
+       allocator()
+   );
+   frame.visible_buffer = VK_NULL_HANDLE;
+   if (gpu_culling_) {
+      buffer_init(
+          &frame.visible_buffer, &frame.visible_allocation, capacity * sizeof(uint32_t),
+          VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocator()
+      );
+   }
+   frame.instance_capacity = capacity;
+   frame.instance_count = 0;
+}
 
-   VkSubmitInfo submit_info = {
-       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-       .commandBufferCount = 1,
-       .pCommandBuffers = &preframe_cmd_buf_,
-   };
-   vkQueueSubmit(device_.graphics_queue(), 1, &submit_info, VK_NULL_HANDLE);
-   vkQueueWaitIdle(device_.graphics_queue());
+void Renderer::create_draw_buffers(Frame &frame, uint32_t capacity) {
+   auto host_visible = static_cast<VkMemoryPropertyFlagBits>(
+       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+   );
+   buffer_init(
+       &frame.draw_buffer, &frame.draw_allocation,
+       capacity * sizeof(VkDrawIndexedIndirectCommand),
+       VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host_visible,
+       allocator()
+   );
+   buffer_init(
+       &frame.cull_draw_buffer, &frame.cull_draw_allocation, capacity * sizeof(CullDraw),
+       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, host_visible, allocator()
+   );
+   frame.draw_capacity = capacity;
+   frame.draw_count = 0;
 }
 
-bool begin_render(Renderer *renderer) {
-   vkWaitForFences(
-       renderer->device().handle(), 1, &renderer->draw_cycle_complete, VK_TRUE, UINT64_MAX
+void Renderer::create_object_buffer(Frame &frame, uint32_t capacity) {
+   buffer_init(
+       &frame.object_buffer, &frame.object_allocation, capacity * sizeof(InstanceData),
+       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+       static_cast<VkMemoryPropertyFlagBits>(
+           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+       ),
+       allocator()
+   );
+   frame.object_capacity = capacity;
+   write_descriptor_set(
+       device().handle(), frame.object_set, {write_storage_buffer(frame.object_buffer, 0)}
    );
+}
+
+void Renderer::grow_instance_buffer(Frame &frame, uint32_t capacity) {
+   frame.dead_buffers.emplace_back(frame.instance_buffer, frame.instance_allocation);
+   if (frame.visible_buffer != VK_NULL_HANDLE) {
+      frame.dead_buffers.emplace_back(frame.visible_buffer, frame.visible_allocation);
+   }
+   create_instance_buffer(frame, std::max(frame.instance_capacity * 2, capacity));
+}
+
+void Renderer::grow_draw_buffers(Frame &frame, uint32_t capacity) {
+   frame.dead_buffers.emplace_back(frame.draw_buffer, frame.draw_allocation);
+   frame.dead_buffers.emplace_back(frame.cull_draw_buffer, frame.cull_draw_allocation);
+   create_draw_buffers(frame, std::max(frame.draw_capacity * 2, capacity));
+}
 
-   VkResult next_image_res = vkAcquireNextImageKHR(
-       renderer->device().handle(), renderer->swapchain_.handle(), UINT64_MAX,
-       renderer->sem_img_avail, VK_NULL_HANDLE, &renderer->current_framebuffer_
+uint32_t Renderer::reserve_instances(uint32_t count) {
+   Frame &frame = this->frame();
+   if (frame.instance_count + count > frame.instance_capacity) {
+      // The cull pass reads every layer's instances out of the frame's current buffers, so they
+      // can't be replaced once a layer has written to the old ones
+      VKAD_ASSERT(
+          !gpu_culling_ || frame.recorded_layers == 0,
+          "render layers reserved more instances than reserve_frame"
+      );
+      grow_instance_buffer(frame, count);
+   }
+
+   uint32_t first_instance = frame.instance_count;
+   frame.instance_count += count;
+   return first_instance;
+}
+
+uint32_t Renderer::reserve_draws(uint32_t count) {
+   Frame &frame = this->frame();
+   if (frame.draw_count + count > frame.draw_capacity) {
+      VKAD_ASSERT(
+          frame.recorded_layers == 0, "render layers reserved more draws than reserve_frame"
+      );
+      grow_draw_buffers(frame, count);
+   }
+
+   uint32_t first_draw = frame.draw_count;
+   frame.draw_count += count;
+   return first_draw;
+}
+
+void Renderer::cull_draws(Frame &frame) {
+   VKAD_ASSERT(
+       frame.draw_count <= vk_instance_.properties().limits.maxComputeWorkGroupCount[0],
+       "too many draws to cull in one dispatch"
+   );
+
+   // Any of the buffers may have been replaced since the slot was last recorded
+   write_descriptor_set(
+       device().handle(), frame.cull_set,
+       {
+           write_storage_buffer(frame.object_buffer, 0),
+           write_storage_buffer(frame.instance_buffer, 1),
+           write_storage_buffer(frame.cull_draw_buffer, 2),
+           write_storage_buffer(frame.draw_buffer, 3),
+           write_storage_buffer(frame.visible_buffer, 4),
+       }
    );
 
-   if (next_image_res == VK_ERROR_OUT_OF_DATE_KHR) {
+   VkCommandBuffer cmd = frame.command_buffer;
+   VkPipelineLayout layout = cull_pipeline_->layout();
+   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline_->handle());
+   vkCmdBindDescriptorSets(
+       cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &frame.cull_set, 0, nullptr
+   );
+   vkCmdPushConstants(
+       cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &frame.draw_count
+   );
+   vkCmdDispatch(cmd, frame.draw_count, 1, 1);
+
+   // Instance counts are read by the indirect draws and the packed ids as vertex attributes
+   VkMemoryBarrier barrier = {
+       .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+       .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+       .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+   };
+   vkCmdPipelineBarrier(
+       cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0,
+       nullptr, 0, nullptr
+   );
+}
+
+void reserve_frame(Renderer *renderer, uint32_t instance_count, uint32_t draw_count) {
+   Renderer::Frame &frame = renderer->frame();
+   VKAD_ASSERT(frame.recorded_layers == 0, "frame reserved after a layer was begun");
+   if (instance_count > frame.instance_capacity) {
+      renderer->grow_instance_buffer(frame, instance_count);
+   }
+   if (renderer->gpu_culling_ && draw_count > frame.draw_capacity) {
+      renderer->grow_draw_buffers(frame, draw_count);
+   }
+}
+
+bool acquire_frame(Renderer *renderer) {
+   RenderContext &context = renderer->context();
+   // Only submit_frames advances the slot, and it runs on the same thread
+   uint32_t slot = context.frame_slot();
+   VkFence slot_fence = context.frame_fence(slot);
+   vkWaitForFences(renderer->device().handle(), 1, &slot_fence, VK_TRUE, UINT64_MAX);
+
+   if (!renderer->swapchain_ || renderer->image_acquired_) {
+      return true;
+   }
+
+   VkResult res;
+   {
+      std::lock_guard lock(context.swapchain_mutex());
+      res = vkAcquireNextImageKHR(
+          renderer->device().handle(), renderer->swapchain_->handle(), UINT64_MAX,
+          renderer->frames_[slot].sem_img_avail, VK_NULL_HANDLE, &renderer->current_framebuffer_
+      );
+   }
+   if (res == VK_ERROR_OUT_OF_DATE_KHR) {
       return false;
-   } else if (next_image_res != VK_SUBOPTIMAL_KHR) {
-      VKAD_VK(next_image_res);
+   } else if (res != VK_SUBOPTIMAL_KHR) {
+      VKAD_VK(res);
+   }
+   renderer->image_acquired_ = true;
+   return true;
+}
+
+bool begin_render(Renderer *renderer) {
+   RenderContext &context = renderer->context();
+   VKAD_ASSERT(!context.has_queued_frame(renderer), "frame begun before the last was submitted");
+
+   // Every renderer on the context records into the same slot, whose fence covers all of their
+   // frames submitted in it
+   renderer->current_frame_ = context.frame_slot();
+   Renderer::Frame &frame = renderer->frame();
+   VkFence slot_fence = context.frame_fence(renderer->current_frame_);
+
+   vkWaitForFences(renderer->device().handle(), 1, &slot_fence, VK_TRUE, UINT64_MAX);
+   frame.started = std::chrono::steady_clock::now();
+   context.pump_uploads();
+   renderer->poll_pipelines();
+   renderer->collect_garbage(frame);
+   renderer->resolve_timestamps(frame);
+   frame.instance_count = 0;
+   frame.draw_count = 0;
+   for (uint32_t layer = 0; layer < MAX_RENDER_LAYERS; ++layer) {
+      if ((frame.recorded_layers & (1u << layer)) != 0) {
+         frame.layer_pools[layer].reset();
+      }
+   }
+   frame.recorded_layers = 0;
+   // The slot's readback buffer may be written again, so a frame left unpolled in it is dropped
+   frame.readback_pending = false;
+
+   if (renderer->swapchain_) {
+      if (!acquire_frame(renderer)) {
+         return false;
+      }
+      renderer->image_acquired_ = false;
+   } else {
+      renderer->current_framebuffer_ = renderer->current_frame_;
+   }
+
+   // The swapchain may hand out an image that an older frame slot is still rendering to
+   VkFence &image_fence = renderer->images_in_flight_[renderer->current_framebuffer_];
+   if (image_fence != VK_NULL_HANDLE && image_fence != slot_fence) {
+      vkWaitForFences(renderer->device().handle(), 1, &image_fence, VK_TRUE, UINT64_MAX);
    }
+   image_fence = slot_fence;
 
-   vkResetFences(renderer->device().handle(), 1, &renderer->draw_cycle_complete);
-   vkResetCommandBuffer(renderer->command_buffer_, 0);
+   vkResetCommandBuffer(frame.command_buffer, 0);
 
    VkCommandBufferBeginInfo cmd_begin = {
        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
    };
-   VKAD_VK(vkBeginCommandBuffer(renderer->command_buffer_, &cmd_begin));
+   VKAD_VK(vkBeginCommandBuffer(frame.command_buffer, &cmd_begin));
 
-   VkClearValue clear_color = {.color = {0.0f, 0.0f, 0.0f, 1.0f}};
-   VkRenderPassBeginInfo render_begin = {
-       .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+   if (renderer->timestamp_pool_ != VK_NULL_HANDLE) {
+      vkCmdResetQueryPool(
+          frame.command_buffer, renderer->timestamp_pool_,
+          renderer->current_frame_ * Renderer::kTimestampsPerFrame, Renderer::kTimestampsPerFrame
+      );
+      renderer->write_timestamp(frame.command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0);
+      frame.timestamps_written = true;
+   }
+   return true;
+}
+
+LayerRecorder *
+begin_layer(Renderer *renderer, uint32_t layer, uint32_t instance_count, uint32_t draw_count) {
+   VKAD_ASSERT(layer < MAX_RENDER_LAYERS, "render layer out of range");
+   Renderer::Frame &frame = renderer->frame();
+   VKAD_ASSERT((frame.recorded_layers & (1u << layer)) == 0, "render layer begun twice");
+
+   LayerRecorder &recorder = frame.layers[layer];
+   if (recorder.command_buffer == VK_NULL_HANDLE) {
+      // Each layer has its own pool, so layers can be recorded on any thread without locking
+      frame.layer_pools[layer].init(
+          renderer->device().handle(), renderer->vk_instance_.graphics_queue()
+      );
+      recorder.command_buffer =
+          frame.layer_pools[layer].allocate(VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+   }
+
+   uint32_t first_instance = renderer->reserve_instances(instance_count);
+   recorder.renderer = renderer;
+   recorder.layer = layer;
+   recorder.pipeline_layout = VK_NULL_HANDLE;
+   recorder.vertex_block = UINT32_MAX;
+   recorder.index_block = UINT32_MAX;
+   recorder.index_type = VK_INDEX_TYPE_UINT16;
+   recorder.mesh_vertex_offset = 0;
+   recorder.mesh_first_index = 0;
+   recorder.mesh_index_count = 0;
+   recorder.instance_ids = reinterpret_cast<uint32_t *>(frame.instance_allocation.mapped);
+   recorder.first_instance = first_instance;
+   recorder.instance_count = 0;
+   recorder.instance_capacity = instance_count;
+   std::fill_n(recorder.mesh_bounds_min, 3, 0.0f);
+   std::fill_n(recorder.mesh_bounds_max, 3, 0.0f);
+   std::fill_n(recorder.view_projection, 16, 0.0f);
+
+   recorder.draw_commands = nullptr;
+   recorder.cull_draws = nullptr;
+   recorder.first_draw = 0;
+   recorder.draw_count = 0;
+   recorder.draw_capacity = 0;
+   recorder.pending_first_draw = 0;
+   recorder.pending_draw_count = 0;
+   if (renderer->gpu_culling_) {
+      recorder.first_draw = renderer->reserve_draws(draw_count);
+      recorder.draw_capacity = draw_count;
+      recorder.draw_commands =
+          reinterpret_cast<VkDrawIndexedIndirectCommand *>(frame.draw_allocation.mapped);
+      recorder.cull_draws = reinterpret_cast<CullDraw *>(frame.cull_draw_allocation.mapped);
+   }
+   recorder.draw_buffer = frame.draw_buffer;
+   frame.recorded_layers |= 1u << layer;
+
+   VkFormat color_format = renderer->target_format();
+   VkCommandBufferInheritanceRenderingInfoKHR inheritance_rendering = {
+       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR,
+       .colorAttachmentCount = 1,
+       .pColorAttachmentFormats = &color_format,
+       .depthAttachmentFormat = renderer->depth_format_,
+       .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+   };
+   bool dynamic_rendering = renderer->device().has_dynamic_rendering();
+   VkCommandBufferInheritanceInfo inheritance = {
+       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+       .pNext = dynamic_rendering ? &inheritance_rendering : nullptr,
        .renderPass = renderer->render_pass_,
-       .framebuffer = renderer->framebuffers_[renderer->current_framebuffer_],
-       .renderArea =
-           {
-               .extent = renderer->swapchain_.extent(),
-           },
-       .clearValueCount = 1,
-       .pClearValues = &clear_color,
+       .subpass = 0,
+       .framebuffer = dynamic_rendering ? VK_NULL_HANDLE
+                                        : renderer->framebuffers_[renderer->current_framebuffer_],
+   };
+   VkCommandBufferBeginInfo cmd_begin = {
+       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+       .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+       .pInheritanceInfo = &inheritance,
    };
+   VKAD_VK(vkBeginCommandBuffer(recorder.command_buffer, &cmd_begin));
 
-   vkCmdBeginRenderPass(renderer->command_buffer_, &render_begin, VK_SUBPASS_CONTENTS_INLINE);
+   // Secondary command buffers inherit no state from the primary. With GPU culling, draws read the
+   // ids the cull pass packed rather than every candidate.
+   VkBuffer instances = renderer->gpu_culling_ ? frame.visible_buffer : frame.instance_buffer;
+   VkDeviceSize instance_offset = 0;
+   vkCmdBindVertexBuffers(recorder.command_buffer, 1, 1, &instances, &instance_offset);
 
    VkViewport viewport = {
-       .width = static_cast<float>(renderer->swapchain_.extent().width),
-       .height = static_cast<float>(renderer->swapchain_.extent().height),
+       .width = static_cast<float>(renderer->draw_extent().width),
+       .height = static_cast<float>(renderer->draw_extent().height),
        .maxDepth = 1.0f,
    };
-   vkCmdSetViewport(renderer->command_buffer_, 0, 1, &viewport);
+   vkCmdSetViewport(recorder.command_buffer, 0, 1, &viewport);
 
    VkRect2D scissor = {
-       .extent = renderer->swapchain_.extent(),
+       .extent = renderer->draw_extent(),
    };
-   vkCmdSetScissor(renderer->command_buffer_, 0, 1, &scissor);
-   return true;
+   vkCmdSetScissor(recorder.command_buffer, 0, 1, &scissor);
+
+   // Layers are drawn over each other in order, so nothing in a lower layer may hide this one
+   if (renderer->depth_image_) {
+      VkClearAttachment clear_depth = {
+          .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+          .clearValue = {.depthStencil = {.depth = 1.0f, .stencil = 0}},
+      };
+      VkClearRect clear_rect = {
+          .rect = scissor,
+          .baseArrayLayer = 0,
+          .layerCount = 1,
+      };
+      vkCmdClearAttachments(recorder.command_buffer, 1, &clear_depth, 1, &clear_rect);
+   }
+
+   renderer->write_timestamp(
+       recorder.command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 2 + layer * 2
+   );
+   return &recorder;
+}
+
+void end_layer(LayerRecorder *recorder) {
+   flush_draws(recorder);
+   if (recorder->draw_count < recorder->draw_capacity) {
+      // The cull pass runs over every reserved draw, so the unused ones are given no candidates
+      std::memset(
+          recorder->cull_draws + recorder->first_draw + recorder->draw_count, 0,
+          (recorder->draw_capacity - recorder->draw_count) * sizeof(CullDraw)
+      );
+   }
+
+   recorder->renderer->write_timestamp(
+       recorder->command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 3 + recorder->layer * 2
+   );
+   VKAD_VK(vkEndCommandBuffer(recorder->command_buffer));
 }
 
 void end_render(Renderer *renderer) {
-   vkCmdEndRenderPass(renderer->command_buffer_);
-   VKAD_VK(vkEndCommandBuffer(renderer->command_buffer_));
-
-   VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-   VkSubmitInfo submit_info = {
-       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-       .waitSemaphoreCount = 1,
-       .pWaitSemaphores = &renderer->sem_img_avail,
-       .pWaitDstStageMask = wait_stages,
-       .commandBufferCount = 1,
-       .pCommandBuffers = &renderer->command_buffer_,
-       .signalSemaphoreCount = 1,
-       .pSignalSemaphores = &renderer->sem_render_complete,
-   };
-   VKAD_VK(vkQueueSubmit(
-       renderer->device().graphics_queue(), 1, &submit_info, renderer->draw_cycle_complete
-   ));
+   Renderer::Frame &frame = renderer->frame();
+
+   // Layers run in layer order no matter which threads recorded them or when they finished
+   std::array<VkCommandBuffer, MAX_RENDER_LAYERS> layer_buffers;
+   uint32_t layer_count = 0;
+   for (uint32_t layer = 0; layer < MAX_RENDER_LAYERS; ++layer) {
+      if ((frame.recorded_layers & (1u << layer)) != 0) {
+         layer_buffers[layer_count++] = frame.layers[layer].command_buffer;
+      }
+   }
+
+   // Compute work can't be recorded inside a render pass
+   if (renderer->gpu_culling_ && frame.draw_count > 0) {
+      renderer->cull_draws(frame);
+   }
+
+   VkClearValue clear_values[] = {
+       {.color = {0.0f, 0.0f, 0.0f, 1.0f}},
+       {.depthStencil = {.depth = 1.0f, .stencil = 0}},
+   };
+   bool has_depth = renderer->depth_image_ != nullptr;
+   if (renderer->device().has_dynamic_rendering()) {
+      renderer->transition_target(true);
+
+      VkRenderingAttachmentInfoKHR color_attachment = {
+          .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+          .imageView = renderer->draw_image_view(renderer->current_framebuffer_),
+          .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+          .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+          .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+          .clearValue = clear_values[0],
+      };
+      VkRenderingAttachmentInfoKHR depth_attachment = {
+          .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+          .imageView = has_depth ? renderer->depth_image_->view() : VK_NULL_HANDLE,
+          .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+          .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+          .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+          .clearValue = clear_values[1],
+      };
+      VkRenderingInfoKHR rendering_info = {
+          .sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,
+          .flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR,
+          .renderArea =
+              {
+                  .extent = renderer->draw_extent(),
+              },
+          .layerCount = 1,
+          .colorAttachmentCount = 1,
+          .pColorAttachments = &color_attachment,
+          .pDepthAttachment = has_depth ? &depth_attachment : nullptr,
+      };
+      renderer->device().begin_rendering(frame.command_buffer, rendering_info);
+   } else {
+      VkRenderPassBeginInfo render_begin = {
+          .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+          .renderPass = renderer->render_pass_,
+          .framebuffer = renderer->framebuffers_[renderer->current_framebuffer_],
+          .renderArea =
+              {
+                  .extent = renderer->draw_extent(),
+              },
+          .clearValueCount = has_depth ? 2u : 1u,
+          .pClearValues = clear_values,
+      };
+      vkCmdBeginRenderPass(
+          frame.command_buffer, &render_begin, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+      );
+   }
 
-   VkSwapchainKHR swap_chains[] = {renderer->swapchain_.handle()};
-   VkPresentInfoKHR present_info = {
-       .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-       .waitSemaphoreCount = 1,
-       .pWaitSemaphores = &renderer->sem_render_complete,
-       .swapchainCount = VKAD_ARRAY_LEN(swap_chains),
-       .pSwapchains = swap_chains,
-       .pImageIndices = &renderer->current_framebuffer_,
+   if (layer_count > 0) {
+      vkCmdExecuteCommands(frame.command_buffer, layer_count, layer_buffers.data());
+   }
+
+   if (renderer->device().has_dynamic_rendering()) {
+      renderer->device().end_rendering(frame.command_buffer);
+      renderer->transition_target(false);
+   } else {
+      vkCmdEndRenderPass(frame.command_buffer);
+   }
+   if (renderer->scaled_) {
+      renderer->blit_to_target(frame);
+   }
+   renderer->write_timestamp(frame.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 1);
+   if (renderer->offscreen_) {
+      renderer->queue_readback(
+          frame, renderer->offscreen_->image(renderer->current_framebuffer_),
+          renderer->offscreen_->extent()
+      );
+   } else if (renderer->capture_interval_ > 0 &&
+              renderer->frames_rendered_ % renderer->capture_interval_ == 0) {
+      renderer->queue_capture(frame);
+   }
+   VKAD_VK(vkEndCommandBuffer(frame.command_buffer));
+
+   bool presenting = renderer->swapchain_.has_value();
+   QueuedFrame queued = {
+       .owner = renderer,
+       .command_buffer = frame.command_buffer,
+       .image_available = presenting ? frame.sem_img_avail : VK_NULL_HANDLE,
+       .render_complete = presenting ? frame.sem_render_complete : VK_NULL_HANDLE,
+       .swapchain = presenting ? renderer->swapchain_->handle() : VK_NULL_HANDLE,
+       .image_index = renderer->current_framebuffer_,
+       .present_timer = nullptr,
+       .present_id = 0,
+       .started = frame.started,
    };
-   vkQueuePresentKHR(renderer->device().present_queue(), &present_info);
+   if (presenting && renderer->present_timer_) {
+      queued.present_timer = &*renderer->present_timer_;
+      queued.present_id = renderer->present_timer_->next_present_id();
+   }
+   renderer->context().queue_frame(queued);
+   renderer->frames_rendered_++;
 }
 
-void set_pipeline(Renderer *renderer, uint32_t pipeline_id) {
-   Renderer::MaterialPipeline &pipe = renderer->pipelines_[pipeline_id];
-   vkCmdBindPipeline(
-       renderer->command_buffer_, VK_PIPELINE_BIND_POINT_GRAPHICS, pipe.pipeline.handle()
+void set_pipeline(LayerRecorder *recorder, uint32_t pipeline_id, BlendMode blend_mode) {
+   flush_draws(recorder);
+   Renderer *renderer = recorder->renderer;
+   Renderer::MaterialPipeline *pipe = &renderer->pipelines_[pipeline_id];
+   if (!pipe->variants.has_value()) {
+      pipe = &renderer->pipelines_[renderer->pipeline_ids_.ui];
+   }
+   const std::optional<Pipeline> &opaque = pipe->variants->opaque;
+   const Pipeline &pipeline = blend_mode == BLEND_MODE_OPAQUE && opaque.has_value()
+                                  ? *opaque
+                                  : pipe->variants->transparent;
+
+   vkCmdBindPipeline(recorder->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.handle());
+
+   // Without descriptor indexing, set 0 holds a single texture and is bound by set_material
+   const TextureTable &textures = renderer->context().texture_table();
+   VkDescriptorSet sets[] = {textures.set(), renderer->frame().object_set};
+   uint32_t first_set = textures.bindless() ? 0 : 1;
+   vkCmdBindDescriptorSets(
+       recorder->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.layout(), first_set,
+       VKAD_ARRAY_LEN(sets) - first_set, sets + first_set, 0, nullptr
    );
-   renderer->last_bound_pipeline_ = &pipe;
+   recorder->pipeline_layout = pipeline.layout();
 }
 
-void set_material(Renderer *renderer, Material *material) {
-   Renderer::MaterialPipeline *last = renderer->last_bound_pipeline_;
-   uint32_t offsets[] = {
-       static_cast<uint32_t>(material->uniform_buffer_index * last->uniforms.element_size())
-   };
+// Bindless tables are bound with the pipeline and each instance names its own texture, so
+// materials only need binding without descriptor indexing
+void set_material(LayerRecorder *recorder, Material *material) {
+   const TextureTable &textures = recorder->renderer->context().texture_table();
+   if (textures.bindless()) {
+      return;
+   }
+
+   flush_draws(recorder);
+   VkDescriptorSet set = textures.slot_set(material->texture);
    vkCmdBindDescriptorSets(
-       renderer->command_buffer_, VK_PIPELINE_BIND_POINT_GRAPHICS, last->pipeline.layout(), 0, 1,
-       &material->descriptor_set, 1, offsets
+       recorder->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, recorder->pipeline_layout, 0,
+       1, &set, 0, nullptr
    );
 }
 
-void set_mesh(Renderer *renderer, Mesh *mesh) {
-   VkBuffer buffers[] = {mesh->buffer};
-   VkDeviceSize offsets[] = {0};
-   vkCmdBindVertexBuffers(renderer->command_buffer_, 0, 1, buffers, offsets);
-   vkCmdBindIndexBuffer(
-       renderer->command_buffer_, mesh->buffer, mesh->vertex_data_size, VK_INDEX_TYPE_UINT16
-   );
-   renderer->last_bound_mesh_index_count_ = mesh->num_indices;
+void set_mesh(LayerRecorder *recorder, Mesh *mesh) {
+   VkCommandBuffer cmd = recorder->command_buffer;
+   RenderContext &context = recorder->renderer->context();
+   VkIndexType index_type =
+       mesh->index_type == INDEX_TYPE_UINT32 ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+   bool rebind_indices =
+       mesh->index_block != recorder->index_block || index_type != recorder->index_type;
+   if (mesh->vertex_block != recorder->vertex_block || rebind_indices) {
+      flush_draws(recorder);
+   }
+   if (mesh->vertex_block != recorder->vertex_block) {
+      VkBuffer buffer = context.vertex_buffer(mesh->vertex_block);
+      VkDeviceSize offset = 0;
+      vkCmdBindVertexBuffers(cmd, 0, 1, &buffer, &offset);
+      recorder->vertex_block = mesh->vertex_block;
+   }
+   // Both index types share the index buffers, so meshes of either are bound at offset 0 and
+   // told apart by the type
+   if (rebind_indices) {
+      vkCmdBindIndexBuffer(cmd, context.index_buffer(mesh->index_block), 0, index_type);
+      recorder->index_block = mesh->index_block;
+      recorder->index_type = index_type;
+   }
+   recorder->mesh_vertex_offset = mesh->vertex_offset;
+   recorder->mesh_first_index = mesh->first_index;
+   recorder->mesh_index_count = mesh->num_indices;
+   std::copy_n(mesh->bounds_min, 3, recorder->mesh_bounds_min);
+   std::copy_n(mesh->bounds_max, 3, recorder->mesh_bounds_max);
+}
+
+uint32_t frame_slot(Renderer *renderer) {
+   return renderer->current_frame_;
+}
+
+uint32_t frame_slot_count(Renderer *renderer) {
+   return renderer->frames_in_flight_;
+}
+
+InstanceData *map_object_buffer(Renderer *renderer, uint32_t capacity) {
+   Renderer::Frame &frame = renderer->frame();
+   if (capacity > frame.object_capacity) {
+      // The slot's previous frame has finished, so the old buffer and the descriptor set are no
+      // longer in use. Objects that haven't changed are only ever written once per slot, so the
+      // old contents are carried over.
+      VkBuffer old_buffer = frame.object_buffer;
+      MemoryAllocation old_allocation = frame.object_allocation;
+      uint32_t old_capacity = frame.object_capacity;
+
+      renderer->create_object_buffer(frame, std::max(old_capacity * 2, capacity));
+      std::memcpy(
+          frame.object_allocation.mapped, old_allocation.mapped,
+          old_capacity * sizeof(InstanceData)
+      );
+      buffer_destroy(&old_buffer, old_allocation, renderer->allocator());
+   }
+   return reinterpret_cast<InstanceData *>(frame.object_allocation.mapped);
 }
 
-void render_object(Renderer *renderer, const PushConstants *push_constants) {
+void set_pass_constants(LayerRecorder *recorder, const PassConstants *constants) {
+   flush_draws(recorder);
+   std::copy_n(constants->view_projection, 16, recorder->view_projection);
    vkCmdPushConstants(
-       renderer->command_buffer_, renderer->last_bound_pipeline_->pipeline.layout(),
-       VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants), push_constants
+       recorder->command_buffer, recorder->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+       sizeof(PassConstants), constants
+   );
+}
+
+void render_instances(LayerRecorder *recorder, const uint32_t *object_ids, uint32_t count) {
+   if (count == 0) {
+      return;
+   }
+   VKAD_ASSERT(
+       recorder->instance_count + count <= recorder->instance_capacity,
+       "render layer drew more instances than it reserved"
    );
 
-   vkCmdDrawIndexed(renderer->command_buffer_, renderer->last_bound_mesh_index_count_, 1, 0, 0, 0);
+   uint32_t first_instance = recorder->first_instance + recorder->instance_count;
+   std::memcpy(recorder->instance_ids + first_instance, object_ids, count * sizeof(uint32_t));
+   recorder->instance_count += count;
+
+   if (recorder->renderer->gpu_culling_) {
+      VKAD_ASSERT(
+          recorder->draw_count < recorder->draw_capacity,
+          "render layer drew more times than it reserved"
+      );
+      uint32_t draw = recorder->first_draw + recorder->draw_count++;
+      recorder->draw_commands[draw] = {
+          .indexCount = recorder->mesh_index_count,
+          .instanceCount = 0,
+          .firstIndex = recorder->mesh_first_index,
+          .vertexOffset = recorder->mesh_vertex_offset,
+          .firstInstance = first_instance,
+      };
+
+      CullDraw &cull = recorder->cull_draws[draw];
+      std::copy_n(recorder->view_projection, 16, cull.view_projection);
+      std::copy_n(recorder->mesh_bounds_min, 3, cull.bounds_min);
+      std::copy_n(recorder->mesh_bounds_max, 3, cull.bounds_max);
+      cull.candidate_count = count;
+
+      if (recorder->pending_draw_count == 0) {
+         recorder->pending_first_draw = draw;
+      }
+      recorder->pending_draw_count++;
+      if (recorder->pending_draw_count == recorder->renderer->max_indirect_draws_) {
+         flush_draws(recorder);
+      }
+      return;
+   }
+
+   vkCmdDrawIndexed(
+       recorder->command_buffer, recorder->mesh_index_count, count, recorder->mesh_first_index,
+       recorder->mesh_vertex_offset, first_instance
+   );
+}
+
+bool poll_readback(Renderer *renderer, uint8_t *pixels, size_t size, uint64_t *frame_number) {
+   if (!renderer->offscreen_ && renderer->capture_interval_ == 0) {
+      return false;
+   }
+
+   // Frames finish in submission order, so only the oldest pending one needs checking
+   Renderer::Frame *oldest = nullptr;
+   for (uint32_t i = 0; i < renderer->frames_in_flight_; ++i) {
+      Renderer::Frame &frame = renderer->frames_[i];
+      if (frame.readback_pending &&
+          (oldest == nullptr || frame.readback_frame < oldest->readback_frame)) {
+         oldest = &frame;
+      }
+   }
+   if (oldest == nullptr) {
+      return false;
+   }
+   // Until a queued frame is submitted, its slot's fence still reports the previous submission
+   uint32_t slot = static_cast<uint32_t>(oldest - renderer->frames_.data());
+   if (slot == renderer->current_frame_ && renderer->context().has_queued_frame(renderer)) {
+      return false;
+   }
+   VkFence fence = renderer->context().frame_fence(slot);
+   if (vkGetFenceStatus(renderer->device().handle(), fence) != VK_SUCCESS) {
+      return false;
+   }
+
+   size_t image_size = renderer->readback_size();
+   if (size < image_size) {
+      throw std::runtime_error(
+          std::format("readback needs {} bytes but was given {}", image_size, size)
+      );
+   }
+   std::memcpy(pixels, oldest->readback_allocation.mapped, image_size);
+   *frame_number = oldest->readback_frame;
+   oldest->readback_pending = false;
+   return true;
+}
+
+void get_renderer_stats(Renderer *renderer, RendererStats *stats) {
+   DescriptorStats descriptors = renderer->descriptor_stats();
+   MemoryStats memory = renderer->context().memory_stats();
+   *stats = {
+       .descriptor_pools = descriptors.pool_count,
+       .descriptor_sets = descriptors.set_count,
+       .descriptor_pool_growths = descriptors.growths,
+       .memory_reserved = memory.reserved,
+       .memory_used = memory.used,
+       .gpu_frame_ns = renderer->gpu_frame_ns_,
+   };
+   std::copy(
+       renderer->gpu_layer_ns_.begin(), renderer->gpu_layer_ns_.end(), stats->gpu_layer_ns
+   );
+   static_assert(PresentTimer::kBuckets == PRESENT_LATENCY_BUCKETS);
+   if (renderer->present_timer_) {
+      renderer->present_timer_->histogram(stats->present_latency_ms);
+   }
+}
+
+void Renderer::pick_copy_paths() {
+   // Scaled frames are upscaled with a linear blit into the target, which not every format or
+   // surface allows
+   VkFormatFeatureFlags blit_features =
+       VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+       VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+   bool can_blit = vk_instance_.supports_format(target_format(), blit_features) &&
+                   (!swapchain_ || (swapchain_->usage() & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0);
+   scaled_ = min_render_scale_ < 1.0f && can_blit;
+
+   // Captures are scaled with a blit too, out of the swapchain's images
+   capture_interval_ = 0;
+   if (swapchain_ && requested_capture_interval_ > 0) {
+      bool can_capture =
+          (swapchain_->usage() & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0 &&
+          vk_instance_.supports_format(target_format(), VK_FORMAT_FEATURE_BLIT_SRC_BIT) &&
+          vk_instance_.supports_format(
+              capture_format(target_format()), VK_FORMAT_FEATURE_BLIT_DST_BIT
+          );
+      if (can_capture) {
+         capture_interval_ = requested_capture_interval_;
+      }
+   }
+}
+
+void Renderer::create_readback_resources(Frame &frame) {
+   if (capture_interval_ > 0 && !frame.capture_image) {
+      frame.capture_image.emplace(
+          allocator(), VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+          capture_format(target_format()), capture_extent_.width, capture_extent_.height, 1
+      );
+   }
+   if ((offscreen_ || capture_interval_ > 0) && frame.readback_buffer == VK_NULL_HANDLE) {
+      buffer_init(
+          &frame.readback_buffer, &frame.readback_allocation, readback_size(),
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          static_cast<VkMemoryPropertyFlagBits>(
+              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+          ),
+          allocator()
+      );
+   }
+}
+
+void Renderer::recreate_render_pass() {
+   // Pipelines still compiling were handed the old pass
+   for (MaterialPipeline &pipe : pipelines_) {
+      if (pipe.pending_variants.valid()) {
+         pipe.pending_variants.wait();
+      }
+   }
+   vkDestroyRenderPass(device().handle(), render_pass_, nullptr);
+   create_render_pass();
+}
+
+void Renderer::create_render_pass() {
+   bool has_depth = depth_format_ != VK_FORMAT_UNDEFINED;
+   // Scaled frames are blitted into the target and offscreen ones read back, both right after
+   // the pass
+   bool copied_out = scaled_ || !swapchain_;
+   VkAttachmentDescription attachments[] = {
+       {
+           .format = target_format(),
+           .samples = VK_SAMPLE_COUNT_1_BIT,
+           .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+           .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+           .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+           .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+           .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+           .finalLayout = copied_out ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                     : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+       },
+       // Depth is only needed while the pass runs, so it is never stored. Left out of the pass
+       // without a depth buffer.
+       {
+           .format = depth_format_,
+           .samples = VK_SAMPLE_COUNT_1_BIT,
+           .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+           .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+           .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+           .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+           .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+           .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+       },
+   };
+
+   VkAttachmentReference color_attachment_ref = {
+       .attachment = 0,
+       .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+   };
+   VkAttachmentReference depth_attachment_ref = {
+       .attachment = 1,
+       .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+   };
+
+   VkSubpassDescription subpass = {
+       .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+       .colorAttachmentCount = 1,
+       .pColorAttachments = &color_attachment_ref,
+       .pDepthStencilAttachment = has_depth ? &depth_attachment_ref : nullptr,
+   };
+
+   // The shared depth image is cleared only once the last frame's depth tests are done with it,
+   // and the shared scaled image only once the last frame's blit has read it
+   VkPipelineStageFlags attachment_stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+   VkAccessFlags attachment_access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+   if (has_depth) {
+      attachment_stages |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                           VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+      attachment_access |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                           VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+   }
+   VkPipelineStageFlags wait_stages = attachment_stages;
+   if (scaled_) {
+      wait_stages |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+   }
+
+   VkSubpassDependency subpass_dependencies[] = {
+       {
+           .srcSubpass = VK_SUBPASS_EXTERNAL,
+           .dstSubpass = 0,
+           .srcStageMask = wait_stages,
+           .dstStageMask = attachment_stages,
+           .srcAccessMask = has_depth ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : 0u,
+           .dstAccessMask = attachment_access,
+       },
+       // The image is then blitted from or copied out for readback
+       {
+           .srcSubpass = 0,
+           .dstSubpass = VK_SUBPASS_EXTERNAL,
+           .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+           .dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+           .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+           .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+       },
+   };
+
+   VkRenderPassCreateInfo render_create = {
+       .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+       .attachmentCount = has_depth ? 2u : 1u,
+       .pAttachments = attachments,
+       .subpassCount = 1,
+       .pSubpasses = &subpass,
+       .dependencyCount = copied_out ? 2u : 1u,
+       .pDependencies = subpass_dependencies,
+   };
+
+   VKAD_VK(vkCreateRenderPass(device().handle(), &render_create, nullptr, &render_pass_));
 }
 
 void Renderer::create_framebuffers() {
-   framebuffers_.resize(swapchain_.num_images());
-   for (int i = 0; i < swapchain_.num_images(); ++i) {
-      VkImageView attachments[] = {swapchain_.image_view(i)};
+   if (render_pass_ == VK_NULL_HANDLE) {
+      return;
+   }
 
-      VkExtent2D extent = swapchain_.extent();
+   framebuffers_.resize(target_image_count());
+   for (int i = 0; i < target_image_count(); ++i) {
+      VkImageView attachments[] = {
+          draw_image_view(i), depth_image_ ? depth_image_->view() : VK_NULL_HANDLE
+      };
+
+      VkExtent2D extent = draw_extent();
       VkFramebufferCreateInfo create_info = {
           .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
           .renderPass = render_pass_,
-          .attachmentCount = VKAD_ARRAY_LEN(attachments),
+          .attachmentCount = depth_image_ ? 2u : 1u,
           .pAttachments = attachments,
           .width = extent.width,
           .height = extent.height,
           .layers = 1,
       };
-      VKAD_VK(vkCreateFramebuffer(device_.handle(), &create_info, nullptr, &framebuffers_[i]));
+      VKAD_VK(vkCreateFramebuffer(device().handle(), &create_info, nullptr, &framebuffers_[i]));
+   }
+}
+
+VkExtent2D Renderer::scaled_extent() const {
+   VkExtent2D extent = target_extent();
+   auto scale = [this](uint32_t size) {
+      return std::max(1u, static_cast<uint32_t>(std::lround(size * render_scale_)));
+   };
+   return {scale(extent.width), scale(extent.height)};
+}
+
+void Renderer::create_scaled_image() {
+   if (!scaled_) {
+      return;
+   }
+
+   VkExtent2D extent = scaled_extent();
+   scaled_image_ = std::make_unique<Image>(
+       allocator(), VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+       target_format(), extent.width, extent.height, 1
+   );
+   scaled_image_->init_view();
+}
+
+void Renderer::recreate_draw_images() {
+   // Frames in flight may still be drawing into or blitting from the old images, which are
+   // destroyed with the last begun frame's slot once its fence shows every frame before is done
+   Frame &frame = this->frame();
+   frame.dead_framebuffers.insert(
+       frame.dead_framebuffers.end(), framebuffers_.begin(), framebuffers_.end()
+   );
+   framebuffers_.clear();
+   if (scaled_image_) {
+      frame.dead_images.push_back(std::move(scaled_image_));
+   }
+   if (depth_image_) {
+      frame.dead_images.push_back(std::move(depth_image_));
    }
+
+   create_scaled_image();
+   create_depth_image();
+   create_framebuffers();
+}
+
+void Renderer::create_depth_image() {
+   if (depth_format_ == VK_FORMAT_UNDEFINED) {
+      return;
+   }
+
+   VkExtent2D extent = draw_extent();
+   depth_image_ = std::make_unique<Image>(
+       allocator(), VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depth_format_, extent.width,
+       extent.height, 1
+   );
+   depth_image_->init_view(VK_IMAGE_ASPECT_DEPTH_BIT);
 }
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <future>
 #include <initializer_list>
+#include <memory>
+#include <optional>
 #include <span>
 #include <unordered_map>
 #include <unordered_set>
@@ -13,20 +18,23 @@
 #include "ffi.h"
 #include "gpu/vulkan/buffer.h"
 #include "gpu/vulkan/command_pool.h"
+#include "gpu/vulkan/compute_pipeline.h"
 #include "gpu/vulkan/descriptor_pool.h"
 #include "gpu/vulkan/device.h"
 #include "gpu/vulkan/gpu.h"
 #include "gpu/vulkan/image.h"
+#include "gpu/vulkan/memory_allocator.h"
+#include "gpu/vulkan/offscreen_target.h"
 #include "gpu/vulkan/pipeline.h"
+#include "gpu/vulkan/present_timer.h"
 #include "gpu/vulkan/shader.h"
 #include "gpu/vulkan/swapchain.h"
 #include "math/matrix.h"
-#include "util/slab.h"
+#include "vk_render_context.h"
 
 namespace simulo {
 
 enum RenderPipeline : int {};
-enum RenderImage : int {};
 
 struct Pipelines {
    RenderPipeline ui;
@@ -63,89 +71,392 @@ private:
    std::unordered_map<std::string, MaterialPropertyValue> properties_;
 };
 
+class Renderer;
+
+// Per-draw input of the cull shader, laid out like its std430 CullDraw
+struct CullDraw {
+   float view_projection[16];
+   // Mesh-space bounding box, inverted for meshes that are never culled
+   float bounds_min[4];
+   float bounds_max[4];
+   uint32_t candidate_count;
+   uint32_t padding[3];
+};
+static_assert(sizeof(CullDraw) == 112);
+
+// Records one render layer's draws into a secondary command buffer of its own, so layers can be
+// recorded on different threads and executed by the frame's primary command buffer in order
+class LayerRecorder {
+public:
+   Renderer *renderer;
+   uint32_t layer;
+   VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+   VkPipelineLayout pipeline_layout;
+   // Shared mesh buffers bound in the command buffer, UINT32_MAX before the first set_mesh. Meshes
+   // in the same buffers are drawn without rebinding.
+   uint32_t vertex_block;
+   uint32_t index_block;
+   VkIndexType index_type;
+   // Where the bound mesh starts in the shared buffers
+   int32_t mesh_vertex_offset;
+   uint32_t mesh_first_index;
+   uint32_t mesh_index_count;
+   float mesh_bounds_min[3];
+   float mesh_bounds_max[3];
+
+   // The instance buffer range reserved by begin_layer, of which instance_count are written
+   uint32_t *instance_ids;
+   uint32_t first_instance;
+   uint32_t instance_count;
+   uint32_t instance_capacity;
+
+   // With GPU culling, the draw buffer range reserved by begin_layer. Each render_instances call
+   // writes an indirect command and its cull inputs, and consecutive commands are issued together
+   // once a state change or end_layer flushes them.
+   VkBuffer draw_buffer;
+   VkDrawIndexedIndirectCommand *draw_commands;
+   CullDraw *cull_draws;
+   uint32_t first_draw;
+   uint32_t draw_count;
+   uint32_t draw_capacity;
+   // Commands written but not yet issued
+   uint32_t pending_first_draw;
+   uint32_t pending_draw_count;
+   // From the last set_pass_constants, the frustum instances are culled against
+   float view_projection[16];
+};
+
 class Renderer {
 public:
+   // Renders to a swapchain on `surface`, or into owned images that are read back to the host when
+   // the surface is VK_NULL_HANDLE, which needs a context on a headless Gpu. Frames are queued on
+   // the context and only submitted by its submit_frames.
    explicit Renderer(
-       Gpu &vk_instance, VkSurfaceKHR surface, uint32_t initial_width, uint32_t initial_height
+       RenderContext &context, VkSurfaceKHR surface, uint32_t initial_width,
+       uint32_t initial_height, const RendererOptions &options
    );
    ~Renderer();
 
-   Mesh create_mesh(std::span<uint8_t> vertex_data, std::span<IndexBufferType> index_data);
-
    void delete_mesh(Mesh &mesh);
 
-   RenderImage create_image(std::span<uint8_t> img_data, int width, int height);
-
-   void
-   update_mesh(Mesh &mesh, std::span<uint8_t> vertex_data, std::span<IndexBufferType> index_data);
-
-   inline Device &device() {
-      return device_;
+   // Images live on the context, so they can be drawn by every renderer sharing it
+   inline RenderImage
+   create_image(std::span<uint8_t> img_data, int width, int height, uint32_t max_mip_levels) {
+      return context_.create_image(img_data, width, height, max_mip_levels);
    }
 
-   inline VkSampler image_sampler() const {
-      return sampler_;
+   inline RenderImage create_compressed_image(
+       std::span<const uint8_t> data, CompressedFormat format, int width, int height,
+       uint32_t mip_levels
+   ) {
+      return context_.create_compressed_image(data, format, width, height, mip_levels);
    }
 
-   void begin_preframe();
+   inline bool supports_compressed_format(CompressedFormat format) const {
+      return context_.supports_compressed_format(format);
+   }
 
-   void buffer_copy(const StagingBuffer &src, VkBuffer dst);
+   inline RenderContext &context() {
+      return context_;
+   }
 
-   void upload_texture(const StagingBuffer &src, Image &image);
+   inline Device &device() {
+      return context_.device();
+   }
 
-   inline void transfer_image_layout(Image &image, VkImageLayout layout) const {
-      image.queue_transfer_layout(layout, preframe_cmd_buf_);
+   inline MemoryAllocator &allocator() {
+      return context_.allocator();
    }
 
-   void end_preframe();
+   inline DescriptorStats descriptor_stats() const {
+      return descriptor_allocator_.stats();
+   }
 
    bool render(Mat4 ui_view_projection, Mat4 world_view_projection);
 
-   inline void wait_idle() const {
-      device_.wait_idle();
+   inline void wait_idle() {
+      device().wait_idle();
    }
 
    void draw_pipeline(RenderPipeline pipeline_id, Mat4 view_projection);
 
    RenderPipeline create_pipeline(
-       uint32_t vertex_size, VkDeviceSize uniform_size,
-       const std::vector<VkVertexInputAttributeDescription> &attrs,
+       uint32_t vertex_size, const std::vector<VkVertexInputAttributeDescription> &attrs,
        std::span<const uint8_t> vertex_shader, std::span<const uint8_t> fragment_shader,
-       const std::vector<VkDescriptorSetLayoutBinding> &bindings
+       bool compile_in_background
    );
 
+   // Moves pipelines that finished compiling on the worker into place and saves the cache if any
+   // did
+   void poll_pipelines();
+
+   // Decides from the target's format and the swapchain's usage whether frames are drawn scaled
+   // and captured, which a new swapchain may change
+   void pick_copy_paths();
+
+   void create_render_pass();
+
+   // Replaces the render pass after scaled_ changed, which only changes its final layout and
+   // dependencies, so the new pass stays compatible with every pipeline. The device must be idle.
+   void recreate_render_pass();
+
+   // Creates the frame's capture image and readback buffer if the renderer now needs them
+   void create_readback_resources(Frame &frame);
+
+   // With dynamic rendering there are no framebuffers to create
    void create_framebuffers();
 
+   // (Re)creates the image frames are drawn into at the render scale of the target's size, if the
+   // renderer draws scaled
+   void create_scaled_image();
+
+   // (Re)creates the depth image at the drawn size, if the renderer has a depth buffer
+   void create_depth_image();
+
+   // Replaces the images and framebuffers sized to what is drawn once the target or the render
+   // scale changed, leaving the old ones to the current frame slot's garbage
+   void recreate_draw_images();
+
+   // The target's size at the current render scale
+   VkExtent2D scaled_extent() const;
+
+   // Images frames are rendered into, from the swapchain or owned by the renderer when headless
+   inline int target_image_count() const {
+      return swapchain_ ? swapchain_->num_images() : offscreen_->num_images();
+   }
+
+   inline VkImage target_image(int index) const {
+      return swapchain_ ? swapchain_->image(index) : offscreen_->image(index);
+   }
+
+   inline VkImageView target_image_view(int index) const {
+      return swapchain_ ? swapchain_->image_view(index) : offscreen_->image_view(index);
+   }
+
+   inline VkFormat target_format() const {
+      return swapchain_ ? swapchain_->img_format() : offscreen_->img_format();
+   }
+
+   inline VkExtent2D target_extent() const {
+      return swapchain_ ? swapchain_->extent() : offscreen_->extent();
+   }
+
+   // Images layers are drawn into: the target's, or when drawing scaled, the one scaled image
+   // that every frame draws into and blits from
+   inline VkImage draw_image(int index) const {
+      return scaled_image_ ? scaled_image_->handle() : target_image(index);
+   }
+
+   inline VkImageView draw_image_view(int index) const {
+      return scaled_image_ ? scaled_image_->view() : target_image_view(index);
+   }
+
+   inline VkExtent2D draw_extent() const {
+      return scaled_image_ ? VkExtent2D{scaled_image_->width(), scaled_image_->height()}
+                           : target_extent();
+   }
+
+   // The blend modes of one material pipeline, compiled together
+   struct PipelineVariants {
+      Pipeline transparent;
+      // Only compiled with a depth buffer, since without one it would draw like the transparent
+      // variant
+      std::optional<Pipeline> opaque;
+   };
+
    struct MaterialPipeline {
-      VkDescriptorSetLayout descriptor_set_layout;
-      Pipeline pipeline;
-      VkDescriptorPool descriptor_pool;
-      int uniform_slot_usage;
-      UniformBuffer uniforms;
+      // Empty until the variants have compiled. Draws set_pipeline to it fall back to the UI
+      // pipeline, and its materials aren't ready in the meantime.
+      std::optional<PipelineVariants> variants;
+      std::future<PipelineVariants> pending_variants;
       Shader vertex_shader;
       Shader fragment_shader;
    };
 
+   struct Frame {
+      VkCommandBuffer command_buffer;
+      VkSemaphore sem_img_avail;
+      VkSemaphore sem_render_complete;
+      // When the frame began recording, the start of its present latency
+      std::chrono::steady_clock::time_point started;
+
+      // Persistently mapped InstanceData indexed by object id. Only objects that changed since the
+      // slot was last recorded are rewritten.
+      VkBuffer object_buffer;
+      MemoryAllocation object_allocation;
+      uint32_t object_capacity;
+      VkDescriptorSet object_set;
+
+      // Object ids of this frame's draws, rewritten from the start every frame. Read as a
+      // per-instance vertex attribute, or with GPU culling, by the cull pass, which packs the ids
+      // in view into the device-local visible buffer that is read instead.
+      VkBuffer instance_buffer;
+      MemoryAllocation instance_allocation;
+      VkBuffer visible_buffer;
+      MemoryAllocation visible_allocation;
+      uint32_t instance_capacity;
+      uint32_t instance_count;
+
+      // GPU culling only. The indirect command and cull inputs of each of the frame's draws, whose
+      // instance counts are filled in by the cull pass.
+      VkBuffer draw_buffer;
+      MemoryAllocation draw_allocation;
+      VkBuffer cull_draw_buffer;
+      MemoryAllocation cull_draw_allocation;
+      uint32_t draw_capacity;
+      uint32_t draw_count;
+      VkDescriptorSet cull_set;
+
+      // Resources released while this frame may still be reading them. Destroyed the next time the
+      // context's fence for the slot is waited on.
+      std::vector<Mesh> dead_meshes;
+      std::vector<std::pair<VkBuffer, MemoryAllocation>> dead_buffers;
+      std::vector<std::unique_ptr<Image>> dead_images;
+      std::vector<VkFramebuffer> dead_framebuffers;
+
+      // Host-visible copy of the frame's rendered image when headless, or of its capture, valid
+      // once the slot's fence has signaled. A frame that hasn't been polled by the time its slot
+      // is rendered to again is dropped.
+      VkBuffer readback_buffer;
+      MemoryAllocation readback_allocation;
+      bool readback_pending;
+      uint64_t readback_frame;
+      // Set when capturing. Captured frames are scaled into it on their way to the readback
+      // buffer.
+      std::optional<Image> capture_image;
+
+      // Each layer records into buffers from its own pool, since command pools can't be used
+      // from several threads at once. Pools are reset with the frame's fence waited on.
+      std::array<CommandPool, MAX_RENDER_LAYERS> layer_pools;
+      std::array<LayerRecorder, MAX_RENDER_LAYERS> layers;
+      // Bit per render layer begun this frame, which also says whose timestamps were written
+      uint32_t recorded_layers;
+      // Whether the frame's begin and end timestamps were written
+      bool timestamps_written;
+   };
+
+   inline Frame &frame() {
+      return frames_[current_frame_];
+   }
+
+   void collect_garbage(Frame &frame);
+
+   // Copies an image in TRANSFER_SRC layout into the frame's readback buffer
+   void queue_readback(Frame &frame, VkImage image, VkExtent2D extent);
+
+   // Scales the swapchain image just rendered into the frame's capture image and reads it back,
+   // leaving the swapchain image ready to present
+   void queue_capture(Frame &frame);
+
+   inline VkDeviceSize readback_size() const {
+      VkExtent2D extent = offscreen_ ? offscreen_->extent() : capture_extent_;
+      return static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+   }
+
+   // Reads the timestamps the frame wrote the last time its slot was recorded, which are final
+   // once its fence has signaled
+   void resolve_timestamps(Frame &frame);
+
+   void
+   write_timestamp(VkCommandBuffer command_buffer, VkPipelineStageFlagBits stage, uint32_t query);
+
+   // Moves the current draw image between the layouts it is presented, read back or blitted from
+   // in and the one it is drawn in, which the render pass does itself when dynamic rendering isn't
+   // used
+   void transition_target(bool to_attachment);
+
+   // Upscales the scaled image into the current target image, leaving the target in the layout it
+   // is presented or read back in
+   void blit_to_target(Frame &frame);
+
+   void create_instance_buffer(Frame &frame, uint32_t capacity);
+
+   void create_draw_buffers(Frame &frame, uint32_t capacity);
+
+   void create_object_buffer(Frame &frame, uint32_t capacity);
+
+   // Replace the frame's buffers with ones holding at least `capacity` entries, which start out
+   // empty. The old buffers are kept until the frame's fence signals, since layers already begun
+   // this frame may still read them.
+   void grow_instance_buffer(Frame &frame, uint32_t capacity);
+   void grow_draw_buffers(Frame &frame, uint32_t capacity);
+
+   // Returns the index of the first of `count` instances in the current frame's instance buffer,
+   // replacing the buffer with a larger one if it is full
+   uint32_t reserve_instances(uint32_t count);
+
+   // Returns the index of the first of `count` draws in the current frame's draw buffers
+   uint32_t reserve_draws(uint32_t count);
+
+   // Records the compute pass that fills in the instance counts of the frame's indirect draws
+   void cull_draws(Frame &frame);
+
+   static constexpr uint32_t kInitialInstanceCapacity = 1024;
+   static constexpr uint32_t kInitialObjectCapacity = 1024;
+   static constexpr uint32_t kInitialDrawCapacity = 256;
+   // Objects, candidate ids, cull inputs, indirect commands and visible ids
+   static constexpr uint32_t kCullBindingCount = 5;
+   // Each frame slot's queries are the frame's begin and end followed by a begin and end for every
+   // render layer
+   static constexpr uint32_t kTimestampsPerFrame = 2 + MAX_RENDER_LAYERS * 2;
+
+   RenderContext &context_;
    Gpu &vk_instance_;
-   Device device_;
-   Swapchain swapchain_;
+   SwapchainConfig swapchain_config_;
+   // Exactly one of these is set, depending on whether the renderer has a surface
+   std::optional<Swapchain> swapchain_;
+   std::optional<OffscreenTarget> offscreen_;
+   // Set when presenting to a device with VK_KHR_present_wait. Declared after the swapchain so it
+   // stops waiting on its presents before the swapchain is destroyed.
+   std::optional<PresentTimer> present_timer_;
    VkRenderPass render_pass_;
+   // VK_FORMAT_UNDEFINED without a depth buffer. Frames in flight share one depth image, which
+   // each clears before use once the previous frame's depth tests are done with it.
+   VkFormat depth_format_;
+   std::unique_ptr<Image> depth_image_;
+   // Set when frames are drawn into scaled_image_ and blitted into the target. The target format
+   // has to support linear blits and color attachments, and a swapchain has to allow blits into its
+   // images. Otherwise frames are drawn at full size.
+   bool scaled_;
+   float render_scale_;
+   float min_render_scale_;
+   // Shared by frames in flight like the depth image, each waiting for the last one's blit to
+   // have read it before drawing into it
+   std::unique_ptr<Image> scaled_image_;
+   // Every capture_interval_-th frame is read back at capture_extent_. 0 when the renderer doesn't
+   // capture, which headless ones never do, since they read back every frame, or while the
+   // swapchain can't be captured from. requested_capture_interval_ is the one asked for.
+   uint32_t requested_capture_interval_;
+   uint32_t capture_interval_;
+   VkExtent2D capture_extent_;
    std::vector<MaterialPipeline> pipelines_;
-   Slab<Image> images_;
    std::vector<VkFramebuffer> framebuffers_;
    uint32_t current_framebuffer_;
-   VkSampler sampler_;
+   // Set by acquire_frame once current_framebuffer_ holds the image the next frame draws to
+   bool image_acquired_;
    CommandPool command_pool_;
-   VkCommandBuffer preframe_cmd_buf_;
-   VkCommandBuffer command_buffer_;
-   VkSemaphore sem_img_avail;
-   VkSemaphore sem_render_complete;
-   VkFence draw_cycle_complete;
-
-   MaterialPipeline *last_bound_pipeline_;
-   IndexBufferType last_bound_mesh_index_count_;
-
-   StagingBuffer staging_buffer_;
+   VkDescriptorSetLayout object_set_layout_;
+   // Set when culling on the GPU, which falls back to direct draws on devices without compute on
+   // the graphics queue or drawIndirectFirstInstance
+   bool gpu_culling_;
+   // Consecutive draws issued by one vkCmdDrawIndexedIndirect, 1 without multiDrawIndirect
+   uint32_t max_indirect_draws_;
+   VkDescriptorSetLayout cull_set_layout_;
+   std::optional<ComputePipeline> cull_pipeline_;
+   // Sets that live as long as the renderer, such as each frame's object and cull sets
+   DescriptorAllocator descriptor_allocator_;
+   std::array<Frame, kMaxFramesInFlight> frames_;
+   // Copied from the context, whose frame slot current_frame_ follows
+   uint32_t frames_in_flight_;
+   uint32_t current_frame_;
+   // Frames submitted so far, numbering readbacks and spacing out captures
+   uint64_t frames_rendered_;
+   // Null if the graphics queue doesn't support timestamps
+   VkQueryPool timestamp_pool_;
+   uint64_t gpu_frame_ns_;
+   std::array<uint64_t, MAX_RENDER_LAYERS> gpu_layer_ns_;
+   // Context fence of the slot that last rendered to each target image
+   std::vector<VkFence> images_in_flight_;
 
    Pipelines pipeline_ids_;
 };
@@ -43,7 +43,10 @@ pub const Keypoint = inference.Keypoint;
 pub const Camera = @import("camera/camera.zig").Camera;
 pub const Gpu = @import("gpu/gpu.zig").Gpu;
 
-const loadImage = @import("image/image.zig").loadImage;
+const image_mod = @import("image/image.zig");
+const loadImage = image_mod.loadImage;
+const AtlasBuilder = @import("render/atlas.zig").AtlasBuilder;
+const loadKtx = @import("image/ktx.zig").loadKtx;
 
 const PollProfiler = Profiler("runtime", enum {
     setup_frame,
@@ -56,7 +59,7 @@ const PollProfiler = Profiler("runtime", enum {
 });
 
 const AssetData = union(enum) {
-    image: Renderer.ImageHandle,
+    image: Renderer.ImageRegion,
     sound: AudioPlayer.Sound,
 };
 
@@ -84,6 +87,8 @@ pub const Runtime = struct {
     assets: std.StringHashMap(AssetData) = undefined,
     next_program: ?DownloadPacket = null,
     devices: std.ArrayList(devices.Device) = .empty,
+    // shared by every display, created along with the first one
+    display_gpu: ?*devices.DisplayGpu = null,
     calibrations_remaining: usize = 0,
 
     schedule: ?struct {
@@ -130,6 +135,10 @@ pub const Runtime = struct {
             device.deinit(self);
         }
         self.devices.deinit(self.allocator);
+        if (self.display_gpu) |display_gpu| {
+            display_gpu.deinit();
+            self.allocator.destroy(display_gpu);
+        }
 
         self.remote.deinit();
     }
@@ -172,7 +181,7 @@ pub const Runtime = struct {
             };
 
             if (std.mem.eql(u8, section, "projector")) {
-                const dev = try devices.DisplayDevice.createFromIni(self.allocator, ini);
+                const dev = try devices.DisplayDevice.createFromIni(self.allocator, try self.getDisplayGpu(), ini);
                 if (dev.calibration_state == .capturing_background) display_count += 1;
                 try new_devices.append(self.allocator, .{ .display = dev });
                 continue;
@@ -194,6 +203,16 @@ pub const Runtime = struct {
         self.calibrations_remaining = display_count;
     }
 
+    // windows keep a pointer to the gpu, so it is heap allocated and outlives every display
+    fn getDisplayGpu(self: *Runtime) !*devices.DisplayGpu {
+        if (self.display_gpu) |display_gpu| return display_gpu;
+
+        const display_gpu = try self.allocator.create(devices.DisplayGpu);
+        display_gpu.* = devices.DisplayGpu.init();
+        self.display_gpu = display_gpu;
+        return display_gpu;
+    }
+
     fn loadProgram(self: *Runtime, program_path: []const u8, assets: []const fs_storage.ProgramAsset) !void {
         self.logger.info("Reading program from {s}", .{program_path});
         const data = try std.fs.cwd().readFileAlloc(self.allocator, program_path, std.math.maxInt(usize));
@@ -209,10 +228,34 @@ pub const Runtime = struct {
         self.wasm_entry = init_func;
         self.first_poll = true;
 
-        for (assets) |*asset| {
+        // small images are packed into atlas pages once every asset has been read
+        var sprites: std.ArrayList(PendingSprite) = .empty;
+        defer {
+            for (sprites.items) |*sprite| {
+                self.allocator.free(sprite.name);
+                sprite.info.deinit();
+            }
+            sprites.deinit(self.allocator);
+        }
+
+        // compressed textures are loaded first, so the png one stands in for is skipped rather than
+        // loaded and then replaced
+        const ordered = self.allocator.dupe(fs_storage.ProgramAsset, assets) catch |err| util.crash.oom(err);
+        defer self.allocator.free(ordered);
+        std.mem.sort(fs_storage.ProgramAsset, ordered, {}, struct {
+            fn lessThan(_: void, a: fs_storage.ProgramAsset, b: fs_storage.ProgramAsset) bool {
+                return isKtx(a) and !isKtx(b);
+            }
+
+            fn isKtx(asset: fs_storage.ProgramAsset) bool {
+                return std.mem.endsWith(u8, asset.name.?.items(), ".ktx");
+            }
+        }.lessThan);
+
+        for (ordered) |*asset| {
             const asset_name = asset.name.?.items();
 
-            const file_data = std.fs.cwd().readFileAlloc(self.allocator, asset.real_path, 10 * 1024 * 1024) catch |err| {
+            const file_data = std.fs.cwd().readFileAlloc(self.allocator, asset.real_path, 64 * 1024 * 1024) catch |err| {
                 self.logger.err("failed to read asset file at {s}: {s}", .{ asset.real_path, @errorName(err) });
                 return error.AssetReadFailed;
             };
@@ -222,20 +265,51 @@ pub const Runtime = struct {
             const renderer = &self.tempGetDisplay().renderer;
 
             if (std.mem.endsWith(u8, asset_name, ".png")) {
-                const image_info = loadImage(file_data) catch |err| {
+                // Already replaced by a compressed version of the same image
+                if (self.assets.contains(asset_name)) {
+                    continue;
+                }
+
+                var image_info = loadImage(file_data) catch |err| {
                     self.logger.err("failed to load data from {s}: {s}", .{ asset.real_path, @errorName(err) });
                     return error.AssertLoadFailed;
                 };
 
-                if (image_info.data.len > 1024 * 1024 * 8) {
-                    self.logger.err("image {s} is too large: {d}", .{ asset_name, image_info.data.len });
-                    return error.ImageTooLarge;
+                if (AtlasBuilder.fits(image_info.width, image_info.height)) {
+                    const name = self.allocator.dupe(u8, asset_name) catch |err| util.crash.oom(err);
+                    sprites.append(self.allocator, .{ .name = name, .info = image_info }) catch |err| util.crash.oom(err);
+                    continue;
                 }
+                defer image_info.deinit();
 
-                const image = renderer.createImage(image_info.data, image_info.width, image_info.height);
+                const image = renderer.createImage(image_info.data, image_info.width, image_info.height, 0);
+                const region = Renderer.ImageRegion{ .image = image, .fully_opaque = Renderer.opaquePixels(image_info.data) };
 
                 const name = self.allocator.dupe(u8, asset_name) catch |err| util.crash.oom(err);
-                self.assets.put(name, .{ .image = image }) catch |err| util.crash.oom(err);
+                self.assets.put(name, .{ .image = region }) catch |err| util.crash.oom(err);
+            } else if (std.mem.endsWith(u8, asset_name, ".ktx")) {
+                const ktx = loadKtx(self.allocator, file_data) catch |err| {
+                    self.logger.err("failed to load data from {s}: {s}", .{ asset.real_path, @errorName(err) });
+                    return error.AssertLoadFailed;
+                };
+                defer self.allocator.free(ktx.data);
+
+                // A compressed texture stands in for the png of the same name, which programs
+                // keep referring to, when the GPU can sample its format
+                if (!renderer.supportsCompressedFormat(ktx.format)) {
+                    self.logger.info("skipping {s}: {s} textures aren't supported", .{ asset_name, @tagName(ktx.format) });
+                    continue;
+                }
+
+                const image = renderer.createCompressedImage(ktx.format, ktx.data, ktx.width, ktx.height, ktx.mip_levels);
+
+                const stem = asset_name[0 .. asset_name.len - ".ktx".len];
+                const name = std.mem.concat(self.allocator, u8, &.{ stem, ".png" }) catch |err| util.crash.oom(err);
+                const entry = self.assets.getOrPut(name) catch |err| util.crash.oom(err);
+                if (entry.found_existing) {
+                    self.allocator.free(name);
+                }
+                entry.value_ptr.* = .{ .image = .{ .image = image } };
             } else if (std.mem.endsWith(u8, asset_name, ".wav")) {
                 //const sound = self.audio_player.loadSound(file_data) catch |err| {
                 //    self.logger.err("failed to load sound from {s}: {s}", .{ asset.real_path, @errorName(err) });
@@ -248,6 +322,58 @@ pub const Runtime = struct {
                 self.logger.err("unsupported asset: {s}", .{asset_name});
             }
         }
+
+        self.loadSprites(sprites.items);
+    }
+
+    const PendingSprite = struct {
+        name: []u8,
+        info: image_mod.ImageInfo,
+    };
+
+    // packs small images into shared atlas pages, so materials made from different sprites are
+    // drawn in the same pass
+    fn loadSprites(self: *Runtime, sprites: []PendingSprite) void {
+        if (sprites.len == 0) return;
+
+        // shelves pack tightest from the tallest image down
+        std.mem.sort(PendingSprite, sprites, {}, struct {
+            fn lessThan(_: void, a: PendingSprite, b: PendingSprite) bool {
+                return a.info.height > b.info.height;
+            }
+        }.lessThan);
+
+        var atlas = AtlasBuilder.init(self.allocator);
+        defer atlas.deinit();
+
+        const placements = self.allocator.alloc(AtlasBuilder.Placement, sprites.len) catch |err| util.crash.oom(err);
+        defer self.allocator.free(placements);
+        for (sprites, placements) |*sprite, *placement| {
+            placement.* = atlas.add(sprite.info.data, sprite.info.width, sprite.info.height) catch |err| util.crash.oom(err);
+        }
+
+        const renderer = &self.tempGetDisplay().renderer;
+        const pages = self.allocator.alloc(Renderer.ImageHandle, atlas.pages.items.len) catch |err| util.crash.oom(err);
+        defer self.allocator.free(pages);
+        for (atlas.pages.items, pages) |page, *handle| {
+            handle.* = renderer.createImage(page.pixels, AtlasBuilder.page_size, AtlasBuilder.page_size, AtlasBuilder.mip_levels);
+        }
+        self.logger.info("packed {d} images into {d} atlas pages", .{ sprites.len, pages.len });
+
+        for (sprites, placements) |*sprite, placement| {
+            const entry = self.assets.getOrPut(sprite.name) catch |err| util.crash.oom(err);
+            // a compressed version loaded after the png takes precedence
+            if (entry.found_existing) continue;
+
+            // the page has transparent gaps, so each sprite is checked on its own
+            entry.value_ptr.* = .{ .image = .{
+                .image = pages[placement.page],
+                .uv_rect = placement.uv_rect,
+                .fully_opaque = Renderer.opaquePixels(sprite.info.data),
+            } };
+            // the map owns the name now
+            sprite.name = sprite.name[0..0];
+        }
     }
 
     fn disposeCurrentProgram(self: *Runtime) void {
@@ -288,7 +414,7 @@ pub const Runtime = struct {
                 return err;
             } orelse break;
 
-            if (std.mem.endsWith(u8, file.name, ".png")) {
+            if (std.mem.endsWith(u8, file.name, ".png") or std.mem.endsWith(u8, file.name, ".ktx")) {
                 const real_path = try std.fs.path.joinZ(path_allocator.allocator(), &.{ run_info.assets, file.name });
                 try assets.append(path_allocator.allocator(), .{
                     .name = util.FixedArrayList(u8, fs_storage.max_asset_name_len).initFrom(file.name) catch unreachable,
@@ -412,6 +538,8 @@ pub const Runtime = struct {
                 return null;
             };
         }
+        // every display has published its snapshot, so they're drawn and presented together
+        if (self.display_gpu) |display_gpu| display_gpu.present();
 
         while (self.remote.nextMessage()) |msg| {
             var message = msg;
@@ -450,6 +578,17 @@ pub const Runtime = struct {
         if (now - self.second_timer >= 1000) {
             if (self.frame_count < 59) {
                 self.logger.warn("Low FPS ({d}), {f}", .{ self.frame_count, &self.poll_profiler });
+                for (self.devices.items) |*device| {
+                    const device_id = device.id();
+                    switch (device.*) {
+                        .display => |*display| {
+                            const stats = display.renderer.stats();
+                            self.logger.warn("{s} {f}", .{ device_id, &display.poll_profiler });
+                            self.logger.warn("{s} renderer: {f}", .{ device_id, &stats });
+                        },
+                        .camera => {},
+                    }
+                }
             } else {
                 self.logger.debug("FPS: {d}", .{self.frame_count});
             }
@@ -469,6 +608,20 @@ pub const Runtime = struct {
         return null;
     }
 
+    // copies the latest frame captured from the display with the given id into out as a jpeg and
+    // returns its frame number, or null if it has none yet. for remote monitoring.
+    pub fn latestCapture(self: *Runtime, display_id: []const u8, out: *std.ArrayList(u8)) !?u64 {
+        for (self.devices.items) |*device| {
+            switch (device.*) {
+                .display => |*display| if (std.mem.eql(u8, display.id.items(), display_id)) {
+                    return display.latestCapture(out);
+                },
+                else => {},
+            }
+        }
+        return error.DisplayNotFound;
+    }
+
     fn tempGetDisplay(self: *Runtime) *devices.DisplayDevice {
         for (self.devices.items) |*device| {
             switch (device.*) {
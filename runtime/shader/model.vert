@@ -2,22 +2,30 @@
 
 layout(location = 0) in vec3 pos;
 layout(location = 1) in vec3 normal;
+layout(location = 2) in uint object_index;
 
-layout(binding = 0) uniform Uniforms {
-    vec3 color;
-} u;
+struct ObjectData {
+    mat4 transform;
+    vec4 color;
+    vec4 uv_rect;
+    uint texture_index;
+};
 
-layout(push_constant) uniform PushConstants {
-    mat4 mvp;
-} push_constants;
+layout(std430, set = 1, binding = 0) readonly buffer Objects {
+    ObjectData objects[];
+};
+
+layout(push_constant) uniform PassConstants {
+    mat4 view_projection;
+} pass_constants;
 
 layout(location = 0) out vec3 pass_color;
 
 const vec3 sun = vec3(1, 1, 1);
 
 void main() {
-    gl_Position = push_constants.mvp * vec4(pos, 1.0);
+    gl_Position = pass_constants.view_projection * objects[object_index].transform * vec4(pos, 1.0);
     float brightness = dot(sun, normal);
     float normalized_brightness = (brightness / 4) + 0.75;
-    pass_color = u.color * normalized_brightness;
+    pass_color = objects[object_index].color.rgb * normalized_brightness;
 }
@@ -1,12 +1,15 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec4 pass_color;
 layout(location = 1) in vec2 pass_tex_coord;
+// Instances of one draw can sample different textures
+layout(location = 2) flat in uint pass_texture_index;
 
-layout(binding = 1) uniform sampler2D u_texture;
+layout(set = 0, binding = 0) uniform sampler2D textures[];
 
 layout(location = 0) out vec4 out_color;
 
 void main() {
-    out_color = texture(u_texture, pass_tex_coord) * pass_color;
+    out_color = texture(textures[nonuniformEXT(pass_texture_index)], pass_tex_coord) * pass_color;
 }
@@ -13,21 +13,30 @@ struct UiOut {
 	simd::float2 uv;
 };
 
-struct PushConstants {
+struct InstanceData {
 	simd::float4x4 transform;
 	simd::float4 color;
+	simd::float4 uv_rect;
+	// Unused, since Metal binds each material's texture
+	uint texture;
+	uint padding[3];
 };
 
-vertex UiOut vertex_main(uint vert_id [[vertex_id]], constant UiVertex* vertices, constant PushConstants *push_constants) {
+struct PassConstants {
+	simd::float4x4 view_projection;
+};
+
+vertex UiOut vertex_main(uint vert_id [[vertex_id]], uint instance_id [[instance_id]], constant UiVertex* vertices [[buffer(0)]], constant InstanceData *objects [[buffer(1)]], constant uint *object_ids [[buffer(2)]], constant PassConstants &pass [[buffer(3)]]) {
 	UiOut out;
-	out.pos = push_constants[0].transform * simd::float4(vertices[vert_id].pos, 1.0);
-	out.color = push_constants[0].color;
-	out.uv = vertices[vert_id].uv;
+	constant InstanceData &object = objects[object_ids[instance_id]];
+	out.pos = pass.view_projection * object.transform * simd::float4(vertices[vert_id].pos, 1.0);
+	out.color = object.color;
+	out.uv = object.uv_rect.xy + vertices[vert_id].uv * object.uv_rect.zw;
 	return out;
 }
 
 fragment float4 fragment_main(UiOut vert [[stage_in]], texture2d<float> texture [[texture(0)]]) {
-	constexpr sampler tex_sampler(mag_filter::linear, min_filter::linear);
+	constexpr sampler tex_sampler(mag_filter::linear, min_filter::linear, mip_filter::linear);
 	return texture.sample(tex_sampler, vert.uv) * vert.color;
 }
 
@@ -38,19 +47,20 @@ struct MeshVertex {
 
 struct MeshOut {
 	simd::float4 pos [[position]];
-	float brightness;
+	simd::float3 color;
 };
 
 constant const simd::float3 sun = simd::float3(1, 1, 1);
 
-vertex MeshOut vertex_main2(uint vert_id [[vertex_id]], constant MeshVertex* vertices, constant PushConstants *push_constants) {
+vertex MeshOut vertex_main2(uint vert_id [[vertex_id]], uint instance_id [[instance_id]], constant MeshVertex* vertices [[buffer(0)]], constant InstanceData *objects [[buffer(1)]], constant uint *object_ids [[buffer(2)]], constant PassConstants &pass [[buffer(3)]]) {
 	MeshOut out;
 	float brightness = dot(sun, vertices[vert_id].normal);
-	out.pos = push_constants[0].transform * simd::float4(vertices[vert_id].pos, 1.0);
-	out.brightness = (brightness / 4) + 0.75;
+	constant InstanceData &object = objects[object_ids[instance_id]];
+	out.pos = pass.view_projection * object.transform * simd::float4(vertices[vert_id].pos, 1.0);
+	out.color = object.color.rgb * ((brightness / 4) + 0.75);
 	return out;
 }
 
-fragment float4 fragment_main2(MeshOut vert [[stage_in]], constant float3* color) {
-	return float4(color[0] * vert.brightness, 1.0);
+fragment float4 fragment_main2(MeshOut vert [[stage_in]]) {
+	return float4(vert.color, 1.0);
 }
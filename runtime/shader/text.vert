@@ -2,17 +2,31 @@
 
 layout(location = 0) in vec3 pos;
 layout(location = 1) in vec2 tex_coord;
+layout(location = 2) in uint object_index;
 
-layout(push_constant) uniform PushConstants {
-    mat4 mvp;
+struct ObjectData {
+    mat4 transform;
     vec4 color;
-} push_constants;
+    vec4 uv_rect;
+    uint texture_index;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Objects {
+    ObjectData objects[];
+};
+
+layout(push_constant) uniform PassConstants {
+    mat4 view_projection;
+} pass_constants;
 
 layout(location = 0) out vec4 pass_color;
 layout(location = 1) out vec2 pass_tex_coord;
+layout(location = 2) flat out uint pass_texture_index;
 
 void main() {
-    gl_Position = push_constants.mvp * vec4(pos, 1.0);
-    pass_color = push_constants.color;
-    pass_tex_coord = tex_coord;
+    ObjectData object = objects[object_index];
+    gl_Position = pass_constants.view_projection * object.transform * vec4(pos, 1.0);
+    pass_color = object.color;
+    pass_tex_coord = object.uv_rect.xy + tex_coord * object.uv_rect.zw;
+    pass_texture_index = object.texture_index;
 }